@@ -1,13 +1,17 @@
 #include "benchmark/benchmark.h"
+
+extern "C" {
 #include "clither/benchmarks.h"
 #include "clither/mem.h"
+}
 
 using namespace benchmark;
 
 int benchmarks_run(int argc, char** argv)
 {
     Initialize(&argc, argv);
-    if (ReportUnrecognizedArguments(argc, argv))
+    /* argv[1] is "--benchmarks", which was already handled by args_parse() */
+    if (argc > 1 && ReportUnrecognizedArguments(argc - 1, argv + 1))
         return 1;
 
     mem_init_threadlocal();
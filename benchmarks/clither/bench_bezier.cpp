@@ -0,0 +1,233 @@
+#include "benchmark/benchmark.h"
+#include <cmath>
+
+extern "C" {
+#include "clither/bezier.h"
+#include "clither/bezier_handle_rb.h"
+#include "clither/bezier_point_vec.h"
+}
+
+using namespace benchmark;
+
+/* Same spacing as snake.c uses for a snake that hasn't grown yet */
+#define SPACING make_qw2(1, 6)
+
+/*
+ * Builds a snake that winds back and forth, with handles spaced roughly as
+ * far apart as the ones bezier_fit_trail() produces.
+ */
+static void make_snake(struct bezier_handle_rb** handles, int count)
+{
+    bezier_handle_rb_init(handles);
+    for (int i = 0; i != count; ++i)
+    {
+        /* Handle vectors point away from the head, i.e. towards lower i */
+        double x = i * 0.5, y = std::sin(i * 0.3);
+        double dx = -0.5, dy = std::sin((i - 1) * 0.3) - y;
+
+        struct bezier_handle* bh = bezier_handle_rb_emplace_realloc(handles);
+        bezier_handle_init(bh, make_qwposf(x, y), make_qa(std::atan2(dy, dx)));
+        bh->len_backwards = 48;
+        bh->len_forwards = 48;
+    }
+}
+
+/*
+ * The binary search bezier_calc_equidistant_points() used before it switched
+ * to an arc length table, kept as a baseline to compare against.
+ */
+static void reference_coeff(
+    qw Ax[4],
+    qw Ay[4],
+    const struct bezier_handle* head,
+    const struct bezier_handle* tail,
+    struct qwpos off)
+{
+    const struct qwpos p0 =
+        make_qwposqw(qw_sub(head->pos.x, off.x), qw_sub(head->pos.y, off.y));
+    const struct qwpos p3 =
+        make_qwposqw(qw_sub(tail->pos.x, off.x), qw_sub(tail->pos.y, off.y));
+    const struct qwpos p1 = make_qwposqw(
+        qw_add(p0.x, qw_rescale(qa_cos(head->angle), head->len_backwards, 255)),
+        qw_add(
+            p0.y, qw_rescale(qa_sin(head->angle), head->len_backwards, 255)));
+    const struct qwpos p2 = make_qwposqw(
+        qw_sub(p3.x, qw_rescale(qa_cos(tail->angle), tail->len_forwards, 255)),
+        qw_sub(p3.y, qw_rescale(qa_sin(tail->angle), tail->len_forwards, 255)));
+
+    Ax[0] = p0.x;
+    Ax[1] = qw_sub(3 * p1.x, 3 * p0.x);
+    Ax[2] = qw_sub(qw_add(3 * p0.x, 3 * p2.x), 6 * p1.x);
+    Ax[3] = qw_sub(qw_sub(qw_add(3 * p1.x, p3.x), 3 * p2.x), p0.x);
+    Ay[0] = p0.y;
+    Ay[1] = qw_sub(3 * p1.y, 3 * p0.y);
+    Ay[2] = qw_sub(qw_add(3 * p0.y, 3 * p2.y), 6 * p1.y);
+    Ay[3] = qw_sub(qw_sub(qw_add(3 * p1.y, p3.y), 3 * p2.y), p0.y);
+}
+
+static int reference_calc_equidistant_points(
+    struct bezier_point_vec**      bezier_points,
+    const struct bezier_handle_rb* bezier_handles,
+    qw                             spacing,
+    qw                             snake_length)
+{
+    const qw     spacing_sq = qw_mul(spacing, spacing);
+    qw           total_spacing = 0;
+    struct qwpos pos = make_qwposi(0, 0);
+    struct qwpos off = rb_peek_write(bezier_handles)->pos;
+
+    bezier_point_vec_clear(*bezier_points);
+    {
+        struct bezier_point* bp = bezier_point_vec_emplace(bezier_points);
+        const struct bezier_handle* head = rb_peek_write(bezier_handles);
+        bp->pos = off;
+        bp->dir.x = -qa_cos(head->angle);
+        bp->dir.y = -qa_sin(head->angle);
+    }
+
+    for (int i = rb_count(bezier_handles) - 2; i >= 0; --i)
+    {
+        qw t = 0, last_t = 0;
+        qw Ax[4], Ay[4];
+        reference_coeff(
+            Ax,
+            Ay,
+            rb_peek(bezier_handles, i + 1),
+            rb_peek(bezier_handles, i),
+            off);
+
+        while (1)
+        {
+            qw t_step = make_qw2(1, 2);
+            while (1)
+            {
+                const qw           t2 = qw_mul(t, t);
+                const qw           t3 = qw_mul(t, t2);
+                const struct qwpos next = make_qwposqw(
+                    qw_add(
+                        qw_add(
+                            qw_add(Ax[0], qw_mul(Ax[1], t)), qw_mul(Ax[2], t2)),
+                        qw_mul(Ax[3], t3)),
+                    qw_add(
+                        qw_add(
+                            qw_add(Ay[0], qw_mul(Ay[1], t)), qw_mul(Ay[2], t2)),
+                        qw_mul(Ay[3], t3)));
+                const qw dx = qw_sub(pos.x, next.x);
+                const qw dy = qw_sub(pos.y, next.y);
+                const qw dist_sq = qw_add(qw_mul(dx, dx), qw_mul(dy, dy));
+
+                t = dist_sq > spacing_sq ? qw_sub(t, t_step)
+                                         : qw_add(t, t_step);
+                if (t >= make_qw(1))
+                    t = make_qw(1) - 1;
+                if (t < last_t)
+                    t = last_t;
+
+                t_step /= 2;
+                if (t_step == 0)
+                {
+                    const qw             tt = qw_mul(t, t);
+                    struct bezier_point* bp;
+                    if (t == make_qw(1) - 1)
+                        goto next_segment;
+
+                    bp = bezier_point_vec_emplace(bezier_points);
+                    bp->pos.x = qw_add(next.x, off.x);
+                    bp->pos.y = qw_add(next.y, off.y);
+                    bp->dir.x = -qw_add(
+                        qw_add(Ax[1], qw_mul(make_qw(2), qw_mul(Ax[2], t))),
+                        qw_mul(make_qw(3), qw_mul(Ax[3], tt)));
+                    bp->dir.y = -qw_add(
+                        qw_add(Ay[1], qw_mul(make_qw(2), qw_mul(Ay[2], t))),
+                        qw_mul(make_qw(3), qw_mul(Ay[3], tt)));
+                    bp->dir = qwpos_normalize(bp->dir);
+
+                    total_spacing = qw_add(total_spacing, qw_sqrt(dist_sq));
+                    if (total_spacing >= snake_length)
+                        return i;
+
+                    pos = next;
+                    break;
+                }
+            }
+            last_t = t;
+        }
+    next_segment:;
+    }
+
+    return 0;
+}
+
+static void BM_ReferenceCalcEquidistantPoints(State& state)
+{
+    struct bezier_handle_rb* handles;
+    struct bezier_point_vec* points;
+
+    make_snake(&handles, (int)state.range(0));
+    bezier_point_vec_init(&points);
+
+    for (auto _ : state)
+    {
+        reference_calc_equidistant_points(
+            &points, handles, SPACING, make_qw(8000));
+        DoNotOptimize(points);
+    }
+    state.SetItemsProcessed(state.iterations() * vec_count(points));
+
+    bezier_point_vec_deinit(points);
+    bezier_handle_rb_deinit(handles);
+}
+BENCHMARK(BM_ReferenceCalcEquidistantPoints)->Arg(1000);
+
+static void BM_BezierCalcEquidistantPoints(State& state)
+{
+    struct bezier_handle_rb* handles;
+    struct bezier_point_vec* points;
+
+    make_snake(&handles, (int)state.range(0));
+    bezier_point_vec_init(&points);
+
+    for (auto _ : state)
+    {
+        bezier_calc_equidistant_points(
+            &points, handles, SPACING, make_qw(8000));
+        DoNotOptimize(points);
+    }
+    state.SetItemsProcessed(state.iterations() * vec_count(points));
+
+    bezier_point_vec_deinit(points);
+    bezier_handle_rb_deinit(handles);
+}
+BENCHMARK(BM_BezierCalcEquidistantPoints)->Arg(1000);
+
+/*
+ * Samples each segment on its own, which is what the client does for segments
+ * it hasn't sampled before.
+ */
+static void BM_BezierSampleSegment(State& state)
+{
+    struct bezier_handle_rb* handles;
+    struct bezier_point_vec* points;
+
+    make_snake(&handles, (int)state.range(0));
+    bezier_point_vec_init(&points);
+
+    for (auto _ : state)
+    {
+        struct qwpos pos = rb_peek_read(handles)->pos;
+        bezier_point_vec_clear(points);
+        for (int i = 0; i != rb_count(handles) - 1; ++i)
+            bezier_sample_segment(
+                &points,
+                rb_peek(handles, i + 1),
+                rb_peek(handles, i),
+                &pos,
+                SPACING);
+        DoNotOptimize(points);
+    }
+    state.SetItemsProcessed(state.iterations() * vec_count(points));
+
+    bezier_point_vec_deinit(points);
+    bezier_handle_rb_deinit(handles);
+}
+BENCHMARK(BM_BezierSampleSegment)->Arg(1000);
@@ -0,0 +1,93 @@
+#include "benchmark/benchmark.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include "clither/msg_vec.h"
+#include "clither/net.h"
+#include "clither/net_addr_hm.h"
+#include "clither/proximity_state_bmap.h"
+#include "clither/server.h"
+#include "clither/server_client.h"
+#include "clither/server_client_vec.h"
+#include "clither/snake.h"
+#include "clither/snake_bmap.h"
+#include "clither/world.h"
+}
+
+using namespace benchmark;
+
+/*
+ * Measures the cost of one interest management pass (what the server does on
+ * every net tick) with N connected clients. The area the snakes are spread
+ * across grows with N so that the density of snakes stays the same, which is
+ * what a populated server looks like.
+ */
+static void BM_ServerUpdateSnakesInRange(State& state)
+{
+    struct server         server;
+    struct world          world;
+    struct server_client* client;
+    int                   side;
+
+    server_client_vec_init(&server.clients);
+    net_addr_hm_init(&server.clients_by_addr);
+    net_addr_hm_init(&server.malicious_clients);
+    net_addr_hm_init(&server.banned_clients);
+    snake_grid_init(&server.snake_grid, make_qw(16));
+    server.udp_sock = -1;
+
+    world_init(&world);
+    side = (int)(8 * std::sqrt((double)state.range(0)));
+    srand(42);
+    for (int i = 0; i != state.range(0); ++i)
+    {
+        struct net_addr client_addr;
+        struct snake*   snake;
+        uint16_t        snake_id = (uint16_t)(i + 1);
+
+        memset(&client_addr, 0, sizeof(client_addr));
+        client_addr.len = sizeof(int);
+        memcpy(client_addr.sockaddr_storage, &i, sizeof(int));
+
+        snake_bmap_emplace_new(&world.snakes, snake_id, &snake);
+        snake_init(
+            snake,
+            make_qwposi(rand() % side - side / 2, rand() % side - side / 2),
+            "bench");
+
+        client = server_add_client(&server, &client_addr);
+        client->pkt.len = ACK_HEADER_SIZE;
+        msg_vec_init(&client->pending_msgs);
+        proximity_state_bmap_init(&client->snakes_in_proximity);
+        client->snake_id = snake_id;
+    }
+
+    for (auto _ : state)
+        server_update_snakes_in_range(&server, &world, make_qw(10));
+    state.SetComplexityN(state.range(0));
+
+    server_client_vec_for_each(server.clients, client)
+    {
+        struct msg** pmsg;
+
+        for (int16_t idx = 0; idx != bmap_count(client->snakes_in_proximity);
+             ++idx)
+            proximity_state_deinit(&client->snakes_in_proximity->values[idx]);
+        proximity_state_bmap_deinit(client->snakes_in_proximity);
+        vec_for_each (client->pending_msgs, pmsg)
+            msg_free(*pmsg);
+        msg_vec_deinit(client->pending_msgs);
+    }
+    server_client_vec_deinit(server.clients);
+    net_addr_hm_deinit(server.clients_by_addr);
+    net_addr_hm_deinit(server.malicious_clients);
+    net_addr_hm_deinit(server.banned_clients);
+    snake_grid_deinit(&server.snake_grid);
+    world_deinit(&world);
+}
+BENCHMARK(BM_ServerUpdateSnakesInRange)
+    ->RangeMultiplier(2)
+    ->Range(10, 2000)
+    ->Complexity();
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "clither/config.h"
+#include <stdint.h>
+
+struct msg;
+struct msg_vec;
+
+/*
+ * Every UDP packet starts with this header:
+ *   2 bytes: Sequence number of this packet
+ *   2 bytes: Most recent sequence number received from the peer, 0 if none
+ *   4 bytes: Bit n is set if the packet (ack - 1 - n) was received
+ *
+ * Sequence numbers start at 1 and skip 0 when wrapping around, so that 0 can
+ * mean "nothing received yet".
+ */
+#define ACK_HEADER_SIZE 8
+
+/* A packet is considered lost once a packet this much newer was acknowledged.
+ * Allows for some reordering */
+#define ACK_LOSS_DISTANCE 3
+
+/* Reliable messages are also resent if no ack arrived after this many net
+ * ticks, e.g. because the packets carrying the acks were lost */
+#define ACK_RESEND_TIMEOUT 10
+
+/* The peer is considered unreachable once a message was sent this often */
+#define ACK_MAX_SENDS 10
+
+enum ack_status
+{
+    ACK_IN_FLIGHT,
+    ACK_RECEIVED,
+    ACK_LOST
+};
+
+/*!
+ * \brief Sequence numbers and acks of one connection, see ACK_HEADER_SIZE.
+ *
+ * Instead of waiting for a message-specific ack, reliable messages are
+ * retired as soon as the packet carrying them is acknowledged, and are only
+ * resent once that packet is known to be lost.
+ */
+struct ack_state
+{
+    uint32_t recv_bits;  /* Bit n is set if packet (recv_seq - 1 - n) arrived */
+    uint32_t acked_bits; /* Same as recv_bits, but as reported by the peer */
+    uint16_t next_seq;   /* Sequence number of the next packet we send */
+    uint16_t recv_seq;   /* Most recent packet received, 0 if none */
+    uint16_t acked_seq;  /* Most recent of our packets the peer received */
+    unsigned ack_pending : 1; /* Received packets we didn't ack yet */
+};
+
+void ack_init(struct ack_state* ack);
+
+/*!
+ * \brief Writes the header of the next outgoing packet into buf.
+ * \return Returns ACK_HEADER_SIZE.
+ */
+int ack_write_header(struct ack_state* ack, uint8_t* buf);
+
+/*!
+ * \brief Reads the header of a received packet and updates which packets the
+ * peer has acknowledged.
+ * \return Returns 1 if the packet should be processed, 0 if it is a duplicate
+ * or too old to be tracked, or -1 if it's too short to contain a header or
+ * isn't a valid header. The state isn't changed in that case.
+ */
+int ack_read_header(struct ack_state* ack, const uint8_t* data, int len);
+
+enum ack_status ack_status_of(const struct ack_state* ack, uint16_t seq);
+
+/*!
+ * \brief Frees reliable messages whose packet was acknowledged, and marks
+ * messages whose packet was lost or timed out for resending. Call this once
+ * per net tick, before packing messages into the next packet.
+ * \return Returns 0 on success, -1 if a message has been sent ACK_MAX_SENDS
+ * times without being acknowledged.
+ */
+int ack_update_msgs(struct ack_state* ack, struct msg_vec* msgs);
+
+/*!
+ * \brief Marks a reliable message as sent in the packet with the specified
+ * sequence number. Usually ack->next_seq, before writing the header.
+ */
+void ack_msg_sent(struct msg* m, uint16_t seq);
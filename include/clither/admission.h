@@ -0,0 +1,61 @@
+#pragma once
+
+#include "clither/config.h"
+#include <stdint.h>
+
+struct net_addr;
+
+/*
+ * The table is set-associative: an address can only live in one of
+ * ADMISSION_WAYS entries of the set its hash selects. One set is 64 bytes,
+ * so checking a packet touches a single cache line. When a set is full, the
+ * entry that was used least recently is replaced. A replaced address starts
+ * over with a full bucket, so 1024 sets * 8 ways is plenty to keep every
+ * active address.
+ */
+#define ADMISSION_SETS 1024
+#define ADMISSION_WAYS 8
+
+struct admission_entry
+{
+    uint32_t tag;    /* Hash of the address, 0 if unused */
+    uint16_t tokens; /* Scaled by the net tick rate, see admission_check() */
+    uint16_t tick;   /* Lower bits of the net tick the bucket was refilled */
+};
+
+/*!
+ * \brief Token bucket per address, checked before any other work is done for
+ * a packet.
+ *
+ * Every address may send a burst of packets, after which its packets are
+ * dropped until the bucket refills at a steady rate. The hash is keyed with a
+ * random secret, so other addresses can't be picked to share a bucket with a
+ * player.
+ */
+struct admission_table
+{
+    struct admission_entry sets[ADMISSION_SETS][ADMISSION_WAYS];
+    uint8_t                key[16];
+};
+
+/*! \return Returns 0 on success, -1 on failure. */
+int admission_init(struct admission_table** table);
+
+void admission_deinit(struct admission_table* table);
+
+/*!
+ * \brief Takes a token from the address's bucket.
+ * \param[in] now Current net tick.
+ * \param[in] rate Tokens added per second.
+ * \param[in] burst Size of the bucket.
+ * \param[in] net_tick_rate Net ticks per second.
+ * \return Returns non-zero if the packet should be processed, 0 if it should
+ * be dropped.
+ */
+int admission_check(
+    struct admission_table* table,
+    const struct net_addr*  addr,
+    uint32_t                now,
+    int                     rate,
+    int                     burst,
+    int                     net_tick_rate);
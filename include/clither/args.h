@@ -17,6 +17,7 @@ enum mode
 #if defined(CLITHER_GFX) && defined(CLITHER_SERVER)
     MODE_CLIENT_AND_SERVER,
 #endif
+    MODE_BOTS,
 #if defined(CLITHER_SERVER)
     MODE_HEADLESS
 #endif
@@ -37,6 +38,7 @@ struct args
 #if defined(CLITHER_GFX)
     int gfx_backend;
 #endif
+    int       bot_count;
     enum mode mode;
 };
 
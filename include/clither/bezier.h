@@ -2,6 +2,13 @@
 
 #include "clither/q.h"
 
+/* Number of straight lines used to approximate a segment's length */
+#define BEZIER_ARC_LENGTH_STEPS 32
+
+/* Trails can't be longer than this, or bezier_fit_sums could overflow at boost
+ * speed */
+#define BEZIER_FIT_MAX_POINTS 1024
+
 struct qwpos_vec;
 struct bezier_handle_rb;
 struct bezier_point_vec;
@@ -39,6 +46,45 @@ void bezier_calc_aabb(
     const struct bezier_handle* head,
     const struct bezier_handle* tail);
 
+/*!
+ * \brief Approximates the length of the curve segment between two handles by
+ * summing up BEZIER_ARC_LENGTH_STEPS straight lines along the curve.
+ * \return Returns the length in world space.
+ */
+qw bezier_calc_arc_length(
+    const struct bezier_handle* head, const struct bezier_handle* tail);
+
+/*!
+ * \brief Running sums over the points of a trail, so bezier_fit_trail()
+ * doesn't have to go over every point again each time one is added.
+ *
+ * x[k-1] is the sum of i^k * (trail[i].x - trail[0].x) for k=1..3, same for y.
+ */
+struct bezier_fit_sums
+{
+    int64_t x[3], y[3];
+};
+
+/*!
+ * \brief Calculates the sums of an entire trail from scratch.
+ */
+void bezier_fit_sums_init(
+    struct bezier_fit_sums* sums, const struct qwpos_vec* trail);
+
+/*!
+ * \brief Adds the last point of the trail to the sums. Call this after pushing
+ * a point.
+ */
+void bezier_fit_sums_push(
+    struct bezier_fit_sums* sums, const struct qwpos_vec* trail);
+
+/*!
+ * \brief Removes the last point of the trail from the sums. Call this before
+ * popping a point.
+ */
+void bezier_fit_sums_pop(
+    struct bezier_fit_sums* sums, const struct qwpos_vec* trail);
+
 /*!
  * \brief Performs a constrained least squares fit on the input data points to
  * generate a 3rd degree bezier curve that fits the data.
@@ -46,13 +92,16 @@ void bezier_calc_aabb(
  * align with the data. head->len_backwards will also be updated. \param[in]
  * tail The tail bezier handle will only have its tail->len_forwards updated.
  * The angle and position are assumed to be correct from the previous bezier
- * segment. \param[in] trail A list of qwpos2 points to fit the data to. \return
- * Returns the least squared error of the fit.
+ * segment. \param[in] trail A list of qwpos2 points to fit the data to.
+ * \param[in] sums The sums of trail, see bezier_fit_sums. \return Returns the
+ * least squared error of the fit, estimated from at most a fixed number of
+ * points of the trail.
  */
 double bezier_fit_trail(
-    struct bezier_handle*   head,
-    struct bezier_handle*   tail,
-    const struct qwpos_vec* trail);
+    struct bezier_handle*         head,
+    struct bezier_handle*         tail,
+    const struct qwpos_vec*       trail,
+    const struct bezier_fit_sums* sums);
 
 /*!
  * \brief Adjusts all bezier handles in a way to cause the snake to "squeeze"
@@ -83,6 +132,25 @@ int bezier_calc_equidistant_points(
     qw                             spacing,
     qw                             snake_length);
 
+/*!
+ * \brief Samples a single segment at constant intervals, going from the tail
+ * handle towards the head handle. Unlike bezier_calc_equidistant_points(),
+ * this allows each segment to be sampled once and cached.
+ * \param[out] bezier_points The resulting points are appended to this array,
+ * in the order they were sampled. Their tangents point towards the head.
+ * \param[in,out] pos The first point is placed spacing away from this
+ * position, usually the last point sampled on the previous segment. Set to the
+ * last point sampled, or left unchanged if the segment is too short.
+ * \param[in] spacing The distance between each sampled point, in world space.
+ * \return Returns 0 on success, -1 if memory allocation failed.
+ */
+int bezier_sample_segment(
+    struct bezier_point_vec**   bezier_points,
+    const struct bezier_handle* head,
+    const struct bezier_handle* tail,
+    struct qwpos*               pos,
+    qw                          spacing);
+
 static int bezier_handles_equal(
     const struct bezier_handle* a, const struct bezier_handle* b)
 {
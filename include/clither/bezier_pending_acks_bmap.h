@@ -0,0 +1,7 @@
+#pragma once
+
+#include "clither/bmap.h"
+
+/* Maps the ID of a bezier handle to the sequence number of the packet it was
+ * last sent in */
+BMAP_DECLARE(bezier_pending_acks_bmap, uint16_t, uint16_t, 16)
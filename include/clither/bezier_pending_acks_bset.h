@@ -1,5 +0,0 @@
-#pragma once
-
-#include "clither/bset.h"
-
-BSET_DECLARE(bezier_pending_acks_bset, int32_t, 32)
@@ -169,7 +169,7 @@ enum bmap_status
     static int prefix##_kvs_realloc(                                           \
         struct prefix** bmap, int##bits##_t new_capacity)                      \
     {                                                                          \
-        int##bits##_t  header, data;                                           \
+        int            header, data;                                           \
         struct prefix* new_bmap;                                               \
         K*             new_keys;                                               \
                                                                                \
@@ -256,7 +256,7 @@ enum bmap_status
         return &bmap->values[idx];                                             \
     }                                                                          \
     static void prefix##_kvs_set_value(                                        \
-        struct prefix* bmap, int##bits##_t idx, const V* value)                \
+        struct prefix* bmap, int##bits##_t idx, V const* value)                \
     {                                                                          \
         bmap->values[idx] = *value;                                            \
     }                                                                          \
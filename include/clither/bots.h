@@ -0,0 +1,16 @@
+#pragma once
+
+struct args;
+
+/*!
+ * \brief Connects a->bot_count headless clients to the server at a->ip and
+ * a->port and steers their snakes around randomly until CTRL+C is pressed.
+ *
+ * The bots go through the same client code paths as a real player over real
+ * UDP sockets, so this can be used to find out how many players a server can
+ * handle. Join latency, rollbacks and the amount of data sent and received are
+ * logged periodically.
+ *
+ * Like client_run(), this expects to be run in the main thread.
+ */
+void* bots_run(const struct args* a);
@@ -102,7 +102,7 @@ enum bset_status
     static int prefix##_kvs_realloc(                                           \
         struct prefix** bset, int##bits##_t new_capacity)                      \
     {                                                                          \
-        int##bits##_t  header, data;                                           \
+        int            header, data;                                           \
         struct prefix* new_bset;                                               \
                                                                                \
         if (new_capacity == 0)                                                 \
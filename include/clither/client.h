@@ -1,14 +1,17 @@
 #pragma once
 
+#include "clither/ack.h"
 #include "clither/config.h"
-#if defined(CLITHER_GFX)
-
-#    include <stdint.h>
+#include <stdint.h>
 
 struct msg;
 struct msg_vec;
 struct world;
 
+/* How often a join request is followed to another server instance before
+ * giving up, in case the instances keep redirecting to each other */
+#define CLIENT_MAX_REDIRECTS 3
+
 /*
  * The client can be in 3 states:
  *   - Disconnected, or "menu mode"
@@ -64,16 +67,25 @@ static struct client_recv_result client_recv_result_combine(
 
 struct client
 {
+    struct ack_state   ack;
     struct str*        username;
+    struct str*        server_address; /* Needed to follow join redirects */
     struct msg_vec*    pending_msgs;
     struct sockfd_vec* udp_sockfds;
     int                timeout_counter;
+    uint64_t           conn_id;      /* From MSG_JOIN_ACCEPT, 0 until then */
     uint16_t           frame_number; /* Counts upwards at sim_tick_rate */
     uint16_t           snake_id;
     int16_t            warp;
+    uint8_t            redirects; /* Join redirects followed so far */
     uint8_t            sim_tick_rate;
     uint8_t            net_tick_rate;
     enum client_state  state;
+
+    /* Statistics, only used for reporting */
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    int      rollbacks;
 };
 
 /*!
@@ -110,6 +122,7 @@ int client_send_pending_data(struct client* client);
 struct client_recv_result
 client_recv(struct client* client, struct world* world);
 
+#if defined(CLITHER_GFX)
 /*!
  * \brief The main loop of the client.
  * \warning This should function assumes that cs_init_threadlocal() was called.
@@ -121,5 +134,4 @@ client_recv(struct client* client, struct world* world);
  */
 struct args;
 void* client_run(const struct args* a);
-
-#endif /* CLITHER_GFX */
+#endif
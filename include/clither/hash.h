@@ -42,6 +42,13 @@ static hash32 hash32_aligned_ptr(uintptr_t ptr)
 }
 #endif
 
+/*!
+ * @brief SipHash-2-4 with a 128-bit key. Unlike the other hashes, the result
+ * can't be predicted without knowing the key, which makes it suitable as a
+ * message authentication code for short messages.
+ */
+uint64_t hash64_siphash24(const uint8_t* key, const void* data, int len);
+
 /*!
  * @brief Taken from boost::hash_combine. Combines two hash values into a
  * new hash value.
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "clither/config.h"
+#include <stdint.h>
+
+struct net_addr;
+
+#define JOIN_COOKIE_SIZE        8
+#define JOIN_COOKIE_SECRET_SIZE 16
+
+/* Seconds between secret rotations. Cookies of the previous secret are still
+ * accepted, so a client has at least this long to answer a challenge */
+#define JOIN_COOKIE_ROTATE_INTERVAL 10
+
+/*!
+ * \brief Secrets used to answer join requests without allocating anything.
+ *
+ * A join request from an unknown address is answered with a cookie, which is
+ * a keyed hash of the address. Only a client that can receive packets at that
+ * address can send the cookie back, so spoofed join requests never get past
+ * the challenge, and the server doesn't have to remember which challenges it
+ * sent.
+ */
+struct join_cookie_secrets
+{
+    uint8_t current[JOIN_COOKIE_SECRET_SIZE];
+    uint8_t previous[JOIN_COOKIE_SECRET_SIZE];
+};
+
+/*! \return Returns 0 on success, -1 if no random secret could be created. */
+int join_cookie_init(struct join_cookie_secrets* s);
+
+/*!
+ * \brief Replaces the previous secret with the current one, and creates a new
+ * current secret.
+ * \return Returns 0 on success, -1 if no random secret could be created.
+ */
+int join_cookie_rotate(struct join_cookie_secrets* s);
+
+/*! \brief Writes JOIN_COOKIE_SIZE bytes for the address into cookie. */
+void join_cookie_make(
+    const struct join_cookie_secrets* s,
+    const struct net_addr*            addr,
+    uint8_t*                          cookie);
+
+/*!
+ * \brief Checks if the cookie was made for this address with the current or
+ * the previous secret.
+ * \return Returns non-zero if the cookie is valid.
+ */
+int join_cookie_check(
+    const struct join_cookie_secrets* s,
+    const struct net_addr*            addr,
+    const uint8_t*                    cookie);
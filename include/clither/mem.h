@@ -3,11 +3,15 @@
 #include "clither/config.h"
 #include <stdint.h>
 
+struct mem_state;
+
 #if !defined(CLITHER_MEMORY_DEBUGGING)
 /* clang-format off */
 #   include <stdlib.h>
 #   define mem_init_threadlocal()
 #   define mem_deinit_threadlocal()  (0)
+#   define mem_share_threadlocal()   ((struct mem_state*)1)
+#   define mem_adopt_threadlocal(s)  do {} while (0)
 #   define mem_alloc                 malloc
 #   define mem_free                  free
 #   define mem_realloc               realloc
@@ -35,6 +39,24 @@ void mem_init_threadlocal(void);
  */
 int mem_deinit_threadlocal(void);
 
+#if defined(CLITHER_SERVER)
+/*!
+ * @brief Memory is normally tracked per thread, which means it has to be freed
+ * by the same thread it was allocated on. Sharing the calling thread's report
+ * lets other threads adopt it (see mem_adopt_threadlocal()), so memory can be
+ * allocated and freed across all of them. From then on, tracking is protected
+ * by a lock.
+ * @return Returns the shared report, or NULL on failure.
+ */
+struct mem_state* mem_share_threadlocal(void);
+
+/*!
+ * @brief Tracks all allocations made by the calling thread in a report shared
+ * by another thread. Pass NULL to go back to the thread's own report.
+ */
+void mem_adopt_threadlocal(struct mem_state* shared);
+#endif
+
 /*!
  * @brief Does the same thing as a normal call to malloc(), but does some
  * additional work to monitor and track down memory leaks.
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "clither/join_cookie.h"
 #include "clither/q.h"
 #include "clither/snake.h"
 #include <stdint.h>
@@ -7,14 +8,25 @@
 struct food_cluster;
 struct snake;
 struct msg_vec;
+struct net_udp_packet;
+
+/*
+ * Packets sent by clients start with the connection id the server assigned in
+ * MSG_JOIN_ACCEPT, followed by the ack header (see ack.h). The id is 0 until
+ * the client joined. Its lower 16 bits index the server's client table, the
+ * upper 48 bits are random so ids of other clients can't be guessed.
+ */
+#define MSG_CONN_ID_SIZE 8
 
 enum msg_type
 {
     MSG_JOIN_REQUEST,
+    MSG_JOIN_CHALLENGE,
     MSG_JOIN_ACCEPT,
     MSG_JOIN_DENY_BAD_PROTOCOL,
     MSG_JOIN_DENY_BAD_USERNAME,
     MSG_JOIN_DENY_SERVER_FULL,
+    MSG_JOIN_REDIRECT,
     MSG_LEAVE,
 
     MSG_COMMANDS,
@@ -23,6 +35,7 @@ enum msg_type
     MSG_SNAKE_USERNAME,
     MSG_SNAKE_USERNAME_ACK,
     MSG_SNAKE_BEZIER,
+    MSG_SNAKE_BEZIER_BATCH,
     MSG_SNAKE_BEZIER_ACK,
     MSG_SNAKE_DESTROY,
     MSG_SNAKE_DESTROY_ACK,
@@ -36,11 +49,21 @@ enum msg_type
     MSG_FOOD_CLUSTER_UPDATE_ACK
 };
 
+#define MSG_POOL_COUNT 3
+
+/* Maximum number of handles a MSG_SNAKE_BEZIER_BATCH message can carry */
+#define MSG_SNAKE_BEZIER_BATCH_MAX 32
+
 struct msg
 {
-    uint8_t       resend_period;
-    uint8_t       resend_period_counter;
-    uint8_t       resend_retry_counter;
+    /* Reliability state, see ack_update_msgs() */
+    uint16_t      seq;          /* Packet that last carried the message */
+    uint8_t       send_count;   /* How often the message was sent */
+    uint8_t       resend_timer; /* Net ticks since it was last sent */
+    unsigned      reliable : 1;
+    unsigned      in_flight : 1; /* Sent, and waiting for an ack */
+
+    uint8_t       pool; /* Which size class the message was allocated from */
     enum msg_type type;
     uint8_t       payload_len;
     uint8_t       payload[1];
@@ -50,15 +73,22 @@ union parsed_payload
 {
     struct
     {
-        const char* username;
-        uint16_t    protocol_version;
-        uint16_t    frame;
-        uint8_t     username_len;
+        const char*    username;
+        const uint8_t* cookie; /* NULL if the client has none yet */
+        uint16_t       protocol_version;
+        uint16_t       frame;
+        uint8_t        username_len;
     } join_request;
 
+    struct
+    {
+        const uint8_t* cookie;
+    } join_challenge;
+
     struct
     {
         struct qwpos spawn;
+        uint64_t     conn_id;
         uint16_t     snake_id;
         uint16_t     client_frame;
         uint16_t     server_frame;
@@ -71,6 +101,11 @@ union parsed_payload
         const char* error;
     } join_deny;
 
+    struct
+    {
+        uint16_t port;
+    } join_redirect;
+
     struct
     {
         uint16_t frame_number;
@@ -104,6 +139,14 @@ union parsed_payload
         uint8_t      len_forwards;
     } snake_bezier;
 
+    struct
+    {
+        struct bezier_handle handles[MSG_SNAKE_BEZIER_BATCH_MAX];
+        uint16_t             snake_id;
+        uint16_t             first_handle_id;
+        uint8_t              count;
+    } snake_bezier_batch;
+
     struct
     {
         uint16_t handle_idx;
@@ -116,15 +159,46 @@ int msg_parse_payload(
     const uint8_t*        payload,
     uint8_t               payload_len);
 
+/*!
+ * \brief Initializes the calling thread's message pools. Messages are
+ * allocated from a set of size-classed pools, which only grow. Call this in
+ * every thread that creates messages.
+ */
+void msg_init_threadlocal(void);
+
+/*!
+ * \brief Releases all memory held by the calling thread's message pools. All
+ * messages allocated by this thread must have been freed beforehand.
+ */
+void msg_deinit_threadlocal(void);
+
+/*!
+ * \brief Returns a message to the pool it was allocated from. Messages must
+ * be freed by the same thread that created them.
+ */
 void msg_free(struct msg* m);
 
-#define msg_is_reliable(m)   ((m)->resend_period > 0)
-#define msg_is_unreliable(m) ((m)->resend_period == 0)
+#define msg_is_reliable(m)   ((m)->reliable)
+#define msg_is_unreliable(m) (!(m)->reliable)
 
 void msg_update_frame_number(struct msg* m, uint16_t frame_number);
 
+/*!
+ * \brief Creates a join request.
+ * \param[in] cookie The JOIN_COOKIE_SIZE bytes received in the server's
+ * MSG_JOIN_CHALLENGE, or NULL for the first request.
+ */
 struct msg* msg_join_request(
-    uint16_t protocol_version, uint16_t frame_number, const char* username);
+    uint16_t       protocol_version,
+    uint16_t       frame_number,
+    const char*    username,
+    const uint8_t* cookie);
+
+/*!
+ * \brief The server's answer to a join request without a valid cookie. The
+ * client has to send the request again, together with the cookie.
+ */
+struct msg* msg_join_challenge(const uint8_t* cookie);
 
 struct msg* msg_join_accept(
     uint8_t       sim_tick_rate,
@@ -132,7 +206,8 @@ struct msg* msg_join_accept(
     uint16_t      client_frame_number,
     uint16_t      server_frame_number,
     uint16_t      snake_id,
-    struct qwpos* spawn_pos);
+    struct qwpos* spawn_pos,
+    uint64_t      conn_id);
 
 struct msg* msg_join_deny_bad_protocol(const char* error);
 
@@ -140,6 +215,12 @@ struct msg* msg_join_deny_bad_username(const char* error);
 
 struct msg* msg_join_deny_server_full(const char* error);
 
+/*!
+ * \brief Sent instead of MSG_JOIN_DENY_SERVER_FULL if another server instance
+ * on the same host has room. The client joins that instance instead.
+ */
+struct msg* msg_join_redirect(uint16_t port);
+
 struct msg* msg_leave(void);
 
 void msg_commands(struct msg_vec** msgs, const struct cmd_queue* cmdq);
@@ -157,10 +238,50 @@ struct msg* msg_feedback(int8_t diff, uint16_t frame_number);
 struct msg*
 msg_snake_head(const struct snake_head* snake, uint16_t frame_number);
 
+/*!
+ * \brief Serializes a MSG_SNAKE_HEAD message directly into the end of a UDP
+ * packet, without creating a message object. Since nothing is kept around to
+ * resend, this is only suitable for unreliable messages.
+ * \return Returns the number of bytes written, or 0 if the message doesn't
+ * fit into the remaining space of the packet.
+ */
+int msg_snake_head_write(
+    struct net_udp_packet*   pkt,
+    const struct snake_head* head,
+    uint16_t                 frame_number);
+
 struct msg* msg_snake_bezier(
     uint16_t                    snake_id,
     uint16_t                    bezier_handle_idx,
     const struct bezier_handle* bezier_handle);
+
+/*!
+ * \brief Creates a message carrying a run of consecutive bezier handles of one
+ * snake. The first handle is stored as-is. Every following handle only stores
+ * how much it deviates from what was predicted from the previous handles,
+ * which usually takes about half the space of a MSG_SNAKE_BEZIER.
+ * \param[in] first Index into data->bezier_handles of the first handle.
+ * \param[in,out] count Number of handles to pack. Is set to the number of
+ * handles that fit into the message, which is at least 1.
+ */
+struct msg* msg_snake_bezier_batch(
+    uint16_t snake_id, const struct snake_data* data, int first, int* count);
+
+/*!
+ * \brief Same as msg_snake_bezier_batch(), but serializes the message directly
+ * into the end of a UDP packet (see msg_snake_head_write()).
+ * \param[in] max_len Maximum number of bytes to append to the packet.
+ * \return Returns the number of bytes written, or 0 if not even one handle
+ * fits.
+ */
+int msg_snake_bezier_batch_write(
+    struct net_udp_packet*   pkt,
+    int                      max_len,
+    uint16_t                 snake_id,
+    const struct snake_data* data,
+    int                      first,
+    int*                     count);
+
 struct msg* msg_snake_bezier_ack(uint16_t bezier_handle_idx);
 
 struct msg* msg_snake_destroy(uint16_t snake_id);
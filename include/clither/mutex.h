@@ -1,6 +1,7 @@
 #pragma once
 
 struct mutex;
+struct cond;
 
 struct mutex*
 mutex_create(void);
@@ -25,3 +26,26 @@ mutex_trylock(struct mutex* m);
 
 void
 mutex_unlock(struct mutex* m);
+
+struct cond*
+cond_create(void);
+
+void
+cond_destroy(struct cond* c);
+
+/*!
+ * \brief Atomically unlocks the mutex and waits for the condition to be
+ * signalled. The mutex is locked again before returning. As with all condition
+ * variables, wakeups can be spurious, so the caller has to re-check whatever
+ * it is waiting for.
+ */
+void
+cond_wait(struct cond* c, struct mutex* m);
+
+/*! Wakes up at least one thread waiting on the condition. */
+void
+cond_signal(struct cond* c);
+
+/*! Wakes up all threads waiting on the condition. */
+void
+cond_broadcast(struct cond* c);
@@ -9,6 +9,12 @@
  */
 #define NET_MAX_UDP_PACKET_SIZE (576 - 60 - 8)
 
+/*
+ * Maximum number of datagrams net_recvfrom_many() and net_sendto_many() hand
+ * to the kernel in a single system call.
+ */
+#define NET_BATCH_SIZE 32
+
 /*
  * In this implementation, IPv6 is the largest address used. The
  * size of struct sockaddr_in6 on windows and linux are 28 bytes.
@@ -105,6 +111,18 @@ void net_close(int sockfd);
 int net_sendto(
     int sockfd, const void* buf, int len, const struct net_addr* addr);
 
+/*!
+ * \brief Sends pkts[i] to addrs[i] for every i < count (UDP), using as few
+ * system calls as the platform allows. Packets that don't fit into the
+ * socket's send buffer are dropped, same as with net_sendto().
+ * \return Returns the number of packets that were sent.
+ */
+int net_sendto_many(
+    int                                 sockfd,
+    const struct net_udp_packet* const* pkts,
+    const struct net_addr* const*       addrs,
+    int                                 count);
+
 /*!
  * \brief Sends data over a previously connected socket (see
  * net_connect_socket()).
@@ -121,6 +139,18 @@ int net_send(int sockfd, const void* buf, int len);
  */
 int net_recvfrom(int sockfd, void* buf, int capacity, struct net_addr* addr);
 
+/*!
+ * \brief Receive up to "count" datagrams (non-blocking) from a socket, using
+ * as few system calls as the platform allows. The i'th datagram is written
+ * to pkts[i] and its sender to addrs[i].
+ *
+ * \return Returns 0 if nothing was received. Returns -1 if an error occurred.
+ * Returns the number of datagrams received if successful. If this is less
+ * than "count", there is nothing more to read for now.
+ */
+int net_recvfrom_many(
+    int sockfd, struct net_udp_packet* pkts, struct net_addr* addrs, int count);
+
 /*!
  * \brief Receive data (non-blocking) from a connected socket. Data is written
  * to buf and the number of bytes received is returned.
@@ -129,3 +159,21 @@ int net_recvfrom(int sockfd, void* buf, int capacity, struct net_addr* addr);
  * Returns the number of bytes received if successful.
  */
 int net_recv(int sockfd, void* buf, int capacity);
+
+/*!
+ * \brief Prepares waiting for a socket to become readable with
+ * net_poll_wait(). Uses epoll on Linux and poll() elsewhere.
+ * \return Returns a handle to pass to net_poll_wait(), or -1 on failure.
+ */
+int net_poll_create(int sockfd);
+
+/*! Releases what net_poll_create() allocated. The socket stays open */
+void net_poll_destroy(int pollfd);
+
+/*!
+ * \brief Blocks until the socket has data to read or until timeout_ms
+ * milliseconds have passed.
+ * \return Returns 1 if the socket is readable, 0 if the timeout expired, or -1
+ * if an error occurred.
+ */
+int net_poll_wait(int pollfd, int timeout_ms);
@@ -1,10 +1,25 @@
 #pragma once
 
-struct bezier_pending_acks_set;
+#include <stdint.h>
+
+struct bezier_pending_acks_bmap;
 
 struct proximity_state
 {
-    struct bezier_pending_acks_bset* bezier_pending_acks;
+    /*
+     * Bezier handles that were sent to the client, but whose packet wasn't
+     * acknowledged yet. Handles are resent once their packet is lost.
+     */
+    struct bezier_pending_acks_bmap* bezier_pending_acks;
+
+    /*
+     * Grows every net tick the snake isn't sent to the client, faster the
+     * closer it is. See server_queue_snake_data().
+     */
+    int32_t priority;
+
+    /* ID of the first bezier handle the client hasn't been sent yet */
+    uint16_t next_handle_id;
 };
 
 void proximity_state_init(struct proximity_state* ps);
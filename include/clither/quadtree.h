@@ -1 +1,85 @@
 #pragma once
+
+#include "clither/q.h"
+#include "clither/vec.h"
+
+#define QUADTREE_MAX_DEPTH 7
+
+struct quadtree_item
+{
+    struct qwaabb aabb;
+    int32_t       node; /* Node the item is linked into, -1 if unused */
+    int32_t       prev; /* Previous/next item in the same node, or -1 */
+    int32_t       next; /* When unused, links the free list instead */
+    uint16_t      key;  /* User value, usually the ID of the owning snake */
+};
+
+VEC_DECLARE(quadtree_item_vec, struct quadtree_item, 32)
+
+/*!
+ * \brief Loose quadtree of axis-aligned bounding boxes.
+ *
+ * The tree is complete and stored level by level in flat arrays, so a node's
+ * index can be computed directly from its depth and cell coordinates. Each
+ * node's region is twice the size of its cell ("loose"), which means an item
+ * can be placed by looking only at its size and center. Inserting, removing
+ * and moving an item are all O(QUADTREE_MAX_DEPTH).
+ *
+ * Items whose center lies outside of the root's bounds are stored in the root
+ * node, so they are still found, only less efficiently.
+ */
+struct quadtree
+{
+    struct quadtree_item_vec* items;
+    int32_t* heads;  /* First item of each node, -1 if empty */
+    int32_t* counts; /* Number of items in each node's subtree */
+    int32_t  free_item;
+    qw       x, y;   /* Lower corner of the root cell */
+    qw       size;   /* Width and height of the root cell */
+};
+
+/*!
+ * \brief Initializes an empty quadtree. Memory for the nodes is only
+ * allocated on the first insertion.
+ * \param[in] bounds Region of the world where items are expected. The root
+ * cell is the smallest square around this region.
+ */
+void quadtree_init(struct quadtree* qt, struct qwaabb bounds);
+
+void quadtree_deinit(struct quadtree* qt);
+
+/*!
+ * \brief Removes all items, but keeps the memory around.
+ */
+void quadtree_clear(struct quadtree* qt);
+
+/*!
+ * \brief Inserts a new item.
+ * \return Returns a handle to the item, which stays valid until the item is
+ * removed. Returns -1 if memory allocation failed.
+ */
+int32_t quadtree_insert(struct quadtree* qt, struct qwaabb aabb, uint16_t key);
+
+void quadtree_remove(struct quadtree* qt, int32_t item);
+
+/*!
+ * \brief Changes the bounding box of an existing item. If it still belongs to
+ * the same node, this is only an assignment.
+ */
+void quadtree_update(struct quadtree* qt, int32_t item, struct qwaabb aabb);
+
+/*!
+ * \brief Calls on_item() for every item whose bounding box overlaps the
+ * specified bounding box.
+ * \return Returns 0 if all items were visited. If the callback returns a
+ * negative value, iteration stops and that value is returned.
+ */
+int quadtree_query(
+    const struct quadtree* qt,
+    struct qwaabb          aabb,
+    int (*on_item)(int32_t item, uint16_t key, void* user),
+    void* user);
+
+#define quadtree_count(qt) ((qt)->counts ? (qt)->counts[0] : 0)
+
+#define quadtree_get(qt, item) (&(qt)->items->data[item])
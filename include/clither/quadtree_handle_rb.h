@@ -0,0 +1,6 @@
+#pragma once
+
+#include "clither/rb.h"
+
+/* Stores item handles returned by quadtree_insert() */
+RB_DECLARE(quadtree_handle_rb, int32_t, 16)
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "clither/q.h"
+#include "clither/rb.h"
+
+RB_DECLARE(qw_rb, qw, 16)
@@ -1,19 +1,57 @@
 #pragma once
 
+#include "clither/join_cookie.h"
 #include "clither/q.h"
+#include "clither/snake_grid.h"
+#include "clither/timer_wheel.h"
 
+struct admission_table;
+struct batch_cache;
 struct net_addr;
+struct net_udp_packet;
 struct server_settings;
 struct server_client;
 struct world;
-struct server_client_hm;
+struct server_client_vec;
 struct net_addr_hm;
+struct snake_update_vec;
 
 struct server
 {
-    struct server_client_hm* clients;
+    struct admission_table* admission; /* Rate limits every address */
+
+    /* Indexed by the lower bits of the connection id clients send in every
+     * packet, see MSG_CONN_ID_SIZE. Addresses are only looked up for packets
+     * without a valid connection id, e.g. join requests. clients_by_addr maps
+     * to the index and also counts the clients */
+    struct server_client_vec* clients;
+    struct net_addr_hm*       clients_by_addr;
+
+    /* The random part of a connection id is a keyed hash of the number of
+     * clients that joined so far, so joining doesn't need system randomness */
+    uint8_t  conn_id_key[16];
+    uint64_t conn_id_counter;
+
     struct net_addr_hm*      malicious_clients;
     struct net_addr_hm*      banned_clients;
+    struct snake_grid        snake_grid;
+    struct snake_update_vec* snake_updates; /* Scratch space */
+    struct batch_cache*      batch_cache; /* See server_queue_snake_data() */
+
+    /* Client timeouts and expiry of the malicious list. Ticks once per net
+     * tick, so timers.now doubles as the net tick counter */
+    struct timer_wheel timers;
+
+    /* Join requests only allocate a client once they echo a cookie, see
+     * join_cookie.h. Rotated on the net tick cookie_rotate_tick */
+    struct join_cookie_secrets cookies;
+    uint32_t                   cookie_rotate_tick;
+
+    /* Port of another instance with room, which joining players are sent to
+     * once this one is full or over its CPU budget. 0 if there is none. Both
+     * are updated by the server instance, see server_instance_run() */
+    uint16_t redirect_port;
+    unsigned over_cpu_budget : 1;
 
     int udp_sock;
 };
@@ -33,6 +71,15 @@ struct server
 int server_init(
     struct server* server, const char* bind_address, const char* port);
 
+/*!
+ * \brief Adds a client for the address and assigns it a connection id. All
+ * other members of the client are zeroed.
+ * \return Returns the new client, or NULL if allocation failed. The pointer is
+ * invalidated by adding more clients.
+ */
+struct server_client*
+server_add_client(struct server* server, const struct net_addr* addr);
+
 /*!
  * \brief Closes all sockets and frees all data.
  * \param[in] server The server to free.
@@ -41,11 +88,46 @@ int server_init(
  */
 void server_deinit(struct server* server);
 
+/*!
+ * \brief Updates the set of snakes each client is interested in. Snakes that
+ * came into range are scheduled to be sent by server_queue_snake_data(),
+ * snakes that left the range (or were removed from the world) get a destroy
+ * message queued.
+ *
+ * Candidates are looked up in a spatial grid that is rebuilt from the world
+ * on every call, so the cost scales with the number of nearby snakes rather
+ * than with the square of the number of clients.
+ */
 int server_update_snakes_in_range(
     struct server* server, const struct world* world, qw proximity_range);
 
+/*!
+ * \brief Queues each client's own snake head, followed by updates about the
+ * snakes in its proximity.
+ *
+ * Every snake in proximity has a priority, which grows each net tick by an
+ * amount that falls off with the snake's distance to the client's head. The
+ * snakes are then sent in order of priority until settings->snake_update_budget
+ * bytes have been written, and the priority of every snake that was sent is
+ * reset. Nearby snakes are therefore refreshed often, while far away snakes
+ * are still guaranteed to be sent eventually.
+ *
+ * Only bezier handles the client hasn't been sent yet are written, plus the
+ * head segment which changes every frame. Sent handles are remembered together
+ * with the sequence number of their packet until the client acknowledges it,
+ * and are resent if the packet is lost. The work per snake therefore scales
+ * with the number of new or unacknowledged handles, not with its length.
+ *
+ * Clients looking at the same snake mostly need the same handles. Such a
+ * batch is only encoded for the first of them, and copied for the others, so
+ * the encoding cost scales with the number of snakes rather than with the
+ * number of snakes times the number of clients seeing them.
+ */
 int server_queue_snake_data(
-    struct server* server, const struct world* world, uint16_t frame_number);
+    struct server*                server,
+    const struct server_settings* settings,
+    const struct world*           world,
+    uint16_t                      frame_number);
 
 /*!
  * \brief Fills all pending data into UDP packets and sends them to all clients.
@@ -53,7 +135,34 @@ int server_queue_snake_data(
 int server_send_pending_data(struct server* server, struct world* world);
 
 /*!
- *
+ * \brief Advances the timers of connected and malicious clients by one net
+ * tick. Only the timers that expire on this tick are processed. Also rotates
+ * the join cookie secret every JOIN_COOKIE_ROTATE_INTERVAL seconds.
+ * \return Returns 0 on success, -1 if allocation failed or no new secret
+ * could be created.
+ */
+int server_update_timeouts(
+    struct server*                server,
+    const struct server_settings* settings,
+    struct world*                 world);
+
+/*!
+ * \brief Processes packets received by someone else, e.g. the I/O thread (see
+ * server_io_take()). pkts[i] was sent from client_addrs[i].
+ * \return Returns 0 on success, -1 on failure.
+ */
+int server_process_packets(
+    struct server*                server,
+    const struct server_settings* settings,
+    struct world*                 world,
+    const struct net_udp_packet*  pkts,
+    const struct net_addr*        client_addrs,
+    int                           count,
+    uint16_t                      frame_number);
+
+/*!
+ * \brief Updates the timeouts and processes everything that can be read from
+ * the socket right now.
  */
 int server_recv(
     struct server*                server,
@@ -2,6 +2,8 @@
 
 #define CBF_WINDOW_SIZE 20
 
+#include "clither/ack.h"
+#include "clither/net.h"
 #include <stdint.h> /* uint16_t */
 
 struct msg_vec;
@@ -9,9 +11,18 @@ struct proximity_state_bmap;
 
 struct server_client
 {
+    struct net_addr addr; /* Follows the client if its address changes */
+    uint64_t        conn_id; /* See MSG_CONN_ID_SIZE. 0 if the slot is unused */
+
+    /* Unreliable messages are serialized straight into this packet when they
+     * are queued. It is sent (and emptied) by server_send_pending_data(). The
+     * first ACK_HEADER_SIZE bytes are reserved for the header */
+    struct net_udp_packet        pkt;
+    struct ack_state             ack;
     struct msg_vec*              pending_msgs;
     struct proximity_state_bmap* snakes_in_proximity;
-    int                          timeout_counter;
+    uint32_t last_recv_tick; /* Net tick the last packet arrived on */
+    uint32_t timeout_tick;   /* Deadline of the client's timeout timer */
     int      cbf_window[CBF_WINDOW_SIZE]; /* "Command Buffer Fullness" window */
     uint16_t snake_id;
     uint16_t last_command_msg_frame;
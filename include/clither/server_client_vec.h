@@ -0,0 +1,23 @@
+#pragma once
+
+#include "clither/server_client.h"
+#include "clither/vec.h"
+
+VEC_DECLARE(server_client_vec, struct server_client, 32)
+
+static struct server_client* server_client_vec_next_used(
+    struct server_client_vec* v, struct server_client* c)
+{
+    while (c != vec_end(v) && c->conn_id == 0)
+        c++;
+    return c;
+}
+
+/*!
+ * \brief Iterates over the clients in the table. Slots of clients that left
+ * stay in the table until they are reused, and are skipped.
+ */
+#define server_client_vec_for_each(v, client)                                  \
+    for (client = server_client_vec_next_used(v, vec_begin(v));                \
+         client != vec_end(v);                                                 \
+         client = server_client_vec_next_used(v, client + 1))
@@ -1,14 +1,52 @@
 #pragma once
 
+#include "clither/config.h"
+#include <stdint.h>
+
+/* Instances other than the default one are stopped after being empty for this
+ * many seconds */
+#define SERVER_INSTANCE_IDLE_TIMEOUT 30
+
+/* After an instance failed, no new instance is started for this many seconds.
+ * The delay doubles with each failure in a row, up to the maximum */
+#define SERVER_INSTANCE_RESTART_DELAY     1
+#define SERVER_INSTANCE_RESTART_DELAY_MAX 64
+
+struct mutex;
 struct server_settings;
 struct thread;
 
+/*!
+ * \brief An independent server with its own thread, world and port.
+ *
+ * server_run() starts the default instance, and starts more instances on the
+ * following ports while all running instances are full, up to
+ * server_settings::max_instances. Instances publish their status once per net
+ * tick, which server_run() uses to make these decisions, and to tell each
+ * instance where to redirect players to once it is full.
+ */
 struct server_instance
 {
     const struct server_settings* settings;
     struct thread*                thread;
-    const char*                   ip;
-    char                          port[6];
+    struct mutex* lock; /* Owned by server_run(), shared by all instances */
+    const char*   ip;
+    uint64_t      idle_since; /* Only used by server_run(), 0 if not idle */
+    char          port[6];
+
+    /* Everything below is protected by lock */
+    uint16_t player_count;
+    uint16_t redirect_port; /* Set by server_run(), see server::redirect_port */
+    uint8_t  load;          /* Percent of the sim tick spent working */
+    unsigned stop : 1;      /* Set by server_run() to shut the instance down */
+    unsigned running : 1;   /* Cleared by the instance when its thread exits */
 };
 
+/*!
+ * \brief Returns non-zero if the instance shouldn't take on more players,
+ * either because it reached max_players, or because it is using up its CPU
+ * budget. The lock must be held.
+ */
+int server_instance_is_full(const struct server_instance* instance);
+
 void* server_instance_run(const void* args);
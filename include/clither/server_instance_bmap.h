@@ -3,4 +3,4 @@
 #include "clither/bmap.h"
 #include "clither/server_instance.h"
 
-BMAP_DECLARE(server_instance_bmap, uint16_t, struct server_instance, 16)
+BMAP_DECLARE(server_instance_bmap, uint16_t, struct server_instance*, 16)
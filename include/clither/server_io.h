@@ -0,0 +1,64 @@
+#pragma once
+
+#include "clither/net.h"
+
+struct mutex;
+struct thread;
+
+/*
+ * Packets received while the simulation thread is busy are buffered up to
+ * this many. Anything beyond is dropped, same as when the socket's receive
+ * buffer overflows.
+ */
+#define SERVER_IO_CAPACITY 256
+
+/* How often the I/O thread checks whether it should stop */
+#define SERVER_IO_POLL_TIMEOUT_MS 100
+
+struct server_io_packets
+{
+    int                   count;
+    struct net_udp_packet pkts[SERVER_IO_CAPACITY];
+    struct net_addr       addrs[SERVER_IO_CAPACITY];
+};
+
+/*!
+ * \brief Receives packets on a thread of its own.
+ *
+ * The thread sleeps until the socket becomes readable (see net_poll_wait())
+ * and copies whatever arrived into a buffer. server_io_take() swaps that
+ * buffer with a second one, so the lock is only ever held for as long as it
+ * takes to copy a batch of packets or to swap two pointers. Packets therefore
+ * don't sit in the socket until the next net tick, and the simulation thread
+ * never makes a system call to receive them.
+ */
+struct server_io
+{
+    struct mutex*             lock;
+    struct thread*            thread;
+    struct server_io_packets* incoming; /* Filled by the thread. Protected by lock */
+    struct server_io_packets* taken;    /* Returned by server_io_take() */
+    int                       sockfd;
+    int                       pollfd;
+    int                       dropped; /* Protected by lock */
+    unsigned                  shutdown : 1; /* Protected by lock */
+    unsigned                  failed : 1;   /* Protected by lock */
+};
+
+/*!
+ * \brief Starts receiving packets from the socket on a new thread. Nothing
+ * else may receive from the socket until server_io_deinit() is called, but
+ * sending is fine.
+ * \return Returns 0 on success, -1 on failure.
+ */
+int server_io_init(struct server_io* io, int sockfd);
+
+/*! Stops the thread. Packets that weren't taken yet are discarded */
+void server_io_deinit(struct server_io* io);
+
+/*!
+ * \brief Returns all packets received since the last call, in the order they
+ * arrived. They remain valid until the next call.
+ * \return Returns NULL if the thread stopped because receiving failed.
+ */
+const struct server_io_packets* server_io_take(struct server_io* io);
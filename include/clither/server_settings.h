@@ -8,9 +8,16 @@ struct server_settings
     uint16_t max_players;
     uint16_t client_timeout;
     uint16_t malicious_timeout;
+    uint16_t snake_update_budget;
+    uint16_t profile_interval; /* Seconds between tick profiles, 0 disables */
     uint8_t  max_username_len;
     uint8_t  sim_tick_rate;
     uint8_t  net_tick_rate;
+    uint8_t  sim_threads; /* 0 means one per CPU core */
+    uint8_t  max_instances; /* 1 disables starting more instances when full */
+    uint8_t  instance_cpu_budget; /* Percent of a sim tick one instance uses */
+    uint8_t  packet_rate;  /* Packets per second one address may send */
+    uint8_t  packet_burst; /* Packets one address may send at once */
     char     port[6];
 
     /*struct cs_hashmap banned_ips;*/
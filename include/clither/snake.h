@@ -4,6 +4,9 @@
 #include "clither/cmd_queue.h"
 #include "clither/snake_param.h"
 
+struct quadtree;
+struct quadtree_handle_rb;
+
 struct snake_head
 {
     struct qwpos pos;
@@ -22,6 +25,17 @@ struct snake_split
                          removed during resimulation */
 };
 
+/*
+ * Points sampled on a segment that is no longer the head segment. These don't
+ * change while the snake moves, so they are only sampled once.
+ */
+struct snake_segment_points
+{
+    struct bezier_point_vec* points; /* Ordered from head to tail */
+    struct qwpos last; /* Sampling of the next segment continues from here */
+    unsigned     valid : 1;
+};
+
 struct snake_data
 {
     /* Username stored here */
@@ -39,23 +53,68 @@ struct snake_data
      */
     struct qwpos_vec_rb* head_trails;
 
+    /* Running sums of the most recent trail, see bezier_fit_trail() */
+    struct bezier_fit_sums head_fit_sums;
+
     /* List of bezier handles that define the shape of the entire snake. */
     struct bezier_handle_rb* bezier_handles;
 
+    /*
+     * Handles are identified over the network by an ID that doesn't change
+     * while the handle exists. The oldest (tail) handle has this ID, and the
+     * handle at index i of bezier_handles has the ID (bezier_handle_id_base +
+     * i). See snake_bezier_handle_id().
+     */
+    uint16_t bezier_handle_id_base;
+
     /*
      * List of axis-aligned bounding-boxes (qwaabb) for each bezier segment.
      * This list will be 1 shorter than the list of bezier_handles.
      */
     struct qwaabb_rb* bezier_aabbs;
 
+    /*
+     * Arc length of each bezier segment, in the same order as bezier_aabbs.
+     * Only the head segment changes shape while stepping, so only its length
+     * is recalculated. Used by snake_step_server().
+     */
+    struct qw_rb* bezier_lengths;
+
     /*
      * The curve is sampled N times (N = length of snake) and the results are
      * cached here. These are used for rendering.
      */
     struct bezier_point_vec* bezier_points;
 
+    /*
+     * Points of each segment, in the same order as bezier_aabbs. Segments are
+     * sampled from the tail towards the head, so only the head segment has to
+     * be sampled again when the snake moves. bezier_points is assembled from
+     * these.
+     */
+    struct snake_segment_points_rb* segment_points;
+
     struct snake_splits_rb* splits;
 
+    /*
+     * Optional broadphase the segment AABBs are registered in, see
+     * snake_attach_quadtree(). Stepping the snake doesn't touch the quadtree,
+     * so snakes can be stepped in parallel. Instead, the changes made to
+     * bezier_aabbs are recorded and applied by snake_sync_quadtree():
+     *  - The first quadtree_stale_tail entries of quadtree_items belong to
+     *    segments that were removed from the tail.
+     *  - The next quadtree_synced entries are the items of the first
+     *    quadtree_synced entries in bezier_aabbs. Any entries after those
+     *    belong to segments that were removed from the head.
+     *  - Segments from index quadtree_dirty onwards changed their AABB.
+     */
+    struct quadtree*           quadtree;
+    struct quadtree_handle_rb* quadtree_items;
+    int                        quadtree_stale_tail;
+    int                        quadtree_synced;
+    int                        quadtree_dirty;
+    uint16_t                   quadtree_key;
+
     /* AABB of the entire snake */
     struct qwaabb aabb;
 };
@@ -77,6 +136,31 @@ void snake_deinit(struct snake* snake);
 
 void snake_head_init(struct snake_head* head, struct qwpos spawn_pos);
 
+/*!
+ * \brief Registers the AABB of every bezier segment in the quadtree. From then
+ * on, changes to the segments are recorded and applied to the quadtree by
+ * snake_sync_quadtree(), until the snake is destroyed.
+ * \param[in] key Stored with each quadtree item, usually the snake's ID.
+ * \return Returns 0 on success, -1 if memory allocation failed.
+ */
+int snake_attach_quadtree(
+    struct snake_data* data, struct quadtree* quadtree, uint16_t key);
+
+/*!
+ * \brief Applies the segment changes made since the last call to the quadtree
+ * the snake is attached to, if any. This must not run at the same time as
+ * anything else that uses the same quadtree.
+ * \return Returns 0 on success, -1 if memory allocation failed. In that case
+ * the remaining changes are applied by the next call.
+ */
+int snake_sync_quadtree(struct snake_data* data);
+
+/*!
+ * \brief Removes all of the snake's segments from the quadtree it was attached
+ * to, if any.
+ */
+void snake_detach_quadtree(struct snake_data* data);
+
 static int
 snake_heads_are_equal(const struct snake_head* a, const struct snake_head* b)
 {
@@ -92,6 +176,10 @@ snake_heads_are_equal(const struct snake_head* a, const struct snake_head* b)
 
 #define snake_is_held(snake) (snake)->hold
 
+/*! Network ID of the bezier handle at index idx of data->bezier_handles */
+#define snake_bezier_handle_id(data, idx)                                      \
+    ((uint16_t)((data)->bezier_handle_id_base + (idx)))
+
 /*!
  * \brief If a snake is in hold mode (@see snake_set_hold), this
  * function checks the condition for resetting the hold state.
@@ -122,10 +210,12 @@ void snake_step_head(
  * is currently not implemented.
  * \param[in] command The command to step forwards with.
  * \param[in] sim_tick_rate The simulation speed.
- * \return Returns the number of segments that could be removed from the curve.
+ * \return Returns the number of segments that could be removed from the curve,
+ * or -1 if the trail point or a new segment could not be allocated. The snake
+ * is left in a consistent state in that case and catches up on a later step.
  *
- * On the server-side this value should be passed to a proceeding call to
- * snake_remove_stale_segments().
+ * On the server-side, snake_step_server() is used instead, and its return
+ * value is passed to a proceeding call to snake_remove_stale_segments().
  *
  * On the client-side, this is handled by snake_ack_frame() instead.
  */
@@ -136,6 +226,19 @@ int snake_step(
     struct cmd                command,
     uint8_t                   sim_tick_rate);
 
+/*!
+ * \brief Same as snake_step(), except data->bezier_points is not generated.
+ * Instead, the number of segments that could be removed is calculated from
+ * the cached length of each segment, which is a lot cheaper. Meant for the
+ * server, which doesn't render anything.
+ */
+int snake_step_server(
+    struct snake_data*        data,
+    struct snake_head*        head,
+    const struct snake_param* param,
+    struct cmd                command,
+    uint8_t                   sim_tick_rate);
+
 void snake_remove_stale_segments(struct snake_data* data, int stale_segments);
 
 void snake_remove_stale_segments_with_rollback_constraint(
@@ -143,7 +246,14 @@ void snake_remove_stale_segments_with_rollback_constraint(
     const struct snake_head* head_ack,
     int                      stale_segments);
 
-void snake_ack_frame(
+/*!
+ * \brief Replays the snake's head up to the specified frame and compares it to
+ * the head the server sent. If they differ, the snake is rolled back to the
+ * server's head and the commands after it are re-simulated.
+ * \return Returns 1 if a rollback happened, 0 otherwise, or -1 if a trail
+ * point or a new segment could not be allocated while re-simulating.
+ */
+int snake_ack_frame(
     struct snake_data*        data,
     struct snake_head*        acknowledged_head,
     struct snake_head*        predicted_head,
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "clither/q.h"
+#include "clither/vec.h"
+
+struct snake_bmap;
+
+struct snake_grid_entry
+{
+    int16_t  cell_x;
+    int16_t  cell_y;
+    uint16_t snake_id;
+};
+
+VEC_DECLARE(snake_grid_entry_vec, struct snake_grid_entry, 32)
+VEC_DECLARE(snake_grid_id_vec, uint16_t, 16)
+
+/*!
+ * \brief Uniform grid over the bounding boxes of all snakes in a world.
+ *
+ * Every snake is registered in each cell its (expanded) bounding box touches.
+ * Cells are hashed into a power-of-two number of buckets, and the entries are
+ * stored contiguously sorted by bucket, so a lookup touches a single
+ * contiguous range of memory. The grid is meant to be thrown away and rebuilt
+ * once per network tick.
+ */
+struct snake_grid
+{
+    /* All entries, sorted by bucket. buckets[b] is the offset of the first
+     * entry of bucket b, buckets[b+1] is one past its last entry */
+    struct snake_grid_entry_vec* entries;
+    struct snake_grid_entry_vec* scratch;
+    int32_t*                     buckets;
+    /* Snakes whose bounding box covers too many cells to be worth inserting.
+     * These are tested by every query */
+    struct snake_grid_id_vec* oversized;
+    int32_t                   bucket_count;
+    qw                        cell_size;
+};
+
+void snake_grid_init(struct snake_grid* grid, qw cell_size);
+
+void snake_grid_deinit(struct snake_grid* grid);
+
+/*!
+ * \brief Clears the grid and re-inserts every snake in the bmap.
+ * \param[in] margin Each snake's bounding box is expanded by this amount
+ * before being inserted. Queries will report all snakes whose expanded
+ * bounding box overlaps the cell the queried position falls into.
+ * \return Returns 0 on success, -1 if memory allocation failed.
+ */
+int snake_grid_rebuild(
+    struct snake_grid* grid, const struct snake_bmap* snakes, qw margin);
+
+/*!
+ * \brief Calls on_snake() once for every snake registered in the cell
+ * containing the specified position. This is a conservative test: The caller
+ * still has to check the snake's expanded bounding box.
+ * \return Returns 0 if all snakes were visited. If the callback returns a
+ * negative value, iteration stops and that value is returned.
+ */
+int snake_grid_query(
+    const struct snake_grid* grid,
+    struct qwpos             pos,
+    int (*on_snake)(uint16_t snake_id, void* user),
+    void* user);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "clither/snake.h"
+#include "clither/rb.h"
+
+RB_DECLARE(snake_segment_points_rb, struct snake_segment_points, 16)
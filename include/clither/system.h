@@ -1,7 +1,11 @@
 #pragma once
 
-#include "odb-util/config.h"
-
-ODBUTIL_PUBLIC_API int
-system_cpu_count(void);
+/*! Returns the number of CPU cores that are online */
+int system_cpu_count(void);
 
+/*!
+ * \brief Fills buf with random bytes from the operating system, which are
+ * suitable for secrets.
+ * \return Returns 0 on success, -1 on failure.
+ */
+int system_random_bytes(void* buf, int len);
@@ -45,3 +45,9 @@ int tick_wait(struct tick* t);
 int tick_wait_warp(struct tick* t, int warp, int tps);
 
 void tick_skip(struct tick* t);
+
+/*!
+ * \brief Returns the current time of a monotonic clock in nanoseconds. Only
+ * useful for measuring the time between two calls.
+ */
+uint64_t tick_now(void);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "clither/config.h"
+#include <stdint.h>
+
+#define TICK_PROFILER_MAX_PHASES 8
+
+/*
+ * Durations are sorted into logarithmic buckets, with 8 buckets per power of
+ * two. This bounds the error of the reported p99 to 12.5% while keeping the
+ * cost of recording a sample constant. Durations of 2^40 ns (18 minutes) and
+ * above all end up in the last bucket.
+ */
+#define TICK_PROFILER_SUB_BUCKETS 8
+#define TICK_PROFILER_BUCKETS     (TICK_PROFILER_SUB_BUCKETS * 40)
+
+struct tick_phase_stats
+{
+    uint64_t min, max, sum;
+    uint32_t count;
+    uint32_t histogram[TICK_PROFILER_BUCKETS];
+};
+
+/*!
+ * \brief Measures how long each phase of a loop takes.
+ *
+ * Call tick_profiler_begin() at the start of an iteration and
+ * tick_profiler_end() after each phase. Every phase is measured from the end
+ * of the previous one, so each iteration costs one clock read per phase.
+ * tick_profiler_end_tick() measures the iteration as a whole. The
+ * statistics are collected over a window of a configurable number of seconds,
+ * after which tick_profiler_report() logs them and starts a new window.
+ */
+struct tick_profiler
+{
+    struct tick_phase_stats phases[TICK_PROFILER_MAX_PHASES];
+    const char* const*      phase_names;
+    int                     phase_count;
+    uint64_t                phase_start;
+    uint64_t                tick_start;
+    uint64_t                window_start;
+    uint64_t                window_length; /* 0 means never report */
+};
+
+/*!
+ * \brief Resets all statistics and starts the first window.
+ * \param[in] phase_names Array of phase_count names used for reporting. The
+ * array is not copied.
+ * \param[in] report_interval Length of a window in seconds. 0 disables the
+ * report, but samples are still collected.
+ */
+void tick_profiler_init(
+    struct tick_profiler* p,
+    const char* const*    phase_names,
+    int                   phase_count,
+    int                   report_interval);
+
+void tick_profiler_begin(struct tick_profiler* p);
+
+/*!
+ * \brief Adds the time since the previous call to tick_profiler_begin() or
+ * tick_profiler_end() to the phase's statistics.
+ */
+void tick_profiler_end(struct tick_profiler* p, int phase);
+
+/*!
+ * \brief Adds the time since the last call to tick_profiler_begin() to the
+ * phase's statistics.
+ */
+void tick_profiler_end_tick(struct tick_profiler* p, int phase);
+
+/*!
+ * \brief Returns the duration below which 99% of the phase's samples in the
+ * current window lie, in nanoseconds.
+ */
+uint64_t tick_profiler_p99(const struct tick_profiler* p, int phase);
+
+/*!
+ * \brief If the current window is over, logs the min/avg/p99/max of every
+ * phase and starts a new window.
+ * \return Returns 1 if a report was logged, 0 otherwise.
+ */
+int tick_profiler_report(struct tick_profiler* p);
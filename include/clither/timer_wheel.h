@@ -0,0 +1,72 @@
+#pragma once
+
+#include "clither/net.h"
+#include "clither/vec.h"
+#include <stdint.h>
+
+/*
+ * Each level of the wheel has 2^TIMER_WHEEL_BITS slots, and every slot of a
+ * level spans one full rotation of the level below it. Four levels of 64
+ * slots cover 2^24 ticks, which is over 9 days at 20 net ticks per second.
+ * Timers further in the future are clamped to that.
+ */
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/*! A timer belongs to a peer and has a user defined type */
+struct timer
+{
+    struct net_addr addr;
+    uint32_t        expires;
+    int             type;
+};
+
+VEC_DECLARE(timer_vec, struct timer, 32)
+
+/*!
+ * \brief Hierarchical timer wheel.
+ *
+ * Adding a timer and advancing by a tick are O(1), except that once every
+ * 2^(TIMER_WHEEL_BITS * n) ticks, a slot of level n is redistributed into the
+ * levels below. The work per tick is therefore proportional to the number of
+ * timers that expire, not to the number of timers registered.
+ *
+ * Timers can't be cancelled. Instead, the owner of a timer checks whether it
+ * is still relevant when it expires, and adds a new one if the deadline moved.
+ */
+struct timer_wheel
+{
+    struct timer_vec* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint32_t          now; /* The last tick that was processed */
+};
+
+/*!
+ * \brief Called for every expired timer. Adding new timers from within the
+ * callback is allowed.
+ * \return Return 0 to continue, or -1 to abort advancing.
+ */
+typedef int (*timer_func)(const struct timer* t, void* user);
+
+void timer_wheel_init(struct timer_wheel* w, uint32_t now);
+void timer_wheel_deinit(struct timer_wheel* w);
+
+/*!
+ * \brief Registers a timer that expires on the specified tick. Deadlines that
+ * aren't in the future expire on the next tick.
+ * \return Returns 0 on success, -1 if allocation failed.
+ */
+int timer_wheel_add(
+    struct timer_wheel*    w,
+    uint32_t               expires,
+    int                    type,
+    const struct net_addr* addr);
+
+/*!
+ * \brief Advances the wheel by one tick and calls on_expire for every timer
+ * that expires on that tick.
+ * \return Returns 0 on success, or -1 if the callback or allocation failed.
+ * Timers that weren't processed yet are lost in that case.
+ */
+int timer_wheel_advance(
+    struct timer_wheel* w, timer_func on_expire, void* user);
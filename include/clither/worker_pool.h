@@ -0,0 +1,67 @@
+#pragma once
+
+struct cond;
+struct mem_state;
+struct mutex;
+struct thread;
+
+typedef void (*worker_pool_func)(void* user, int begin, int end);
+
+/*!
+ * \brief Fixed set of threads that split a range of work between them.
+ *
+ * The threads are started once and then sleep until worker_pool_run() hands
+ * them a job. The thread calling worker_pool_run() takes part in the job and
+ * only returns once all of it is done, so from the caller's point of view it
+ * behaves like a normal loop.
+ *
+ * The workers track their allocations in the memory report of the thread that
+ * created the pool, so memory can be allocated by a worker and freed by the
+ * owning thread, or vice versa.
+ */
+struct worker_pool
+{
+    struct mutex*     lock;
+    struct cond*      work_ready; /* Broadcast when a new job starts */
+    struct cond*      work_done;  /* Signalled by the last worker to finish */
+    struct thread**   threads;
+    struct mem_state* mem;
+
+    /* Current job. Protected by lock */
+    worker_pool_func func;
+    void*            user;
+    int              count;
+    int              chunk_size;
+    int              next;
+    int              busy; /* Workers that haven't finished the job yet */
+    unsigned         job_id;
+    unsigned         shutdown : 1;
+
+    int thread_count; /* Number of workers, not including the caller */
+};
+
+/*!
+ * \brief Starts the worker threads.
+ * \param[in] thread_count Total number of threads that should work on each
+ * job, including the thread calling worker_pool_run(). A value of 1 (or less)
+ * doesn't start any threads and runs every job on the calling thread.
+ * \return Returns 0 on success, -1 on failure.
+ */
+int worker_pool_init(struct worker_pool* pool, int thread_count);
+
+void worker_pool_deinit(struct worker_pool* pool);
+
+/*!
+ * \brief Calls func() for chunks of the range [0, count) in parallel and waits
+ * for all of them to finish. The chunks don't overlap and together cover the
+ * entire range.
+ * \param[in] min_chunk_size Ranges are never split into chunks smaller than
+ * this. If the range is smaller than this, func() is called directly on the
+ * calling thread without waking the workers.
+ */
+void worker_pool_run(
+    struct worker_pool* pool,
+    worker_pool_func    func,
+    void*               user,
+    int                 count,
+    int                 min_chunk_size);
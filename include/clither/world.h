@@ -1,15 +1,38 @@
 #pragma once
 
 #include "clither/q.h"
+#include "clither/quadtree.h"
+#include "clither/vec.h"
 
 struct snake_bmap;
 
+/*!
+ * \brief The head of snake_id touches the bounding box of one of
+ * other_snake_id's bezier segments. Both IDs are the same if a snake touches
+ * one of its own older segments.
+ */
+struct world_collision
+{
+    uint16_t snake_id;
+    uint16_t other_snake_id;
+};
+
+VEC_DECLARE(world_collision_vec, struct world_collision, 16)
+
 struct world
 {
     struct snake_bmap* snakes;
-    qw                 inner_radius;
-    qw                 ring_start;
-    qw                 ring_end;
+
+    /* Broadphase over the bounding boxes of all bezier segments of all
+     * snakes */
+    struct quadtree quadtree;
+
+    /* Head-vs-body collisions found by the last call to world_step() */
+    struct world_collision_vec* collisions;
+
+    qw inner_radius;
+    qw ring_start;
+    qw ring_end;
 };
 
 void world_init(struct world* world);
@@ -35,4 +58,17 @@ struct snake* world_create_snake(
 
 void world_remove_snake(struct world* world, uint16_t snake_id);
 
+/*!
+ * \brief Empties the quadtree and re-inserts the segments of all snakes. The
+ * quadtree is normally kept up to date incrementally, but this compacts its
+ * item storage after many snakes have come and gone.
+ * \return Returns 0 on success, -1 if memory allocation failed.
+ */
+int world_rebuild_quadtree(struct world* world);
+
+/*!
+ * \brief Applies the segment changes of all snakes to the quadtree, then finds
+ * head-vs-body collisions and stores them in world->collisions. The quadtree
+ * is used as a broadphase, so only segments close to each head are tested.
+ */
 void world_step(struct world* w, uint16_t frame_number, uint8_t sim_tick_rate);
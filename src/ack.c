@@ -0,0 +1,187 @@
+#include "clither/ack.h"
+#include "clither/log.h"
+#include "clither/msg.h"
+#include "clither/msg_vec.h"
+#include "clither/wrap.h"
+
+/* ------------------------------------------------------------------------- */
+void ack_init(struct ack_state* ack)
+{
+    ack->recv_bits = 0;
+    ack->acked_bits = 0;
+    ack->next_seq = 1;
+    ack->recv_seq = 0;
+    ack->acked_seq = 0;
+    ack->ack_pending = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int ack_write_header(struct ack_state* ack, uint8_t* buf)
+{
+    buf[0] = ack->next_seq >> 8;
+    buf[1] = ack->next_seq & 0xFF;
+    buf[2] = ack->recv_seq >> 8;
+    buf[3] = ack->recv_seq & 0xFF;
+    buf[4] = (ack->recv_bits >> 24) & 0xFF;
+    buf[5] = (ack->recv_bits >> 16) & 0xFF;
+    buf[6] = (ack->recv_bits >> 8) & 0xFF;
+    buf[7] = (ack->recv_bits >> 0) & 0xFF;
+
+    if (++ack->next_seq == 0)
+        ack->next_seq = 1;
+    ack->ack_pending = 0;
+
+    return ACK_HEADER_SIZE;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Shifts a window of bits so it is relative to a newer sequence number.
+ * \param[in] diff How much newer the sequence number is. Must be positive.
+ */
+static uint32_t advance_window(uint32_t bits, int diff)
+{
+    /* The previous most recent packet becomes bit diff-1 */
+    if (diff > 32)
+        return 0;
+    if (diff == 32)
+        return (uint32_t)1 << 31;
+    return (bits << diff) | ((uint32_t)1 << (diff - 1));
+}
+
+/* ------------------------------------------------------------------------- */
+int ack_read_header(struct ack_state* ack, const uint8_t* data, int len)
+{
+    uint16_t seq, acked_seq;
+    uint32_t acked_bits;
+    int      diff;
+
+    if (len < ACK_HEADER_SIZE)
+        return -1;
+
+    /* Sequence numbers start at 1, so this isn't a packet of ours */
+    seq = (data[0] << 8) | data[1];
+    if (seq == 0)
+        return -1;
+
+    acked_seq = (data[2] << 8) | data[3];
+    acked_bits = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) |
+                 ((uint32_t)data[6] << 8) | ((uint32_t)data[7] << 0);
+
+    /* Update what the peer received of ours. Older acks are ignored, since
+     * the newest one carries all of the information */
+    if (acked_seq != 0)
+    {
+        if (ack->acked_seq == 0)
+        {
+            ack->acked_seq = acked_seq;
+            ack->acked_bits = acked_bits;
+        }
+        else if (u16_gt_wrap(acked_seq, ack->acked_seq))
+        {
+            /* Bits we knew about but the peer doesn't report anymore are
+             * still valid, so merge them */
+            ack->acked_bits = acked_bits | advance_window(
+                                               ack->acked_bits,
+                                               u16_sub_wrap(
+                                                   acked_seq, ack->acked_seq));
+            ack->acked_seq = acked_seq;
+        }
+        else if (acked_seq == ack->acked_seq)
+            ack->acked_bits |= acked_bits;
+    }
+
+    /* Update what we received of theirs */
+    if (ack->recv_seq == 0)
+    {
+        ack->recv_seq = seq;
+        ack->ack_pending = 1;
+        return 1;
+    }
+
+    diff = u16_sub_wrap(seq, ack->recv_seq);
+    if (diff > 0)
+    {
+        ack->recv_bits = advance_window(ack->recv_bits, diff);
+        ack->recv_seq = seq;
+        ack->ack_pending = 1;
+        return 1;
+    }
+    if (diff == 0 || -diff > 32)
+        return 0;
+    if (ack->recv_bits & ((uint32_t)1 << (-diff - 1)))
+        return 0;
+
+    ack->recv_bits |= (uint32_t)1 << (-diff - 1);
+    ack->ack_pending = 1;
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+enum ack_status ack_status_of(const struct ack_state* ack, uint16_t seq)
+{
+    int diff;
+
+    if (ack->acked_seq == 0)
+        return ACK_IN_FLIGHT;
+
+    diff = u16_sub_wrap(ack->acked_seq, seq);
+    if (diff < 0)
+        return ACK_IN_FLIGHT;
+    if (diff == 0)
+        return ACK_RECEIVED;
+    if (diff <= 32 && (ack->acked_bits & ((uint32_t)1 << (diff - 1))))
+        return ACK_RECEIVED;
+    if (diff >= ACK_LOSS_DISTANCE)
+        return ACK_LOST;
+    return ACK_IN_FLIGHT;
+}
+
+/* ------------------------------------------------------------------------- */
+static int update_msg(struct msg** pmsg, void* user)
+{
+    struct ack_state* ack = user;
+    struct msg*       msg = *pmsg;
+
+    if (msg_is_unreliable(msg) || !msg->in_flight)
+        return VEC_RETAIN;
+
+    switch (ack_status_of(ack, msg->seq))
+    {
+        case ACK_RECEIVED:
+            log_net("Retiring msg type=%d, seq=%d\n", msg->type, msg->seq);
+            msg_free(msg);
+            return VEC_ERASE;
+
+        case ACK_LOST:
+            log_net("Lost msg type=%d, seq=%d\n", msg->type, msg->seq);
+            msg->in_flight = 0;
+            break;
+
+        case ACK_IN_FLIGHT:
+            if (++msg->resend_timer < ACK_RESEND_TIMEOUT)
+                return VEC_RETAIN;
+            log_net("Timed out msg type=%d, seq=%d\n", msg->type, msg->seq);
+            msg->in_flight = 0;
+            break;
+    }
+
+    if (msg->send_count >= ACK_MAX_SENDS)
+        return log_err(
+            "Peer did not acknowledge reliable message: type=%d\n", msg->type);
+
+    return VEC_RETAIN;
+}
+int ack_update_msgs(struct ack_state* ack, struct msg_vec* msgs)
+{
+    return msg_vec_retain(msgs, update_msg, ack);
+}
+
+/* ------------------------------------------------------------------------- */
+void ack_msg_sent(struct msg* m, uint16_t seq)
+{
+    m->seq = seq;
+    m->in_flight = 1;
+    m->resend_timer = 0;
+    m->send_count++;
+}
@@ -0,0 +1,103 @@
+#include "clither/admission.h"
+#include "clither/hash.h"
+#include "clither/log.h"
+#include "clither/mem.h"
+#include "clither/net.h"
+#include "clither/system.h"
+#include <string.h> /* memset */
+
+/* ------------------------------------------------------------------------- */
+int admission_init(struct admission_table** table)
+{
+    *table = mem_alloc(sizeof(**table));
+    if (*table == NULL)
+        return log_oom(sizeof(**table), "admission_init()");
+
+    memset((*table)->sets, 0, sizeof((*table)->sets));
+    if (system_random_bytes((*table)->key, sizeof((*table)->key)) != 0)
+    {
+        mem_free(*table);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+void admission_deinit(struct admission_table* table)
+{
+    mem_free(table);
+}
+
+/* ------------------------------------------------------------------------- */
+int admission_check(
+    struct admission_table* table,
+    const struct net_addr*  addr,
+    uint32_t                now,
+    int                     rate,
+    int                     burst,
+    int                     net_tick_rate)
+{
+    struct admission_entry* set;
+    struct admission_entry* entry;
+    uint32_t                tokens;
+    int                     way, oldest_age;
+    uint64_t                h;
+    uint32_t                tag;
+
+    /*
+     * Tokens are scaled by the net tick rate, so a refill of "rate" tokens
+     * per second is exactly "rate" scaled tokens per net tick, and a packet
+     * costs net_tick_rate scaled tokens.
+     */
+    const uint32_t capacity = (uint32_t)burst * net_tick_rate;
+
+    h = hash64_siphash24(table->key, addr->sockaddr_storage, addr->len);
+    set = table->sets[h & (ADMISSION_SETS - 1)];
+    tag = (uint32_t)(h >> 32);
+    if (tag == 0)
+        tag = 1;
+
+    /* Find the address, or the entry that was used least recently */
+    entry = &set[0];
+    oldest_age = -1;
+    for (way = 0; way != ADMISSION_WAYS; ++way)
+    {
+        int age;
+        if (set[way].tag == tag)
+        {
+            entry = &set[way];
+            break;
+        }
+
+        age = set[way].tag == 0 ? 0x10000 : (uint16_t)(now - set[way].tick);
+        if (age > oldest_age)
+        {
+            entry = &set[way];
+            oldest_age = age;
+        }
+    }
+
+    if (entry->tag != tag)
+    {
+        entry->tag = tag;
+        entry->tokens = (uint16_t)capacity;
+        entry->tick = (uint16_t)now;
+    }
+
+    /* Refill for the ticks that passed since the last packet */
+    tokens = entry->tokens +
+             (uint32_t)(uint16_t)((uint16_t)now - entry->tick) * rate;
+    if (tokens > capacity)
+        tokens = capacity;
+    entry->tick = (uint16_t)now;
+
+    if (tokens < (uint32_t)net_tick_rate)
+    {
+        entry->tokens = (uint16_t)tokens;
+        return 0;
+    }
+
+    entry->tokens = (uint16_t)(tokens - net_tick_rate);
+    return 1;
+}
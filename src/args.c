@@ -111,6 +111,12 @@ print_help(const char* prog_name)
         "  " ARG2 "-p" RESET "," ARG1 " --port " RESET "<" ARG2 "port" RESET ">   Port to bind server to.\n");
 #endif
 
+    fprintf(stderr,
+        "     " ARG1 " --bots " RESET "<" ARG2 "count" RESET ">\n"
+        "                      Connect  this many  headless  bot  clients to  --ip and\n"
+        "                      --port  and  steer them  around  randomly. Useful  for\n"
+        "                      testing how many players a server can handle.\n");
+
     fprintf(stderr,
         "     " ARG1 " --mcd " RESET "<" ARG2 "latency" RESET "> <" ARG2 "loss" RESET "> <" ARG2 "dup" RESET "> <" ARG2 "reorder" RESET ">\n"
         "                      Enable McDonald's WiFi mode.  Latency is in ms.  Loss,\n"
@@ -153,6 +159,7 @@ args_parse(struct args* a, int argc, char* argv[])
     int i;
     char tests_flag = 0;
     char bench_flag = 0;
+    char bots_flag = 0;
 #if defined(CLITHER_GFX) && defined(CLITHER_SERVER)
     char server_flag = 0;
     char host_flag = 0;
@@ -173,6 +180,7 @@ args_parse(struct args* a, int argc, char* argv[])
 #if defined(CLITHER_GFX)
     a->gfx_backend = 0;
 #endif
+    a->bot_count = 0;
 #if defined(CLITHER_MCD)
     a->mcd_port = "5554";
     a->mcd_latency = 0;
@@ -227,6 +235,22 @@ args_parse(struct args* a, int argc, char* argv[])
                 else if (strcmp(arg, "host") == 0)
                     host_flag = 1;
 #endif
+                else if (strcmp(arg, "bots") == 0)
+                {
+                    ++i;
+                    if (i >= argc || !*argv[i])
+                    {
+                        log_err("Missing argument for --bots\n");
+                        return -1;
+                    }
+                    a->bot_count = atoi(argv[i]);
+                    if (a->bot_count < 1)
+                    {
+                        log_err("Bot count must be at least 1\n");
+                        return -1;
+                    }
+                    bots_flag = 1;
+                }
                 else if (strcmp(arg, "ip") == 0)
                 {
                     ++i;
@@ -345,6 +369,8 @@ args_parse(struct args* a, int argc, char* argv[])
     else if (bench_flag)
         a->mode = MODE_BENCHMARKS;
 #endif
+    else if (bots_flag)
+        a->mode = MODE_BOTS;
 #if defined(CLITHER_GFX) && defined(CLITHER_SERVER)
     else if (server_flag && host_flag)
     {
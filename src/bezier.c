@@ -7,93 +7,103 @@
 #include <math.h>
 #include <string.h>
 
+/* Newton iterations sample_curve() uses to correct the distance between
+ * points */
+#define BEZIER_SAMPLE_NEWTON_STEPS 3
+
+/* Number of trail points bezier_fit_trail() measures the error of */
+#define BEZIER_FIT_ERROR_SAMPLES 16
+
+/* Newton iterations used to find the closest point on the curve */
+#define BEZIER_FIT_NEWTON_STEPS 6
+
 /* ------------------------------------------------------------------------- */
-static q16_16 distance_to_segment_sq(
-    q16_16 px, q16_16 py, q16_16 t, const q16_16 Ax[4], const q16_16 Ay[4])
-{
-    q16_16 t2 = q16_16_mul(t, t);
-    q16_16 t3 = q16_16_mul(t, t2);
-    q16_16 x = q16_16_add(
-        q16_16_add(
-            q16_16_add(Ax[0], q16_16_mul(Ax[1], t)), q16_16_mul(Ax[2], t2)),
-        q16_16_mul(Ax[3], t3));
-    q16_16 y = q16_16_add(
-        q16_16_add(
-            q16_16_add(Ay[0], q16_16_mul(Ay[1], t)), q16_16_mul(Ay[2], t2)),
-        q16_16_mul(Ay[3], t3));
-    q16_16 dx = q16_16_sub(px, x);
-    q16_16 dy = q16_16_sub(py, y);
-    return dx * dx +
-           dy * dy; /* HACK: Not the same as q16_16_mul(), but the precision
-                       of Q16.16 isn't enough so we do this */
-}
-static q16_16 binary_search_min_dist_sq(
-    const struct qwpos* p,
-    const q16_16        Ax[4],
-    const q16_16        Ay[4],
-    q16_16              t_initial_guess)
+/*!
+ * \brief Finds the squared distance from a point to the closest point on the
+ * curve using a few Newton iterations, starting at t.
+ */
+static double newton_min_dist_sq(
+    double px, double py, const double Ax[4], const double Ay[4], double t)
 {
-    q16_16 last_error;
-    q16_16 t = t_initial_guess;
-    q16_16 t_step = make_q16_16_2(1, 2);
-    q16_16 px = qw_to_q16_16(p->x);
-    q16_16 py = qw_to_q16_16(p->y);
-
-    last_error = distance_to_segment_sq(px, py, t, Ax, Ay);
-    do
-    {
-        q16_16 error_up, error_down;
-        q16_16 t_up = q16_16_add(t, t_step);
-        q16_16 t_down = q16_16_sub(t, t_step);
-
-        if (t_up <= make_q16_16(1))
-            error_up = distance_to_segment_sq(px, py, t_up, Ax, Ay);
-        else
-            error_up = last_error;
+    int    i;
+    double best = -1;
+    double t_best = t;
+    double step = 0;
 
-        if (t_down >= 0)
-            error_down = distance_to_segment_sq(px, py, t_down, Ax, Ay);
-        else
-            error_down = last_error;
+    for (i = 0; i <= BEZIER_FIT_NEWTON_STEPS; ++i)
+    {
+        double x = ((Ax[3] * t + Ax[2]) * t + Ax[1]) * t + Ax[0];
+        double y = ((Ay[3] * t + Ay[2]) * t + Ay[1]) * t + Ay[0];
+        double dist_sq = (x - px) * (x - px) + (y - py) * (y - py);
 
-        if (error_up < last_error)
+        if (best < 0 || dist_sq < best)
         {
-            last_error = error_up;
-            t = t_up;
-        }
-        else if (error_down < last_error)
-        {
-            last_error = error_down;
-            t = t_down;
+            /* Derivatives of the squared distance (halved) with respect to t */
+            double x1 = (3 * Ax[3] * t + 2 * Ax[2]) * t + Ax[1];
+            double y1 = (3 * Ay[3] * t + 2 * Ay[2]) * t + Ay[1];
+            double x2 = 6 * Ax[3] * t + 2 * Ax[2];
+            double y2 = 6 * Ay[3] * t + 2 * Ay[2];
+            double d1 = (x - px) * x1 + (y - py) * y1;
+            double d2 = x1 * x1 + y1 * y1 + (x - px) * x2 + (y - py) * y2;
+
+            /*
+             * Far away from tight bends the squared distance isn't convex,
+             * in which case a Gauss-Newton step still heads downhill
+             */
+            if (d2 <= 0)
+                d2 = x1 * x1 + y1 * y1;
+            if (d2 <= 0)
+                break;
+
+            best = dist_sq;
+            t_best = t;
+            step = -d1 / d2;
         }
+        else
+            step /= 2; /* Overshot, try again closer to the best point */
 
-        t_step /= 2;
-    } while (t_step > 0);
+        t = t_best + step;
+        if (t < 0)
+            t = 0;
+        if (t > 1)
+            t = 1;
+    }
 
-    return last_error;
+    return best;
 }
 
 /* ------------------------------------------------------------------------- */
-static void calc_coeff(
-    qw*                         Ax,
-    qw*                         Ay,
+static void calc_control_points(
+    struct qwpos                p[4],
     const struct bezier_handle* head,
     const struct bezier_handle* tail,
     const struct qwpos          off)
 {
-    /* Calculate bezier control points */
-    const struct qwpos p0 =
+    p[0] =
         make_qwposqw(qw_sub(head->pos.x, off.x), qw_sub(head->pos.y, off.y));
-    const struct qwpos p3 =
+    p[3] =
         make_qwposqw(qw_sub(tail->pos.x, off.x), qw_sub(tail->pos.y, off.y));
-    const struct qwpos p1 = make_qwposqw(
-        qw_add(p0.x, qw_rescale(qa_cos(head->angle), head->len_backwards, 255)),
+    p[1] = make_qwposqw(
         qw_add(
-            p0.y, qw_rescale(qa_sin(head->angle), head->len_backwards, 255)));
-    const struct qwpos p2 = make_qwposqw(
-        qw_sub(p3.x, qw_rescale(qa_cos(tail->angle), tail->len_forwards, 255)),
-        qw_sub(p3.y, qw_rescale(qa_sin(tail->angle), tail->len_forwards, 255)));
+            p[0].x, qw_rescale(qa_cos(head->angle), head->len_backwards, 255)),
+        qw_add(
+            p[0].y, qw_rescale(qa_sin(head->angle), head->len_backwards, 255)));
+    p[2] = make_qwposqw(
+        qw_sub(
+            p[3].x, qw_rescale(qa_cos(tail->angle), tail->len_forwards, 255)),
+        qw_sub(
+            p[3].y, qw_rescale(qa_sin(tail->angle), tail->len_forwards, 255)));
+}
 
+/* ------------------------------------------------------------------------- */
+static void calc_coeff_from_points(
+    qw*                Ax,
+    qw*                Ay,
+    const struct qwpos p0,
+    const struct qwpos p1,
+    const struct qwpos p2,
+    const struct qwpos p3)
+{
     const qw _3x0 = 3 * p0.x;
     const qw _3x1 = 3 * p1.x;
     const qw _6x1 = 6 * p1.x;
@@ -118,18 +128,32 @@ static void calc_coeff(
 }
 
 /* ------------------------------------------------------------------------- */
-static struct qwpos bezier_xy(const qw Ax[4], const qw Ay[4], const qw t)
+static void calc_coeff(
+    qw*                         Ax,
+    qw*                         Ay,
+    const struct bezier_handle* head,
+    const struct bezier_handle* tail,
+    const struct qwpos          off)
 {
-    /* Calculate x,y position on curve */
-    const qw t2 = qw_mul(t, t);
-    const qw t3 = qw_mul(t, t2);
-    return make_qwposqw(
-        qw_add(
-            qw_add(qw_add(Ax[0], qw_mul(Ax[1], t)), qw_mul(Ax[2], t2)),
-            qw_mul(Ax[3], t3)),
-        qw_add(
-            qw_add(qw_add(Ay[0], qw_mul(Ay[1], t)), qw_mul(Ay[2], t2)),
-            qw_mul(Ay[3], t3)));
+    struct qwpos p[4];
+    calc_control_points(p, head, tail, off);
+    calc_coeff_from_points(Ax, Ay, p[0], p[1], p[2], p[3]);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Same as calc_coeff(), but t=0 is at the tail and t=1 is at the head.
+ */
+static void calc_coeff_reverse(
+    qw*                         Ax,
+    qw*                         Ay,
+    const struct bezier_handle* head,
+    const struct bezier_handle* tail,
+    const struct qwpos          off)
+{
+    struct qwpos p[4];
+    calc_control_points(p, head, tail, off);
+    calc_coeff_from_points(Ax, Ay, p[3], p[2], p[1], p[0]);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -259,20 +283,139 @@ void bezier_calc_aabb(
     bb->y2 = qw_add(bb->y2, head->pos.y);
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Builds a table of the length of the curve from t=0 up to
+ * t=i/BEZIER_ARC_LENGTH_STEPS. The points along the curve are stepped with
+ * forward differencing, so each entry only costs a few additions and a sqrt.
+ * \param[in] Ax, Ay Polynomial coefficients, relative to something close by.
+ */
+static void calc_arc_length_table(
+    double lut[BEZIER_ARC_LENGTH_STEPS + 1], const qw Ax[4], const qw Ay[4])
+{
+    int          i;
+    const double h = 1.0 / BEZIER_ARC_LENGTH_STEPS;
+    /* Squaring in qw loses everything on short segments, so use doubles */
+    double dx1 = Ax[1] * h + Ax[2] * h * h + Ax[3] * h * h * h;
+    double dx2 = 2 * Ax[2] * h * h + 6 * Ax[3] * h * h * h;
+    double dx3 = 6 * Ax[3] * h * h * h;
+    double dy1 = Ay[1] * h + Ay[2] * h * h + Ay[3] * h * h * h;
+    double dy2 = 2 * Ay[2] * h * h + 6 * Ay[3] * h * h * h;
+    double dy3 = 6 * Ay[3] * h * h * h;
+
+    lut[0] = 0;
+    for (i = 1; i <= BEZIER_ARC_LENGTH_STEPS; ++i)
+    {
+        lut[i] = lut[i - 1] + sqrt(dx1 * dx1 + dy1 * dy1);
+        dx1 += dx2;
+        dx2 += dx3;
+        dy1 += dy2;
+        dy2 += dy3;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Looks up t at a length along the curve, see calc_arc_length_table().
+ * \param[in] s Must be less than the length of the curve.
+ * \param[in,out] k Index into the table to start searching from. Set to the
+ * index that was found, so increasing lengths can continue from there.
+ */
+static double arc_length_to_t(const double* lut, double s, int* k)
+{
+    while (lut[*k + 1] <= s)
+        ++*k;
+    return (*k + (s - lut[*k]) / (lut[*k + 1] - lut[*k])) /
+           BEZIER_ARC_LENGTH_STEPS;
+}
+
+/* ------------------------------------------------------------------------- */
+qw bezier_calc_arc_length(
+    const struct bezier_handle* head, const struct bezier_handle* tail)
+{
+    qw     Ax[4], Ay[4];
+    double lut[BEZIER_ARC_LENGTH_STEPS + 1];
+
+    calc_coeff(Ax, Ay, head, tail, head->pos);
+    calc_arc_length_table(lut, Ax, Ay);
+
+    return (qw)lut[BEZIER_ARC_LENGTH_STEPS];
+}
+
+/* ------------------------------------------------------------------------- */
+static void fit_sums_add(
+    struct bezier_fit_sums* sums,
+    int64_t                 i,
+    const struct qwpos*     p0,
+    const struct qwpos*     p,
+    int                     sign)
+{
+    const int64_t dx = sign * (int64_t)qw_sub(p->x, p0->x);
+    const int64_t dy = sign * (int64_t)qw_sub(p->y, p0->y);
+    sums->x[0] += dx * i;
+    sums->x[1] += dx * i * i;
+    sums->x[2] += dx * i * i * i;
+    sums->y[0] += dy * i;
+    sums->y[1] += dy * i * i;
+    sums->y[2] += dy * i * i * i;
+}
+void bezier_fit_sums_init(
+    struct bezier_fit_sums* sums, const struct qwpos_vec* trail)
+{
+    int i;
+    memset(sums, 0, sizeof(*sums));
+    for (i = 1; i < vec_count(trail); ++i)
+        fit_sums_add(sums, i, vec_first(trail), vec_get(trail, i), 1);
+}
+void bezier_fit_sums_push(
+    struct bezier_fit_sums* sums, const struct qwpos_vec* trail)
+{
+    fit_sums_add(
+        sums, vec_count(trail) - 1, vec_first(trail), vec_last(trail), 1);
+}
+void bezier_fit_sums_pop(
+    struct bezier_fit_sums* sums, const struct qwpos_vec* trail)
+{
+    fit_sums_add(
+        sums, vec_count(trail) - 1, vec_first(trail), vec_last(trail), -1);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Calculates T[k] = sum((i/N)^k) for i=0..N and k=0..6, using
+ * Faulhaber's formulas.
+ */
+static void calc_power_sums(double T[7], int N)
+{
+    const double n = N;
+    T[0] = n + 1;
+    T[1] = (n + 1) / 2;
+    T[2] = n * (n + 1) * (2 * n + 1) / 6 / (n * n);
+    T[3] = T[1] * T[1] / n;
+    T[4] = n * (n + 1) * (2 * n + 1) * (3 * n * n + 3 * n - 1) / 30 /
+           (n * n * n * n);
+    T[5] = n * n * (n + 1) * (n + 1) * (2 * n * n + 2 * n - 1) / 12 /
+           (n * n * n * n * n);
+    T[6] = n * (n + 1) * (2 * n + 1) * (3 * n * n * n * n + 6 * n * n * n -
+                                        3 * n + 1) /
+           42 / (n * n * n * n * n * n);
+}
+
 /* ------------------------------------------------------------------------- */
 double bezier_fit_trail(
-    struct bezier_handle*   head,
-    struct bezier_handle*   tail,
-    const struct qwpos_vec* trail)
+    struct bezier_handle*         head,
+    struct bezier_handle*         tail,
+    const struct qwpos_vec*       trail,
+    const struct bezier_fit_sums* sums)
 {
-    int      i, m;
-    q16_16   T[2][2];
-    q16_16   T_inv[2][2];
-    q16_16   Ax[4], Ay[4];
-    q16_16   Cx[2], Cy[2];
-    uint64_t mse_error;
-    q16_16   det;
-    q16_16   mx, qx, my, qy; /* f(t) coefficients */
+    int    i, N;
+    double T[7];
+    double G[2][2];
+    double Bx[2], By[2];
+    double det;
+    q16_16 Ax[4], Ay[4];
+    q16_16 Cx[2], Cy[2];
+    q16_16 mx, qx, my, qy; /* f(t) coefficients */
 
     const struct qwpos* p0 = vec_first(trail); /* tail */
     const struct qwpos* pm = vec_last(trail);  /* head */
@@ -357,76 +500,32 @@ double bezier_fit_trail(
      *
      *   r(t) = (t-t0)(t-tm)
      *
-     * then the problem can be rewritten as:
-     *
-     *   (x - fx(t)) / r(t) = cx0 + cx1*t
-     *   (y - fy(t)) / r(t) = cy0 + cy1*t
-     *
-     * Notice, however, that r(t) has singularities at t0 and tm, and therefore,
-     * we must build the T matrix (see below) excluding those datapoints.
-     *
-     * The coefficients cx0..cx1 and cy0..cy1 can be independently estimated
-     * using ordinary least squares estimation. For a polynomial of the form
+     * and place the points at t = i/N, where N is the index of the last
+     * point, then cx0 and cx1 are the coefficients that minimize
      *
-     *   x(t) = c0 + c1*t + c2*t^2 + c3*t^3
+     *   sum((x - fx(t) - r(t)*cx0 - r(t)*t*cx1)^2)
      *
-     * rewritten in matrix form X = T*C + E
+     * and the same goes for the y dimension. Ordinary least squares estimation
+     * of the coefficients comes down to solving the normal equations G*C = B:
      *
-     *   [ x0 ]   [ 1  t0 ]          [ e0 ]
-     *   [ x1 ] = [ 1  t1 ] [ c0 ] + [ e1 ]
-     *   [ .. ]   [ .  .. ] [ c1 ]   [ e2 ]
-     *   [ xm ]   [ 1  tm ]          [ e3 ]
+     *   [ sum(r^2)    sum(r^2*t)   ] [ cx0 ]   [ sum((x - fx(t))*r)   ]
+     *   [ sum(r^2*t)  sum(r^2*t^2) ] [ cx1 ] = [ sum((x - fx(t))*r*t) ]
      *
-     * Least squares estimation of c0 and c1 can be computed with:
+     * With t0=0 and tm=1, r(t)^2*t^k = t^(k+4) - 2*t^(k+3) + t^(k+2), and the
+     * sum of (i/N)^k has a closed form, so G only depends on N. Similarly,
+     * fx(t) = x0 + (xm-x0)*t, so B only depends on the sums of i^k*(x - x0)
+     * for k=1..3, which are kept up to date by bezier_fit_sums_push() and
+     * bezier_fit_sums_pop(). This makes fitting O(1) no matter how many points
+     * the trail has.
      *
-     *   C = (T'*T)^-1 * T' * X
+     * The first and last points have r=0, so they don't contribute to either
+     * side and can be included in all of the sums.
      */
-
-    /*
-     * Calculate T'*T:
-     *
-     *                   [ 1   t0 ]
-     * [ 1   1  ... 1  ] [ 1   t1 ]
-     * [ t0  t1 ... tn ] [ ..  .. ]
-     *                   [ 1   tn ]
-     */
-    memset(T, 0, sizeof(T));
-    for (i = 1; i < vec_count(trail) - 1; ++i)
-    {
-        /* t = [0..1] */
-        q16_16 t = make_q16_16_2(i, vec_count(trail) - 1);
-        q16_16 t2 = q16_16_mul(t, t);
-
-        T[0][0] = q16_16_add(T[0][0], make_q16_16(1));
-        T[0][1] = q16_16_add(T[0][1], t);
-        T[1][0] = q16_16_add(T[1][0], t);
-        T[1][1] = q16_16_add(T[1][1], t2);
-    }
-
-    /*
-     * Calculate inverse (T'*T)^-1
-     *
-     *          -1       1
-     *   [ a b ]    = ------- [  d -b ]
-     *   [ c d ]      ad - bc [ -c  a ]
-     */
-    det =
-        q16_16_sub(q16_16_mul(T[0][0], T[1][1]), q16_16_mul(T[0][1], T[1][0]));
-    if (det == 0)
-    {
-        /*
-         * Usually means there are too many data points and we've exceeded the
-         * precision of q16.16. Kind of ugly but the best we can do is update
-         * the head position (hoping it still fits the data) and return an
-         * error estimate that will definitely cause a new segment to be created
-         */
-        head->pos = *pm;
-        return (1 << 30);
-    }
-    T_inv[0][0] = q16_16_div(T[1][1], det);
-    T_inv[0][1] = q16_16_div(-T[0][1], det);
-    T_inv[1][0] = q16_16_div(-T[1][0], det);
-    T_inv[1][1] = q16_16_div(T[0][0], det);
+    N = vec_count(trail) - 1;
+    calc_power_sums(T, N);
+    G[0][0] = T[4] - 2 * T[3] + T[2];
+    G[0][1] = T[5] - 2 * T[4] + T[3];
+    G[1][1] = T[6] - 2 * T[5] + T[4];
 
     /*
      * Calculate f(t) coefficients
@@ -442,40 +541,33 @@ double bezier_fit_trail(
     qy = qw_to_q16_16(p0->y);
 
     /*
-     * (T'*T)^-1 * T' * X = T_inv * T' * X
-     *
-     *   T' = [ 1   1  ... 1  ]
-     *        [ t0  t1 ... tn ]
+     * sum((x - fx(t))*r*t^k) = sum((x-x0)*(t^(k+2) - t^(k+1)))
+     *                        - (xm-x0) * sum(t^(k+3) - t^(k+2))
      */
-    memset(Cx, 0, sizeof(Cx));
-    memset(Cy, 0, sizeof(Cy));
-    for (i = 1; i < vec_count(trail) - 1; ++i)
-    {
-        /* t = [0..1] */
-        q16_16 t = make_q16_16_2(i, vec_count(trail) - 1);
-
-        /* r(t) = (t-t0)(t-tm) = (t-0)(t-1) = t(t-1) */
-        q16_16 tm = make_q16_16(1); /* tm = 1 (pass through last point) */
-        q16_16 r = q16_16_mul(t, q16_16_sub(t, tm));
-
-        /* f = m*t + q */
-        q16_16 fx = q16_16_add(q16_16_mul(mx, t), qx);
-        q16_16 fy = q16_16_add(q16_16_mul(my, t), qy);
-
-        /* X = (x - f) / r */
-        const struct qwpos* p = vec_get(trail, i);
-        q16_16 x = q16_16_div(q16_16_sub(qw_to_q16_16(p->x), fx), r);
-        q16_16 y = q16_16_div(q16_16_sub(qw_to_q16_16(p->y), fy), r);
-        for (m = 0; m != 2; ++m)
-        {
-            q16_16 c = q16_16_add(T_inv[m][0], q16_16_mul(T_inv[m][1], t));
-            q16_16 cx = q16_16_mul(c, x);
-            q16_16 cy = q16_16_mul(c, y);
+    Bx[0] = sums->x[1] / ((double)N * N) - sums->x[0] / (double)N -
+            qw_sub(pm->x, p0->x) * (T[3] - T[2]);
+    Bx[1] = sums->x[2] / ((double)N * N * N) - sums->x[1] / ((double)N * N) -
+            qw_sub(pm->x, p0->x) * (T[4] - T[3]);
+    By[0] = sums->y[1] / ((double)N * N) - sums->y[0] / (double)N -
+            qw_sub(pm->y, p0->y) * (T[3] - T[2]);
+    By[1] = sums->y[2] / ((double)N * N * N) - sums->y[1] / ((double)N * N) -
+            qw_sub(pm->y, p0->y) * (T[4] - T[3]);
 
-            Cx[m] = q16_16_add(Cx[m], cx);
-            Cy[m] = q16_16_add(Cy[m], cy);
-        }
-    }
+    /*
+     * Solve with the inverse of G
+     *
+     *          -1        1
+     *   [ a b ]    = -------- [  d -b ]
+     *   [ b d ]      ad - b^2 [ -b  a ]
+     *
+     * The trail has at least 5 points at this stage, so G is never singular.
+     * The solution is in qw units and needs to be converted to q16.16.
+     */
+    det = G[0][0] * G[1][1] - G[0][1] * G[0][1];
+    Cx[0] = qw_to_q16_16((G[1][1] * Bx[0] - G[0][1] * Bx[1]) / det);
+    Cx[1] = qw_to_q16_16((G[0][0] * Bx[1] - G[0][1] * Bx[0]) / det);
+    Cy[0] = qw_to_q16_16((G[1][1] * By[0] - G[0][1] * By[1]) / det);
+    Cy[1] = qw_to_q16_16((G[0][0] * By[1] - G[0][1] * By[0]) / det);
 
     /*
      * Convert fitted coefficients Cx and Cy to bezier handle coordinates
@@ -590,18 +682,43 @@ double bezier_fit_trail(
         Ay[3] = q16_16_add(q16_16_sub(q16_16_sub(_3y1, y0), _3y2), y3);
     }
 
-    /* Error estimation */
-    mse_error = 0;
-    for (i = 1; i < vec_count(trail) - 1; ++i)
+    /*
+     * Error estimation. Finding the closest point on the curve for every point
+     * of the trail would make this O(n) again, so only a fixed number of
+     * interior points spread evenly over the trail are measured. Their mean
+     * is scaled so the result is comparable to the sum over all interior
+     * points divided by N.
+     *
+     * The distances are in raw q16.16 units, i.e. squared they are scaled
+     * by 2^32.
+     */
     {
-        /* t = [0..1] */
-        q16_16 t = make_q16_16_2(i, vec_count(trail) - 1);
+        double fAx[4], fAy[4];
+        double mse_error = 0;
+        int    samples = N - 1 < BEZIER_FIT_ERROR_SAMPLES
+                             ? N - 1
+                             : BEZIER_FIT_ERROR_SAMPLES;
 
-        const struct qwpos* p = vec_get(trail, i);
-        mse_error += binary_search_min_dist_sq(p, Ax, Ay, t);
-    }
+        for (i = 0; i != 4; ++i)
+        {
+            fAx[i] = Ax[i];
+            fAy[i] = Ay[i];
+        }
+
+        for (i = 0; i != samples; ++i)
+        {
+            int                 idx = 1 + i * (N - 1) / samples;
+            const struct qwpos* p = vec_get(trail, idx);
+            mse_error += newton_min_dist_sq(
+                (double)qw_to_q16_16(p->x),
+                (double)qw_to_q16_16(p->y),
+                fAx,
+                fAy,
+                (double)idx / N);
+        }
 
-    return q16_16_div(mse_error, make_q16_16(vec_count(trail) - 1));
+        return mse_error / samples * (N - 1) / N;
+    }
 }
 
 /* ------------------------------------------------------------------------- */
@@ -616,6 +733,139 @@ void bezier_squeeze_n_recent_step(
 {
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Looks up the length of the curve at t, the inverse of
+ * arc_length_to_t().
+ * \param[out] k Set to the index of the table entry at or below t.
+ */
+static double t_to_arc_length(const double* lut, double t, int* k)
+{
+    const double i = t * BEZIER_ARC_LENGTH_STEPS;
+    *k = (int)i;
+    if (*k >= BEZIER_ARC_LENGTH_STEPS)
+        *k = BEZIER_ARC_LENGTH_STEPS - 1;
+    return lut[*k] + (i - *k) * (lut[*k + 1] - lut[*k]);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Places points along the curve, each one spacing away from the
+ * previous one, until the end of the curve is reached.
+ *
+ * An arc length table gives a first guess of t for each point. The distance
+ * along the curve is longer than the straight distance where the curve bends,
+ * so a few Newton steps then move the point until it is exactly spacing away
+ * from the previous one in a straight line.
+ * \param[in] Ax, Ay Polynomial coefficients, relative to off.
+ * \param[in] reverse Set if t=0 is at the tail, see calc_coeff_reverse().
+ * Tangents always point towards the head.
+ * \param[in,out] pos The previous point, relative to off. The first point is
+ * placed so it is spacing away from this position.
+ * \param[in,out] total_spacing The distance to each point is added to this.
+ * Stops early once it reaches snake_length.
+ * \return Returns 1 if snake_length was reached, 0 if the end of the curve was
+ * reached, or -1 if memory allocation failed.
+ */
+static int sample_curve(
+    struct bezier_point_vec** bezier_points,
+    const qw                  Ax[4],
+    const qw                  Ay[4],
+    struct qwpos              off,
+    int                       reverse,
+    struct qwpos*             pos,
+    qw                        spacing,
+    double*                   total_spacing,
+    qw                        snake_length)
+{
+    int          i, k;
+    double       lut[BEZIER_ARC_LENGTH_STEPS + 1];
+    double       s, t, t_min, end;
+    double       x, y, dx, dy;
+    double       px = pos->x, py = pos->y; /* Previous point, not rounded */
+    const double spacing_sq = (double)spacing * spacing;
+
+    calc_arc_length_table(lut, Ax, Ay);
+    end = lut[BEZIER_ARC_LENGTH_STEPS];
+
+    /*
+     * The previous point is usually on the previous curve. Assuming the
+     * distance to the start of this curve is short enough to be straight, the
+     * remaining spacing is used up on this curve.
+     */
+    {
+        const double ox = Ax[0] - px;
+        const double oy = Ay[0] - py;
+        const double d = sqrt(ox * ox + oy * oy);
+        s = d < spacing ? spacing - d : 0;
+    }
+
+    k = 0;
+    t_min = 0;
+    while (s < end)
+    {
+        double               len;
+        struct bezier_point* bp;
+
+        t = arc_length_to_t(lut, s, &k);
+        for (i = 0;; ++i)
+        {
+            x = ((Ax[3] * t + Ax[2]) * t + Ax[1]) * t + Ax[0];
+            y = ((Ay[3] * t + Ay[2]) * t + Ay[1]) * t + Ay[0];
+            dx = (3.0 * Ax[3] * t + 2.0 * Ax[2]) * t + Ax[1];
+            dy = (3.0 * Ay[3] * t + 2.0 * Ay[2]) * t + Ay[1];
+            if (i == BEZIER_SAMPLE_NEWTON_STEPS)
+                break;
+
+            /* Solve |p(t) - previous|^2 = spacing^2 */
+            {
+                const double ex = x - px;
+                const double ey = y - py;
+                const double g = ex * ex + ey * ey - spacing_sq;
+                const double dg = 2 * (ex * dx + ey * dy);
+                if (dg <= 0)
+                    break;
+                t -= g / dg;
+            }
+
+            /* Points can't go backwards, which also keeps the first point at
+             * t=0 if the previous curve ended more than spacing away */
+            if (t < t_min)
+                t = t_min;
+        }
+
+        /* t=1 means we'd be on the next curve */
+        if (t >= 1)
+            return 0;
+
+        bp = bezier_point_vec_emplace(bezier_points);
+        if (bp == NULL)
+            return -1;
+
+        /* Normalize the tangent vector */
+        len = sqrt(dx * dx + dy * dy);
+        if (len > 0)
+            len = (reverse ? 1 : -1) * make_qw(1) / len;
+        pos->x = (qw)floor(x + 0.5);
+        pos->y = (qw)floor(y + 0.5);
+        bp->pos.x = qw_add(pos->x, off.x);
+        bp->pos.y = qw_add(pos->y, off.y);
+        bp->dir.x = (qw)floor(dx * len + 0.5);
+        bp->dir.y = (qw)floor(dy * len + 0.5);
+
+        *total_spacing += sqrt((x - px) * (x - px) + (y - py) * (y - py));
+        if (*total_spacing >= snake_length)
+            return 1;
+
+        px = x;
+        py = y;
+        t_min = t;
+        s = t_to_arc_length(lut, t, &k) + spacing;
+    }
+
+    return 0;
+}
+
 /* ------------------------------------------------------------------------- */
 int bezier_calc_equidistant_points(
     struct bezier_point_vec**      bezier_points,
@@ -625,8 +875,7 @@ int bezier_calc_equidistant_points(
 {
     int i;
 
-    const qw spacing_sq = qw_mul(spacing, spacing);
-    qw       total_spacing = 0;
+    double total_spacing = 0;
 
     /*
      * Initial x,y positions
@@ -653,67 +902,59 @@ int bezier_calc_equidistant_points(
         const struct bezier_handle* head = rb_peek(bezier_handles, i + 1);
         const struct bezier_handle* tail = rb_peek(bezier_handles, i + 0);
 
-        qw t = make_qw(0); /* Begin search at head of curve */
-        qw last_t = make_qw(0);
-
         qw Ax[4], Ay[4];
         calc_coeff(Ax, Ay, head, tail, off);
 
-        while (1)
+        switch (sample_curve(
+            bezier_points,
+            Ax,
+            Ay,
+            off,
+            0,
+            &pos,
+            spacing,
+            &total_spacing,
+            snake_length))
         {
-            qw t_step = make_qw2(1, 2);
-            while (1)
-            {
-                /* Calculate x,y position on curve */
-                const struct qwpos next = bezier_xy(Ax, Ay, t);
-
-                /* Check distance to previous calculated position */
-                const qw dx = qw_sub(pos.x, next.x);
-                const qw dy = qw_sub(pos.y, next.y);
-                const qw dist_sq = qw_add(qw_mul(dx, dx), qw_mul(dy, dy));
-                if (dist_sq > spacing_sq)
-                    t = qw_sub(t, t_step);
-                else
-                    t = qw_add(t, t_step);
-
-                if (t >= make_qw(1))
-                    t = make_qw(1) -
-                        1; /* t=1 means we'd be on the next curve segment */
-                if (t < last_t)
-                    t = last_t;
-
-                t_step /= 2;
-                if (t_step == 0)
-                {
-                    const qw             t2 = qw_mul(t, t);
-                    struct bezier_point* bp;
-                    if (t == make_qw(1) - 1)
-                        goto next_segment;
-
-                    /* Insert new point and calculate tangent vector */
-                    bp = bezier_point_vec_emplace(bezier_points);
-                    bp->pos.x = qw_add(next.x, off.x);
-                    bp->pos.y = qw_add(next.y, off.y);
-                    bp->dir.x = -qw_add(
-                        qw_add(Ax[1], qw_mul(make_qw(2), qw_mul(Ax[2], t))),
-                        qw_mul(make_qw(3), qw_mul(Ax[3], t2)));
-                    bp->dir.y = -qw_add(
-                        qw_add(Ay[1], qw_mul(make_qw(2), qw_mul(Ay[2], t))),
-                        qw_mul(make_qw(3), qw_mul(Ay[3], t2)));
-                    bp->dir = qwpos_normalize(bp->dir);
-
-                    total_spacing = qw_add(total_spacing, qw_sqrt(dist_sq));
-                    if (total_spacing >= snake_length)
-                        return i;
-
-                    pos = next;
-                    break;
-                }
-            }
-            last_t = t;
+            case 1: return i;
+            case 0: break;
+            default: return 0;
         }
-    next_segment:;
     }
 
     return 0;
 }
+
+/* ------------------------------------------------------------------------- */
+int bezier_sample_segment(
+    struct bezier_point_vec**   bezier_points,
+    const struct bezier_handle* head,
+    const struct bezier_handle* tail,
+    struct qwpos*               pos,
+    qw                          spacing)
+{
+    qw           Ax[4], Ay[4];
+    double       total_spacing = 0;
+    struct qwpos off = tail->pos;
+    struct qwpos local_pos =
+        make_qwposqw(qw_sub(pos->x, off.x), qw_sub(pos->y, off.y));
+    int          count = vec_count(*bezier_points);
+
+    calc_coeff_reverse(Ax, Ay, head, tail, off);
+    if (sample_curve(
+            bezier_points,
+            Ax,
+            Ay,
+            off,
+            1,
+            &local_pos,
+            spacing,
+            &total_spacing,
+            (qw)0x7FFFFFFF) < 0)
+        return -1;
+
+    if (vec_count(*bezier_points) > count)
+        *pos = vec_last(*bezier_points)->pos;
+
+    return 0;
+}
@@ -0,0 +1,3 @@
+#include "clither/bezier_pending_acks_bmap.h"
+
+BMAP_DEFINE(bezier_pending_acks_bmap, uint16_t, uint16_t, 16)
@@ -1,3 +0,0 @@
-#include "clither/bezier_pending_acks_bset.h"
-
-BSET_DEFINE(bezier_pending_acks_bset, int32_t, 32)
@@ -0,0 +1,300 @@
+#include "clither/args.h"
+#include "clither/bots.h"
+#include "clither/cli_colors.h"
+#include "clither/client.h"
+#include "clither/cmd.h"
+#include "clither/log.h"
+#include "clither/mem.h"
+#include "clither/msg.h"
+#include "clither/signals.h"
+#include "clither/snake.h"
+#include "clither/snake_bmap.h"
+#include "clither/tick.h"
+#include "clither/world.h"
+#include <math.h>   /* M_PI */
+#include <stdio.h>  /* sprintf */
+#include <stdlib.h> /* rand */
+#include <string.h> /* memset */
+
+#define REPORT_INTERVAL_SEC 5
+
+struct bot
+{
+    struct client client;
+    struct world  world;
+    struct cmd    cmd;
+    uint64_t      connect_time;
+    uint64_t      join_latency; /* 0 until joined */
+    float         angle;
+    int           frames_until_turn;
+};
+
+struct bot_stats
+{
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t join_latency_sum;
+    uint64_t join_latency_max;
+    int      joined;
+    int      connected;
+    int      rollbacks;
+};
+
+/* ------------------------------------------------------------------------- */
+static int bot_step(struct bot* bot)
+{
+    int           stale_segments;
+    struct snake* snake =
+        snake_bmap_find(bot->world.snakes, bot->client.snake_id);
+
+    /* Random walk: Hold a direction for a random amount of time, then pick a
+     * new one close to the previous */
+    if (--bot->frames_until_turn <= 0)
+    {
+        bot->angle += (float)((rand() % 361 - 180) * M_PI / 360.0);
+        bot->frames_until_turn = bot->client.sim_tick_rate / 2 +
+                                 rand() % (bot->client.sim_tick_rate * 2);
+    }
+    bot->cmd = cmd_make(bot->cmd, bot->angle, 1.0f, CMD_ACTION_NONE);
+
+    cmd_queue_put(&snake->cmdq, bot->cmd, bot->client.frame_number);
+    stale_segments = snake_step(
+        &snake->data,
+        &snake->head,
+        &snake->param,
+        bot->cmd,
+        bot->client.sim_tick_rate);
+    if (stale_segments < 0)
+        return -1;
+    snake_remove_stale_segments_with_rollback_constraint(
+        &snake->data, &snake->head_ack, stale_segments);
+    world_step(
+        &bot->world, bot->client.frame_number, bot->client.sim_tick_rate);
+
+    bot->client.frame_number++;
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static void gather_stats(
+    struct bot_stats* stats, const struct bot* bots, int bot_count)
+{
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i != bot_count; ++i)
+    {
+        const struct bot* bot = &bots[i];
+        stats->bytes_sent += bot->client.bytes_sent;
+        stats->bytes_received += bot->client.bytes_received;
+        stats->rollbacks += bot->client.rollbacks;
+        if (bot->client.state == CLIENT_CONNECTED)
+            stats->connected++;
+        if (bot->join_latency > 0)
+        {
+            stats->joined++;
+            stats->join_latency_sum += bot->join_latency;
+            if (stats->join_latency_max < bot->join_latency)
+                stats->join_latency_max = bot->join_latency;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static void report_stats(
+    const struct bot_stats* now,
+    const struct bot_stats* prev,
+    int                     bot_count,
+    double                  seconds)
+{
+    log_info(
+        "%d/%d bots connected, join latency avg %.1f ms max %.1f ms, "
+        "%d rollbacks, %.1f KiB/s in, %.1f KiB/s out\n",
+        now->connected,
+        bot_count,
+        now->joined ? now->join_latency_sum / now->joined / 1e6 : 0.0,
+        now->join_latency_max / 1e6,
+        now->rollbacks - prev->rollbacks,
+        (now->bytes_received - prev->bytes_received) / 1024.0 / seconds,
+        (now->bytes_sent - prev->bytes_sent) / 1024.0 / seconds);
+}
+
+/* ------------------------------------------------------------------------- */
+void* bots_run(const struct args* a)
+{
+    struct bot*      bots;
+    struct bot_stats stats, prev_stats;
+    struct tick      sim_tick;
+    struct tick      net_tick;
+    uint64_t         report_time;
+    int              i, bot_count = 0;
+
+    log_set_prefix("Bots: ");
+    log_set_colors(COL_B_YELLOW, COL_RESET);
+
+    bots = mem_alloc((int)sizeof(struct bot) * a->bot_count);
+    if (bots == NULL)
+    {
+        log_oom((int)sizeof(struct bot) * a->bot_count, "bots_run()");
+        goto alloc_bots_failed;
+    }
+
+    srand((unsigned)tick_now());
+    for (bot_count = 0; bot_count != a->bot_count; ++bot_count)
+    {
+        char        username[16];
+        struct bot* bot = &bots[bot_count];
+
+        client_init(&bot->client);
+        world_init(&bot->world);
+        bot->cmd = cmd_default();
+        bot->join_latency = 0;
+        bot->angle = (float)(rand() % 360 * M_PI / 180.0);
+        bot->frames_until_turn = 0;
+
+        sprintf(username, "bot%d", bot_count);
+        bot->connect_time = tick_now();
+        if (client_connect(&bot->client, a->ip, a->port, username) < 0)
+        {
+            world_deinit(&bot->world);
+            client_deinit(&bot->client);
+            goto connect_bots_failed;
+        }
+    }
+    log_info("Connecting %d bots\n", bot_count);
+
+    memset(&prev_stats, 0, sizeof(prev_stats));
+    report_time = tick_now();
+    tick_cfg(&sim_tick, bots[0].client.sim_tick_rate);
+    tick_cfg(&net_tick, bots[0].client.net_tick_rate);
+    while (signals_exit_requested() == 0)
+    {
+        int net_update = tick_advance(&net_tick);
+        for (i = 0; i != bot_count; ++i)
+        {
+            struct bot* bot = &bots[i];
+            int         steps;
+            if (bot->client.state == CLIENT_DISCONNECTED)
+                continue;
+
+            /*
+             * All bots share one sim tick, so instead of stretching the tick
+             * interval by a tenth of a frame per warp (see tick_wait_warp()),
+             * skip or double up one whole frame every 10 warps.
+             */
+            steps = 1;
+            if (bot->client.warp > 0)
+            {
+                bot->client.warp--;
+                if (bot->client.warp % 10 == 0)
+                    steps = 0;
+            }
+            if (bot->client.warp < 0)
+            {
+                bot->client.warp++;
+                if (bot->client.warp % 10 == 0)
+                    steps = 2;
+            }
+
+            if (net_update)
+            {
+                struct client_recv_result result =
+                    client_recv(&bot->client, &bot->world);
+                if (result.error)
+                {
+                    log_err("Bot %d: Failed to receive data\n", i);
+                    client_disconnect(&bot->client);
+                    continue;
+                }
+                if (result.tick_rated_changed)
+                {
+                    /* All bots are connected to the same server, so they
+                     * all end up with the same tick rates */
+                    tick_cfg(&sim_tick, bot->client.sim_tick_rate);
+                    tick_cfg(&net_tick, bot->client.net_tick_rate);
+                }
+                if (bot->client.state == CLIENT_CONNECTED &&
+                    bot->join_latency == 0)
+                {
+                    bot->join_latency = tick_now() - bot->connect_time;
+                }
+            }
+
+            if (bot->client.state == CLIENT_CONNECTED)
+            {
+                for (; steps > 0; --steps)
+                    if (bot_step(bot) != 0)
+                        break;
+                if (steps > 0)
+                {
+                    log_err("Bot %d: Failed to step snake\n", i);
+                    client_disconnect(&bot->client);
+                    continue;
+                }
+                if (net_update)
+                {
+                    struct snake* snake = snake_bmap_find(
+                        bot->world.snakes, bot->client.snake_id);
+                    if (cmd_queue_count(&snake->cmdq) > 0)
+                        msg_commands(&bot->client.pending_msgs, &snake->cmdq);
+                }
+            }
+            else
+                bot->client.frame_number++;
+
+            if (net_update && bot->client.state != CLIENT_DISCONNECTED)
+            {
+                if (client_send_pending_data(&bot->client) < 0)
+                {
+                    log_err("Bot %d: Failed to send data\n", i);
+                    client_disconnect(&bot->client);
+                }
+            }
+        }
+
+        if (tick_now() - report_time >=
+            (uint64_t)REPORT_INTERVAL_SEC * 1000000000)
+        {
+            uint64_t now = tick_now();
+            gather_stats(&stats, bots, bot_count);
+            report_stats(
+                &stats, &prev_stats, bot_count, (now - report_time) / 1e9);
+            prev_stats = stats;
+            report_time = now;
+        }
+
+        if (tick_wait(&sim_tick) > bots[0].client.sim_tick_rate * 3)
+        {
+            log_warn("Bots are lagging more than 3 seconds behind\n");
+            tick_skip(&sim_tick);
+        }
+    }
+    log_info("Stopping bots\n");
+
+    gather_stats(&stats, bots, bot_count);
+    log_info(
+        "%d of %d bots joined, %d rollbacks in total\n",
+        stats.joined,
+        bot_count,
+        stats.rollbacks);
+
+connect_bots_failed:
+    for (i = 0; i != bot_count; ++i)
+    {
+        struct bot* bot = &bots[i];
+        if (bot->client.state != CLIENT_DISCONNECTED)
+        {
+            /* Send quit message to server to be nice */
+            client_queue(&bot->client, msg_leave());
+            client_send_pending_data(&bot->client);
+        }
+        world_deinit(&bot->world);
+        client_deinit(&bot->client);
+    }
+    mem_free(bots);
+alloc_bots_failed:
+    log_set_colors("", "");
+    log_set_prefix("");
+    return (void*)(intptr_t)(bot_count == a->bot_count ? 0 : -1);
+}
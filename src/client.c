@@ -1,22 +1,26 @@
+#include "clither/ack.h"
 #include "clither/args.h"
-#include "clither/camera.h"
 #include "clither/cli_colors.h"
 #include "clither/client.h"
-#include "clither/gfx.h"
-#include "clither/input.h"
 #include "clither/log.h"
 #include "clither/msg.h"
 #include "clither/msg_vec.h"
 #include "clither/net.h"
-#include "clither/resource_pack.h"
 #include "clither/signals.h"
 #include "clither/snake.h"
 #include "clither/snake_bmap.h"
 #include "clither/str.h"
 #include "clither/tick.h"
 #include "clither/world.h"
+#include <stdio.h>  /* sprintf */
 #include <string.h> /* memcpy */
-#if defined(CLITHER_MCD)
+#if defined(CLITHER_GFX)
+#    include "clither/camera.h"
+#    include "clither/gfx.h"
+#    include "clither/input.h"
+#    include "clither/resource_pack.h"
+#endif
+#if defined(CLITHER_GFX) && defined(CLITHER_MCD)
 #    include "clither/mcd_wifi.h"
 #    include "clither/thread.h"
 #endif
@@ -25,13 +29,19 @@
 void client_init(struct client* client)
 {
     client->username = NULL;
+    client->server_address = NULL;
     client->sim_tick_rate = 60;
     client->net_tick_rate = 20;
     client->timeout_counter = 0;
+    client->conn_id = 0;
     client->frame_number = 0;
     client->snake_id = 0;
     client->warp = 0;
+    client->redirects = 0;
     client->state = CLIENT_DISCONNECTED;
+    client->bytes_sent = 0;
+    client->bytes_received = 0;
+    client->rollbacks = 0;
 
     msg_vec_init(&client->pending_msgs);
     sockfd_vec_init(&client->udp_sockfds);
@@ -43,6 +53,7 @@ void client_deinit(struct client* client)
     if (client->state != CLIENT_DISCONNECTED)
         client_disconnect(client);
 
+    str_deinit(client->server_address);
     str_deinit(client->username);
     sockfd_vec_deinit(client->udp_sockfds);
     msg_vec_deinit(client->pending_msgs);
@@ -75,11 +86,17 @@ int client_connect(
 
     if (str_set_cstr(&client->username, username) != 0)
         return -1;
+    if (str_set_cstr(&client->server_address, server_address) != 0)
+        return -1;
     if (net_connect(&client->udp_sockfds, server_address, port) < 0)
         return -1;
 
+    ack_init(&client->ack);
+    client->conn_id = 0;
+    client->redirects = 0;
     client_queue(
-        client, msg_join_request(0x0000, client->frame_number, username));
+        client,
+        msg_join_request(0x0000, client->frame_number, username, NULL));
 
     client->state = CLIENT_JOINING;
 
@@ -98,6 +115,8 @@ void client_disconnect(struct client* client)
 
     str_deinit(client->username);
     client->username = NULL;
+    str_deinit(client->server_address);
+    client->server_address = NULL;
 
     vec_for_each (client->udp_sockfds, sockfd)
         net_close(*sockfd);
@@ -120,6 +139,7 @@ int client_queue(struct client* client, struct msg* m)
 struct append_msgs_ctx
 {
     uint16_t frame_number;
+    uint16_t seq;
     int      len;
     uint8_t  buf[NET_MAX_UDP_PACKET_SIZE];
 };
@@ -153,18 +173,8 @@ static int append_reliable_msgs_to_buf(struct msg** pmsg, void* user)
 
     if (ctx->len + msg->payload_len + 2 > NET_MAX_UDP_PACKET_SIZE)
         return VEC_RETAIN;
-    if (msg_is_unreliable(msg))
-        return VEC_RETAIN;
-
-    if (--msg->resend_period_counter > 0)
+    if (msg_is_unreliable(msg) || msg->in_flight)
         return VEC_RETAIN;
-    msg->resend_period_counter = msg->resend_period;
-    if (--msg->resend_retry_counter == 0)
-    {
-        return log_err(
-            "Server did not acknowledge reliable message: type=%d\n",
-            msg->type);
-    }
 
     /*
      * Some messages in the reliable queue contain the frame number they were
@@ -174,12 +184,13 @@ static int append_reliable_msgs_to_buf(struct msg** pmsg, void* user)
      */
     msg_update_frame_number(msg, ctx->frame_number);
 
+    ack_msg_sent(msg, ctx->seq);
     log_net(
-        "Packing msg type=%d, len=%d, resend=%d, retry=%d\n",
+        "Packing msg type=%d, len=%d, seq=%d, sends=%d\n",
         msg->type,
         msg->payload_len,
-        msg->resend_period,
-        msg->resend_retry_counter);
+        msg->seq,
+        msg->send_count);
 
     type = (uint8_t)msg->type;
     memcpy(ctx->buf + ctx->len + 0, &type, 1);
@@ -195,18 +206,28 @@ int client_send_pending_data(struct client* client)
 {
     struct append_msgs_ctx ctx;
 
+    /* Retire reliable messages the server received, and find out which ones
+     * have to be sent again */
+    if (ack_update_msgs(&client->ack, client->pending_msgs) != 0)
+        return -1;
+
     /* Append unreliable messages first before appending reliable */
-    ctx.len = 0;
+    ctx.len = MSG_CONN_ID_SIZE + ACK_HEADER_SIZE;
     ctx.frame_number = client->frame_number;
+    ctx.seq = client->ack.next_seq;
     msg_vec_retain(client->pending_msgs, append_unreliable_msgs_to_buf, &ctx);
-    if (msg_vec_retain(
-            client->pending_msgs, append_reliable_msgs_to_buf, &ctx) == -1)
-    {
-        return -1;
-    }
+    msg_vec_retain(client->pending_msgs, append_reliable_msgs_to_buf, &ctx);
 
-    if (ctx.len > 0)
+    /* Even if there is nothing to send, the server is waiting for our acks */
+    if (ctx.len > MSG_CONN_ID_SIZE + ACK_HEADER_SIZE ||
+        client->ack.ack_pending)
     {
+        int i;
+        for (i = 0; i != MSG_CONN_ID_SIZE; ++i)
+            ctx.buf[MSG_CONN_ID_SIZE - 1 - i] = (client->conn_id >> (8 * i)) &
+                                                0xFF;
+        ack_write_header(&client->ack, ctx.buf + MSG_CONN_ID_SIZE);
+
         /*
          * The client was initialized with a list of possible sockets. This is
          * because we can't know without first communicating with the server
@@ -226,6 +247,8 @@ int client_send_pending_data(struct client* client)
             goto retry_send;
         }
 
+        client->bytes_sent += ctx.len;
+
         /* We can't reset our timeout counter if we aren't sending data */
         client->timeout_counter++;
     }
@@ -240,6 +263,56 @@ int client_send_pending_data(struct client* client)
     return 0;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Reconnects to another server instance on the same host and sends it
+ * a new join request, as if client_connect() had been called with that port.
+ */
+static int follow_redirect(struct client* client, uint16_t port)
+{
+    struct sockfd_vec* sockfds;
+    struct msg**       msg;
+    int*               sockfd;
+    char               port_str[6];
+
+    if (client->redirects >= CLIENT_MAX_REDIRECTS)
+    {
+        log_err("Failed to join server: Redirected too often\n");
+        return -1;
+    }
+    client->redirects++;
+
+    sprintf(port_str, "%u", (unsigned)port);
+    log_info("Server is full, joining the instance on port %s\n", port_str);
+
+    /* Keep the old sockets until the new ones are connected, so the client
+     * can still be disconnected normally if this fails */
+    sockfd_vec_init(&sockfds);
+    if (net_connect(&sockfds, str_cstr(client->server_address), port_str) < 0)
+    {
+        sockfd_vec_deinit(sockfds);
+        return -1;
+    }
+
+    vec_for_each (client->udp_sockfds, sockfd)
+        net_close(*sockfd);
+    sockfd_vec_deinit(client->udp_sockfds);
+    client->udp_sockfds = sockfds;
+
+    /* Nothing that was sent to the previous instance carries over */
+    vec_for_each (client->pending_msgs, msg)
+        msg_free(*msg);
+    msg_vec_clear(client->pending_msgs);
+    ack_init(&client->ack);
+    client->conn_id = 0;
+    client->timeout_counter = 0;
+
+    return client_queue(
+        client,
+        msg_join_request(
+            0x0000, client->frame_number, str_cstr(client->username), NULL));
+}
+
 /* ------------------------------------------------------------------------- */
 static struct client_recv_result process_message(
     struct client* client,
@@ -263,6 +336,30 @@ static struct client_recv_result process_message(
 
         case MSG_JOIN_REQUEST: break;
 
+        case MSG_JOIN_CHALLENGE: {
+            if (client->state != CLIENT_JOINING)
+                return client_recv_ok();
+
+            /* Send the join request again, this time with the cookie. The
+             * old request doesn't need to be acked anymore. The challenge
+             * was sent without a connection, so its sequence number must
+             * not count as received either */
+            log_net("MSG_JOIN_CHALLENGE\n");
+            msg_vec_remove_type(client->pending_msgs, MSG_JOIN_REQUEST);
+            ack_init(&client->ack);
+            if (client_queue(
+                    client,
+                    msg_join_request(
+                        0x0000,
+                        client->frame_number,
+                        str_cstr(client->username),
+                        pp.join_challenge.cookie)) != 0)
+            {
+                return client_recv_error();
+            }
+            return client_recv_ok();
+        }
+
         case MSG_JOIN_ACCEPT: {
             uint16_t rtt;
 
@@ -314,6 +411,7 @@ static struct client_recv_result process_message(
                 5 * client->sim_tick_rate / client->net_tick_rate;
 
             client->snake_id = pp.join_accept.snake_id;
+            client->conn_id = pp.join_accept.conn_id;
             if (world_create_snake(
                     world,
                     client->snake_id,
@@ -352,6 +450,18 @@ static struct client_recv_result process_message(
             return client_recv_disconnected();
         }
 
+        case MSG_JOIN_REDIRECT: {
+            if (client->state != CLIENT_JOINING)
+                return client_recv_ok();
+
+            if (follow_redirect(client, pp.join_redirect.port) != 0)
+            {
+                client_disconnect(client);
+                return client_recv_disconnected();
+            }
+            return client_recv_ok();
+        }
+
         case MSG_LEAVE:
         case MSG_COMMANDS: break;
 
@@ -362,9 +472,10 @@ static struct client_recv_result process_message(
         }
 
         case MSG_SNAKE_HEAD: {
+            int           rollback;
             struct snake* snake =
                 snake_bmap_find(world->snakes, client->snake_id);
-            snake_ack_frame(
+            rollback = snake_ack_frame(
                 &snake->data,
                 &snake->head_ack,
                 &snake->head,
@@ -373,6 +484,9 @@ static struct client_recv_result process_message(
                 &snake->cmdq,
                 pp.snake_head.frame_number,
                 client->sim_tick_rate);
+            if (rollback < 0)
+                return client_recv_error();
+            client->rollbacks += rollback;
             return client_recv_ok();
         }
 
@@ -390,6 +504,23 @@ static struct client_recv_result process_message(
             return client_recv_ok();
         }
 
+        case MSG_SNAKE_BEZIER_BATCH: {
+            struct snake* snake =
+                snake_bmap_find(world->snakes, pp.snake_bezier_batch.snake_id);
+            if (snake == NULL)
+            {
+                snake = world_create_snake(
+                    world,
+                    pp.snake_bezier_batch.snake_id,
+                    make_qwposi(0, 0),
+                    "");
+                if (snake == NULL)
+                    return client_recv_error();
+            }
+
+            return client_recv_ok();
+        }
+
         case MSG_SNAKE_BEZIER_ACK: break;
     }
 
@@ -405,13 +536,22 @@ static struct client_recv_result unpack_packet(
     int                       i;
     struct client_recv_result result = client_recv_ok();
 
+    switch (ack_read_header(&client->ack, packet->data, packet->len))
+    {
+        case 1: break;
+        case 0: log_net("Dropping duplicate packet\n"); return result;
+        default:
+            log_warn("Received packet without a header from server\n");
+            return result;
+    }
+
     /*
-     * Packet can contain multiple message objects.
+     * Packet can contain multiple message objects after the header.
      * buf[0] == message type
      * buf[1] == message payload length
      * buf[2] == beginning of message payload
      */
-    for (i = 0; i < packet->len - 1;)
+    for (i = ACK_HEADER_SIZE; i < packet->len - 1;)
     {
         enum msg_type  msg_type = packet->data[i + 0];
         uint8_t        msg_len = packet->data[i + 1];
@@ -466,6 +606,7 @@ retry_recv:
 
     /* Don't let client time out */
     client->timeout_counter = 0;
+    client->bytes_received += packet.len;
 
     log_net("Received UDP packet, size=%d\n", packet.len);
     return unpack_packet(client, world, &packet);
@@ -640,6 +781,7 @@ void* client_run(const struct args* a)
         /* sim_update */
         if (client.state == CLIENT_CONNECTED)
         {
+            int           stale_segments;
             struct snake* snake =
                 snake_bmap_find(world.snakes, client.snake_id);
 
@@ -667,15 +809,16 @@ void* client_run(const struct args* a)
                    &snake->param,
                    snake->param.upgrades,
                    snake->param.food_eaten + 1);*/
-            snake_remove_stale_segments_with_rollback_constraint(
+            stale_segments = snake_step(
                 &snake->data,
-                &snake->head_ack,
-                snake_step(
-                    &snake->data,
-                    &snake->head,
-                    &snake->param,
-                    cmd,
-                    client.sim_tick_rate));
+                &snake->head,
+                &snake->param,
+                cmd,
+                client.sim_tick_rate);
+            if (stale_segments < 0)
+                break;
+            snake_remove_stale_segments_with_rollback_constraint(
+                &snake->data, &snake->head_ack, stale_segments);
 
             /* Update world */
             world_step(&world, client.frame_number, client.sim_tick_rate);
@@ -50,3 +50,77 @@ hash32_combine(hash32 lhs, hash32 rhs)
     lhs ^= rhs + 0x9e3779b9 + (lhs << 6) + (lhs >> 2);
     return lhs;
 }
+
+/* ------------------------------------------------------------------------- */
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static uint64_t
+u64_from_le(const uint8_t* p)
+{
+    return ((uint64_t)p[0] << 0) | ((uint64_t)p[1] << 8) |
+           ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static void
+sipround(uint64_t* v)
+{
+    v[0] += v[1];
+    v[1] = ROTL64(v[1], 13);
+    v[1] ^= v[0];
+    v[0] = ROTL64(v[0], 32);
+    v[2] += v[3];
+    v[3] = ROTL64(v[3], 16);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = ROTL64(v[3], 21);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = ROTL64(v[1], 17);
+    v[1] ^= v[2];
+    v[2] = ROTL64(v[2], 32);
+}
+
+uint64_t
+hash64_siphash24(const uint8_t* key, const void* data, int len)
+{
+    uint64_t       v[4], m;
+    const uint8_t* in = data;
+    const uint8_t* end = in + (len & ~7);
+    uint64_t       k0 = u64_from_le(key + 0);
+    uint64_t       k1 = u64_from_le(key + 8);
+    int            i;
+
+    /* "somepseudorandomlygeneratedbytes". 64-bit literals aren't C90 */
+    v[0] = k0 ^ (((uint64_t)0x736f6d65 << 32) | 0x70736575);
+    v[1] = k1 ^ (((uint64_t)0x646f7261 << 32) | 0x6e646f6d);
+    v[2] = k0 ^ (((uint64_t)0x6c796765 << 32) | 0x6e657261);
+    v[3] = k1 ^ (((uint64_t)0x74656462 << 32) | 0x79746573);
+
+    for (; in != end; in += 8)
+    {
+        m = u64_from_le(in);
+        v[3] ^= m;
+        sipround(v);
+        sipround(v);
+        v[0] ^= m;
+    }
+
+    /* The last block holds the remaining bytes and the length */
+    m = (uint64_t)(len & 0xFF) << 56;
+    for (i = 0; i != (len & 7); ++i)
+        m |= (uint64_t)in[i] << (8 * i);
+    v[3] ^= m;
+    sipround(v);
+    sipround(v);
+    v[0] ^= m;
+
+    v[2] ^= 0xFF;
+    sipround(v);
+    sipround(v);
+    sipround(v);
+    sipround(v);
+
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
@@ -0,0 +1,67 @@
+#include "clither/hash.h"
+#include "clither/join_cookie.h"
+#include "clither/net.h"
+#include "clither/system.h"
+#include <string.h> /* memcpy */
+
+/* ------------------------------------------------------------------------- */
+int join_cookie_init(struct join_cookie_secrets* s)
+{
+    if (system_random_bytes(s->current, JOIN_COOKIE_SECRET_SIZE) != 0)
+        return -1;
+    memcpy(s->previous, s->current, JOIN_COOKIE_SECRET_SIZE);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int join_cookie_rotate(struct join_cookie_secrets* s)
+{
+    memcpy(s->previous, s->current, JOIN_COOKIE_SECRET_SIZE);
+    return system_random_bytes(s->current, JOIN_COOKIE_SECRET_SIZE);
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+make_cookie(const uint8_t* secret, const struct net_addr* addr, uint8_t* cookie)
+{
+    int      i;
+    uint64_t h = hash64_siphash24(secret, addr->sockaddr_storage, addr->len);
+    for (i = 0; i != JOIN_COOKIE_SIZE; ++i)
+        cookie[i] = (uint8_t)(h >> (8 * i));
+}
+
+/* ------------------------------------------------------------------------- */
+void join_cookie_make(
+    const struct join_cookie_secrets* s,
+    const struct net_addr*            addr,
+    uint8_t*                          cookie)
+{
+    make_cookie(s->current, addr, cookie);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Takes the same time no matter where the first difference is */
+static int cookies_equal(const uint8_t* a, const uint8_t* b)
+{
+    int     i;
+    uint8_t diff = 0;
+    for (i = 0; i != JOIN_COOKIE_SIZE; ++i)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int join_cookie_check(
+    const struct join_cookie_secrets* s,
+    const struct net_addr*            addr,
+    const uint8_t*                    cookie)
+{
+    uint8_t expected[JOIN_COOKIE_SIZE];
+
+    make_cookie(s->current, addr, expected);
+    if (cookies_equal(expected, cookie))
+        return 1;
+
+    make_cookie(s->previous, addr, expected);
+    return cookies_equal(expected, cookie);
+}
@@ -1,6 +1,8 @@
 #include "clither/args.h"
+#include "clither/bots.h"
 #include "clither/client.h"
 #include "clither/log.h"
+#include "clither/msg.h"
 #include "clither/net.h"
 #include "clither/server.h"
 #include "clither/signals.h"
@@ -23,6 +25,7 @@ int main(int argc, char* argv[])
 
     /* Init threadlocal memory */
     mem_init_threadlocal();
+    msg_init_threadlocal();
 
     /*
      * Parse command line args before doing anything else. This function
@@ -92,6 +95,11 @@ int main(int argc, char* argv[])
             break;
         }
 #endif
+        case MODE_BOTS: {
+            /* Like client_run(), this runs in the main thread */
+            retval = (int)(intptr_t)bots_run(&args);
+            break;
+        }
 #if defined(CLITHER_GFX) && defined(CLITHER_SERVER)
         case MODE_CLIENT_AND_SERVER: {
             struct thread* server_thread;
@@ -128,6 +136,7 @@ int main(int argc, char* argv[])
     log_file_close();
 #endif
     signals_remove();
+    msg_deinit_threadlocal();
     (void)mem_deinit_threadlocal();
 
     return retval;
@@ -137,6 +146,7 @@ net_init_failed:
     log_file_close();
 #endif
     signals_remove();
+    msg_deinit_threadlocal();
     (void)mem_deinit_threadlocal();
     return -1;
 }
@@ -4,6 +4,7 @@
 #include "clither/hm.h"
 #include "clither/log.h"
 #include "clither/mem.h"
+#include "clither/mutex.h"
 #include <assert.h>
 #include <inttypes.h>
 #include <stdio.h>
@@ -285,23 +286,77 @@ struct report_info* report_hm_erase(struct report_hm* hm, uintptr_t key)
     return report_hm_kvs_get_value(&hm->kvs, -1 - slot);
 }
 
-struct state
+struct mem_state
 {
     struct report_hm* report;
-    int               allocations;
-    int               deallocations;
-    unsigned          ignore_malloc : 1;
+#if defined(CLITHER_SERVER)
+    struct mutex* lock; /* Only created once the state is shared */
+#endif
+    int      allocations;
+    int      deallocations;
+    unsigned ignore_malloc : 1;
 };
 
-static CLITHER_THREADLOCAL struct state state;
+static CLITHER_THREADLOCAL struct mem_state  local_state;
+static CLITHER_THREADLOCAL struct mem_state* adopted_state;
+
+/* ------------------------------------------------------------------------- */
+static struct mem_state* active_state(void)
+{
+    return adopted_state ? adopted_state : &local_state;
+}
+
+/* ------------------------------------------------------------------------- */
+static void lock_state(void)
+{
+#if defined(CLITHER_SERVER)
+    struct mem_state* s = active_state();
+    if (s->lock)
+        mutex_lock(s->lock);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+static void unlock_state(void)
+{
+#if defined(CLITHER_SERVER)
+    struct mem_state* s = active_state();
+    if (s->lock)
+        mutex_unlock(s->lock);
+#endif
+}
 
+/* ------------------------------------------------------------------------- */
 void mem_init_threadlocal(void)
 {
-    state.allocations = 0;
-    state.deallocations = 0;
+    local_state.allocations = 0;
+    local_state.deallocations = 0;
+#if defined(CLITHER_SERVER)
+    local_state.lock = NULL;
+#endif
+    adopted_state = NULL;
+
+    report_hm_init(&local_state.report);
+}
+
+#if defined(CLITHER_SERVER)
+/* ------------------------------------------------------------------------- */
+struct mem_state* mem_share_threadlocal(void)
+{
+    if (local_state.lock == NULL)
+        local_state.lock = mutex_create_recursive();
+    if (local_state.lock == NULL)
+        return NULL;
 
-    report_hm_init(&state.report);
+    return &local_state;
+}
+
+/* ------------------------------------------------------------------------- */
+void mem_adopt_threadlocal(struct mem_state* shared)
+{
+    adopted_state = shared;
 }
+#endif
 
 /* ------------------------------------------------------------------------- */
 #if defined(CLITHER_BACKTRACE)
@@ -310,7 +365,7 @@ static void print_backtrace(void)
     char** bt;
     int    bt_size, i;
 
-    if (state.ignore_malloc)
+    if (active_state()->ignore_malloc)
         return;
 
     if (!(bt = backtrace_get(&bt_size)))
@@ -334,8 +389,9 @@ static void print_backtrace(void)
 /* ------------------------------------------------------------------------- */
 static void track_allocation(uintptr_t addr, int size)
 {
+    struct mem_state*   s = active_state();
     struct report_info* info;
-    ++state.allocations;
+    ++s->allocations;
 
     if (size == 0)
     {
@@ -345,13 +401,13 @@ static void track_allocation(uintptr_t addr, int size)
 #endif
     }
 
-    if (state.ignore_malloc)
+    if (s->ignore_malloc)
         return;
 
     /* insert info into hashmap */
-    state.ignore_malloc = 1;
-    info = report_hm_emplace_new(&state.report, addr);
-    state.ignore_malloc = 0;
+    s->ignore_malloc = 1;
+    info = report_hm_emplace_new(&s->report, addr);
+    s->ignore_malloc = 0;
     if (info == NULL)
     {
         fprintf(
@@ -368,17 +424,18 @@ static void track_allocation(uintptr_t addr, int size)
 
     /* Create backtrace to this allocation */
 #if defined(CLITHER_BACKTRACE)
-    state.ignore_malloc = 1;
+    s->ignore_malloc = 1;
     if (!(info->backtrace = backtrace_get(&info->backtrace_size)))
         fprintf(stderr, "Failed to generate backtrace\n");
-    state.ignore_malloc = 0;
+    s->ignore_malloc = 0;
 #endif
 }
 
 static void track_deallocation(uintptr_t addr, const char* free_type)
 {
+    struct mem_state*   s = active_state();
     struct report_info* info;
-    state.deallocations++;
+    s->deallocations++;
 
     if (addr == 0)
     {
@@ -388,11 +445,11 @@ static void track_deallocation(uintptr_t addr, const char* free_type)
 #endif
     }
 
-    if (state.ignore_malloc)
+    if (s->ignore_malloc)
         return;
 
     /* find matching allocation and remove from hashmap */
-    info = report_hm_erase(state.report, addr);
+    info = report_hm_erase(s->report, addr);
     if (info)
     {
 #if defined(CLITHER_BACKTRACE)
@@ -415,17 +472,18 @@ static void track_deallocation(uintptr_t addr, const char* free_type)
 
 static void acquire(uintptr_t addr, int size)
 {
+    struct mem_state*   s = active_state();
     struct report_info* info;
 
     if (addr == 0)
         return;
 
-    ++state.allocations;
+    ++s->allocations;
 
     /* insert info into hashmap */
-    state.ignore_malloc = 1;
-    info = report_hm_emplace_new(&state.report, addr);
-    state.ignore_malloc = 0;
+    s->ignore_malloc = 1;
+    info = report_hm_emplace_new(&s->report, addr);
+    s->ignore_malloc = 0;
     if (info == NULL)
     {
         fprintf(
@@ -442,24 +500,25 @@ static void acquire(uintptr_t addr, int size)
 
     /* Create backtrace to this allocation */
 #if defined(CLITHER_BACKTRACE)
-    state.ignore_malloc = 1;
+    s->ignore_malloc = 1;
     if (!(info->backtrace = backtrace_get(&info->backtrace_size)))
         fprintf(stderr, "Failed to generate backtrace\n");
-    state.ignore_malloc = 0;
+    s->ignore_malloc = 0;
 #endif
 }
 
 static int release(uintptr_t addr)
 {
+    struct mem_state*   s = active_state();
     struct report_info* info;
 
     if (addr == 0)
         return 0;
 
-    state.deallocations++;
+    s->deallocations++;
 
     /* find matching allocation and remove from hashmap */
-    info = report_hm_erase(state.report, addr);
+    info = report_hm_erase(s->report, addr);
     if (info)
     {
 #if defined(CLITHER_BACKTRACE)
@@ -492,7 +551,9 @@ void* mem_alloc(int size)
         return NULL;
     }
 
+    lock_state();
     track_allocation((uintptr_t)p, size);
+    unlock_state();
     return p;
 }
 
@@ -511,9 +572,11 @@ void* mem_realloc(void* p, int new_size)
         return NULL;
     }
 
+    lock_state();
     if (old_addr)
         track_deallocation(old_addr, "realloc()");
     track_allocation((uintptr_t)p, new_size);
+    unlock_state();
 
     return p;
 }
@@ -521,7 +584,9 @@ void* mem_realloc(void* p, int new_size)
 /* ------------------------------------------------------------------------- */
 void mem_free(void* p)
 {
+    lock_state();
     track_deallocation((uintptr_t)p, "free()");
+    unlock_state();
     free(p);
 }
 
@@ -571,7 +636,18 @@ int mem_deinit_threadlocal(void)
     uintptr_t           addr;
     struct report_info* info;
     int32_t             slot;
-    hm_for_each (state.report, slot, addr, info)
+
+#if defined(CLITHER_SERVER)
+    /* The lock's memory is tracked too, so free it before reporting */
+    if (local_state.lock != NULL)
+    {
+        struct mutex* lock = local_state.lock;
+        local_state.lock = NULL;
+        mutex_destroy(lock);
+    }
+#endif
+
+    hm_for_each (local_state.report, slot, addr, info)
     {
         fprintf(
             stderr,
@@ -600,20 +676,24 @@ int mem_deinit_threadlocal(void)
 #endif
     }
 
-    state.ignore_malloc = 1;
-    report_hm_deinit(state.report);
-    state.ignore_malloc = 0;
+    local_state.ignore_malloc = 1;
+    report_hm_deinit(local_state.report);
+    local_state.ignore_malloc = 0;
 
     /* overall report */
     leaks =
-        (state.allocations > state.deallocations
-             ? state.allocations - state.deallocations
-             : state.deallocations - state.allocations);
+        (local_state.allocations > local_state.deallocations
+             ? local_state.allocations - local_state.deallocations
+             : local_state.deallocations - local_state.allocations);
     if (leaks)
     {
         fprintf(stderr, "Memory report:\n");
-        fprintf(stderr, "  allocations   : %" PRIu32 "\n", state.allocations);
-        fprintf(stderr, "  deallocations : %" PRIu32 "\n", state.deallocations);
+        fprintf(
+            stderr, "  allocations   : %" PRIu32 "\n", local_state.allocations);
+        fprintf(
+            stderr,
+            "  deallocations : %" PRIu32 "\n",
+            local_state.deallocations);
         fprintf(
             stderr,
             COL_B_RED "  memory leaks  : %" PRIu64 COL_RESET "\n",
@@ -625,20 +705,30 @@ int mem_deinit_threadlocal(void)
 
 void mem_track_allocation(void* p)
 {
+    lock_state();
     track_allocation((uintptr_t)p, 1);
+    unlock_state();
 }
 
 void mem_track_deallocation(void* p)
 {
+    lock_state();
     track_deallocation((uintptr_t)p, "track_deallocation()");
+    unlock_state();
 }
 
 void mem_own(void* p, int size)
 {
+    lock_state();
     acquire((uintptr_t)p, size);
+    unlock_state();
 }
 
 int mem_unown(void* p)
 {
-    return release((uintptr_t)p);
+    int size;
+    lock_state();
+    size = release((uintptr_t)p);
+    unlock_state();
+    return size;
 }
@@ -6,6 +6,7 @@
 #include "clither/mem.h"
 #include "clither/msg.h"
 #include "clither/msg_vec.h"
+#include "clither/net.h"
 #include "clither/snake.h"
 #include "clither/wrap.h"
 #include <assert.h>
@@ -15,26 +16,143 @@
 /* Because msg.payload is defined as uint8_t[1] */
 #define msg_size(extra_bytes) (offsetof(struct msg, payload) + (extra_bytes))
 
-#define alloc_msg(extra_bytes) mem_alloc(msg_size(extra_bytes))
+/* Number of messages allocated at once when a pool runs dry */
+#define MSG_SLAB_COUNT 64
+
+/*
+ * Payload capacity of each pool. A message is allocated from the smallest
+ * pool its payload fits into. Most messages the server sends every net tick
+ * (heads, acks, beziers) fit into the first class.
+ */
+static const int pool_capacities[MSG_POOL_COUNT] = {16, 64, 255};
+
+union msg_free_node
+{
+    union msg_free_node* next;
+    struct msg           msg;
+};
+
+struct msg_slab
+{
+    struct msg_slab* next;
+};
+
+struct msg_pool
+{
+    union msg_free_node* free;
+    struct msg_slab*     slabs;
+};
+
+struct msg_pools
+{
+    struct msg_pool pool[MSG_POOL_COUNT];
+    int             in_use;
+};
+
+static CLITHER_THREADLOCAL struct msg_pools pools;
+
+/* ------------------------------------------------------------------------- */
+static int pool_stride(int pool_idx)
+{
+    int size = (int)msg_size(pool_capacities[pool_idx]);
+    if (size < (int)sizeof(union msg_free_node))
+        size = (int)sizeof(union msg_free_node);
+    /* Round up so every block is aligned for a pointer */
+    return (size + (int)sizeof(void*) - 1) & ~((int)sizeof(void*) - 1);
+}
+
+/* ------------------------------------------------------------------------- */
+static int pool_grow(struct msg_pool* pool, int pool_idx)
+{
+    int              i;
+    char*            blocks;
+    struct msg_slab* slab;
+    const int        stride = pool_stride(pool_idx);
+    const int header = (int)(sizeof(struct msg_slab) + sizeof(void*) - 1) &
+                       ~((int)sizeof(void*) - 1);
+    const int slab_size = header + stride * MSG_SLAB_COUNT;
+
+    slab = mem_alloc(slab_size);
+    if (slab == NULL)
+        return log_oom(slab_size, "pool_grow()");
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    blocks = (char*)slab + header;
+    for (i = MSG_SLAB_COUNT - 1; i >= 0; --i)
+    {
+        union msg_free_node* node = (union msg_free_node*)(blocks + i * stride);
+        node->next = pool->free;
+        pool->free = node;
+    }
+
+    return 0;
+}
 
 /* ------------------------------------------------------------------------- */
-static struct msg* msg_alloc(enum msg_type type, int8_t resend_period, int size)
+void msg_init_threadlocal(void)
 {
-    struct msg* msg;
+    memset(&pools, 0, sizeof(pools));
+}
+
+/* ------------------------------------------------------------------------- */
+void msg_deinit_threadlocal(void)
+{
+    int i;
+
+    if (pools.in_use != 0)
+        log_warn(
+            "%d message(s) were not freed before the pools were destroyed\n",
+            pools.in_use);
+
+    for (i = 0; i != MSG_POOL_COUNT; ++i)
+    {
+        struct msg_pool* pool = &pools.pool[i];
+        while (pool->slabs != NULL)
+        {
+            struct msg_slab* next = pool->slabs->next;
+            mem_free(pool->slabs);
+            pool->slabs = next;
+        }
+        pool->free = NULL;
+    }
+    pools.in_use = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static struct msg* msg_alloc(enum msg_type type, char reliable, int size)
+{
+    struct msg*          msg;
+    struct msg_pool*     pool;
+    union msg_free_node* node;
+    int                  pool_idx;
     CLITHER_DEBUG_ASSERT(size <= 255); /* The payload length field is 1 byte */
 
     if (size < 0)
         size = 255;
 
-    msg = alloc_msg(255);
+    for (pool_idx = 0; pool_capacities[pool_idx] < size; ++pool_idx)
+    {
+    }
+    pool = &pools.pool[pool_idx];
+    if (pool->free == NULL)
+        if (pool_grow(pool, pool_idx) != 0)
+            return NULL;
+
+    node = pool->free;
+    pool->free = node->next;
+    pools.in_use++;
+
+    msg = &node->msg;
+    msg->pool = (uint8_t)pool_idx;
     msg->type = type;
     msg->payload_len = size;
 
-    msg->resend_period = resend_period;
-    /* Make sure to send it immediately first */
-    msg->resend_period_counter = 1;
-    /* How many times to retry before dropping the connection */
-    msg->resend_retry_counter = 10;
+    msg->reliable = reliable;
+    msg->in_flight = 0;
+    msg->send_count = 0;
+    msg->resend_timer = 0;
+    msg->seq = 0;
 
     return msg;
 }
@@ -42,7 +160,13 @@ static struct msg* msg_alloc(enum msg_type type, int8_t resend_period, int size)
 /* ------------------------------------------------------------------------- */
 void msg_free(struct msg* m)
 {
-    mem_free(m);
+    union msg_free_node* node = (union msg_free_node*)m;
+    struct msg_pool*     pool = &pools.pool[m->pool];
+    CLITHER_DEBUG_ASSERT(pools.in_use > 0);
+
+    node->next = pool->free;
+    pool->free = node;
+    pools.in_use--;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -59,10 +183,12 @@ void msg_update_frame_number(struct msg* m, uint16_t frame_number)
             m->payload[3] = frame_number & 0xFF;
             break;
 
+        case MSG_JOIN_CHALLENGE: break;
         case MSG_JOIN_ACCEPT: break;
         case MSG_JOIN_DENY_BAD_PROTOCOL: break;
         case MSG_JOIN_DENY_BAD_USERNAME: break;
         case MSG_JOIN_DENY_SERVER_FULL: break;
+        case MSG_JOIN_REDIRECT: break;
         case MSG_LEAVE: break;
 
         case MSG_COMMANDS: break;
@@ -71,6 +197,7 @@ void msg_update_frame_number(struct msg* m, uint16_t frame_number)
         case MSG_SNAKE_USERNAME: break;
         case MSG_SNAKE_USERNAME_ACK: break;
         case MSG_SNAKE_BEZIER: break;
+        case MSG_SNAKE_BEZIER_BATCH: break;
         case MSG_SNAKE_BEZIER_ACK: break;
         case MSG_SNAKE_DESTROY: break;
         case MSG_SNAKE_DESTROY_ACK: break;
@@ -85,6 +212,71 @@ void msg_update_frame_number(struct msg* m, uint16_t frame_number)
     }
 }
 
+/* ------------------------------------------------------------------------- */
+static uint32_t zigzag_encode(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (value < 0 ? 0xFFFFFFFFu : 0u);
+}
+static int32_t zigzag_decode(uint32_t value)
+{
+    return (int32_t)((value >> 1) ^ (0u - (value & 1)));
+}
+
+/* ------------------------------------------------------------------------- */
+static int varint_write(uint8_t* buf, int32_t value)
+{
+    int      len = 0;
+    uint32_t u = zigzag_encode(value);
+    while (u >= 0x80)
+    {
+        buf[len++] = (uint8_t)(u | 0x80);
+        u >>= 7;
+    }
+    buf[len++] = (uint8_t)u;
+    return len;
+}
+
+/*!
+ * \brief Reads a zigzag encoded varint starting at buf[*pos]. Returns -1 if
+ * it runs past the end of the buffer or is longer than 5 bytes.
+ */
+static int varint_read(
+    const uint8_t* buf, int len, int* pos, int32_t* value)
+{
+    uint32_t u = 0;
+    int      shift;
+    for (shift = 0; shift < 35; shift += 7)
+    {
+        if (*pos >= len)
+            return -1;
+        u |= (uint32_t)(buf[*pos] & 0x7F) << shift;
+        if ((buf[(*pos)++] & 0x80) == 0)
+        {
+            *value = zigzag_decode(u);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * Handle positions in a MSG_SNAKE_BEZIER_BATCH are stored relative to a
+ * linear extrapolation of the previous two handles. Segments of a snake tend
+ * to have similar lengths and directions, so this is usually close.
+ */
+static struct qwpos predict_handle_pos(
+    const struct bezier_handle* prev, const struct bezier_handle* prev_prev)
+{
+    struct qwpos predicted = prev->pos;
+    if (prev_prev != NULL)
+    {
+        predicted.x = 2 * prev->pos.x - prev_prev->pos.x;
+        predicted.y = 2 * prev->pos.y - prev_prev->pos.y;
+    }
+    return predicted;
+}
+
 /* ------------------------------------------------------------------------- */
 int msg_parse_payload(
     union parsed_payload* pp,
@@ -128,11 +320,31 @@ int msg_parse_payload(
                 log_warn("Name string is not properly null-terminated\n");
                 return -4;
             }
+
+            /* The cookie is optional and follows the name */
+            pp->join_request.cookie = NULL;
+            if (5 + pp->join_request.username_len + 1 + JOIN_COOKIE_SIZE <=
+                payload_len)
+            {
+                pp->join_request.cookie =
+                    &payload[5 + pp->join_request.username_len + 1];
+            }
+        }
+        break;
+
+        case MSG_JOIN_CHALLENGE: {
+            if (payload_len < JOIN_COOKIE_SIZE)
+            {
+                log_warn("MSG_JOIN_CHALLENGE payload is too small\n");
+                return -1;
+            }
+            pp->join_challenge.cookie = payload;
         }
         break;
 
         case MSG_JOIN_ACCEPT: {
-            if (payload_len < 14)
+            int i;
+            if (payload_len < 14 + MSG_CONN_ID_SIZE)
             {
                 log_warn("MSG_JOIN_ACCEPT payload is too small\n");
                 return -1;
@@ -157,6 +369,10 @@ int msg_parse_payload(
                      : 0) | /* Don't forget to sign extend 24-bit to 32-bit */
                 (payload[11] << 16) |
                 (payload[12] << 8) | (payload[13] << 0);
+            pp->join_accept.conn_id = 0;
+            for (i = 0; i != MSG_CONN_ID_SIZE; ++i)
+                pp->join_accept.conn_id =
+                    (pp->join_accept.conn_id << 8) | payload[14 + i];
         }
         break;
 
@@ -189,6 +405,22 @@ int msg_parse_payload(
             break;
         }
 
+        case MSG_JOIN_REDIRECT: {
+            if (payload_len < 2)
+            {
+                log_warn("MSG_JOIN_REDIRECT payload is too small\n");
+                return -1;
+            }
+
+            pp->join_redirect.port = (payload[0] << 8) | (payload[1] << 0);
+            if (pp->join_redirect.port == 0)
+            {
+                log_warn("MSG_JOIN_REDIRECT port is invalid\n");
+                return -2;
+            }
+            break;
+        }
+
         case MSG_LEAVE: break;
 
         case MSG_COMMANDS: {
@@ -264,6 +496,75 @@ int msg_parse_payload(
             break;
         }
 
+        case MSG_SNAKE_BEZIER_BATCH: {
+            int i, pos = 15;
+            if (payload_len < 15)
+            {
+                log_warn(
+                    "MSG_SNAKE_BEZIER_BATCH: Payload is too small (%d) < 15\n",
+                    payload_len);
+                return -1;
+            }
+
+            pp->snake_bezier_batch.snake_id =
+                (payload[0] << 8) | (payload[1] << 0);
+            pp->snake_bezier_batch.first_handle_id =
+                (payload[2] << 8) | (payload[3] << 0);
+            pp->snake_bezier_batch.count = payload[4];
+            if (pp->snake_bezier_batch.count == 0 ||
+                pp->snake_bezier_batch.count > MSG_SNAKE_BEZIER_BATCH_MAX)
+            {
+                log_warn(
+                    "MSG_SNAKE_BEZIER_BATCH: Invalid handle count %d\n",
+                    pp->snake_bezier_batch.count);
+                return -2;
+            }
+
+            {
+                struct bezier_handle* h = &pp->snake_bezier_batch.handles[0];
+                h->pos.x = (payload[5] & 0x80
+                                ? 0xFF << 24
+                                : 0) | /* Sign extend 24-bit to 32-bit */
+                           (payload[5] << 16) | (payload[6] << 8) |
+                           (payload[7] << 0);
+                h->pos.y = (payload[8] & 0x80
+                                ? 0xFF << 24
+                                : 0) | /* Sign extend 24-bit to 32-bit */
+                           (payload[8] << 16) | (payload[9] << 8) |
+                           (payload[10] << 0);
+                h->angle = (payload[11] << 8) | (payload[12] << 0);
+                h->len_backwards = payload[13];
+                h->len_forwards = payload[14];
+            }
+
+            for (i = 1; i != pp->snake_bezier_batch.count; ++i)
+            {
+                int32_t               dx, dy, da;
+                struct bezier_handle* h = &pp->snake_bezier_batch.handles[i];
+                const struct bezier_handle* prev = h - 1;
+                struct qwpos predicted =
+                    predict_handle_pos(prev, i > 1 ? h - 2 : NULL);
+
+                if (varint_read(payload, payload_len, &pos, &dx) != 0 ||
+                    varint_read(payload, payload_len, &pos, &dy) != 0 ||
+                    varint_read(payload, payload_len, &pos, &da) != 0 ||
+                    pos + 2 > payload_len)
+                {
+                    log_warn(
+                        "MSG_SNAKE_BEZIER_BATCH: Handle %d is truncated\n", i);
+                    return -3;
+                }
+
+                h->pos.x = predicted.x + dx;
+                h->pos.y = predicted.y + dy;
+                h->angle = (qa)(prev->angle + da);
+                h->len_backwards = payload[pos++];
+                h->len_forwards = payload[pos++];
+            }
+
+            break;
+        }
+
         case MSG_SNAKE_BEZIER_ACK: {
             if (payload_len < 2)
             {
@@ -319,24 +620,40 @@ int msg_parse_payload(
 
 /* ------------------------------------------------------------------------- */
 struct msg* msg_join_request(
-    uint16_t protocol_version, uint16_t frame_number, const char* username)
+    uint16_t       protocol_version,
+    uint16_t       frame_number,
+    const char*    username,
+    const uint8_t* cookie)
 {
+    /* Leave room for the cookie in the 255 byte payload */
     int     name_len_i32 = (int)strlen(username);
-    uint8_t name_len = name_len_i32 > 254 ? 254 : (uint8_t)name_len_i32;
+    uint8_t name_len = name_len_i32 > 254 - 5 - JOIN_COOKIE_SIZE
+                           ? 254 - 5 - JOIN_COOKIE_SIZE
+                           : (uint8_t)name_len_i32;
 
     struct msg* m = msg_alloc(
         MSG_JOIN_REQUEST,
         1,
         sizeof(protocol_version) + sizeof(frame_number) + sizeof(name_len) +
             name_len + 1 /* we need to include the null terminator */
-    );
+            + (cookie ? JOIN_COOKIE_SIZE : 0));
     m->payload[0] = protocol_version >> 8;
     m->payload[1] = protocol_version & 0xFF;
     m->payload[2] = frame_number >> 8;
     m->payload[3] = frame_number & 0xFF;
     m->payload[4] = name_len;
-    /* we need to include the null terminator */
-    memcpy(m->payload + 5, username, name_len + 1);
+    memcpy(m->payload + 5, username, name_len);
+    m->payload[5 + name_len] = '\0';
+    if (cookie)
+        memcpy(m->payload + 5 + name_len + 1, cookie, JOIN_COOKIE_SIZE);
+    return m;
+}
+
+/* ------------------------------------------------------------------------- */
+struct msg* msg_join_challenge(const uint8_t* cookie)
+{
+    struct msg* m = msg_alloc(MSG_JOIN_CHALLENGE, 0, JOIN_COOKIE_SIZE);
+    memcpy(m->payload, cookie, JOIN_COOKIE_SIZE);
     return m;
 }
 
@@ -347,15 +664,17 @@ struct msg* msg_join_accept(
     uint16_t      client_frame,
     uint16_t      server_frame,
     uint16_t      snake_id,
-    struct qwpos* spawn_pos)
+    struct qwpos* spawn_pos,
+    uint64_t      conn_id)
 {
+    int         i;
     struct msg* m = msg_alloc(
         MSG_JOIN_ACCEPT,
         0,
         sizeof(sim_tick_rate) + sizeof(net_tick_rate) + sizeof(client_frame) +
             sizeof(server_frame) + sizeof(snake_id) +
-            6 /* qwpos is 2x q10.14 (24 bits) = 48 bits */
-    );
+            6 /* qwpos is 2x q10.14 (24 bits) = 48 bits */ +
+            MSG_CONN_ID_SIZE);
 
     m->payload[0] = sim_tick_rate;
     m->payload[1] = net_tick_rate;
@@ -376,19 +695,22 @@ struct msg* msg_join_accept(
     m->payload[12] = spawn_pos->y >> 8;
     m->payload[13] = spawn_pos->y & 0xFF;
 
+    for (i = 0; i != MSG_CONN_ID_SIZE; ++i)
+        m->payload[13 + MSG_CONN_ID_SIZE - i] = (conn_id >> (8 * i)) & 0xFF;
+
     return m;
 }
 
 /* ------------------------------------------------------------------------- */
 static struct msg* msg_alloc_string_payload(
-    enum msg_type type, int8_t resend_period, const char* str)
+    enum msg_type type, char reliable, const char* str)
 {
     int     len_i32 = (int)strlen(str);
     uint8_t len = len_i32 > 254 ? 254 : (uint8_t)len_i32;
 
     struct msg* m = msg_alloc(
         type,
-        resend_period,
+        reliable,
         sizeof(len) + len + 1 /* we need to include the null terminator */
     );
     m->payload[0] = len;
@@ -415,6 +737,15 @@ struct msg* msg_join_deny_server_full(const char* error)
     return msg_alloc_string_payload(MSG_JOIN_DENY_SERVER_FULL, 0, error);
 }
 
+/* ------------------------------------------------------------------------- */
+struct msg* msg_join_redirect(uint16_t port)
+{
+    struct msg* m = msg_alloc(MSG_JOIN_REDIRECT, 0, sizeof(port));
+    m->payload[0] = port >> 8;
+    m->payload[1] = port & 0xFF;
+    return m;
+}
+
 /* ------------------------------------------------------------------------- */
 struct msg* msg_leave(void)
 {
@@ -717,30 +1048,30 @@ struct msg* msg_feedback(int8_t diff, uint16_t frame_number)
 }
 
 /* ------------------------------------------------------------------------- */
-struct msg* msg_snake_head(const struct snake_head* head, uint16_t frame_number)
+/*
+ * frame number (16-bit), world position (2x 24-bit qwpos), angle (16-bit),
+ * speed (uint8_t)
+ */
+#define SNAKE_HEAD_PAYLOAD_LEN (2 + 6 + 2 + 1)
+
+static void write_snake_head_payload(
+    uint8_t* payload, const struct snake_head* head, uint16_t frame_number)
 {
-    struct msg* m = msg_alloc(
-        MSG_SNAKE_HEAD,
-        0,
-        sizeof(frame_number) + 6 + /* world position (2x 24-bit qwpos) */
-            2 +                    /* angle (16-bit) */
-            1);                    /* speed (uint8_t) */
+    payload[0] = (frame_number >> 8) & 0xFF;
+    payload[1] = (frame_number & 0xFF);
 
-    m->payload[0] = (frame_number >> 8) & 0xFF;
-    m->payload[1] = (frame_number & 0xFF);
+    payload[2] = (head->pos.x >> 16) & 0xFF;
+    payload[3] = (head->pos.x >> 8) & 0xFF;
+    payload[4] = head->pos.x & 0xFF;
 
-    m->payload[2] = (head->pos.x >> 16) & 0xFF;
-    m->payload[3] = (head->pos.x >> 8) & 0xFF;
-    m->payload[4] = head->pos.x & 0xFF;
+    payload[5] = (head->pos.y >> 16) & 0xFF;
+    payload[6] = (head->pos.y >> 8) & 0xFF;
+    payload[7] = head->pos.y & 0xFF;
 
-    m->payload[5] = (head->pos.y >> 16) & 0xFF;
-    m->payload[6] = (head->pos.y >> 8) & 0xFF;
-    m->payload[7] = head->pos.y & 0xFF;
+    payload[8] = (head->angle >> 8) & 0xFF;
+    payload[9] = head->angle & 0xFF;
 
-    m->payload[8] = (head->angle >> 8) & 0xFF;
-    m->payload[9] = head->angle & 0xFF;
-
-    m->payload[10] = head->speed;
+    payload[10] = head->speed;
 
     log_net(
         "MSG_SNAKE_HEAD: pos=%d,%d, angle=%d, speed=%d, frame=%d\n",
@@ -749,10 +1080,33 @@ struct msg* msg_snake_head(const struct snake_head* head, uint16_t frame_number)
         head->angle,
         head->speed,
         frame_number);
+}
 
+/* ------------------------------------------------------------------------- */
+struct msg* msg_snake_head(const struct snake_head* head, uint16_t frame_number)
+{
+    struct msg* m = msg_alloc(MSG_SNAKE_HEAD, 0, SNAKE_HEAD_PAYLOAD_LEN);
+    write_snake_head_payload(m->payload, head, frame_number);
     return m;
 }
 
+/* ------------------------------------------------------------------------- */
+int msg_snake_head_write(
+    struct net_udp_packet*   pkt,
+    const struct snake_head* head,
+    uint16_t                 frame_number)
+{
+    if (pkt->len + SNAKE_HEAD_PAYLOAD_LEN + 2 > NET_MAX_UDP_PACKET_SIZE)
+        return 0;
+
+    pkt->data[pkt->len + 0] = MSG_SNAKE_HEAD;
+    pkt->data[pkt->len + 1] = SNAKE_HEAD_PAYLOAD_LEN;
+    write_snake_head_payload(pkt->data + pkt->len + 2, head, frame_number);
+    pkt->len += SNAKE_HEAD_PAYLOAD_LEN + 2;
+
+    return SNAKE_HEAD_PAYLOAD_LEN + 2;
+}
+
 /* ------------------------------------------------------------------------- */
 struct msg* msg_snake_bezier(
     uint16_t                    snake_id,
@@ -803,6 +1157,128 @@ struct msg* msg_snake_bezier(
     return m;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Encodes as many of the requested handles as fit into "capacity"
+ * bytes. Returns the payload length, or 0 if not even the first handle fits.
+ */
+static int write_snake_bezier_batch_payload(
+    uint8_t*                 payload,
+    int                      capacity,
+    uint16_t                 snake_id,
+    const struct snake_data* data,
+    int                      first,
+    int*                     count)
+{
+    int                         i, len;
+    uint16_t                    first_handle_id;
+    const struct bezier_handle* h;
+
+    CLITHER_DEBUG_ASSERT(*count > 0);
+    CLITHER_DEBUG_ASSERT(first + *count <= rb_count(data->bezier_handles));
+    if (*count > MSG_SNAKE_BEZIER_BATCH_MAX)
+        *count = MSG_SNAKE_BEZIER_BATCH_MAX;
+    if (capacity > 255)
+        capacity = 255;
+    if (capacity < 15)
+        return 0;
+
+    first_handle_id = snake_bezier_handle_id(data, first);
+    payload[0] = snake_id >> 8;
+    payload[1] = snake_id & 0xFF;
+    payload[2] = first_handle_id >> 8;
+    payload[3] = first_handle_id & 0xFF;
+
+    h = rb_peek(data->bezier_handles, first);
+    payload[5] = (h->pos.x >> 16) & 0xFF;
+    payload[6] = (h->pos.x >> 8) & 0xFF;
+    payload[7] = h->pos.x & 0xFF;
+    payload[8] = (h->pos.y >> 16) & 0xFF;
+    payload[9] = (h->pos.y >> 8) & 0xFF;
+    payload[10] = h->pos.y & 0xFF;
+    payload[11] = (h->angle >> 8) & 0xFF;
+    payload[12] = h->angle & 0xFF;
+    payload[13] = h->len_backwards;
+    payload[14] = h->len_forwards;
+    len = 15;
+
+    for (i = 1; i != *count; ++i)
+    {
+        /* Worst case is 3 varints of 5 bytes and two lengths */
+        uint8_t                     buf[17];
+        int                         buf_len;
+        const struct bezier_handle* prev;
+        struct qwpos                predicted;
+
+        h = rb_peek(data->bezier_handles, first + i);
+        prev = rb_peek(data->bezier_handles, first + i - 1);
+        predicted = predict_handle_pos(
+            prev, i > 1 ? rb_peek(data->bezier_handles, first + i - 2) : NULL);
+
+        buf_len = varint_write(buf, h->pos.x - predicted.x);
+        buf_len += varint_write(buf + buf_len, h->pos.y - predicted.y);
+        buf_len += varint_write(buf + buf_len, h->angle - prev->angle);
+        buf[buf_len++] = h->len_backwards;
+        buf[buf_len++] = h->len_forwards;
+
+        if (len + buf_len > capacity)
+            break;
+        memcpy(payload + len, buf, buf_len);
+        len += buf_len;
+    }
+
+    *count = i;
+    payload[4] = (uint8_t)i;
+
+    log_net(
+        "MSG_SNAKE_BEZIER_BATCH: snake=%d, first=%d, count=%d, len=%d\n",
+        snake_id,
+        first_handle_id,
+        i,
+        len);
+
+    return len;
+}
+
+/* ------------------------------------------------------------------------- */
+struct msg* msg_snake_bezier_batch(
+    uint16_t snake_id, const struct snake_data* data, int first, int* count)
+{
+    struct msg* m = msg_alloc(MSG_SNAKE_BEZIER_BATCH, 1, 255);
+    if (m == NULL)
+        return NULL;
+
+    m->payload_len = (uint8_t)write_snake_bezier_batch_payload(
+        m->payload, 255, snake_id, data, first, count);
+
+    return m;
+}
+
+/* ------------------------------------------------------------------------- */
+int msg_snake_bezier_batch_write(
+    struct net_udp_packet*   pkt,
+    int                      max_len,
+    uint16_t                 snake_id,
+    const struct snake_data* data,
+    int                      first,
+    int*                     count)
+{
+    int len;
+    if (max_len > NET_MAX_UDP_PACKET_SIZE - pkt->len)
+        max_len = NET_MAX_UDP_PACKET_SIZE - pkt->len;
+
+    len = write_snake_bezier_batch_payload(
+        pkt->data + pkt->len + 2, max_len - 2, snake_id, data, first, count);
+    if (len == 0)
+        return 0;
+
+    pkt->data[pkt->len + 0] = MSG_SNAKE_BEZIER_BATCH;
+    pkt->data[pkt->len + 1] = (uint8_t)len;
+    pkt->len += len + 2;
+
+    return len + 2;
+}
+
 /* ------------------------------------------------------------------------- */
 struct msg* msg_snake_bezier_ack(uint16_t bezier_handle_idx)
 {
@@ -819,7 +1295,7 @@ struct msg* msg_snake_bezier_ack(uint16_t bezier_handle_idx)
 /* ------------------------------------------------------------------------- */
 struct msg* msg_snake_destroy(uint16_t snake_id)
 {
-    struct msg* m = msg_alloc(MSG_SNAKE_DESTROY, 10, 2);
+    struct msg* m = msg_alloc(MSG_SNAKE_DESTROY, 1, 2);
     if (m == NULL)
         return NULL;
 
@@ -10,6 +10,11 @@ struct mutex
     pthread_mutex_t handle;
 };
 
+struct cond
+{
+    pthread_cond_t handle;
+};
+
 struct mutex*
 mutex_create(void)
 {
@@ -86,3 +91,44 @@ mutex_unlock(struct mutex* m)
     pthread_mutex_unlock(&m->handle);
 }
 
+
+struct cond*
+cond_create(void)
+{
+    struct cond* c = mem_alloc(sizeof(*c));
+    if (c == NULL)
+        return NULL;
+
+    if (pthread_cond_init(&c->handle, NULL) != 0)
+    {
+        mem_free(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+void
+cond_destroy(struct cond* c)
+{
+    pthread_cond_destroy(&c->handle);
+    mem_free(c);
+}
+
+void
+cond_wait(struct cond* c, struct mutex* m)
+{
+    pthread_cond_wait(&c->handle, &m->handle);
+}
+
+void
+cond_signal(struct cond* c)
+{
+    pthread_cond_signal(&c->handle);
+}
+
+void
+cond_broadcast(struct cond* c)
+{
+    pthread_cond_broadcast(&c->handle);
+}
@@ -9,6 +9,11 @@ struct mutex
     CRITICAL_SECTION handle;
 };
 
+struct cond
+{
+    CONDITION_VARIABLE handle;
+};
+
 struct mutex*
 mutex_create(void)
 {
@@ -50,3 +55,37 @@ mutex_unlock(struct mutex* m)
     LeaveCriticalSection(&m->handle);
 }
 
+
+struct cond*
+cond_create(void)
+{
+    struct cond* c = mem_alloc(sizeof *c);
+    if (c == NULL)
+        return NULL;
+    InitializeConditionVariable(&c->handle);
+    return c;
+}
+
+void
+cond_destroy(struct cond* c)
+{
+    mem_free(c);
+}
+
+void
+cond_wait(struct cond* c, struct mutex* m)
+{
+    SleepConditionVariableCS(&c->handle, &m->handle, INFINITE);
+}
+
+void
+cond_signal(struct cond* c)
+{
+    WakeConditionVariable(&c->handle);
+}
+
+void
+cond_broadcast(struct cond* c)
+{
+    WakeAllConditionVariable(&c->handle);
+}
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE /* recvmmsg(), sendmmsg() */
+
 #include "clither/log.h"
 #include "clither/mem.h"
 #include "clither/net.h"
@@ -9,8 +11,15 @@
 #include <netdb.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#   include <sys/epoll.h>
+#else
+#   include <poll.h>
+#endif
+
 VEC_DEFINE(sockfd_vec, int, 8)
 
 CLITHER_STATIC_ASSERT(sizeof(struct sockaddr_in) <= NET_MAX_ADDRLEN);
@@ -266,6 +275,71 @@ int net_sendto(
     return sendto(sockfd, buf, len, 0, sockaddr, addr->len);
 }
 
+/* ------------------------------------------------------------------------- */
+#if defined(__linux__)
+int net_sendto_many(
+    int                                 sockfd,
+    const struct net_udp_packet* const* pkts,
+    const struct net_addr* const*       addrs,
+    int                                 count)
+{
+    struct mmsghdr msgs[NET_BATCH_SIZE];
+    struct iovec   iovs[NET_BATCH_SIZE];
+    int            sent = 0;
+
+    while (sent < count)
+    {
+        int i, result;
+        int batch = count - sent;
+        if (batch > NET_BATCH_SIZE)
+            batch = NET_BATCH_SIZE;
+
+        memset(msgs, 0, sizeof(*msgs) * batch);
+        for (i = 0; i != batch; ++i)
+        {
+            iovs[i].iov_base = (void*)pkts[sent + i]->data;
+            iovs[i].iov_len = pkts[sent + i]->len;
+            msgs[i].msg_hdr.msg_name = (void*)addrs[sent + i]->sockaddr_storage;
+            msgs[i].msg_hdr.msg_namelen = addrs[sent + i]->len;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        result = sendmmsg(sockfd, msgs, batch, 0);
+        if (result < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            /* The first packet of the batch failed. Skip it so one bad
+             * address can't prevent everyone else from being served */
+            log_err("sendmmsg() failed: %s\n", strerror(errno));
+            count--;
+            pkts++;
+            addrs++;
+            continue;
+        }
+
+        sent += result;
+    }
+
+    return sent;
+}
+#else
+int net_sendto_many(
+    int                                 sockfd,
+    const struct net_udp_packet* const* pkts,
+    const struct net_addr* const*       addrs,
+    int                                 count)
+{
+    int i, sent = 0;
+    for (i = 0; i != count; ++i)
+        if (net_sendto(sockfd, pkts[i]->data, pkts[i]->len, addrs[i]) >= 0)
+            sent++;
+    return sent;
+}
+#endif
+
 /* ------------------------------------------------------------------------- */
 int net_send(int sockfd, const void* buf, int len)
 {
@@ -297,6 +371,64 @@ int net_recvfrom(int sockfd, void* buf, int capacity, struct net_addr* addr)
     return bytes_received;
 }
 
+/* ------------------------------------------------------------------------- */
+#if defined(__linux__)
+int net_recvfrom_many(
+    int sockfd, struct net_udp_packet* pkts, struct net_addr* addrs, int count)
+{
+    struct mmsghdr msgs[NET_BATCH_SIZE];
+    struct iovec   iovs[NET_BATCH_SIZE];
+    int            i, received;
+
+    if (count > NET_BATCH_SIZE)
+        count = NET_BATCH_SIZE;
+
+    memset(msgs, 0, sizeof(*msgs) * count);
+    for (i = 0; i != count; ++i)
+    {
+        iovs[i].iov_base = pkts[i].data;
+        iovs[i].iov_len = sizeof(pkts[i].data);
+        msgs[i].msg_hdr.msg_name = addrs[i].sockaddr_storage;
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i].sockaddr_storage);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    received = recvmmsg(sockfd, msgs, count, MSG_DONTWAIT, NULL);
+    if (received < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        log_err("recvmmsg() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i != received; ++i)
+    {
+        pkts[i].len = (int)msgs[i].msg_len;
+        addrs[i].len = (int)msgs[i].msg_hdr.msg_namelen;
+    }
+
+    return received;
+}
+#else
+int net_recvfrom_many(
+    int sockfd, struct net_udp_packet* pkts, struct net_addr* addrs, int count)
+{
+    int i;
+    for (i = 0; i != count; ++i)
+    {
+        pkts[i].len =
+            net_recvfrom(sockfd, pkts[i].data, sizeof(pkts[i].data), &addrs[i]);
+        if (pkts[i].len < 0)
+            return i > 0 ? i : -1;
+        if (pkts[i].len == 0)
+            break;
+    }
+    return i;
+}
+#endif
+
 /* ------------------------------------------------------------------------- */
 int net_recv(int sockfd, void* buf, int capacity)
 {
@@ -312,3 +444,84 @@ int net_recv(int sockfd, void* buf, int capacity)
 
     return bytes_received;
 }
+
+/* ------------------------------------------------------------------------- */
+#if defined(__linux__)
+int net_poll_create(int sockfd)
+{
+    struct epoll_event event;
+    int                epollfd = epoll_create1(0);
+    if (epollfd < 0)
+    {
+        log_err("epoll_create1() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = sockfd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event) != 0)
+    {
+        log_err("epoll_ctl() failed: %s\n", strerror(errno));
+        close(epollfd);
+        return -1;
+    }
+
+    return epollfd;
+}
+
+/* ------------------------------------------------------------------------- */
+void net_poll_destroy(int pollfd)
+{
+    close(pollfd);
+}
+
+/* ------------------------------------------------------------------------- */
+int net_poll_wait(int pollfd, int timeout_ms)
+{
+    struct epoll_event event;
+    int                result = epoll_wait(pollfd, &event, 1, timeout_ms);
+    if (result < 0)
+    {
+        if (errno == EINTR)
+            return 0;
+        log_err("epoll_wait() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return result > 0;
+}
+#else
+/* poll() doesn't need any state, so the socket itself is the handle */
+int net_poll_create(int sockfd)
+{
+    return sockfd;
+}
+
+/* ------------------------------------------------------------------------- */
+void net_poll_destroy(int pollfd)
+{
+    (void)pollfd;
+}
+
+/* ------------------------------------------------------------------------- */
+int net_poll_wait(int pollfd, int timeout_ms)
+{
+    struct pollfd pfd;
+    int           result;
+
+    pfd.fd = pollfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    result = poll(&pfd, 1, timeout_ms);
+    if (result < 0)
+    {
+        if (errno == EINTR)
+            return 0;
+        log_err("poll() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return result > 0;
+}
+#endif
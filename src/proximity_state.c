@@ -1,12 +1,14 @@
-#include "clither/bezier_pending_acks_bset.h"
+#include "clither/bezier_pending_acks_bmap.h"
 #include "clither/proximity_state.h"
 
 void proximity_state_init(struct proximity_state* ps)
 {
-    bezier_pending_acks_bset_init(&ps->bezier_pending_acks);
+    bezier_pending_acks_bmap_init(&ps->bezier_pending_acks);
+    ps->priority = 0;
+    ps->next_handle_id = 0;
 }
 
 void proximity_state_deinit(struct proximity_state* ps)
 {
-    bezier_pending_acks_bset_deinit(ps->bezier_pending_acks);
+    bezier_pending_acks_bmap_deinit(ps->bezier_pending_acks);
 }
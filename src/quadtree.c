@@ -1 +1,299 @@
+#include "clither/log.h"
+#include "clither/mem.h"
 #include "clither/quadtree.h"
+
+/* Index of the first node at the specified depth */
+#define LEVEL_OFFSET(depth) ((((int32_t)1 << (2 * (depth))) - 1) / 3)
+#define NODE_COUNT          LEVEL_OFFSET(QUADTREE_MAX_DEPTH + 1)
+
+VEC_DEFINE(quadtree_item_vec, struct quadtree_item, 32)
+
+struct node_ref
+{
+    int32_t cx, cy;
+    int     depth;
+};
+
+/* ------------------------------------------------------------------------- */
+static int32_t node_index(struct node_ref n)
+{
+    return LEVEL_OFFSET(n.depth) + (n.cy << n.depth) + n.cx;
+}
+
+/* ------------------------------------------------------------------------- */
+static struct node_ref node_ref_of(int32_t node)
+{
+    struct node_ref n;
+    int32_t         offset;
+    for (n.depth = 0; LEVEL_OFFSET(n.depth + 1) <= node; ++n.depth)
+    {
+    }
+    offset = node - LEVEL_OFFSET(n.depth);
+    n.cx = offset & ((1 << n.depth) - 1);
+    n.cy = offset >> n.depth;
+    return n;
+}
+
+/* ------------------------------------------------------------------------- */
+static void add_to_subtree_counts(struct quadtree* qt, int32_t node, int delta)
+{
+    struct node_ref n = node_ref_of(node);
+    while (1)
+    {
+        qt->counts[node_index(n)] += delta;
+        if (n.depth == 0)
+            break;
+        n.depth--;
+        n.cx >>= 1;
+        n.cy >>= 1;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static int aabbs_overlap(struct qwaabb a, struct qwaabb b)
+{
+    return a.x1 <= b.x2 && a.x2 >= b.x1 && a.y1 <= b.y2 && a.y2 >= b.y1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Finds the deepest node whose loose region is guaranteed to contain
+ * the bounding box. Since loose regions extend half a cell past each edge,
+ * this is the deepest level whose cell size is at least the box's extent.
+ */
+static int32_t find_node(const struct quadtree* qt, struct qwaabb aabb)
+{
+    struct node_ref n;
+    int64_t         cell_size, center_x, center_y, extent;
+
+    center_x = ((int64_t)aabb.x1 + aabb.x2) / 2 - qt->x;
+    center_y = ((int64_t)aabb.y1 + aabb.y2) / 2 - qt->y;
+    if (center_x < 0 || center_y < 0 || center_x >= qt->size ||
+        center_y >= qt->size)
+    {
+        return 0;
+    }
+
+    extent = (int64_t)aabb.x2 - aabb.x1;
+    if (extent < (int64_t)aabb.y2 - aabb.y1)
+        extent = (int64_t)aabb.y2 - aabb.y1;
+
+    n.depth = 0;
+    cell_size = qt->size;
+    while (n.depth < QUADTREE_MAX_DEPTH && extent <= cell_size / 2)
+    {
+        cell_size /= 2;
+        n.depth++;
+    }
+
+    n.cx = (int32_t)((center_x << n.depth) / qt->size);
+    n.cy = (int32_t)((center_y << n.depth) / qt->size);
+    return node_index(n);
+}
+
+/* ------------------------------------------------------------------------- */
+static void link_item(struct quadtree* qt, int32_t item, int32_t node)
+{
+    struct quadtree_item* it = quadtree_get(qt, item);
+    it->node = node;
+    it->prev = -1;
+    it->next = qt->heads[node];
+    if (it->next != -1)
+        quadtree_get(qt, it->next)->prev = item;
+    qt->heads[node] = item;
+
+    add_to_subtree_counts(qt, node, 1);
+}
+
+/* ------------------------------------------------------------------------- */
+static void unlink_item(struct quadtree* qt, int32_t item)
+{
+    struct quadtree_item* it = quadtree_get(qt, item);
+    int32_t               node = it->node;
+
+    if (it->prev != -1)
+        quadtree_get(qt, it->prev)->next = it->next;
+    else
+        qt->heads[node] = it->next;
+    if (it->next != -1)
+        quadtree_get(qt, it->next)->prev = it->prev;
+
+    add_to_subtree_counts(qt, node, -1);
+}
+
+/* ------------------------------------------------------------------------- */
+void quadtree_init(struct quadtree* qt, struct qwaabb bounds)
+{
+    quadtree_item_vec_init(&qt->items);
+    qt->heads = NULL;
+    qt->counts = NULL;
+    qt->free_item = -1;
+    qt->x = bounds.x1;
+    qt->y = bounds.y1;
+    qt->size = qw_sub(bounds.x2, bounds.x1);
+    if (qt->size < qw_sub(bounds.y2, bounds.y1))
+        qt->size = qw_sub(bounds.y2, bounds.y1);
+    if (qt->size <= 0)
+        qt->size = 1;
+}
+
+/* ------------------------------------------------------------------------- */
+void quadtree_deinit(struct quadtree* qt)
+{
+    if (qt->counts != NULL)
+        mem_free(qt->counts);
+    if (qt->heads != NULL)
+        mem_free(qt->heads);
+    quadtree_item_vec_deinit(qt->items);
+}
+
+/* ------------------------------------------------------------------------- */
+void quadtree_clear(struct quadtree* qt)
+{
+    int32_t i;
+    quadtree_item_vec_clear(qt->items);
+    qt->free_item = -1;
+    if (qt->heads == NULL)
+        return;
+    for (i = 0; i != NODE_COUNT; ++i)
+    {
+        qt->heads[i] = -1;
+        qt->counts[i] = 0;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+int32_t quadtree_insert(struct quadtree* qt, struct qwaabb aabb, uint16_t key)
+{
+    int32_t               item;
+    struct quadtree_item* it;
+    const int             nodes_size = (int)sizeof(int32_t) * NODE_COUNT;
+
+    if (qt->heads == NULL)
+    {
+        qt->heads = mem_alloc(nodes_size);
+        if (qt->heads == NULL)
+            return log_oom(nodes_size, "quadtree_insert()");
+        qt->counts = mem_alloc(nodes_size);
+        if (qt->counts == NULL)
+        {
+            mem_free(qt->heads);
+            qt->heads = NULL;
+            return log_oom(nodes_size, "quadtree_insert()");
+        }
+        quadtree_clear(qt);
+    }
+
+    if (qt->free_item != -1)
+    {
+        item = qt->free_item;
+        qt->free_item = quadtree_get(qt, item)->next;
+    }
+    else
+    {
+        if (quadtree_item_vec_emplace(&qt->items) == NULL)
+            return -1;
+        item = vec_count(qt->items) - 1;
+    }
+
+    it = quadtree_get(qt, item);
+    it->aabb = aabb;
+    it->key = key;
+    link_item(qt, item, find_node(qt, aabb));
+
+    return item;
+}
+
+/* ------------------------------------------------------------------------- */
+void quadtree_remove(struct quadtree* qt, int32_t item)
+{
+    struct quadtree_item* it = quadtree_get(qt, item);
+    CLITHER_DEBUG_ASSERT(it->node != -1);
+
+    unlink_item(qt, item);
+    it->node = -1;
+    it->next = qt->free_item;
+    qt->free_item = item;
+}
+
+/* ------------------------------------------------------------------------- */
+void quadtree_update(struct quadtree* qt, int32_t item, struct qwaabb aabb)
+{
+    struct quadtree_item* it = quadtree_get(qt, item);
+    int32_t               node = find_node(qt, aabb);
+    CLITHER_DEBUG_ASSERT(it->node != -1);
+
+    it->aabb = aabb;
+    if (it->node == node)
+        return;
+
+    unlink_item(qt, item);
+    link_item(qt, item, node);
+}
+
+/* ------------------------------------------------------------------------- */
+int quadtree_query(
+    const struct quadtree* qt,
+    struct qwaabb          aabb,
+    int (*on_item)(int32_t item, uint16_t key, void* user),
+    void* user)
+{
+    /* Each level of the depth-first traversal grows the stack by at most 3 */
+    struct node_ref stack[3 * QUADTREE_MAX_DEPTH + 4];
+    int             sp = 0;
+
+    if (qt->heads == NULL)
+        return 0;
+
+    stack[sp].cx = 0;
+    stack[sp].cy = 0;
+    stack[sp].depth = 0;
+    sp++;
+
+    while (sp > 0)
+    {
+        int32_t         item;
+        struct node_ref n = stack[--sp];
+        int32_t         node = node_index(n);
+
+        for (item = qt->heads[node]; item != -1;
+             item = quadtree_get(qt, item)->next)
+        {
+            const struct quadtree_item* it = quadtree_get(qt, item);
+            if (aabbs_overlap(it->aabb, aabb))
+            {
+                int result = on_item(item, it->key, user);
+                if (result < 0)
+                    return result;
+            }
+        }
+
+        if (n.depth < QUADTREE_MAX_DEPTH)
+        {
+            int     i;
+            int64_t cell_size = (int64_t)qt->size >> (n.depth + 1);
+            for (i = 0; i != 4; ++i)
+            {
+                struct qwaabb   loose;
+                struct node_ref child;
+                int64_t         x1, y1;
+                child.depth = n.depth + 1;
+                child.cx = n.cx * 2 + (i & 1);
+                child.cy = n.cy * 2 + (i >> 1);
+                if (qt->counts[node_index(child)] == 0)
+                    continue;
+
+                x1 = qt->x + child.cx * cell_size - cell_size / 2;
+                y1 = qt->y + child.cy * cell_size - cell_size / 2;
+                loose.x1 = (qw)x1;
+                loose.y1 = (qw)y1;
+                loose.x2 = (qw)(x1 + cell_size * 2);
+                loose.y2 = (qw)(y1 + cell_size * 2);
+                if (aabbs_overlap(loose, aabb))
+                    stack[sp++] = child;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,3 @@
+#include "clither/quadtree_handle_rb.h"
+
+RB_DEFINE(quadtree_handle_rb, int32_t, 16)
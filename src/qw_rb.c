@@ -0,0 +1,3 @@
+#include "clither/qw_rb.h"
+
+RB_DEFINE(qw_rb, qw, 16)
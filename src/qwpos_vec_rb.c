@@ -1,3 +1,3 @@
 #include "clither/qwpos_vec_rb.h"
 
-RB_DEFINE(qwpos_vec_rb, struct qwpos_vec*, 8)
+RB_DEFINE(qwpos_vec_rb, struct qwpos_vec*, 16)
@@ -1,92 +1,305 @@
+#include "clither/ack.h"
+#include "clither/admission.h"
 #include "clither/args.h"
 #include "clither/bezier_handle_rb.h"
-#include "clither/bezier_pending_acks_bset.h"
+#include "clither/bezier_pending_acks_bmap.h"
 #include "clither/cli_colors.h"
+#include "clither/hash.h"
 #include "clither/log.h"
+#include "clither/mem.h"
 #include "clither/msg_vec.h"
+#include "clither/mutex.h"
 #include "clither/net.h"
 #include "clither/net_addr_hm.h"
 #include "clither/proximity_state_bmap.h"
 #include "clither/server.h"
 #include "clither/server_client.h"
-#include "clither/server_client_hm.h"
+#include "clither/server_client_vec.h"
 #include "clither/server_instance.h"
 #include "clither/server_instance_bmap.h"
 #include "clither/server_settings.h"
+#include "clither/signals.h"
 #include "clither/snake.h"
 #include "clither/snake_bmap.h"
+#include "clither/snake_grid.h"
+#include "clither/system.h"
 #include "clither/thread.h"
+#include "clither/tick.h"
+#include "clither/timer_wheel.h"
 #include "clither/world.h"
 #include "clither/wrap.h"
-#include <stdlib.h> /* atoi */
-#include <string.h> /* memcpy */
+#include <stdio.h>  /* sprintf */
+#include <stdlib.h> /* atoi, qsort */
+#include <string.h> /* memcpy, memset */
+
+/* How often server_run() checks whether instances need to be started or
+ * stopped */
+#define INSTANCE_SCALE_RATE 10
+
+/* Should be in the same order of magnitude as the proximity range */
+#define SNAKE_GRID_CELL_SIZE make_qw(16)
+
+/*
+ * A snake right next to the client's head gains SNAKE_UPDATE_WEIGHT priority
+ * per net tick, a snake SNAKE_UPDATE_FALLOFF away gains half of that, etc.
+ */
+#define SNAKE_UPDATE_WEIGHT  256
+#define SNAKE_UPDATE_FALLOFF make_qw(8)
+#define SNAKE_UPDATE_MAX     0x3FFFFFFF
+
+/*
+ * Most clients only need the head segment of the snakes around them, which is
+ * the same message for everyone looking at a snake. The first encoding of a
+ * batch in a net tick is kept and copied into the packets of other clients
+ * that need the same handles. The cache is direct mapped by snake ID, and
+ * collisions just encode the batch again.
+ */
+#define BATCH_CACHE_SIZE     1024
+#define BATCH_CACHE_MSG_SIZE 64
+
+/*
+ * Handles that are pending for more than this many packets are resent, no
+ * matter what the ack state says. Snakes that weren't updated for a while can
+ * have pending handles so old that their seq wrapped around and looks newer
+ * than the client's acks.
+ */
+#define PENDING_HANDLE_MAX_AGE 256
+
+enum server_timer_type
+{
+    TIMER_CLIENT_TIMEOUT,
+    TIMER_MALICIOUS_EXPIRY
+};
+
+struct snake_update
+{
+    struct proximity_state* prox;
+    uint16_t                snake_id;
+};
+
+VEC_DECLARE(snake_update_vec, struct snake_update, 16)
+VEC_DEFINE(snake_update_vec, struct snake_update, 16)
+
+struct batch_cache_entry
+{
+    uint32_t epoch; /* Equal to batch_cache::epoch if encoded this net tick */
+    uint16_t snake_id;
+    int16_t  first; /* Index of the first handle */
+    uint8_t  count;
+    uint8_t  len; /* Including the message type and length */
+    uint8_t  data[BATCH_CACHE_MSG_SIZE];
+};
+
+struct batch_cache
+{
+    struct batch_cache_entry entries[BATCH_CACHE_SIZE];
+    uint32_t                 epoch; /* Incremented every net tick */
+};
+
+/* ------------------------------------------------------------------------- */
+static void proximity_states_deinit(struct proximity_state_bmap* snakes)
+{
+    int16_t                 idx;
+    uint16_t                snake_id;
+    struct proximity_state* prox;
+    bmap_for_each (snakes, idx, snake_id, prox)
+    {
+        (void)snake_id;
+        proximity_state_deinit(prox);
+    }
+    proximity_state_bmap_deinit(snakes);
+}
+
+/* ------------------------------------------------------------------------- */
+static int
+net_addr_equal(const struct net_addr* a1, const struct net_addr* a2)
+{
+    return a1->len == a2->len &&
+           memcmp(a1->sockaddr_storage, a2->sockaddr_storage, a1->len) == 0;
+}
+
+/* ------------------------------------------------------------------------- */
+struct server_client*
+server_add_client(struct server* server, const struct net_addr* addr)
+{
+    struct server_client* client;
+    int32_t               slot;
+    uint64_t              nonce;
+
+    nonce = hash64_siphash24(
+        server->conn_id_key,
+        &server->conn_id_counter,
+        sizeof(server->conn_id_counter));
+    server->conn_id_counter++;
+    nonce <<= 16;
+    if (nonce == 0)
+        nonce = 0x10000;
+
+    /* Reuse the slot of a client that left. Joining is rare enough for a
+     * linear search */
+    for (slot = 0; slot != vec_count(server->clients); ++slot)
+        if (vec_get(server->clients, slot)->conn_id == 0)
+            break;
+    if (slot > 0xFFFF)
+    {
+        log_err("Client table is full\n");
+        return NULL;
+    }
+    if (slot == vec_count(server->clients))
+    {
+        client = server_client_vec_emplace(&server->clients);
+        if (client == NULL)
+            return NULL;
+        client->conn_id = 0;
+    }
+
+    if (net_addr_hm_insert_new(&server->clients_by_addr, addr, slot) != 0)
+        return NULL;
+
+    client = vec_get(server->clients, slot);
+    memset(client, 0, sizeof(*client));
+    client->addr = *addr;
+    client->conn_id = nonce | (uint64_t)slot;
+
+    return client;
+}
+
+/* ------------------------------------------------------------------------- */
+static struct server_client*
+find_client(const struct server* server, uint64_t conn_id)
+{
+    struct server_client* client;
+    int32_t               slot = (int32_t)(conn_id & 0xFFFF);
+
+    if (conn_id == 0 || slot >= vec_count(server->clients))
+        return NULL;
+
+    client = vec_get(server->clients, slot);
+    return client->conn_id == conn_id ? client : NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+static struct server_client*
+find_client_by_addr(const struct server* server, const struct net_addr* addr)
+{
+    int* slot = net_addr_hm_find(server->clients_by_addr, addr);
+    return slot != NULL ? vec_get(server->clients, *slot) : NULL;
+}
 
 /* ------------------------------------------------------------------------- */
 static void client_remove(
-    struct server*              server,
-    struct world*               world,
-    const struct net_addr*      addr,
-    const struct server_client* client)
+    struct server* server, struct world* world, struct server_client* client)
 {
     struct msg** pmsg;
 
     world_remove_snake(world, client->snake_id);
     vec_for_each (client->pending_msgs, pmsg)
         msg_free(*pmsg);
-    proximity_state_bmap_deinit(client->snakes_in_proximity);
+    proximity_states_deinit(client->snakes_in_proximity);
     msg_vec_deinit(client->pending_msgs);
-    server_client_hm_erase(server->clients, addr);
+    net_addr_hm_erase(server->clients_by_addr, &client->addr);
+    client->conn_id = 0;
 }
 
 /* ------------------------------------------------------------------------- */
 static void mark_client_as_malicious_and_drop(
-    struct server*              server,
-    const struct net_addr*      addr,
-    const struct server_client* client,
-    struct world*               world,
-    int                         timeout)
+    struct server*                server,
+    const struct net_addr*        addr,
+    struct server_client*         client,
+    struct world*                 world,
+    const struct server_settings* settings)
 {
-    net_addr_hm_insert_update(&server->malicious_clients, addr, timeout);
-    client_remove(server, world, addr, client);
+    int*           expires;
+    uint32_t       deadline = server->timers.now +
+                        (uint32_t)settings->malicious_timeout *
+                            settings->net_tick_rate;
+    enum hm_status status =
+        net_addr_hm_emplace_or_get(&server->malicious_clients, addr, &expires);
+
+    /* An address that is already on the list has a timer, which notices the
+     * later deadline when it expires */
+    if (status != HM_OOM)
+        *expires = (int)deadline;
+    if (status == HM_NEW)
+        timer_wheel_add(
+            &server->timers, deadline, TIMER_MALICIOUS_EXPIRY, addr);
+
+    if (client != NULL)
+        client_remove(server, world, client);
 }
 
 /* ------------------------------------------------------------------------- */
 int server_init(
     struct server* server, const char* bind_address, const char* port)
 {
+    if (join_cookie_init(&server->cookies) != 0)
+        return -1;
+    server->cookie_rotate_tick = 0;
+
+    if (system_random_bytes(
+            server->conn_id_key, sizeof(server->conn_id_key)) != 0)
+        return -1;
+    server->conn_id_counter = 0;
+
+    if (admission_init(&server->admission) != 0)
+        return -1;
+
+    server->batch_cache = mem_alloc(sizeof(*server->batch_cache));
+    if (server->batch_cache == NULL)
+    {
+        log_oom(sizeof(*server->batch_cache), "server_init()");
+        goto alloc_batch_cache_failed;
+    }
+    memset(server->batch_cache, 0, sizeof(*server->batch_cache));
+
     server->udp_sock = net_bind(bind_address, port);
     if (server->udp_sock < 0)
-        return -1;
+        goto bind_failed;
 
-    server_client_hm_init(&server->clients);
+    server_client_vec_init(&server->clients);
+    net_addr_hm_init(&server->clients_by_addr);
     net_addr_hm_init(&server->malicious_clients);
     net_addr_hm_init(&server->banned_clients);
+    snake_grid_init(&server->snake_grid, SNAKE_GRID_CELL_SIZE);
+    snake_update_vec_init(&server->snake_updates);
+    timer_wheel_init(&server->timers, 0);
+    server->redirect_port = 0;
+    server->over_cpu_budget = 0;
 
     return 0;
+
+bind_failed:
+    mem_free(server->batch_cache);
+alloc_batch_cache_failed:
+    admission_deinit(server->admission);
+    return -1;
 }
 
 /* ------------------------------------------------------------------------- */
 void server_deinit(struct server* server)
 {
-    const struct net_addr* addr;
-    struct server_client*  client;
-    int                    slot;
+    struct server_client* client;
 
     net_close(server->udp_sock);
 
     net_addr_hm_deinit(server->banned_clients);
     net_addr_hm_deinit(server->malicious_clients);
 
-    server_client_hm_for_each (server->clients, slot, addr, client)
+    server_client_vec_for_each (server->clients, client)
     {
         struct msg** pmsg;
-        (void)addr;
-
         vec_for_each (client->pending_msgs, pmsg)
             msg_free(*pmsg);
         msg_vec_deinit(client->pending_msgs);
+        proximity_states_deinit(client->snakes_in_proximity);
     }
-    server_client_hm_deinit(server->clients);
+    net_addr_hm_deinit(server->clients_by_addr);
+    server_client_vec_deinit(server->clients);
+    snake_grid_deinit(&server->snake_grid);
+    snake_update_vec_deinit(server->snake_updates);
+    timer_wheel_deinit(&server->timers);
+    mem_free(server->batch_cache);
+    admission_deinit(server->admission);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -113,8 +326,9 @@ static int cbf_lower_bound(struct server_client* client)
 /* ------------------------------------------------------------------------- */
 struct append_msgs_ctx
 {
-    int  len;
-    char buf[NET_MAX_UDP_PACKET_SIZE];
+    int      len;
+    uint8_t* buf;
+    uint16_t seq;
 };
 static int append_unreliable_msgs_to_buf(struct msg** pmsg, void* user)
 {
@@ -145,23 +359,16 @@ static int append_reliable_msgs_to_buf(struct msg** pmsg, void* user)
     struct msg*             msg = *pmsg;
     if (ctx->len + msg->payload_len + 2 > NET_MAX_UDP_PACKET_SIZE)
         return VEC_RETAIN;
-    if (msg_is_unreliable(msg))
+    if (msg_is_unreliable(msg) || msg->in_flight)
         return VEC_RETAIN;
 
-    if (--msg->resend_period_counter > 0)
-        return VEC_RETAIN;
-    msg->resend_period_counter = msg->resend_period;
-    if (--msg->resend_retry_counter == 0)
-        return log_err(
-            "Client did not acknowledge reliable message: type=%d\n",
-            msg->type);
-
+    ack_msg_sent(msg, ctx->seq);
     log_net(
-        "Packing msg type=%d, len=%d, resend=%d, retry=%d\n",
+        "Packing msg type=%d, len=%d, seq=%d, sends=%d\n",
         msg->type,
         msg->payload_len,
-        msg->resend_period,
-        msg->resend_retry_counter);
+        msg->seq,
+        msg->send_count);
 
     type = (uint8_t)msg->type;
     memcpy(ctx->buf + ctx->len + 0, &type, 1);
@@ -175,34 +382,60 @@ static int append_reliable_msgs_to_buf(struct msg** pmsg, void* user)
 /* ------------------------------------------------------------------------- */
 int server_send_pending_data(struct server* server, struct world* world)
 {
-    int                    slot;
-    const struct net_addr* addr;
-    struct server_client*  client;
-    struct append_msgs_ctx ctx;
-
-    server_client_hm_for_each (server->clients, slot, addr, client)
+    struct server_client*        client;
+    struct append_msgs_ctx       ctx;
+    const struct net_udp_packet* pkts[NET_BATCH_SIZE];
+    const struct net_addr*       addrs[NET_BATCH_SIZE];
+    struct server_client*        clients[NET_BATCH_SIZE];
+    int                          i, pkt_count = 0;
+
+    server_client_vec_for_each (server->clients, client)
     {
-        /* Append unreliable messages first */
-        ctx.len = 0;
-        msg_vec_retain(
-            client->pending_msgs, append_unreliable_msgs_to_buf, &ctx);
-        if (msg_vec_retain(
-                client->pending_msgs, append_reliable_msgs_to_buf, &ctx) == -1)
+        /* Retire reliable messages the client received, and find out which
+         * ones have to be sent again */
+        if (ack_update_msgs(&client->ack, client->pending_msgs) != 0)
         {
-            client_remove(server, world, addr, client);
+            client_remove(server, world, client);
             continue;
         }
 
-        if (ctx.len == 0)
+        /* The packet already contains unreliable messages that were
+         * serialized when they were queued. Messages that didn't fit, and
+         * reliable messages, are appended after those */
+        ctx.len = client->pkt.len;
+        ctx.buf = client->pkt.data;
+        ctx.seq = client->ack.next_seq;
+        msg_vec_retain(
+            client->pending_msgs, append_unreliable_msgs_to_buf, &ctx);
+        msg_vec_retain(client->pending_msgs, append_reliable_msgs_to_buf, &ctx);
+
+        /* Even if there is nothing to send, the client is waiting for our
+         * acks */
+        if (ctx.len == ACK_HEADER_SIZE && !client->ack.ack_pending)
             continue;
+        ack_write_header(&client->ack, client->pkt.data);
+
+        /* NOTE: Removing clients only marks their slot as unused, so the
+         * pointers stay valid until the batch is sent */
+        log_net("Queuing UDP packet, size=%d\n", ctx.len);
+        client->pkt.len = ctx.len;
+        pkts[pkt_count] = &client->pkt;
+        addrs[pkt_count] = &client->addr;
+        clients[pkt_count] = client;
 
-        /* NOTE: The hashmap's key size contains the length of the stored
-         * address */
-        log_net("Sending UDP packet, size=%d\n", ctx.len);
-        net_sendto(server->udp_sock, ctx.buf, ctx.len, addr);
-        client->timeout_counter++;
+        if (++pkt_count == NET_BATCH_SIZE)
+        {
+            net_sendto_many(server->udp_sock, pkts, addrs, pkt_count);
+            for (i = 0; i != pkt_count; ++i)
+                clients[i]->pkt.len = ACK_HEADER_SIZE;
+            pkt_count = 0;
+        }
     }
 
+    net_sendto_many(server->udp_sock, pkts, addrs, pkt_count);
+    for (i = 0; i != pkt_count; ++i)
+        clients[i]->pkt.len = ACK_HEADER_SIZE;
+
     return 0;
 }
 
@@ -212,81 +445,432 @@ static int server_queue(struct server_client* client, struct msg* msg)
     return msg_vec_push(&client->pending_msgs, msg);
 }
 
+/* ------------------------------------------------------------------------- */
+static int server_queue_snake_head(
+    struct server_client*    client,
+    const struct snake_head* head,
+    uint16_t                 frame_number)
+{
+    if (msg_snake_head_write(&client->pkt, head, frame_number) > 0)
+        return 0;
+
+    /* Packet is full. The message is sent in a later packet instead */
+    return server_queue(client, msg_snake_head(head, frame_number));
+}
+
+/* ------------------------------------------------------------------------- */
+static int snake_in_range(
+    const struct snake* snake, struct qwpos pos, qw proximity_range)
+{
+    struct qwaabb aabb = snake->data.aabb;
+    aabb.x1 = qw_sub(aabb.x1, proximity_range);
+    aabb.y1 = qw_sub(aabb.y1, proximity_range);
+    aabb.x2 = qw_add(aabb.x2, proximity_range);
+    aabb.y2 = qw_add(aabb.y2, proximity_range);
+    return qwaabb_test_qwpos(aabb, pos);
+}
+
+/* ------------------------------------------------------------------------- */
+struct update_proximity_ctx
+{
+    struct server_client* client;
+    const struct world*   world;
+    struct qwpos          head_pos;
+    qw                    proximity_range;
+};
+
+static int remove_snake_out_of_range(
+    uint16_t snake_id, struct proximity_state* prox, void* user)
+{
+    struct update_proximity_ctx* ctx = user;
+    const struct snake* snake = snake_bmap_find(ctx->world->snakes, snake_id);
+    if (snake != NULL &&
+        snake_in_range(snake, ctx->head_pos, ctx->proximity_range))
+    {
+        return BMAP_RETAIN;
+    }
+
+    server_queue(ctx->client, msg_snake_destroy(snake_id));
+    proximity_state_deinit(prox);
+    return BMAP_ERASE;
+}
+
+static int add_snake_in_range(uint16_t snake_id, void* user)
+{
+    struct proximity_state*      prox;
+    struct update_proximity_ctx* ctx = user;
+    const struct snake*          snake;
+
+    if (snake_id == ctx->client->snake_id)
+        return 0;
+
+    snake = snake_bmap_find(ctx->world->snakes, snake_id);
+    CLITHER_DEBUG_ASSERT(snake != NULL);
+    if (!snake_in_range(snake, ctx->head_pos, ctx->proximity_range))
+        return 0;
+
+    switch (proximity_state_bmap_emplace_or_get(
+        &ctx->client->snakes_in_proximity, snake_id, &prox))
+    {
+        case BMAP_OOM: return -1;
+        case BMAP_EXISTS: return 0;
+        case BMAP_NEW: break;
+    }
+
+    proximity_state_init(prox);
+
+    /* The client doesn't know anything about this snake yet, so it should be
+     * sent before snakes the client has already seen */
+    prox->priority = SNAKE_UPDATE_WEIGHT;
+    prox->next_handle_id = snake->data.bezier_handle_id_base;
+
+    return 0;
+}
+
 /* ------------------------------------------------------------------------- */
 int server_update_snakes_in_range(
     struct server* server, const struct world* world, qw proximity_range)
 {
-    int                    slot;
-    int                    other_slot;
-    const struct net_addr* addr;
-    const struct net_addr* other_addr;
-    struct server_client*  client;
-    struct server_client*  other_client;
+    struct server_client*       client;
+    struct update_proximity_ctx ctx;
+
+    if (snake_grid_rebuild(
+            &server->snake_grid, world->snakes, proximity_range) != 0)
+        return -1;
+
+    ctx.world = world;
+    ctx.proximity_range = proximity_range;
 
-    /* TODO: O(n^2) */
-    server_client_hm_for_each (server->clients, slot, addr, client)
+    server_client_vec_for_each (server->clients, client)
     {
-        server_client_hm_for_each (
-            server->clients, other_slot, other_addr, other_client)
+        const struct snake* snake =
+            snake_bmap_find(world->snakes, client->snake_id);
+        CLITHER_DEBUG_ASSERT(snake != NULL);
+
+        ctx.client = client;
+        ctx.head_pos = snake->head.pos;
+
+        /* Only the snakes already in proximity can leave it, and only the
+         * snakes registered in the head's grid cell can enter it */
+        if (proximity_state_bmap_retain(
+                client->snakes_in_proximity, remove_snake_out_of_range, &ctx) <
+            0)
         {
-            struct snake* snake;
-            struct snake* other_snake;
-            struct qwaabb other_aabb;
+            return -1;
+        }
+        if (snake_grid_query(
+                &server->snake_grid, ctx.head_pos, add_snake_in_range, &ctx) <
+            0)
+        {
+            return -1;
+        }
+    }
 
-            /* OK to compare pointers here -- they're from the same hashmap */
-            if (addr == other_addr)
-                continue;
+    return 0;
+}
 
-            snake = snake_bmap_find(world->snakes, client->snake_id);
-            other_snake =
-                snake_bmap_find(world->snakes, other_client->snake_id);
-            other_aabb = other_snake->data.aabb;
-            other_aabb.x1 = qw_sub(other_aabb.x1, proximity_range);
-            other_aabb.y1 = qw_sub(other_aabb.y1, proximity_range);
-            other_aabb.x2 = qw_add(other_aabb.x2, proximity_range);
-            other_aabb.y2 = qw_add(other_aabb.y2, proximity_range);
-            if (qwaabb_test_qwpos(other_aabb, snake->head.pos))
-            {
-                int32_t                     handle_id;
-                const struct bezier_handle* handle;
-                struct proximity_state*     prox;
-                enum bmap_status status = proximity_state_bmap_emplace_or_get(
-                    &client->snakes_in_proximity,
-                    other_client->snake_id,
-                    &prox);
-                switch (status)
-                {
-                    case HM_OOM: return -1;
-                    case HM_EXISTS: continue;
-                    case HM_NEW: break;
-                }
+/* ------------------------------------------------------------------------- */
+static int32_t snake_update_weight(struct qwpos client_head, struct qwpos head)
+{
+    int64_t dx = (int64_t)head.x - client_head.x;
+    int64_t dy = (int64_t)head.y - client_head.y;
+    int64_t dist = dx < 0 ? -dx : dx;
+    if (dist < (dy < 0 ? -dy : dy))
+        dist = dy < 0 ? -dy : dy;
+
+    return (int32_t)(SNAKE_UPDATE_WEIGHT * (int64_t)SNAKE_UPDATE_FALLOFF /
+                     (SNAKE_UPDATE_FALLOFF + dist));
+}
 
-                proximity_state_init(prox);
+/* ------------------------------------------------------------------------- */
+static int snake_update_cmp(const void* a, const void* b)
+{
+    const struct snake_update* ua = a;
+    const struct snake_update* ub = b;
+
+    /* Highest priority first. Ties are broken by ID so the order doesn't
+     * depend on qsort() */
+    if (ua->prox->priority != ub->prox->priority)
+        return ua->prox->priority > ub->prox->priority ? -1 : 1;
+    if (ua->snake_id != ub->snake_id)
+        return ua->snake_id < ub->snake_id ? -1 : 1;
+    return 0;
+}
 
-                /* Queue all bezier handles of the snake in proximity. These
-                 * remain in the server's message queue until they get ACK'd by
-                 * the client */
-                rb_for_each (
-                    other_snake->data.bezier_handles, handle_id, handle)
-                {
-                    server_queue(
-                        client,
-                        msg_snake_bezier(
-                            other_client->snake_id, handle_id, handle));
-                }
-            }
-            else
-            {
-                struct proximity_state* prox = proximity_state_bmap_find(
-                    client->snakes_in_proximity, other_client->snake_id);
-                if (prox == NULL)
-                    continue;
+/* ------------------------------------------------------------------------- */
+static enum ack_status
+pending_handle_status(const struct ack_state* ack, uint16_t seq)
+{
+    if ((uint16_t)(ack->next_seq - seq) > PENDING_HANDLE_MAX_AGE)
+        return ACK_LOST;
+    return ack_status_of(ack, seq);
+}
+
+/* ------------------------------------------------------------------------- */
+struct retire_handles_ctx
+{
+    const struct ack_state* ack;
+    uint16_t                id_base;
+};
+
+static int retire_handle(uint16_t handle_id, uint16_t* seq, void* user)
+{
+    struct retire_handles_ctx* ctx = user;
+
+    /* The handle was removed from the tail of the snake */
+    if ((int16_t)(uint16_t)(handle_id - ctx->id_base) < 0)
+        return BMAP_ERASE;
+    if (pending_handle_status(ctx->ack, *seq) == ACK_RECEIVED)
+        return BMAP_ERASE;
+    return BMAP_RETAIN;
+}
+
+/* ------------------------------------------------------------------------- */
+static int mark_handles_pending(
+    struct proximity_state* prox,
+    const struct snake*     snake,
+    int                     first,
+    int                     count,
+    uint16_t                seq)
+{
+    int i;
+    for (i = first; i != first + count; ++i)
+    {
+        uint16_t* pending_seq;
+        if (bezier_pending_acks_bmap_emplace_or_get(
+                &prox->bezier_pending_acks,
+                snake_bezier_handle_id(&snake->data, i),
+                &pending_seq) == BMAP_OOM)
+        {
+            return -1;
+        }
+        *pending_seq = seq;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Resends runs of handles whose packet was lost, skipping handles from
+ * index "end" onwards since those are sent anyway.
+ * \return Returns the number of bytes written, or -1 if allocation failed.
+ * Stops early once the budget runs out.
+ */
+static int resend_lost_handles(
+    struct server_client*   client,
+    struct proximity_state* prox,
+    uint16_t                snake_id,
+    const struct snake*     snake,
+    int                     end,
+    int                     budget)
+{
+    int16_t idx;
+    int     run_first = 0, run_count = 0, total = 0;
+
+    /* Keys are sorted, so consecutive handles form a run that can be sent as a
+     * single batch. The extra iteration flushes the last run */
+    for (idx = 0; idx <= bmap_count(prox->bezier_pending_acks); ++idx)
+    {
+        int count, written, handle_idx = -1;
 
-                server_queue(client, msg_snake_destroy(other_client->snake_id));
-                proximity_state_bmap_erase(
-                    client->snakes_in_proximity, other_client->snake_id);
+        if (idx < bmap_count(prox->bezier_pending_acks))
+        {
+            uint16_t handle_id = prox->bezier_pending_acks->keys[idx];
+            uint16_t seq = prox->bezier_pending_acks->values[idx];
+            handle_idx = (int16_t)(uint16_t)(handle_id -
+                                             snake->data.bezier_handle_id_base);
+            if (handle_idx >= end ||
+                pending_handle_status(&client->ack, seq) != ACK_LOST)
+            {
+                handle_idx = -1;
             }
         }
+
+        if (handle_idx >= 0 && run_count > 0 &&
+            handle_idx == run_first + run_count &&
+            run_count < MSG_SNAKE_BEZIER_BATCH_MAX)
+        {
+            run_count++;
+            continue;
+        }
+
+        if (run_count > 0)
+        {
+            count = run_count;
+            written = msg_snake_bezier_batch_write(
+                &client->pkt,
+                budget - total,
+                snake_id,
+                &snake->data,
+                run_first,
+                &count);
+            if (written == 0)
+                break;
+            total += written;
+
+            /* Only updates existing keys, so iterating stays valid */
+            if (mark_handles_pending(
+                    prox, snake, run_first, count, client->ack.next_seq) != 0)
+                return -1;
+            if (count < run_count)
+                break;
+        }
+
+        run_first = handle_idx;
+        run_count = handle_idx >= 0;
+    }
+
+    return total;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Same as msg_snake_bezier_batch_write(), but copies the batch if
+ * another client already needed the same handles in this net tick, see
+ * BATCH_CACHE_SIZE.
+ */
+static int write_snake_batch(
+    struct batch_cache*      cache,
+    struct net_udp_packet*   pkt,
+    int                      budget,
+    uint16_t                 snake_id,
+    const struct snake_data* data,
+    int                      first,
+    int*                     count)
+{
+    struct batch_cache_entry* entry =
+        &cache->entries[snake_id & (BATCH_CACHE_SIZE - 1)];
+    int requested =
+        *count < MSG_SNAKE_BEZIER_BATCH_MAX ? *count : MSG_SNAKE_BEZIER_BATCH_MAX;
+    int written;
+
+    if (entry->epoch == cache->epoch && entry->snake_id == snake_id &&
+        entry->first == first)
+    {
+        if (entry->len <= budget &&
+            pkt->len + entry->len <= NET_MAX_UDP_PACKET_SIZE)
+        {
+            memcpy(pkt->data + pkt->len, entry->data, entry->len);
+            pkt->len += entry->len;
+            *count = entry->count;
+            return entry->len;
+        }
+
+        /* Only part of the batch fits into this client's packet */
+        return msg_snake_bezier_batch_write(
+            pkt, budget, snake_id, data, first, count);
+    }
+
+    written =
+        msg_snake_bezier_batch_write(pkt, budget, snake_id, data, first, count);
+
+    /* A batch that was cut short by the budget is only valid for this
+     * client */
+    if (written > 0 && written <= BATCH_CACHE_MSG_SIZE && *count == requested)
+    {
+        entry->epoch = cache->epoch;
+        entry->snake_id = snake_id;
+        entry->first = (int16_t)first;
+        entry->count = (uint8_t)*count;
+        entry->len = (uint8_t)written;
+        memcpy(entry->data, pkt->data + pkt->len - written, written);
+    }
+
+    return written;
+}
+
+/* ------------------------------------------------------------------------- */
+static int queue_snake_updates(
+    struct server*        server,
+    struct server_client* client,
+    const struct world*   world,
+    int                   budget)
+{
+    int16_t                 prox_idx;
+    uint16_t                snake_id;
+    struct proximity_state* prox;
+    struct snake_update*    update;
+    const struct snake*     client_snake =
+        snake_bmap_find(world->snakes, client->snake_id);
+    CLITHER_DEBUG_ASSERT(client_snake != NULL);
+
+    snake_update_vec_clear(server->snake_updates);
+    bmap_for_each (client->snakes_in_proximity, prox_idx, snake_id, prox)
+    {
+        const struct snake* snake = snake_bmap_find(world->snakes, snake_id);
+        CLITHER_DEBUG_ASSERT(snake != NULL);
+
+        prox->priority +=
+            snake_update_weight(client_snake->head.pos, snake->head.pos);
+        if (prox->priority > SNAKE_UPDATE_MAX)
+            prox->priority = SNAKE_UPDATE_MAX;
+
+        update = snake_update_vec_emplace(&server->snake_updates);
+        if (update == NULL)
+            return -1;
+        update->prox = prox;
+        update->snake_id = snake_id;
+    }
+
+    /* Not vec_data(), -Wnonnull can't see past its NULL branch */
+    if (vec_count(server->snake_updates) > 1)
+        qsort(
+            vec_get(server->snake_updates, 0),
+            vec_count(server->snake_updates),
+            sizeof(struct snake_update),
+            snake_update_cmp);
+
+    vec_for_each (server->snake_updates, update)
+    {
+        int                       first, count, written, resent;
+        struct retire_handles_ctx retire_ctx;
+        const struct snake*       snake =
+            snake_bmap_find(world->snakes, update->snake_id);
+        const int handle_count = rb_count(snake->data.bezier_handles);
+
+        /* Forget about handles the client acknowledged in the meantime */
+        retire_ctx.ack = &client->ack;
+        retire_ctx.id_base = snake->data.bezier_handle_id_base;
+        bezier_pending_acks_bmap_retain(
+            update->prox->bezier_pending_acks, retire_handle, &retire_ctx);
+
+        /* Resume from the first handle the client hasn't seen. The handles of
+         * the head segment change every frame, so they are always resent */
+        first = (int16_t)(uint16_t)(update->prox->next_handle_id -
+                                    snake->data.bezier_handle_id_base);
+        if (first > handle_count - 2)
+            first = handle_count - 2;
+        if (first < 0)
+            first = 0;
+
+        count = handle_count - first;
+        written = write_snake_batch(
+            server->batch_cache,
+            &client->pkt,
+            budget,
+            update->snake_id,
+            &snake->data,
+            first,
+            &count);
+        /* Not even a single handle fits anymore */
+        if (written == 0)
+            break;
+
+        budget -= written;
+        update->prox->priority = 0;
+        update->prox->next_handle_id =
+            snake_bezier_handle_id(&snake->data, first + count);
+        if (mark_handles_pending(
+                update->prox, snake, first, count, client->ack.next_seq) != 0)
+            return -1;
+
+        /* Use what's left of the budget to repair handles that were lost */
+        resent = resend_lost_handles(
+            client, update->prox, update->snake_id, snake, first, budget);
+        if (resent < 0)
+            return -1;
+        budget -= resent;
     }
 
     return 0;
@@ -294,49 +878,61 @@ int server_update_snakes_in_range(
 
 /* ------------------------------------------------------------------------- */
 int server_queue_snake_data(
-    struct server* server, const struct world* world, uint16_t frame_number)
+    struct server*                server,
+    const struct server_settings* settings,
+    const struct world*           world,
+    uint16_t                      frame_number)
 {
-    int                    slot;
-    const struct net_addr* addr;
-    struct server_client*  client;
+    struct server_client* client;
+
+    /* Batches encoded in the previous net tick are outdated */
+    server->batch_cache->epoch++;
 
     /* Send back real position of client snake's head */
-    server_client_hm_for_each (server->clients, slot, addr, client)
+    server_client_vec_for_each (server->clients, client)
     {
         struct snake* snake = snake_bmap_find(world->snakes, client->snake_id);
         CLITHER_DEBUG_ASSERT(snake != NULL);
         if (snake_is_held(snake))
             continue;
-        server_queue(client, msg_snake_head(&snake->head, frame_number));
+        server_queue_snake_head(client, &snake->head, frame_number);
     }
 
-    /* Queue bezier handles of all snakes in proximity */
-    server_client_hm_for_each (server->clients, slot, addr, client)
+    /* Send as many of the snakes in proximity as the budget allows */
+    server_client_vec_for_each (server->clients, client)
     {
-        int16_t                 prox_idx;
-        uint16_t                snake_id;
-        struct proximity_state* prox;
-        bmap_for_each (client->snakes_in_proximity, prox_idx, snake_id, prox)
+        if (queue_snake_updates(
+                server, client, world, settings->snake_update_budget) != 0)
         {
-            int                   handle_id;
-            struct bezier_handle* handle;
-            struct snake* snake = snake_bmap_find(world->snakes, snake_id);
-            CLITHER_DEBUG_ASSERT(snake != NULL);
-            rb_for_each (snake->data.bezier_handles, handle_id, handle)
-            {
-                if (bezier_pending_acks_bset_find(
-                        prox->bezier_pending_acks, handle_id))
-                {
-                    server_queue(
-                        client, msg_snake_bezier(snake_id, handle_id, handle));
-                }
-            }
+            return -1;
         }
     }
 
     return 0;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Join challenges, denials and redirects are sent immediately, because
+ * there is no client to queue them for. The header acks nothing since there is
+ * no connection.
+ */
+static void send_join_response(
+    struct server* server, const struct net_addr* addr, struct msg* msg)
+{
+    struct net_udp_packet pkt;
+    struct ack_state      ack;
+
+    ack_init(&ack);
+    pkt.len = ack_write_header(&ack, pkt.data);
+    pkt.data[pkt.len + 0] = msg->type;
+    pkt.data[pkt.len + 1] = msg->payload_len;
+    memcpy(pkt.data + pkt.len + 2, msg->payload, msg->payload_len);
+    pkt.len += msg->payload_len + 2;
+    net_sendto(server->udp_sock, pkt.data, pkt.len, addr);
+    msg_free(msg);
+}
+
 /* ------------------------------------------------------------------------- */
 static int process_message(
     struct server*                server,
@@ -359,30 +955,56 @@ static int process_message(
     switch (msg_parse_payload(&pp, msg_type, msg_data, msg_len))
     {
         case MSG_JOIN_REQUEST: {
-            if (hm_count(server->clients) + 1 > settings->max_players)
+            /*
+             * Nothing is allocated for an address until it proves that it
+             * receives our packets, so spoofed join floods stay cheap. This
+             * comes before any other reply, so that a spoofed address can't
+             * be used to reflect anything other than a challenge.
+             */
+            if (client == NULL &&
+                (pp.join_request.cookie == NULL ||
+                 !join_cookie_check(
+                     &server->cookies, client_addr, pp.join_request.cookie)))
+            {
+                uint8_t cookie[JOIN_COOKIE_SIZE];
+                join_cookie_make(&server->cookies, client_addr, cookie);
+                send_join_response(
+                    server, client_addr, msg_join_challenge(cookie));
+                return 0;
+            }
+
+            /* Prefer sending new players to another instance over lagging */
+            if (client == NULL && server->redirect_port != 0 &&
+                (hm_count(server->clients_by_addr) + 1 >
+                     settings->max_players ||
+                 server->over_cpu_budget))
             {
-                struct net_udp_packet pkt;
-                struct msg* msg = msg_join_deny_server_full("Server full");
-                pkt.len = msg->payload_len + 2;
-                pkt.data[0] = msg->type;
-                pkt.data[1] = msg->payload_len;
-                memcpy(pkt.data + 2, msg->payload, msg->payload_len);
-                net_sendto(server->udp_sock, pkt.data, pkt.len, client_addr);
-                msg_free(msg);
+                log_net(
+                    "Redirecting join request to port %d\n",
+                    server->redirect_port);
+                send_join_response(
+                    server,
+                    client_addr,
+                    msg_join_redirect(server->redirect_port));
+                return 0;
+            }
+
+            if (hm_count(server->clients_by_addr) + 1 >
+                settings->max_players)
+            {
+                send_join_response(
+                    server,
+                    client_addr,
+                    msg_join_deny_server_full("Server full"));
                 return 0;
             }
 
             if (pp.join_request.username_len > settings->max_username_len)
             {
-                struct net_udp_packet pkt;
-                struct msg*           msg =
-                    msg_join_deny_bad_username("Username too long");
-                pkt.len = msg->payload_len + 2;
-                pkt.data[0] = msg->type;
-                pkt.data[1] = msg->payload_len;
-                memcpy(pkt.data + 2, msg->payload, msg->payload_len);
-                net_sendto(server->udp_sock, pkt.data, pkt.len, client_addr);
-                msg_free(msg);
+                send_join_response(
+                    server,
+                    client_addr,
+                    msg_join_deny_bad_username("Username too long"));
                 return 0;
             }
 
@@ -396,13 +1018,27 @@ static int process_message(
                 int           cbf_idx;
                 log_net("MSG_JOIN_REQUEST \"%s\"\n", pp.join_request.username);
 
-                client =
-                    server_client_hm_emplace_new(&server->clients, client_addr);
-                CLITHER_DEBUG_ASSERT(client != NULL);
+                client = server_add_client(server, client_addr);
+                if (client == NULL)
+                    return -1;
 
+                client->pkt.len = ACK_HEADER_SIZE;
+                ack_init(&client->ack);
                 msg_vec_init(&client->pending_msgs);
                 proximity_state_bmap_init(&client->snakes_in_proximity);
-                client->timeout_counter = 0;
+                client->last_recv_tick = server->timers.now;
+                client->timeout_tick = server->timers.now +
+                                       (uint32_t)settings->client_timeout *
+                                           settings->net_tick_rate +
+                                       1;
+                if (timer_wheel_add(
+                        &server->timers,
+                        client->timeout_tick,
+                        TIMER_CLIENT_TIMEOUT,
+                        client_addr) != 0)
+                {
+                    return -1;
+                }
                 client->snake_id =
                     world_spawn_snake(world, pp.join_request.username);
                 client->last_command_msg_frame = frame_number;
@@ -433,22 +1069,25 @@ static int process_message(
                     pp.join_request.frame,
                     frame_number,
                     client->snake_id,
-                    &snake->head.pos);
+                    &snake->head.pos,
+                    client->conn_id);
                 msg_vec_push(&client->pending_msgs, response);
             }
             return 0;
         }
 
+        case MSG_JOIN_CHALLENGE:
         case MSG_JOIN_ACCEPT:
         case MSG_JOIN_DENY_BAD_PROTOCOL:
         case MSG_JOIN_DENY_BAD_USERNAME:
-        case MSG_JOIN_DENY_SERVER_FULL: {
+        case MSG_JOIN_DENY_SERVER_FULL:
+        case MSG_JOIN_REDIRECT: {
             log_warn("Server received unexpected message type %d\n", msg_type);
             break;
         }
 
         case MSG_LEAVE: {
-            client_remove(server, world, client_addr, client);
+            client_remove(server, world, client);
             return 0;
         }
 
@@ -526,13 +1165,14 @@ static int process_message(
         }
 
         case MSG_SNAKE_BEZIER: break;
+        case MSG_SNAKE_BEZIER_BATCH: break;
         case MSG_SNAKE_BEZIER_ACK: {
             break;
         }
     }
 
     mark_client_as_malicious_and_drop(
-        server, client_addr, client, world, settings->malicious_timeout);
+        server, client_addr, client, world, settings);
 
     return 0;
 }
@@ -549,13 +1189,14 @@ static int unpack_packet(
     uint16_t                      frame_number)
 {
     /*
-     * Packet can contain multiple message objects.
+     * Packet can contain multiple message objects after the connection id and
+     * the header.
      * buf[0] == message type
      * buf[1] == message payload length
      * buf[2] == beginning of message payload
      */
     int i;
-    for (i = 0; i < udp_len - 1;)
+    for (i = MSG_CONN_ID_SIZE + ACK_HEADER_SIZE; i < udp_len - 1;)
     {
         enum msg_type  type = udp_buf[i + 0];
         const uint8_t  msg_len = udp_buf[i + 1];
@@ -577,7 +1218,7 @@ static int unpack_packet(
                 client_addr,
                 client,
                 world,
-                settings->malicious_timeout);
+                settings);
             break;
         }
 
@@ -616,114 +1257,593 @@ static int unpack_packet(
 }
 
 /* ------------------------------------------------------------------------- */
-int server_recv(
-    struct server*                server,
-    const struct server_settings* settings,
-    struct world*                 world,
-    uint16_t                      frame_number)
+struct timeout_ctx
 {
-    uint8_t                udp_buf[NET_MAX_UDP_PACKET_SIZE];
-    const struct net_addr* server_addr;
-    struct net_addr        client_addr;
-    struct server_client*  client;
-    int                    slot;
-    int*                   timeout;
+    struct server*                server;
+    const struct server_settings* settings;
+    struct world*                 world;
+};
 
-    log_net("server_recv() frame=%d\n", frame_number);
+static int on_timer_expired(const struct timer* t, void* user)
+{
+    struct timeout_ctx* ctx = user;
+    struct server*      server = ctx->server;
+    uint32_t            now = server->timers.now;
+    struct net_addr_str ipstr;
 
-    /* Update timeout counters of every client that we've communicated with */
-    server_client_hm_for_each (server->clients, slot, server_addr, client)
+    switch (t->type)
     {
-        client->timeout_counter++;
+        case TIMER_CLIENT_TIMEOUT: {
+            uint32_t timeout = (uint32_t)ctx->settings->client_timeout *
+                               ctx->settings->net_tick_rate;
+            struct server_client* client =
+                find_client_by_addr(server, &t->addr);
+
+            /* The client left or moved to another address, or this is the
+             * timer of a previous client that used the same address */
+            if (client == NULL || client->timeout_tick != t->expires)
+                break;
+
+            /* Packets arrived in the meantime, check again later */
+            if (now - client->last_recv_tick <= timeout)
+            {
+                client->timeout_tick = client->last_recv_tick + timeout + 1;
+                return timer_wheel_add(
+                    &server->timers,
+                    client->timeout_tick,
+                    TIMER_CLIENT_TIMEOUT,
+                    &t->addr);
+            }
 
-        if (client->timeout_counter >
-            settings->client_timeout * settings->net_tick_rate)
-        {
-            struct net_addr_str ipstr;
-            net_addr_to_str(&ipstr, server_addr);
+            net_addr_to_str(&ipstr, &t->addr);
             log_warn("Client %s timed out\n", ipstr.cstr);
-            client_remove(server, world, server_addr, client);
+            client_remove(server, ctx->world, client);
+            break;
+        }
+
+        case TIMER_MALICIOUS_EXPIRY: {
+            int* expires =
+                net_addr_hm_find(server->malicious_clients, &t->addr);
+            if (expires == NULL)
+                break;
+
+            /* The client kept sending packets, which extends the timeout */
+            if ((int)((uint32_t)*expires - now) > 0)
+                return timer_wheel_add(
+                    &server->timers,
+                    (uint32_t)*expires,
+                    TIMER_MALICIOUS_EXPIRY,
+                    &t->addr);
+
+            net_addr_to_str(&ipstr, &t->addr);
+            log_info("Client %s removed from malicious list\n", ipstr.cstr);
+            net_addr_hm_erase(server->malicious_clients, &t->addr);
+            break;
         }
     }
 
-    /* Update malicious client timeouts */
-    net_addr_hm_for_each (server->malicious_clients, slot, server_addr, timeout)
+    return 0;
+}
+
+int server_update_timeouts(
+    struct server*                server,
+    const struct server_settings* settings,
+    struct world*                 world)
+{
+    struct timeout_ctx ctx;
+    ctx.server = server;
+    ctx.settings = settings;
+    ctx.world = world;
+    if (timer_wheel_advance(&server->timers, on_timer_expired, &ctx) != 0)
+        return -1;
+
+    if ((int32_t)(server->timers.now - server->cookie_rotate_tick) >= 0)
     {
-        struct net_addr_str ipstr;
+        if (join_cookie_rotate(&server->cookies) != 0)
+            return -1;
+        server->cookie_rotate_tick =
+            server->timers.now +
+            (uint32_t)JOIN_COOKIE_ROTATE_INTERVAL * settings->net_tick_rate;
+    }
 
-        if (--(*timeout) > 0)
-            continue;
+    return 0;
+}
 
-        net_addr_to_str(&ipstr, server_addr);
-        log_info("Client %s removed from malicious list\n", ipstr.cstr);
-        net_addr_hm_erase(server->malicious_clients, server_addr);
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Moves a client to the address its packets now arrive from, e.g.
+ * because a NAT mapping changed. Only a packet newer than any received so far
+ * can do this, so packets from the old address that were delayed don't move
+ * the client back.
+ * \param[in] header The ack header of the packet.
+ * \return Returns 1 if the client moved, 0 if the packet should be dropped,
+ * or -1 if the client's timeout couldn't be moved along with it.
+ */
+static int rebind_client(
+    struct server*         server,
+    struct server_client*  client,
+    const struct net_addr* addr,
+    const uint8_t*         header,
+    int                    len)
+{
+    struct net_addr_str ipstr;
+    uint16_t            seq;
+    int                 slot;
+
+    if (len < ACK_HEADER_SIZE)
+        return 0;
+    seq = (header[0] << 8) | header[1];
+    if (client->ack.recv_seq != 0 && !u16_gt_wrap(seq, client->ack.recv_seq))
+        return 0;
+
+    if (net_addr_hm_find(server->banned_clients, addr) ||
+        net_addr_hm_find(server->malicious_clients, addr) ||
+        net_addr_hm_find(server->clients_by_addr, addr))
+    {
+        return 0;
     }
 
-    /* We may need to read more than one UDP packet */
-    while (1)
+    /* The client stays on its old address if this fails */
+    slot = (int)(client->conn_id & 0xFFFF);
+    if (net_addr_hm_insert_new(&server->clients_by_addr, addr, slot) != 0)
+        return 0;
+    net_addr_hm_erase(server->clients_by_addr, &client->addr);
+    client->addr = *addr;
+
+    net_addr_to_str(&ipstr, addr);
+    log_info("Client moved to %s\n", ipstr.cstr);
+
+    /* The timer registered for the old address won't find the client
+     * anymore */
+    if (timer_wheel_add(
+            &server->timers,
+            client->timeout_tick,
+            TIMER_CLIENT_TIMEOUT,
+            addr) != 0)
     {
-        struct server_client* client;
-        int                   udp_len;
+        return -1;
+    }
 
-        udp_len = net_recvfrom(
-            server->udp_sock, udp_buf, sizeof(udp_buf), &client_addr);
+    return 1;
+}
 
-        /* Nothing received or error */
-        if (udp_len <= 0)
-            return udp_len;
-        log_net("Received UDP packet, size=%d\n", udp_len);
+/* ------------------------------------------------------------------------- */
+int server_process_packets(
+    struct server*                server,
+    const struct server_settings* settings,
+    struct world*                 world,
+    const struct net_udp_packet*  pkts,
+    const struct net_addr*        client_addrs,
+    int                           count,
+    uint16_t                      frame_number)
+{
+    int i;
+    for (i = 0; i != count; ++i)
+    {
+        struct server_client*  client;
+        const struct net_addr* client_addr = &client_addrs[i];
+        const uint8_t*         data = pkts[i].data;
+        int                    len = pkts[i].len;
+        uint64_t               conn_id = 0;
+        log_net("Received UDP packet, size=%d\n", len);
 
         /*
-         * If we received a packet from a banned client, ignore packet
+         * Rate limit every address before doing anything else. This only
+         * touches one cache line, so a flood from a single address is
+         * dropped before any of the hash maps below are looked at
          */
-        if (net_addr_hm_find(server->banned_clients, &client_addr))
+        if (!admission_check(
+                server->admission,
+                client_addr,
+                server->timers.now,
+                settings->packet_rate,
+                settings->packet_burst,
+                settings->net_tick_rate))
+        {
             continue;
+        }
 
         /*
-         * If we received a packet from a potentially malicious client,
-         * increase their timeout
+         * Packets of clients that joined carry their connection id, which
+         * indexes the client table directly. The address is only compared to
+         * check that the packet came from the client
          */
+        if (len >= MSG_CONN_ID_SIZE)
         {
-            int* timeout =
-                net_addr_hm_find(server->malicious_clients, &client_addr);
-            if (timeout != NULL)
+            int byte;
+            for (byte = 0; byte != MSG_CONN_ID_SIZE; ++byte)
+                conn_id = (conn_id << 8) | data[byte];
+        }
+        client = find_client(server, conn_id);
+        if (client != NULL && !net_addr_equal(&client->addr, client_addr))
+        {
+            switch (rebind_client(
+                server,
+                client,
+                client_addr,
+                data + MSG_CONN_ID_SIZE,
+                len - MSG_CONN_ID_SIZE))
             {
-                *timeout +=
-                    settings->malicious_timeout * settings->net_tick_rate;
+                case 1: break;
+                case 0: continue;
+                default: return -1;
+            }
+        }
+
+        if (client == NULL)
+        {
+            /*
+             * If we received a packet from a banned client, ignore packet
+             */
+            if (net_addr_hm_find(server->banned_clients, client_addr))
                 continue;
+
+            /*
+             * If we received a packet from a potentially malicious client,
+             * increase their timeout
+             */
+            {
+                int* expires =
+                    net_addr_hm_find(server->malicious_clients, client_addr);
+                if (expires != NULL)
+                {
+                    *expires +=
+                        settings->malicious_timeout * settings->net_tick_rate;
+                    continue;
+                }
             }
+
+            /* Clients that didn't receive their connection id yet keep
+             * sending join requests without one */
+            client = find_client_by_addr(server, client_addr);
         }
 
         /*
-         * If we received a packet from a registered client, reset their timeout
-         * counter
+         * If we received a packet from a registered client, reset their
+         * timeout counter
          */
-        client = server_client_hm_find(server->clients, &client_addr);
         if (client != NULL)
-            client->timeout_counter = 0;
+        {
+            client->last_recv_tick = server->timers.now;
+            switch (ack_read_header(
+                &client->ack,
+                data + MSG_CONN_ID_SIZE,
+                len - MSG_CONN_ID_SIZE))
+            {
+                case 1: break;
+                case 0: log_net("Dropping duplicate packet\n"); continue;
+                default:
+                    mark_client_as_malicious_and_drop(
+                        server,
+                        client_addr,
+                        client,
+                        world,
+                        settings);
+                    continue;
+            }
+        }
+        else if (len < MSG_CONN_ID_SIZE + ACK_HEADER_SIZE)
+            continue;
 
         if (unpack_packet(
                 server,
                 settings,
                 client,
-                &client_addr,
+                client_addr,
+                world,
+                data,
+                len,
+                frame_number) != 0)
+        {
+            return -1;
+        }
+
+        /* If this packet created the client, its header has to be tracked
+         * too, so the join request gets acked */
+        if (client == NULL)
+        {
+            client = find_client_by_addr(server, client_addr);
+            if (client != NULL)
+                ack_read_header(
+                    &client->ack,
+                    data + MSG_CONN_ID_SIZE,
+                    len - MSG_CONN_ID_SIZE);
+        }
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int server_recv(
+    struct server*                server,
+    const struct server_settings* settings,
+    struct world*                 world,
+    uint16_t                      frame_number)
+{
+    struct net_udp_packet pkts[NET_BATCH_SIZE];
+    struct net_addr       client_addrs[NET_BATCH_SIZE];
+
+    log_net("server_recv() frame=%d\n", frame_number);
+
+    if (server_update_timeouts(server, settings, world) != 0)
+        return -1;
+
+    /* We may need to read more than one batch of UDP packets */
+    while (1)
+    {
+        int pkt_count = net_recvfrom_many(
+            server->udp_sock, pkts, client_addrs, NET_BATCH_SIZE);
+
+        /* Nothing received or error */
+        if (pkt_count <= 0)
+            return pkt_count;
+
+        if (server_process_packets(
+                server,
+                settings,
                 world,
-                udp_buf,
-                udp_len,
+                pkts,
+                client_addrs,
+                pkt_count,
                 frame_number) != 0)
         {
             return -1;
         }
+
+        /* A partial batch means the socket has been drained */
+        if (pkt_count < NET_BATCH_SIZE)
+            break;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+static struct server_instance* start_instance(
+    struct server_instance_bmap** instances,
+    const struct server_settings* settings,
+    struct mutex*                 lock,
+    const char*                   ip,
+    uint16_t                      port)
+{
+    struct server_instance*  instance;
+    struct server_instance** slot;
+
+    instance = mem_alloc(sizeof(*instance));
+    if (instance == NULL)
+    {
+        log_oom(sizeof(*instance), "start_instance()");
+        goto alloc_instance_failed;
+    }
+    instance->settings = settings;
+    instance->lock = lock;
+    instance->ip = ip;
+    instance->idle_since = 0;
+    sprintf(instance->port, "%u", (unsigned)port);
+    instance->player_count = 0;
+    instance->redirect_port = 0;
+    instance->load = 0;
+    instance->stop = 0;
+    instance->running = 1;
+
+    if (server_instance_bmap_emplace_new(instances, port, &slot) != BMAP_NEW)
+        goto insert_instance_failed;
+    *slot = instance;
+
+    instance->thread = thread_start(server_instance_run, instance);
+    if (instance->thread == NULL)
+        goto start_thread_failed;
+
+    return instance;
+
+start_thread_failed:
+    server_instance_bmap_erase(*instances, port);
+insert_instance_failed:
+    mem_free(instance);
+alloc_instance_failed:
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+static void
+stop_instance(struct server_instance_bmap* instances, uint16_t port)
+{
+    struct server_instance* instance =
+        *server_instance_bmap_find(instances, port);
+
+    mutex_lock(instance->lock);
+    instance->stop = 1;
+    mutex_unlock(instance->lock);
+
+    thread_join(instance->thread);
+    server_instance_bmap_erase(instances, port);
+    mem_free(instance);
+}
+
+/* ------------------------------------------------------------------------- */
+static void stop_all_instances(struct server_instance_bmap* instances)
+{
+    int16_t                  idx;
+    uint16_t                 port;
+    struct server_instance** instance;
+
+    /* Let all instances shut down in parallel before joining them */
+    bmap_for_each (instances, idx, port, instance)
+    {
+        (void)port;
+        mutex_lock((*instance)->lock);
+        (*instance)->stop = 1;
+        mutex_unlock((*instance)->lock);
+    }
+
+    while (bmap_count(instances) > 0)
+        stop_instance(instances, instances->keys[0]);
+}
+
+/* ------------------------------------------------------------------------- */
+struct restart_backoff
+{
+    uint64_t retry_at; /* tick_now() time before which nothing is started */
+    unsigned delay;    /* Seconds to wait after the next failure */
+};
+
+static void
+restart_backoff_failed(struct restart_backoff* backoff, uint64_t now)
+{
+    if (backoff->delay == 0)
+        backoff->delay = SERVER_INSTANCE_RESTART_DELAY;
+
+    log_warn(
+        "Not starting server instances for the next %u seconds\n",
+        backoff->delay);
+    backoff->retry_at = now + (uint64_t)backoff->delay * 1000000000;
+    if (backoff->delay < SERVER_INSTANCE_RESTART_DELAY_MAX)
+        backoff->delay *= 2;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Starts a new instance if all instances are full, and stops instances
+ * that have been empty for a while. The default instance is never stopped.
+ * Failed instances hold off starting new ones, see restart_backoff_failed().
+ * \return Returns -1 if the default instance stopped by itself, 0 otherwise.
+ */
+static int scale_instances(
+    struct server_instance_bmap** instances,
+    const struct server_settings* settings,
+    struct mutex*                 lock,
+    const char*                   ip,
+    uint16_t                      default_port,
+    struct restart_backoff*       backoff)
+{
+    int16_t                  idx;
+    uint16_t                 port;
+    struct server_instance** instance;
+    int                      full_count = 0;
+    int                      count = bmap_count(*instances);
+    uint16_t                 stopped_port = 0;
+    uint16_t                 idle_port = 0;
+    uint64_t                 now = tick_now();
+    const uint64_t           idle_timeout =
+        (uint64_t)SERVER_INSTANCE_IDLE_TIMEOUT * 1000000000;
+
+    mutex_lock(lock);
+    bmap_for_each (*instances, idx, port, instance)
+    {
+        if (!(*instance)->running)
+            stopped_port = port;
+        if (server_instance_is_full(*instance))
+            full_count++;
+
+        if (port == default_port || (*instance)->player_count > 0)
+            (*instance)->idle_since = 0;
+        else if ((*instance)->idle_since == 0)
+            (*instance)->idle_since = now;
+        else if (now - (*instance)->idle_since >= idle_timeout)
+            idle_port = port;
+    }
+    mutex_unlock(lock);
+
+    /* Instances stop by themselves on exit requests, or if they fail, e.g.
+     * because the port is in use */
+    if (stopped_port == default_port)
+    {
+        if (signals_exit_requested() == 0)
+            log_err("The default server instance stopped\n");
+        return -1;
+    }
+    if (stopped_port != 0)
+    {
+        log_warn("Server instance on port %u stopped\n", stopped_port);
+        stop_instance(*instances, stopped_port);
+        if (signals_exit_requested() == 0)
+            restart_backoff_failed(backoff, now);
+        return 0;
+    }
+
+    /* Only stop an idle instance if the others can take on new players, or it
+     * would have to be started again right away */
+    if (idle_port != 0 && full_count < count - 1)
+    {
+        log_info("Stopping idle server instance on port %u\n", idle_port);
+        stop_instance(*instances, idle_port);
+        backoff->delay = 0;
+        return 0;
+    }
+
+    if (full_count == count && count < settings->max_instances &&
+        now >= backoff->retry_at)
+    {
+        for (port = default_port + 1; port != 0; ++port)
+            if (server_instance_bmap_find(*instances, port) == NULL)
+                break;
+        if (port == 0)
+            return 0;
+
+        log_info(
+            "All server instances are full, starting another one on port "
+            "%u\n",
+            port);
+        if (start_instance(instances, settings, lock, ip, port) == NULL)
+        {
+            log_err("Failed to start server instance on port %u\n", port);
+            restart_backoff_failed(backoff, now);
+        }
     }
 
     return 0;
 }
 
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Tells every instance to redirect players to the instance with the
+ * fewest players that still has room, other than itself.
+ */
+static void
+assign_redirects(struct server_instance_bmap* instances, struct mutex* lock)
+{
+    int16_t                  idx;
+    uint16_t                 port;
+    struct server_instance** instance;
+    uint16_t                 best_port = 0, second_port = 0;
+    int                      best_count = 0, second_count = 0;
+
+    mutex_lock(lock);
+    bmap_for_each (instances, idx, port, instance)
+    {
+        int count = (*instance)->player_count;
+        if (!(*instance)->running || server_instance_is_full(*instance))
+            continue;
+
+        if (best_port == 0 || count < best_count)
+        {
+            second_port = best_port;
+            second_count = best_count;
+            best_port = port;
+            best_count = count;
+        }
+        else if (second_port == 0 || count < second_count)
+        {
+            second_port = port;
+            second_count = count;
+        }
+    }
+
+    bmap_for_each (instances, idx, port, instance)
+        (*instance)->redirect_port = port == best_port ? second_port : best_port;
+    mutex_unlock(lock);
+}
+
 /* ------------------------------------------------------------------------- */
 void* server_run(const void* args)
 {
     struct server_instance_bmap* instances;
     struct server_settings       settings;
+    struct mutex*                lock;
+    struct tick                  scale_tick;
+    struct restart_backoff       backoff;
+    uint16_t                     default_port;
     const struct args*           a = args;
 
     /* Change log prefix and color for server log messages */
@@ -737,57 +1857,55 @@ void* server_run(const void* args)
     if (server_settings_load_or_set_defaults(&settings, a->config_file) < 0)
         goto load_settings_failed;
 
+    lock = mutex_create();
+    if (lock == NULL)
+        goto create_lock_failed;
+
     /*
      * Create the default server instance. This is always active, regardless of
      * how many players are connected.
+     *
+     * The port passed in over the command line has precedence over the port
+     * specified in the config file. Note that the port obtained from the
+     * settings structure is always initialized, regardless of whether the
+     * config file existed or not.
      */
+    default_port = atoi(*a->port ? a->port : settings.port);
+    CLITHER_DEBUG_ASSERT(default_port != 0);
+    log_dbg("Starting default server instance\n");
+    if (start_instance(&instances, &settings, lock, a->ip, default_port) ==
+        NULL)
     {
-        /*
-         * The port passed in over the command line has precedence over the port
-         * specified in the config file. Note that the port obtained from the
-         * settings structure is always initialized, regardless of whether the
-         * config file existed or not.
-         */
-        struct server_instance* instance;
-        const char*             port = *a->port ? a->port : settings.port;
-        uint16_t                key = atoi(port);
-        CLITHER_DEBUG_ASSERT(key != 0);
-
-        if (server_instance_bmap_emplace_new(&instances, key, &instance) !=
-            BMAP_NEW)
-        {
-            goto start_default_instance_failed;
-        }
-        instance->settings = &settings;
-        instance->ip = a->ip;
-        strcpy(instance->port, port);
-
-        log_dbg("Starting default server instance\n");
-        instance->thread = thread_start(server_instance_run, instance);
-        if (instance->thread == NULL)
-        {
-            log_err(
-                "Failed to start the default server instance! Can't "
-                "continue\n");
-            goto start_default_instance_failed;
-        }
+        log_err(
+            "Failed to start the default server instance! Can't continue\n");
+        goto start_default_instance_failed;
     }
 
-    /* For now we don't create more instances once the server fills up */
+    backoff.retry_at = 0;
+    backoff.delay = 0;
+    tick_cfg(&scale_tick, INSTANCE_SCALE_RATE);
+    while (signals_exit_requested() == 0)
     {
-        int16_t                 idx;
-        uint16_t                port;
-        struct server_instance* instance;
-        bmap_for_each (instances, idx, port, instance)
+        tick_wait(&scale_tick);
+        if (scale_instances(
+                &instances,
+                &settings,
+                lock,
+                a->ip,
+                default_port,
+                &backoff) != 0)
         {
-            (void)port;
-            thread_join(instance->thread);
+            break;
         }
-        log_dbg("Joined all server instances\n");
+        assign_redirects(instances, lock);
     }
 
+    stop_all_instances(instances);
+    log_dbg("Joined all server instances\n");
+
     server_settings_save(&settings, a->config_file);
 
+    mutex_destroy(lock);
     server_instance_bmap_deinit(instances);
     mem_deinit_threadlocal();
     log_set_colors("", "");
@@ -796,6 +1914,8 @@ void* server_run(const void* args)
     return (void*)0;
 
 start_default_instance_failed:
+    mutex_destroy(lock);
+create_lock_failed:
 load_settings_failed:
     server_instance_bmap_deinit(instances);
     mem_deinit_threadlocal();
@@ -0,0 +1,3 @@
+#include "clither/server_client_vec.h"
+
+VEC_DEFINE(server_client_vec, struct server_client, 32)
@@ -2,32 +2,146 @@
 #include "clither/cli_colors.h"
 #include "clither/log.h"
 #include "clither/mem.h"
+#include "clither/msg.h"
+#include "clither/mutex.h"
 #include "clither/net.h"
+#include "clither/net_addr_hm.h"
 #include "clither/server.h"
 #include "clither/server_instance.h"
+#include "clither/server_io.h"
 #include "clither/server_settings.h"
 #include "clither/signals.h"
 #include "clither/snake_bmap.h"
+#include "clither/str.h"
+#include "clither/system.h"
 #include "clither/tick.h"
+#include "clither/tick_profiler.h"
+#include "clither/worker_pool.h"
 #include "clither/world.h"
 #include <stdio.h>  /* sprintf */
 #include <stdlib.h> /* atoi */
 
+/* Below this, waking up the workers costs more than stepping the snakes */
+#define MIN_SNAKES_PER_CHUNK 16
+
+enum tick_phase
+{
+    PHASE_RECV,
+    PHASE_STEP,
+    PHASE_WORLD,
+    PHASE_RANGE,
+    PHASE_QUEUE,
+    PHASE_SEND,
+    PHASE_TICK, /* Everything above, without waiting for the next tick */
+
+    PHASE_COUNT
+};
+
+static const char* phase_names[PHASE_COUNT] = {
+    "recv", "step", "world", "range", "queue", "send", "tick"};
+
+struct step_snakes_ctx
+{
+    struct snake_bmap* snakes;
+    uint16_t           frame_number;
+    uint8_t            sim_tick_rate;
+};
+
+/* ------------------------------------------------------------------------- */
+static void step_snakes(void* user, int begin, int end)
+{
+    int                     idx;
+    struct step_snakes_ctx* ctx = user;
+
+    for (idx = begin; idx != end; ++idx)
+    {
+        int           stale_segments;
+        struct cmd    cmd;
+        struct snake* snake = &ctx->snakes->values[idx];
+        if (!snake_try_reset_hold(snake, ctx->frame_number))
+            continue;
+        cmd = cmd_queue_take_or_predict(&snake->cmdq, ctx->frame_number);
+        /*snake_param_update(
+             &snake->param,
+             snake->param.upgrades,
+             snake->param.food_eaten + 1);*/
+        stale_segments = snake_step_server(
+            &snake->data, &snake->head, &snake->param, cmd, ctx->sim_tick_rate);
+        /* The new segment is added on a later frame instead */
+        if (stale_segments < 0)
+        {
+            log_err(
+                "Failed to add a segment to snake \"%s\"\n",
+                str_cstr(snake->data.name));
+            continue;
+        }
+        snake_remove_stale_segments(&snake->data, stale_segments);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+int server_instance_is_full(const struct server_instance* instance)
+{
+    return instance->player_count >= instance->settings->max_players ||
+           instance->load >= instance->settings->instance_cpu_budget;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Tells server_run() how many players are connected and how busy the
+ * instance is, and picks up which instance to redirect players to.
+ * \return Returns non-zero if server_run() wants the instance to stop.
+ */
+static int publish_status(
+    struct server_instance* instance,
+    struct server*          server,
+    uint64_t                busy_ns,
+    uint64_t                elapsed_ns)
+{
+    int stop;
+    mutex_lock(instance->lock);
+    instance->player_count = (uint16_t)hm_count(server->clients_by_addr);
+    if (elapsed_ns > 0)
+        instance->load =
+            busy_ns >= elapsed_ns ? 100 : (uint8_t)(busy_ns * 100 / elapsed_ns);
+    server->redirect_port = instance->redirect_port;
+    server->over_cpu_budget =
+        instance->load >= instance->settings->instance_cpu_budget;
+    stop = instance->stop;
+    mutex_unlock(instance->lock);
+    return stop;
+}
+
+/* ------------------------------------------------------------------------- */
+static void set_stopped(struct server_instance* instance)
+{
+    mutex_lock(instance->lock);
+    instance->running = 0;
+    mutex_unlock(instance->lock);
+}
+
 /* ------------------------------------------------------------------------- */
 void* server_instance_run(const void* args)
 {
     struct world                  world;
     struct server                 server;
+    struct server_io              io;
+    struct worker_pool            workers;
     struct tick                   sim_tick;
     struct tick                   net_tick;
+    struct tick_profiler          profiler;
+    struct step_snakes_ctx        step_ctx;
+    int                           sim_threads;
     uint16_t                      frame_number;
+    uint64_t                      busy_ns, status_time;
     char                          log_prefix[] = "S:xxxxx ";
-    const struct server_instance* instance = args;
+    struct server_instance*       instance = (struct server_instance*)args;
 
     static const char* colors[] = {
         COL_N_CYAN, COL_N_MAGENTA, COL_N_BLUE, COL_N_GREEN, COL_N_RED};
 
     mem_init_threadlocal();
+    msg_init_threadlocal();
 
     /* Change log prefix and color for server log messages */
     sprintf(log_prefix + 2, "%-6s", instance->port);
@@ -40,57 +154,98 @@ void* server_instance_run(const void* args)
         goto server_init_failed;
     net_log_host_ips();
 
+    /* Each snake's step only touches its own data. The world's quadtree is
+     * brought up to date afterwards by world_step(). If more instances can be
+     * started, the cores are shared between them */
+    sim_threads = instance->settings->sim_threads;
+    if (sim_threads == 0)
+        sim_threads = system_cpu_count() / instance->settings->max_instances;
+    if (sim_threads < 1)
+        sim_threads = 1;
+    if (worker_pool_init(&workers, sim_threads) != 0)
+        goto worker_pool_init_failed;
+    if (server_io_init(&io, server.udp_sock) != 0)
+        goto server_io_init_failed;
+
     log_dbg("Started server instance\n");
     tick_cfg(&sim_tick, instance->settings->sim_tick_rate);
     tick_cfg(&net_tick, instance->settings->net_tick_rate);
+    tick_profiler_init(
+        &profiler,
+        phase_names,
+        PHASE_COUNT,
+        instance->settings->profile_interval);
     frame_number = 0;
+    busy_ns = 0;
+    status_time = tick_now();
     while (signals_exit_requested() == 0)
     {
-        struct snake* snake;
-        int16_t       idx;
-        int           tick_lag, net_update;
-        uint16_t      uid;
+        int                             tick_lag, net_update;
+        const struct server_io_packets* received;
 
+        tick_profiler_begin(&profiler);
+
+        /* Packets are processed every sim tick instead of every net tick, so
+         * commands are queued as soon as possible */
         net_update = tick_advance(&net_tick);
-        if (net_update)
-        {
-            if (server_recv(
-                    &server, instance->settings, &world, frame_number) != 0)
-                break;
-        }
+        if (net_update &&
+            server_update_timeouts(&server, instance->settings, &world) != 0)
+            break;
+        received = server_io_take(&io);
+        if (received == NULL)
+            break;
+        if (server_process_packets(
+                &server,
+                instance->settings,
+                &world,
+                received->pkts,
+                received->addrs,
+                received->count,
+                frame_number) != 0)
+            break;
+        tick_profiler_end(&profiler, PHASE_RECV);
 
         /* sim_update */
-        bmap_for_each (world.snakes, idx, uid, snake)
-        {
-            struct cmd cmd;
-            (void)uid;
-            if (!snake_try_reset_hold(snake, frame_number))
-                continue;
-            cmd = cmd_queue_take_or_predict(&snake->cmdq, frame_number);
-            /*snake_param_update(
-                 &snake->param,
-                 snake->param.upgrades,
-                 snake->param.food_eaten + 1);*/
-            snake_remove_stale_segments(
-                &snake->data,
-                snake_step(
-                    &snake->data,
-                    &snake->head,
-                    &snake->param,
-                    cmd,
-                    instance->settings->sim_tick_rate));
-        }
+        step_ctx.snakes = world.snakes;
+        step_ctx.frame_number = frame_number;
+        step_ctx.sim_tick_rate = instance->settings->sim_tick_rate;
+        worker_pool_run(
+            &workers,
+            step_snakes,
+            &step_ctx,
+            bmap_count(world.snakes),
+            MIN_SNAKES_PER_CHUNK);
+        tick_profiler_end(&profiler, PHASE_STEP);
         world_step(&world, frame_number, instance->settings->sim_tick_rate);
+        tick_profiler_end(&profiler, PHASE_WORLD);
 
         if (net_update)
         {
             if (server_update_snakes_in_range(&server, &world, make_qw(10)) !=
                 0)
                 break;
-            if (server_queue_snake_data(&server, &world, frame_number) != 0)
+            tick_profiler_end(&profiler, PHASE_RANGE);
+            if (server_queue_snake_data(
+                    &server, instance->settings, &world, frame_number) != 0)
                 break;
+            tick_profiler_end(&profiler, PHASE_QUEUE);
             if (server_send_pending_data(&server, &world) != 0)
                 break;
+            tick_profiler_end(&profiler, PHASE_SEND);
+        }
+
+        tick_profiler_end_tick(&profiler, PHASE_TICK);
+        tick_profiler_report(&profiler);
+
+        busy_ns += tick_now() - profiler.tick_start;
+        if (net_update)
+        {
+            uint64_t now = tick_now();
+            if (publish_status(
+                    instance, &server, busy_ns, now - status_time))
+                break;
+            busy_ns = 0;
+            status_time = now;
         }
 
         if ((tick_lag = tick_wait(&sim_tick)) > 0)
@@ -103,16 +258,25 @@ void* server_instance_run(const void* args)
     }
     log_info("Stopping server instance\n");
 
+    server_io_deinit(&io);
+    worker_pool_deinit(&workers);
     server_deinit(&server);
     world_deinit(&world);
 
+    msg_deinit_threadlocal();
     (void)mem_deinit_threadlocal();
 
+    set_stopped(instance);
     return (void*)0;
 
+server_io_init_failed:
+    worker_pool_deinit(&workers);
+worker_pool_init_failed:
+    server_deinit(&server);
 server_init_failed:
     world_deinit(&world);
     log_set_colors("", "");
     log_set_prefix("");
+    set_stopped(instance);
     return (void*)-1;
 }
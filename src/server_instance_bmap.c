@@ -1,3 +1,3 @@
 #include "clither/server_instance_bmap.h"
 
-BMAP_DEFINE(server_instance_bmap, uint16_t, struct server_instance, 16)
+BMAP_DEFINE(server_instance_bmap, uint16_t, struct server_instance*, 16)
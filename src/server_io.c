@@ -0,0 +1,176 @@
+#include "clither/log.h"
+#include "clither/mem.h"
+#include "clither/mutex.h"
+#include "clither/server_io.h"
+#include "clither/thread.h"
+#include <string.h> /* memcpy */
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Appends a batch of received packets to the incoming buffer. Must be
+ * called with the lock held.
+ */
+static void push_packets(
+    struct server_io*            io,
+    const struct net_udp_packet* pkts,
+    const struct net_addr*       addrs,
+    int                          count)
+{
+    struct server_io_packets* incoming = io->incoming;
+    int                       space = SERVER_IO_CAPACITY - incoming->count;
+    if (count > space)
+    {
+        io->dropped += count - space;
+        count = space;
+    }
+
+    memcpy(
+        incoming->pkts + incoming->count,
+        pkts,
+        sizeof(*pkts) * (size_t)count);
+    memcpy(
+        incoming->addrs + incoming->count,
+        addrs,
+        sizeof(*addrs) * (size_t)count);
+    incoming->count += count;
+}
+
+/* ------------------------------------------------------------------------- */
+static void* fail(struct server_io* io)
+{
+    mutex_lock(io->lock);
+    io->failed = 1;
+    mutex_unlock(io->lock);
+    return (void*)-1;
+}
+
+/* ------------------------------------------------------------------------- */
+static void* io_main(const void* args)
+{
+    struct server_io*     io = (struct server_io*)args;
+    struct net_udp_packet pkts[NET_BATCH_SIZE];
+    struct net_addr       addrs[NET_BATCH_SIZE];
+
+    while (1)
+    {
+        int ready = net_poll_wait(io->pollfd, SERVER_IO_POLL_TIMEOUT_MS);
+
+        mutex_lock(io->lock);
+        if (io->shutdown)
+        {
+            mutex_unlock(io->lock);
+            break;
+        }
+        mutex_unlock(io->lock);
+
+        if (ready < 0)
+            return fail(io);
+
+        /* Drain the socket so the next wait only wakes up for new data */
+        while (ready)
+        {
+            int count =
+                net_recvfrom_many(io->sockfd, pkts, addrs, NET_BATCH_SIZE);
+            if (count < 0)
+                return fail(io);
+
+            mutex_lock(io->lock);
+            push_packets(io, pkts, addrs, count);
+            mutex_unlock(io->lock);
+
+            /* A partial batch means the socket has been drained */
+            ready = count == NET_BATCH_SIZE;
+        }
+    }
+
+    return (void*)0;
+}
+
+/* ------------------------------------------------------------------------- */
+int server_io_init(struct server_io* io, int sockfd)
+{
+    io->sockfd = sockfd;
+    io->dropped = 0;
+    io->shutdown = 0;
+    io->failed = 0;
+
+    io->incoming = mem_alloc(sizeof(*io->incoming));
+    if (io->incoming == NULL)
+    {
+        log_oom((int)sizeof(*io->incoming), "server_io_init()");
+        goto alloc_incoming_failed;
+    }
+    io->taken = mem_alloc(sizeof(*io->taken));
+    if (io->taken == NULL)
+    {
+        log_oom((int)sizeof(*io->taken), "server_io_init()");
+        goto alloc_taken_failed;
+    }
+    io->incoming->count = 0;
+    io->taken->count = 0;
+
+    io->lock = mutex_create();
+    if (io->lock == NULL)
+        goto create_lock_failed;
+
+    io->pollfd = net_poll_create(sockfd);
+    if (io->pollfd < 0)
+        goto poll_create_failed;
+
+    io->thread = thread_start(io_main, io);
+    if (io->thread == NULL)
+        goto start_thread_failed;
+
+    log_dbg("Started network I/O thread\n");
+
+    return 0;
+
+start_thread_failed:
+    net_poll_destroy(io->pollfd);
+poll_create_failed:
+    mutex_destroy(io->lock);
+create_lock_failed:
+    mem_free(io->taken);
+alloc_taken_failed:
+    mem_free(io->incoming);
+alloc_incoming_failed:
+    return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+void server_io_deinit(struct server_io* io)
+{
+    mutex_lock(io->lock);
+    io->shutdown = 1;
+    mutex_unlock(io->lock);
+
+    thread_join(io->thread);
+    net_poll_destroy(io->pollfd);
+    mutex_destroy(io->lock);
+    mem_free(io->taken);
+    mem_free(io->incoming);
+}
+
+/* ------------------------------------------------------------------------- */
+const struct server_io_packets* server_io_take(struct server_io* io)
+{
+    struct server_io_packets* taken = io->taken;
+    int                       dropped, failed;
+
+    taken->count = 0;
+
+    mutex_lock(io->lock);
+    io->taken = io->incoming;
+    io->incoming = taken;
+    dropped = io->dropped;
+    io->dropped = 0;
+    failed = io->failed;
+    mutex_unlock(io->lock);
+
+    if (failed)
+        return NULL;
+    if (dropped > 0)
+        log_warn("Dropped %d packets, the server can't keep up\n", dropped);
+
+    return io->taken;
+}
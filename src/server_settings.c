@@ -139,6 +139,13 @@ void server_settings_set_defaults(struct server_settings* s)
     s->net_tick_rate = 20;
     s->client_timeout = 5;
     s->malicious_timeout = 60;
+    s->snake_update_budget = 400;
+    s->sim_threads = 0;
+    s->profile_interval = 60;
+    s->max_instances = 1;
+    s->instance_cpu_budget = 75;
+    s->packet_rate = 60;
+    s->packet_burst = 30;
     strcpy(s->port, NET_DEFAULT_PORT);
 }
 
@@ -221,6 +228,101 @@ parse_server_malicious_timeout(struct parser* p, struct server_settings* server)
     return 0;
 }
 
+static int parse_server_snake_update_budget(
+    struct parser* p, struct server_settings* server)
+{
+    if (scan_next_token(p) != TOK_INTEGER)
+        return parser_error(p, "Expected an integer value\n");
+
+    if (p->value.integer_literal < 16 ||
+        p->value.integer_literal > NET_MAX_UDP_PACKET_SIZE)
+        return parser_error(
+            p,
+            "'snake_update_budget' must be 16-%d\n",
+            NET_MAX_UDP_PACKET_SIZE);
+
+    server->snake_update_budget = (uint16_t)p->value.integer_literal;
+    return 0;
+}
+
+static int
+parse_server_sim_threads(struct parser* p, struct server_settings* server)
+{
+    if (scan_next_token(p) != TOK_INTEGER)
+        return parser_error(p, "Expected an integer value\n");
+
+    if (p->value.integer_literal < 0 || p->value.integer_literal > 64)
+        return parser_error(p, "'sim_threads' must be 0-64\n");
+
+    server->sim_threads = (uint8_t)p->value.integer_literal;
+    return 0;
+}
+
+static int
+parse_server_max_instances(struct parser* p, struct server_settings* server)
+{
+    if (scan_next_token(p) != TOK_INTEGER)
+        return parser_error(p, "Expected an integer value\n");
+
+    if (p->value.integer_literal < 1 || p->value.integer_literal > 255)
+        return parser_error(p, "'max_instances' must be 1-255\n");
+
+    server->max_instances = (uint8_t)p->value.integer_literal;
+    return 0;
+}
+
+static int parse_server_instance_cpu_budget(
+    struct parser* p, struct server_settings* server)
+{
+    if (scan_next_token(p) != TOK_INTEGER)
+        return parser_error(p, "Expected an integer value\n");
+
+    if (p->value.integer_literal < 1 || p->value.integer_literal > 100)
+        return parser_error(p, "'instance_cpu_budget' must be 1-100\n");
+
+    server->instance_cpu_budget = (uint8_t)p->value.integer_literal;
+    return 0;
+}
+
+static int
+parse_server_packet_rate(struct parser* p, struct server_settings* server)
+{
+    if (scan_next_token(p) != TOK_INTEGER)
+        return parser_error(p, "Expected an integer value\n");
+
+    if (p->value.integer_literal < 1 || p->value.integer_literal > 255)
+        return parser_error(p, "'packet_rate' must be 1-255\n");
+
+    server->packet_rate = (uint8_t)p->value.integer_literal;
+    return 0;
+}
+
+static int
+parse_server_packet_burst(struct parser* p, struct server_settings* server)
+{
+    if (scan_next_token(p) != TOK_INTEGER)
+        return parser_error(p, "Expected an integer value\n");
+
+    if (p->value.integer_literal < 1 || p->value.integer_literal > 255)
+        return parser_error(p, "'packet_burst' must be 1-255\n");
+
+    server->packet_burst = (uint8_t)p->value.integer_literal;
+    return 0;
+}
+
+static int
+parse_server_profile_interval(struct parser* p, struct server_settings* server)
+{
+    if (scan_next_token(p) != TOK_INTEGER)
+        return parser_error(p, "Expected an integer value\n");
+
+    if (p->value.integer_literal < 0 || p->value.integer_literal > 0xFFFF)
+        return parser_error(p, "'profile_interval' must be 0-65535\n");
+
+    server->profile_interval = (uint16_t)p->value.integer_literal;
+    return 0;
+}
+
 static int parse_server_port(struct parser* p, struct server_settings* server)
 {
     struct strview value;
@@ -268,6 +370,13 @@ parse_server_key_values(struct parser* p, struct server_settings* server)
                 HANDLE_KEY(net_tick_rate)
                 HANDLE_KEY(client_timeout)
                 HANDLE_KEY(malicious_timeout)
+                HANDLE_KEY(snake_update_budget)
+                HANDLE_KEY(sim_threads)
+                HANDLE_KEY(profile_interval)
+                HANDLE_KEY(max_instances)
+                HANDLE_KEY(instance_cpu_budget)
+                HANDLE_KEY(packet_rate)
+                HANDLE_KEY(packet_burst)
                 HANDLE_KEY(port)
 #undef HANDLE_KEY
                 else
@@ -366,6 +475,13 @@ void server_settings_save(const struct server_settings* s, const char* filename)
     fprintf(fp, "net_tick_rate = %d    ; Network update speed in Hz. Should be smaller or equal to simulation speed\n", s->net_tick_rate);
     fprintf(fp, "client_timeout = %d    ; How many seconds to wait for a client before disconnecting them\n", s->client_timeout);
     fprintf(fp, "malicious_timeout = %d ; How many seconds to keep a client on the malicious list\n", s->malicious_timeout);
+    fprintf(fp, "snake_update_budget = %d ; Bytes per net tick each client gets for updates about other snakes\n", s->snake_update_budget);
+    fprintf(fp, "sim_threads = %d      ; Number of threads stepping snakes. 0 uses one per CPU core\n", s->sim_threads);
+    fprintf(fp, "profile_interval = %d ; Seconds between logging how long each phase of a server tick takes. 0 disables\n", s->profile_interval);
+    fprintf(fp, "max_instances = %d     ; Start more instances on the following ports while all are full. 1 disables\n", s->max_instances);
+    fprintf(fp, "instance_cpu_budget = %d ; Percent of a sim tick an instance may spend before it counts as full\n", s->instance_cpu_budget);
+    fprintf(fp, "packet_rate = %d      ; Packets per second each address may send. Excess packets are dropped unread\n", s->packet_rate);
+    fprintf(fp, "packet_burst = %d     ; Packets each address may send at once before packet_rate applies\n", s->packet_burst);
     fprintf(fp, "port = \"%s\"         ; Port to bind server to\n", s->port);
     /* clang-format on */
     fclose(fp);
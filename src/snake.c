@@ -3,10 +3,14 @@
 #include "clither/bezier_point_vec.h"
 #include "clither/log.h"
 #include "clither/q.h"
+#include "clither/quadtree.h"
+#include "clither/quadtree_handle_rb.h"
+#include "clither/qw_rb.h"
 #include "clither/qwaabb_rb.h"
 #include "clither/qwpos_vec.h"
 #include "clither/qwpos_vec_rb.h"
 #include "clither/snake.h"
+#include "clither/snake_segment_points_rb.h"
 #include "clither/str.h"
 #include "clither/wrap.h"
 
@@ -30,10 +34,12 @@ void snake_head_init(struct snake_head* head, struct qwpos spawn_pos)
 static int snake_data_init(
     struct snake_data* data, struct qwpos spawn_pos, const char* name)
 {
-    struct qwpos_vec**    trail;
-    struct bezier_handle* h1;
-    struct bezier_handle* h2;
-    struct qwaabb*        aabb;
+    struct qwpos_vec**           trail;
+    struct bezier_handle*        h1;
+    struct bezier_handle*        h2;
+    struct qwaabb*               aabb;
+    qw*                          length;
+    struct snake_segment_points* points;
 
     str_init(&data->name);
     if (str_set_cstr(&data->name, name) != 0)
@@ -41,8 +47,17 @@ static int snake_data_init(
 
     qwpos_vec_rb_init(&data->head_trails);
     bezier_handle_rb_init(&data->bezier_handles);
+    data->bezier_handle_id_base = 0;
     qwaabb_rb_init(&data->bezier_aabbs);
+    qw_rb_init(&data->bezier_lengths);
     bezier_point_vec_init(&data->bezier_points);
+    snake_segment_points_rb_init(&data->segment_points);
+    quadtree_handle_rb_init(&data->quadtree_items);
+    data->quadtree = NULL;
+    data->quadtree_stale_tail = 0;
+    data->quadtree_synced = 0;
+    data->quadtree_dirty = 0;
+    data->quadtree_key = 0;
 
     /*
      * Create the initial trail, which is the list of points the curve
@@ -55,6 +70,7 @@ static int snake_data_init(
     qwpos_vec_init(trail);
     if (qwpos_vec_push(trail, spawn_pos) != 0)
         goto push_spawn_pos_failed;
+    bezier_fit_sums_init(&data->head_fit_sums, *trail);
 
     /*
      * Create the first bezier segment, which consists of two handles. By
@@ -80,8 +96,22 @@ static int snake_data_init(
     data->aabb = *aabb =
         make_qwaabbqw(spawn_pos.x, spawn_pos.y, spawn_pos.x, spawn_pos.y);
 
+    /* Both handles are at the same position, so the curve has no length */
+    length = qw_rb_emplace_realloc(&data->bezier_lengths);
+    if (length == NULL)
+        goto emplace_length_failed;
+    *length = 0;
+
+    points = snake_segment_points_rb_emplace_realloc(&data->segment_points);
+    if (points == NULL)
+        goto emplace_points_failed;
+    bezier_point_vec_init(&points->points);
+    points->valid = 0;
+
     return 0;
 
+emplace_points_failed:
+emplace_length_failed:
 emplace_aabb_failed:
 emplace_h2_failed:
 emplace_h1_failed:
@@ -89,7 +119,9 @@ push_spawn_pos_failed:
     while (rb_count(data->head_trails) > 0)
         qwpos_vec_deinit(qwpos_vec_rb_take(data->head_trails));
 emplace_trail_failed:
+    snake_segment_points_rb_deinit(data->segment_points);
     bezier_point_vec_deinit(data->bezier_points);
+    qw_rb_deinit(data->bezier_lengths);
     qwaabb_rb_deinit(data->bezier_aabbs);
     bezier_handle_rb_deinit(data->bezier_handles);
     qwpos_vec_rb_deinit(data->head_trails);
@@ -98,10 +130,32 @@ set_name_failed:
     return -1;
 }
 
+/* ------------------------------------------------------------------------- */
+void snake_detach_quadtree(struct snake_data* data)
+{
+    if (data->quadtree == NULL)
+        return;
+
+    while (rb_count(data->quadtree_items) > 0)
+        quadtree_remove(
+            data->quadtree, quadtree_handle_rb_take(data->quadtree_items));
+    data->quadtree = NULL;
+    data->quadtree_stale_tail = 0;
+    data->quadtree_synced = 0;
+    data->quadtree_dirty = 0;
+}
+
 /* ------------------------------------------------------------------------- */
 static void snake_data_deinit(struct snake_data* data)
 {
+    snake_detach_quadtree(data);
+    quadtree_handle_rb_deinit(data->quadtree_items);
+    while (rb_count(data->segment_points) > 0)
+        bezier_point_vec_deinit(
+            snake_segment_points_rb_take(data->segment_points).points);
+    snake_segment_points_rb_deinit(data->segment_points);
     bezier_point_vec_deinit(data->bezier_points);
+    qw_rb_deinit(data->bezier_lengths);
     qwaabb_rb_deinit(data->bezier_aabbs);
     bezier_handle_rb_deinit(data->bezier_handles);
     while (rb_count(data->head_trails) > 0)
@@ -110,6 +164,130 @@ static void snake_data_deinit(struct snake_data* data)
     str_deinit(data->name);
 }
 
+/* ------------------------------------------------------------------------- */
+int snake_attach_quadtree(
+    struct snake_data* data, struct quadtree* quadtree, uint16_t key)
+{
+    snake_detach_quadtree(data);
+    data->quadtree = quadtree;
+    data->quadtree_key = key;
+
+    if (snake_sync_quadtree(data) != 0)
+    {
+        snake_detach_quadtree(data);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int snake_sync_quadtree(struct snake_data* data)
+{
+    int i;
+
+    if (data->quadtree == NULL)
+        return 0;
+
+    for (; data->quadtree_stale_tail > 0; data->quadtree_stale_tail--)
+        quadtree_remove(
+            data->quadtree, quadtree_handle_rb_take(data->quadtree_items));
+    while (rb_count(data->quadtree_items) > data->quadtree_synced)
+        quadtree_remove(
+            data->quadtree, quadtree_handle_rb_takew(data->quadtree_items));
+
+    for (i = data->quadtree_dirty; i < data->quadtree_synced; ++i)
+        quadtree_update(
+            data->quadtree,
+            *rb_peek(data->quadtree_items, i),
+            *rb_peek(data->bezier_aabbs, i));
+    data->quadtree_dirty = data->quadtree_synced;
+
+    for (i = data->quadtree_synced; i != rb_count(data->bezier_aabbs); ++i)
+    {
+        int32_t item = quadtree_insert(
+            data->quadtree,
+            *rb_peek(data->bezier_aabbs, i),
+            data->quadtree_key);
+        if (item < 0)
+            return -1;
+        if (quadtree_handle_rb_put_realloc(&data->quadtree_items, item) != 0)
+        {
+            quadtree_remove(data->quadtree, item);
+            return -1;
+        }
+        data->quadtree_synced++;
+        data->quadtree_dirty++;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*
+ * The following functions must be used to modify bezier_aabbs, so
+ * bezier_lengths and segment_points stay in sync, and so the changes are
+ * recorded for snake_sync_quadtree().
+ */
+static int segment_aabb_push(struct snake_data* data, struct qwaabb aabb)
+{
+    qw*                          length;
+    struct snake_segment_points* points;
+    struct qwaabb* bb = qwaabb_rb_emplace_realloc(&data->bezier_aabbs);
+    if (bb == NULL)
+        goto emplace_aabb_failed;
+    *bb = aabb;
+
+    /* New segments start out with both handles at the head */
+    length = qw_rb_emplace_realloc(&data->bezier_lengths);
+    if (length == NULL)
+        goto emplace_length_failed;
+    *length = 0;
+
+    points = snake_segment_points_rb_emplace_realloc(&data->segment_points);
+    if (points == NULL)
+        goto emplace_points_failed;
+    bezier_point_vec_init(&points->points);
+    points->valid = 0;
+
+    return 0;
+
+emplace_points_failed:
+    qw_rb_takew(data->bezier_lengths);
+emplace_length_failed:
+    qwaabb_rb_takew(data->bezier_aabbs);
+emplace_aabb_failed:
+    return -1;
+}
+static void segment_aabb_take(struct snake_data* data)
+{
+    qwaabb_rb_take(data->bezier_aabbs);
+    qw_rb_take(data->bezier_lengths);
+    bezier_point_vec_deinit(
+        snake_segment_points_rb_take(data->segment_points).points);
+    if (data->quadtree_synced > 0)
+    {
+        data->quadtree_stale_tail++;
+        data->quadtree_synced--;
+    }
+    if (data->quadtree_dirty > 0)
+        data->quadtree_dirty--;
+}
+static void segment_aabb_takew(struct snake_data* data)
+{
+    qwaabb_rb_takew(data->bezier_aabbs);
+    qw_rb_takew(data->bezier_lengths);
+    bezier_point_vec_deinit(
+        snake_segment_points_rb_takew(data->segment_points).points);
+    if (data->quadtree_synced > rb_count(data->bezier_aabbs))
+        data->quadtree_synced = rb_count(data->bezier_aabbs);
+}
+static void segment_aabb_head_changed(struct snake_data* data)
+{
+    if (data->quadtree_dirty > rb_count(data->bezier_aabbs) - 1)
+        data->quadtree_dirty = rb_count(data->bezier_aabbs) - 1;
+}
+
 /* ------------------------------------------------------------------------- */
 int snake_init(struct snake* snake, struct qwpos spawn_pos, const char* name)
 {
@@ -244,63 +422,243 @@ static void snake_update_head_trail_aabb(struct snake_data* data)
         if (bb->y2 < p->y)
             bb->y2 = p->y;
     }
+
+    segment_aabb_head_changed(data);
 }
 
 /* ------------------------------------------------------------------------- */
 static int snake_update_curve_from_head(
     struct snake_data* data, const struct snake_head* head)
 {
-    struct qwpos_vec** trail;
-    double             error_squared;
+    struct qwpos_vec**    trail;
+    struct bezier_handle* head_handle;
+    struct bezier_handle* tail_handle;
+    double                error_squared;
 
     /* Append new position to the trail */
     trail = rb_peek_write(data->head_trails);
-    qwpos_vec_push(trail, head->pos);
+    if (qwpos_vec_push(trail, head->pos) != 0)
+        return -1;
+    bezier_fit_sums_push(&data->head_fit_sums, *trail);
 
     /* Fit current bezier segment to trail */
+    head_handle =
+        rb_peek(data->bezier_handles, rb_count(data->bezier_handles) - 1);
+    tail_handle =
+        rb_peek(data->bezier_handles, rb_count(data->bezier_handles) - 2);
     error_squared = bezier_fit_trail(
-        rb_peek(data->bezier_handles, rb_count(data->bezier_handles) - 1),
-        rb_peek(data->bezier_handles, rb_count(data->bezier_handles) - 2),
-        *trail);
+        head_handle, tail_handle, *trail, &data->head_fit_sums);
+    *rb_peek_write(data->bezier_lengths) =
+        bezier_calc_arc_length(head_handle, tail_handle);
 
     /*
      * If the fit's error exceeds some threshold (determined empirically),
      * signal that a new segment needs to be created.
      */
-    return error_squared > make_q16_16_2(1, 16);
+    return error_squared > make_q16_16_2(1, 16) ||
+           vec_count(*trail) >= BEZIER_FIT_MAX_POINTS;
 }
 
 /* ------------------------------------------------------------------------- */
-static void
+static int
 snake_add_new_segment(struct snake_data* data, const struct snake_head* head)
 {
+    struct qwpos_vec**    trail;
+    struct bezier_handle* handle;
+
     /*
      * Create new trail, which is the list of points the curve is fitted
      * to. This grows as the head moves forwards. Add the current head position
      * now, because we will want the start position of the curve to line up
      * with the end position of the previous curve.
      */
-    struct qwpos_vec** trail = qwpos_vec_rb_emplace_realloc(&data->head_trails);
+    trail = qwpos_vec_rb_emplace_realloc(&data->head_trails);
+    if (trail == NULL)
+        goto emplace_trail_failed;
     qwpos_vec_init(trail);
-    qwpos_vec_push(trail, head->pos);
+    if (qwpos_vec_push(trail, head->pos) != 0)
+        goto push_head_pos_failed;
 
     /*
      * Add a new bezier handle. Since there is only one datapoint, the curve
      * is completely defined by the current head position.
      */
-    bezier_handle_init(
-        bezier_handle_rb_emplace_realloc(&data->bezier_handles),
-        head->pos,
-        qa_add(head->angle, QA_PI));
+    handle = bezier_handle_rb_emplace_realloc(&data->bezier_handles);
+    if (handle == NULL)
+        goto emplace_handle_failed;
+    bezier_handle_init(handle, head->pos, qa_add(head->angle, QA_PI));
 
     /* Add a new bounding box, which is also defined by the current head
      * position */
-    *qwaabb_rb_emplace_realloc(&data->bezier_aabbs) =
-        make_qwaabbqw(head->pos.x, head->pos.y, head->pos.x, head->pos.y);
+    if (segment_aabb_push(
+            data,
+            make_qwaabbqw(head->pos.x, head->pos.y, head->pos.x, head->pos.y)) !=
+        0)
+        goto push_aabb_failed;
+
+    /* The sums still belong to the previous trail until everything else
+     * succeeded */
+    bezier_fit_sums_init(&data->head_fit_sums, *trail);
+
+    return 0;
+
+push_aabb_failed:
+    bezier_handle_rb_takew(data->bezier_handles);
+emplace_handle_failed:
+push_head_pos_failed:
+    qwpos_vec_deinit(qwpos_vec_rb_takew(data->head_trails));
+emplace_trail_failed:
+    return -1;
 }
 
 /* ------------------------------------------------------------------------- */
-int snake_step(
+static qw point_distance(struct qwpos a, struct qwpos b)
+{
+    const double dx = qw_sub(a.x, b.x);
+    const double dy = qw_sub(a.y, b.y);
+    return (qw)sqrt(dx * dx + dy * dy);
+}
+
+/* ------------------------------------------------------------------------- */
+static int append_points(
+    struct bezier_point_vec** dst, const struct bezier_point_vec* src, int n)
+{
+    if (vec_count(*dst) + n > vec_capacity(*dst))
+        if (bezier_point_vec_realloc(dst, vec_count(*dst) + n) != 0)
+            return -1;
+    memcpy((*dst)->data + (*dst)->count, src->data, n * sizeof(*src->data));
+    (*dst)->count += n;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Samples the curve and stores the points in data->bezier_points.
+ *
+ * Only the head segment, and segments that stopped being the head segment
+ * since the last call, are sampled. All other points are copied from
+ * data->segment_points.
+ * \return Returns the number of segments that are superfluous, same as
+ * bezier_calc_equidistant_points().
+ */
+static int snake_update_points(
+    struct snake_data* data, const struct snake_param* param)
+{
+    int                          i, head_idx;
+    qw                           total_spacing;
+    struct qwpos                 pos;
+    struct bezier_point*         bp;
+    struct snake_segment_points* sp;
+    const struct bezier_handle*  head = rb_peek_write(data->bezier_handles);
+    const qw spacing = qw_mul(SNAKE_PART_SPACING, snake_scale(param));
+    const qw length = snake_length(param);
+
+    /* The head segment changes shape every frame */
+    head_idx = rb_count(data->segment_points) - 1;
+    rb_peek_write(data->segment_points)->valid = 0;
+
+    /*
+     * Each segment continues where the segment behind it left off, so new
+     * segments are sampled starting with the one closest to the tail.
+     */
+    for (i = head_idx; i > 0; --i)
+        if (rb_peek(data->segment_points, i - 1)->valid)
+            break;
+    for (; i < head_idx; ++i)
+    {
+        sp = rb_peek(data->segment_points, i);
+        sp->last = i > 0 ? rb_peek(data->segment_points, i - 1)->last
+                         : rb_peek_read(data->bezier_handles)->pos;
+        bezier_point_vec_clear(sp->points);
+        if (bezier_sample_segment(
+                &sp->points,
+                rb_peek(data->bezier_handles, i + 1),
+                rb_peek(data->bezier_handles, i),
+                &sp->last,
+                spacing) != 0)
+            return 0;
+        if (vec_count(sp->points) > 1)
+            bezier_point_vec_reverse_range(
+                sp->points, 0, vec_count(sp->points));
+        sp->valid = 1;
+    }
+
+    /* Insert first point */
+    bezier_point_vec_clear(data->bezier_points);
+    bp = bezier_point_vec_emplace(&data->bezier_points);
+    if (bp == NULL)
+        return 0;
+    bp->pos = head->pos;
+    bp->dir.x = -qa_cos(head->angle);
+    bp->dir.y = -qa_sin(head->angle);
+
+    /*
+     * The head segment also continues from the segments behind it. This way,
+     * points are spaced evenly everywhere except right behind the head.
+     */
+    pos = head_idx > 0 ? rb_peek(data->segment_points, head_idx - 1)->last
+                       : rb_peek_read(data->bezier_handles)->pos;
+    if (bezier_sample_segment(
+            &data->bezier_points,
+            head,
+            rb_peek(data->bezier_handles, head_idx),
+            &pos,
+            spacing) != 0)
+        return 0;
+    if (vec_count(data->bezier_points) > 2)
+        bezier_point_vec_reverse_range(
+            data->bezier_points, 1, vec_count(data->bezier_points));
+
+    /* Cut off the points that go past the snake's length */
+    total_spacing = 0;
+    for (i = 1; i < vec_count(data->bezier_points); ++i)
+    {
+        total_spacing = qw_add(
+            total_spacing,
+            i == 1 ? point_distance(
+                         head->pos, vec_get(data->bezier_points, 1)->pos)
+                   : spacing);
+        if (total_spacing >= length)
+        {
+            data->bezier_points->count = i + 1;
+            return head_idx;
+        }
+    }
+
+    for (i = head_idx - 1; i >= 0; --i)
+    {
+        int keep;
+        sp = rb_peek(data->segment_points, i);
+        if (vec_count(sp->points) == 0)
+            continue;
+
+        total_spacing = qw_add(
+            total_spacing,
+            vec_count(data->bezier_points) == 1
+                ? point_distance(head->pos, vec_first(sp->points)->pos)
+                : spacing);
+        keep = vec_count(sp->points);
+        if (total_spacing >= length)
+            keep = 1;
+        else if (qw_add(total_spacing, (keep - 1) * spacing) >= length)
+            keep = 1 + (length - total_spacing + spacing - 1) / spacing;
+
+        if (append_points(&data->bezier_points, sp->points, keep) != 0)
+            return 0;
+        total_spacing = qw_add(total_spacing, (keep - 1) * spacing);
+        if (total_spacing >= length)
+            return i;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Moves the head and updates the curve, trails and AABBs. This is
+ * everything snake_step() and snake_step_server() have in common.
+ */
+static int step_curve(
     struct snake_data*        data,
     struct snake_head*        head,
     const struct snake_param* param,
@@ -311,6 +669,8 @@ int snake_step(
 
     snake_step_head(head, param, command, sim_tick_rate);
     need_new_segment = snake_update_curve_from_head(data, head);
+    if (need_new_segment < 0)
+        return -1;
 
     /*
      * Have to call these after updating curve data, because only then is the
@@ -319,17 +679,62 @@ int snake_step(
     snake_update_head_trail_aabb(data);
     snake_update_aabb(data);
 
-    if (need_new_segment)
-        snake_add_new_segment(data, head);
+    if (need_new_segment && snake_add_new_segment(data, head) != 0)
+        return -1;
 
     bezier_squeeze_step(data->bezier_handles, sim_tick_rate);
 
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int snake_step(
+    struct snake_data*        data,
+    struct snake_head*        head,
+    const struct snake_param* param,
+    struct cmd                command,
+    uint8_t                   sim_tick_rate)
+{
+    if (step_curve(data, head, param, command, sim_tick_rate) != 0)
+        return -1;
+
     /* This function returns the number of segments that are superfluous. */
-    return bezier_calc_equidistant_points(
-        &data->bezier_points,
-        data->bezier_handles,
-        qw_mul(SNAKE_PART_SPACING, snake_scale(param)),
-        snake_length(param));
+    return snake_update_points(data, param);
+}
+
+/* ------------------------------------------------------------------------- */
+int snake_step_server(
+    struct snake_data*        data,
+    struct snake_head*        head,
+    const struct snake_param* param,
+    struct cmd                command,
+    uint8_t                   sim_tick_rate)
+{
+    int      i;
+    qw       total_length = 0;
+    const qw spacing = qw_mul(SNAKE_PART_SPACING, snake_scale(param));
+    qw       length = snake_length(param);
+
+    if (step_curve(data, head, param, command, sim_tick_rate) != 0)
+        return -1;
+
+    /*
+     * bezier_calc_equidistant_points() only stops once it has placed enough
+     * points, so the length is rounded up to a whole number of spacings.
+     */
+    length = spacing * ((length + spacing - 1) / spacing);
+    if (length < spacing)
+        length = spacing;
+
+    /* Walk from the head towards the tail until the snake is long enough */
+    for (i = rb_count(data->bezier_lengths) - 1; i >= 0; --i)
+    {
+        total_length = qw_add(total_length, *rb_peek(data->bezier_lengths, i));
+        if (total_length >= length)
+            return i;
+    }
+
+    return 0;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -341,7 +746,8 @@ void snake_remove_stale_segments(struct snake_data* data, int stale_segments)
     {
         qwpos_vec_deinit(qwpos_vec_rb_take(data->head_trails));
         bezier_handle_rb_take(data->bezier_handles);
-        qwaabb_rb_take(data->bezier_aabbs);
+        data->bezier_handle_id_base++;
+        segment_aabb_take(data);
     }
 
     snake_update_aabb(data);
@@ -367,14 +773,15 @@ void snake_remove_stale_segments_with_rollback_constraint(
 
         qwpos_vec_deinit(qwpos_vec_rb_take(data->head_trails));
         bezier_handle_rb_take(data->bezier_handles);
-        qwaabb_rb_take(data->bezier_aabbs);
+        data->bezier_handle_id_base++;
+        segment_aabb_take(data);
     }
 
     snake_update_aabb(data);
 }
 
 /* ------------------------------------------------------------------------- */
-void snake_ack_frame(
+int snake_ack_frame(
     struct snake_data*        data,
     struct snake_head*        acknowledged_head,
     struct snake_head*        predicted_head,
@@ -392,7 +799,7 @@ void snake_ack_frame(
             "snake_ack_frame(): Command buffer of snake \"%s\" is empty. Can't "
             "step.\n",
             str_cstr(data->name));
-        return;
+        return 0;
     }
     last_ackd_frame = cmd_queue_frame_begin(cmdq);
     predicted_frame = cmd_queue_frame_end(cmdq);
@@ -410,7 +817,7 @@ void snake_ack_frame(
             frame_number,
             last_ackd_frame,
             predicted_frame);
-        return;
+        return 0;
     }
 
     /*
@@ -434,6 +841,7 @@ void snake_ack_frame(
     if (snake_heads_are_equal(acknowledged_head, authoritative_head) == 0)
     {
         int               handles_to_squeeze;
+        int               need_new_segment;
         struct qwpos_vec* trail;
         uint16_t          frame;
         int               i;
@@ -468,16 +876,20 @@ void snake_ack_frame(
         trail = *rb_peek_write(data->head_trails);
         while (u16_gt_wrap(predicted_frame, frame_number))
         {
+            bezier_fit_sums_pop(&data->head_fit_sums, trail);
             qwpos_vec_pop(trail);
             if (vec_count(trail) == 0)
             {
                 qwpos_vec_deinit(qwpos_vec_rb_takew(data->head_trails));
                 bezier_handle_rb_takew(data->bezier_handles);
-                qwaabb_rb_takew(data->bezier_aabbs);
+                segment_aabb_takew(data);
 
-                /* Remove duplicate point */
+                /* Remove duplicate point. The sums of the previous trail
+                 * weren't kept, so this is the only time they are
+                 * recalculated from scratch */
                 trail = *rb_peek_write(data->head_trails);
                 qwpos_vec_pop(trail);
+                bezier_fit_sums_init(&data->head_fit_sums, trail);
             }
 
             predicted_frame--;
@@ -490,10 +902,14 @@ void snake_ack_frame(
         *acknowledged_head = *authoritative_head;
         *predicted_head = *authoritative_head;
         handles_to_squeeze = 0;
-        if (snake_update_curve_from_head(data, predicted_head))
+        need_new_segment = snake_update_curve_from_head(data, predicted_head);
+        if (need_new_segment < 0)
+            return -1;
+        if (need_new_segment)
         {
             snake_update_head_trail_aabb(data);
-            snake_add_new_segment(data, predicted_head);
+            if (snake_add_new_segment(data, predicted_head) != 0)
+                return -1;
             handles_to_squeeze++;
         }
 
@@ -501,10 +917,15 @@ void snake_ack_frame(
         cmd_queue_for_each(cmdq, i, frame, command)
         {
             snake_step_head(predicted_head, param, *command, sim_tick_rate);
-            if (snake_update_curve_from_head(data, predicted_head))
+            need_new_segment =
+                snake_update_curve_from_head(data, predicted_head);
+            if (need_new_segment < 0)
+                return -1;
+            if (need_new_segment)
             {
                 snake_update_head_trail_aabb(data);
-                snake_add_new_segment(data, predicted_head);
+                if (snake_add_new_segment(data, predicted_head) != 0)
+                    return -1;
                 handles_to_squeeze++;
             }
 
@@ -520,13 +941,12 @@ void snake_ack_frame(
         snake_update_head_trail_aabb(data);
         snake_update_aabb(data);
 
-        /* TODO: distance is a function of the snake's length */
-        bezier_calc_equidistant_points(
-            &data->bezier_points,
-            data->bezier_handles,
-            qw_mul(SNAKE_PART_SPACING, snake_scale(param)),
-            snake_length(param));
+        snake_update_points(data, param);
+
+        return 1;
     }
+
+    return 0;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -0,0 +1,194 @@
+#include "clither/log.h"
+#include "clither/mem.h"
+#include "clither/snake.h"
+#include "clither/snake_bmap.h"
+#include "clither/snake_grid.h"
+#include <string.h> /* memset */
+
+/*
+ * Snakes whose expanded bounding box covers more cells than this are not
+ * inserted into the grid, but are tested by every query instead. This bounds
+ * the cost of inserting a single, very long snake.
+ */
+#define MAX_CELLS_PER_SNAKE 64
+
+VEC_DEFINE(snake_grid_entry_vec, struct snake_grid_entry, 32)
+VEC_DEFINE(snake_grid_id_vec, uint16_t, 16)
+
+/* ------------------------------------------------------------------------- */
+static int16_t cell_coord(qw value, qw cell_size)
+{
+    int32_t cell = value >= 0 ? value / cell_size
+                              : -((-value + cell_size - 1) / cell_size);
+    if (cell > INT16_MAX)
+        return INT16_MAX;
+    if (cell < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t)cell;
+}
+
+/* ------------------------------------------------------------------------- */
+static int32_t bucket_of(const struct snake_grid* grid, int16_t x, int16_t y)
+{
+    uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u;
+    return (int32_t)(h & (uint32_t)(grid->bucket_count - 1));
+}
+
+/* ------------------------------------------------------------------------- */
+void snake_grid_init(struct snake_grid* grid, qw cell_size)
+{
+    CLITHER_DEBUG_ASSERT(cell_size > 0);
+    snake_grid_entry_vec_init(&grid->entries);
+    snake_grid_entry_vec_init(&grid->scratch);
+    snake_grid_id_vec_init(&grid->oversized);
+    grid->buckets = NULL;
+    grid->bucket_count = 0;
+    grid->cell_size = cell_size;
+}
+
+/* ------------------------------------------------------------------------- */
+void snake_grid_deinit(struct snake_grid* grid)
+{
+    if (grid->buckets != NULL)
+        mem_free(grid->buckets);
+    snake_grid_id_vec_deinit(grid->oversized);
+    snake_grid_entry_vec_deinit(grid->scratch);
+    snake_grid_entry_vec_deinit(grid->entries);
+}
+
+/* ------------------------------------------------------------------------- */
+static int resize_buckets(struct snake_grid* grid, int32_t entry_count)
+{
+    int32_t bucket_count = 64;
+    while (bucket_count < entry_count * 2)
+        bucket_count *= 2;
+
+    if (bucket_count != grid->bucket_count)
+    {
+        int32_t* new_buckets = (int32_t*)mem_realloc(
+            grid->buckets, (int)sizeof(int32_t) * (bucket_count + 1));
+        if (new_buckets == NULL)
+            return log_oom(
+                (int)sizeof(int32_t) * (bucket_count + 1),
+                "snake_grid_rebuild()");
+        grid->buckets = new_buckets;
+        grid->bucket_count = bucket_count;
+    }
+
+    memset(grid->buckets, 0, sizeof(int32_t) * (bucket_count + 1));
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int snake_grid_rebuild(
+    struct snake_grid* grid, const struct snake_bmap* snakes, qw margin)
+{
+    int16_t                  idx;
+    uint16_t                 snake_id;
+    const struct snake*      snake;
+    struct snake_grid_entry* entry;
+    int32_t                  i, offset;
+
+    snake_grid_entry_vec_clear(grid->scratch);
+    snake_grid_id_vec_clear(grid->oversized);
+
+    /* Register every snake in all cells touched by its expanded AABB */
+    bmap_for_each (snakes, idx, snake_id, snake)
+    {
+        int16_t x, y, x1, y1, x2, y2;
+        x1 = cell_coord(qw_sub(snake->data.aabb.x1, margin), grid->cell_size);
+        y1 = cell_coord(qw_sub(snake->data.aabb.y1, margin), grid->cell_size);
+        x2 = cell_coord(qw_add(snake->data.aabb.x2, margin), grid->cell_size);
+        y2 = cell_coord(qw_add(snake->data.aabb.y2, margin), grid->cell_size);
+
+        if ((int32_t)(x2 - x1 + 1) * (y2 - y1 + 1) > MAX_CELLS_PER_SNAKE)
+        {
+            if (snake_grid_id_vec_push(&grid->oversized, snake_id) != 0)
+                return -1;
+            continue;
+        }
+
+        for (y = y1; y <= y2; ++y)
+            for (x = x1; x <= x2; ++x)
+            {
+                entry = snake_grid_entry_vec_emplace(&grid->scratch);
+                if (entry == NULL)
+                    return -1;
+                entry->cell_x = x;
+                entry->cell_y = y;
+                entry->snake_id = snake_id;
+            }
+    }
+
+    /* Counting sort the entries by bucket */
+    if (resize_buckets(grid, vec_count(grid->scratch)) != 0)
+        return -1;
+    vec_for_each (grid->scratch, entry)
+        grid->buckets[bucket_of(grid, entry->cell_x, entry->cell_y) + 1]++;
+    for (i = 0; i != grid->bucket_count; ++i)
+        grid->buckets[i + 1] += grid->buckets[i];
+
+    snake_grid_entry_vec_clear(grid->entries);
+    if (vec_count(grid->scratch) > vec_capacity(grid->entries))
+        if (snake_grid_entry_vec_realloc(
+                &grid->entries, vec_count(grid->scratch)) != 0)
+            return -1;
+    if (grid->entries != NULL)
+        grid->entries->count = vec_count(grid->scratch);
+
+    /* Use the start offsets as insertion cursors. Afterwards, each offset
+     * points to the end of its bucket, i.e. the start of the next one, so
+     * shift them back by one slot */
+    vec_for_each (grid->scratch, entry)
+    {
+        offset = grid->buckets[bucket_of(grid, entry->cell_x, entry->cell_y)]++;
+        grid->entries->data[offset] = *entry;
+    }
+    memmove(
+        grid->buckets + 1,
+        grid->buckets,
+        sizeof(int32_t) * grid->bucket_count);
+    grid->buckets[0] = 0;
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+int snake_grid_query(
+    const struct snake_grid* grid,
+    struct qwpos             pos,
+    int (*on_snake)(uint16_t snake_id, void* user),
+    void* user)
+{
+    int16_t   x, y;
+    int32_t   i, end;
+    uint16_t* snake_id;
+
+    vec_for_each (grid->oversized, snake_id)
+    {
+        int result = on_snake(*snake_id, user);
+        if (result < 0)
+            return result;
+    }
+
+    if (grid->bucket_count == 0)
+        return 0;
+
+    x = cell_coord(pos.x, grid->cell_size);
+    y = cell_coord(pos.y, grid->cell_size);
+    i = bucket_of(grid, x, y);
+    end = grid->buckets[i + 1];
+    for (i = grid->buckets[i]; i != end; ++i)
+    {
+        int                            result;
+        const struct snake_grid_entry* entry = &grid->entries->data[i];
+        /* Different cells can hash to the same bucket */
+        if (entry->cell_x != x || entry->cell_y != y)
+            continue;
+        result = on_snake(entry->snake_id, user);
+        if (result < 0)
+            return result;
+    }
+
+    return 0;
+}
@@ -0,0 +1,3 @@
+#include "clither/snake_segment_points_rb.h"
+
+RB_DEFINE(snake_segment_points_rb, struct snake_segment_points, 16)
@@ -1,8 +1,29 @@
-#include "odb-util/system.h"
+#include "clither/log.h"
+#include "clither/system.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
-int
-system_cpu_count(void)
+/* ------------------------------------------------------------------------- */
+int system_cpu_count(void)
 {
-    return sysconf(_SC_NPROCESSORS_ONLN);
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+/* ------------------------------------------------------------------------- */
+int system_random_bytes(void* buf, int len)
+{
+    size_t read;
+    FILE*  fp = fopen("/dev/urandom", "rb");
+    if (fp == NULL)
+        return log_err("Failed to open /dev/urandom: %s\n", strerror(errno));
+
+    read = fread(buf, 1, (size_t)len, fp);
+    fclose(fp);
+    if (read != (size_t)len)
+        return log_err("Failed to read from /dev/urandom\n");
+
+    return 0;
 }
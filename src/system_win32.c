@@ -1,4 +1,8 @@
+/* Has to be defined before stdlib.h is included for rand_s() */
+#define _CRT_RAND_S
 #include "odb-util/system.h"
+#include <stdlib.h>
+#include <string.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
@@ -10,3 +14,18 @@ system_cpu_count(void)
     GetSystemInfo(&si);
     return (int)si.dwNumberOfProcessors;
 }
+
+int
+system_random_bytes(void* buf, int len)
+{
+    unsigned int value;
+    int          i;
+    for (i = 0; i < len; i += sizeof(value))
+    {
+        int n = len - i < (int)sizeof(value) ? len - i : (int)sizeof(value);
+        if (rand_s(&value) != 0)
+            return -1;
+        memcpy((char*)buf + i, &value, n);
+    }
+    return 0;
+}
@@ -81,3 +81,10 @@ tick_skip(struct tick* t)
 {
     t->last = (uint64_t)(emscripten_get_now() * 1e6);
 }
+
+/* ------------------------------------------------------------------------- */
+uint64_t
+tick_now(void)
+{
+    return (uint64_t)(emscripten_get_now() * 1e6);
+}
@@ -120,3 +120,11 @@ void tick_skip(struct tick* t)
     clock_gettime(CLOCK_MONOTONIC, &ts);
     t->last = ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
+
+/* ------------------------------------------------------------------------- */
+uint64_t tick_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
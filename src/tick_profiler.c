@@ -0,0 +1,168 @@
+#include "clither/log.h"
+#include "clither/tick.h"
+#include "clither/tick_profiler.h"
+#include <string.h> /* memset */
+
+/* log2(TICK_PROFILER_SUB_BUCKETS) */
+#define SUB_BUCKET_BITS 3
+
+/* ------------------------------------------------------------------------- */
+static int bucket_of(uint64_t ns)
+{
+    int exponent, bucket;
+
+    /* Small values get a bucket each */
+    if (ns < TICK_PROFILER_SUB_BUCKETS)
+        return (int)ns;
+
+    for (exponent = SUB_BUCKET_BITS; ns >> (exponent + 1); ++exponent)
+    {
+    }
+    bucket = (exponent - SUB_BUCKET_BITS + 1) * TICK_PROFILER_SUB_BUCKETS +
+             (int)((ns >> (exponent - SUB_BUCKET_BITS)) &
+                   (TICK_PROFILER_SUB_BUCKETS - 1));
+
+    return bucket < TICK_PROFILER_BUCKETS ? bucket : TICK_PROFILER_BUCKETS - 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*! Largest duration that ends up in the bucket */
+static uint64_t bucket_upper_bound(int bucket)
+{
+    int      shift;
+    uint64_t lower;
+
+    if (bucket < TICK_PROFILER_SUB_BUCKETS)
+        return (uint64_t)bucket;
+
+    shift = bucket / TICK_PROFILER_SUB_BUCKETS - 1;
+    lower = (uint64_t)(TICK_PROFILER_SUB_BUCKETS +
+                       bucket % TICK_PROFILER_SUB_BUCKETS)
+            << shift;
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+/* ------------------------------------------------------------------------- */
+static void reset_window(struct tick_profiler* p, uint64_t now)
+{
+    int i;
+
+    memset(p->phases, 0, sizeof(p->phases));
+    for (i = 0; i != p->phase_count; ++i)
+        p->phases[i].min = (uint64_t)-1;
+    p->window_start = now;
+}
+
+/* ------------------------------------------------------------------------- */
+void tick_profiler_init(
+    struct tick_profiler* p,
+    const char* const*    phase_names,
+    int                   phase_count,
+    int                   report_interval)
+{
+    CLITHER_DEBUG_ASSERT(phase_count <= TICK_PROFILER_MAX_PHASES);
+
+    p->phase_names = phase_names;
+    p->phase_count = phase_count;
+    p->window_length = (uint64_t)report_interval * 1000000000;
+    p->phase_start = tick_now();
+    p->tick_start = p->phase_start;
+    reset_window(p, p->phase_start);
+}
+
+/* ------------------------------------------------------------------------- */
+void tick_profiler_begin(struct tick_profiler* p)
+{
+    p->phase_start = tick_now();
+    p->tick_start = p->phase_start;
+}
+
+/* ------------------------------------------------------------------------- */
+static void add_sample(struct tick_phase_stats* stats, uint64_t ns)
+{
+    if (stats->min > ns)
+        stats->min = ns;
+    if (stats->max < ns)
+        stats->max = ns;
+    stats->sum += ns;
+    stats->count++;
+    stats->histogram[bucket_of(ns)]++;
+}
+
+/* ------------------------------------------------------------------------- */
+void tick_profiler_end(struct tick_profiler* p, int phase)
+{
+    uint64_t now = tick_now();
+    add_sample(&p->phases[phase], now - p->phase_start);
+    p->phase_start = now;
+}
+
+/* ------------------------------------------------------------------------- */
+void tick_profiler_end_tick(struct tick_profiler* p, int phase)
+{
+    uint64_t now = tick_now();
+    add_sample(&p->phases[phase], now - p->tick_start);
+    p->phase_start = now;
+}
+
+/* ------------------------------------------------------------------------- */
+uint64_t tick_profiler_p99(const struct tick_profiler* p, int phase)
+{
+    const struct tick_phase_stats* stats = &p->phases[phase];
+    uint32_t                       rank, seen;
+    int                            bucket;
+
+    if (stats->count == 0)
+        return 0;
+
+    /* Rank of the sample that 99% of samples are smaller or equal to */
+    rank = stats->count - stats->count / 100;
+    seen = 0;
+    for (bucket = 0; bucket != TICK_PROFILER_BUCKETS; ++bucket)
+    {
+        seen += stats->histogram[bucket];
+        if (seen >= rank)
+            break;
+    }
+
+    /* The bucket's bound can overshoot what was actually measured */
+    return bucket_upper_bound(bucket) < stats->max ? bucket_upper_bound(bucket)
+                                                   : stats->max;
+}
+
+/* ------------------------------------------------------------------------- */
+int tick_profiler_report(struct tick_profiler* p)
+{
+    int      i;
+    uint64_t now;
+
+    if (p->window_length == 0)
+        return 0;
+    now = tick_now();
+    if (now - p->window_start < p->window_length)
+        return 0;
+
+    log_info(
+        "Tick profile of the last %d s (min/avg/p99/max in us):\n",
+        (int)((now - p->window_start) / 1000000000));
+    for (i = 0; i != p->phase_count; ++i)
+    {
+        const struct tick_phase_stats* stats = &p->phases[i];
+        if (stats->count == 0)
+        {
+            log_raw("  %-8s no samples\n", p->phase_names[i]);
+            continue;
+        }
+        log_raw(
+            "  %-8s %8.1f %8.1f %8.1f %8.1f  (%u samples)\n",
+            p->phase_names[i],
+            stats->min / 1e3,
+            (double)stats->sum / stats->count / 1e3,
+            tick_profiler_p99(p, i) / 1e3,
+            stats->max / 1e3,
+            (unsigned)stats->count);
+    }
+
+    reset_window(p, now);
+    return 1;
+}
@@ -114,3 +114,16 @@ tick_skip(struct tick* t)
     QueryPerformanceCounter(&ticks);
     t->last = ticks.QuadPart;
 }
+
+/* ------------------------------------------------------------------------- */
+uint64_t
+tick_now(void)
+{
+    LARGE_INTEGER freq, ticks;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&ticks);
+
+    /* Split up to avoid overflowing */
+    return ticks.QuadPart / freq.QuadPart * 1000000000 +
+           ticks.QuadPart % freq.QuadPart * 1000000000 / freq.QuadPart;
+}
@@ -0,0 +1,138 @@
+#include "clither/timer_wheel.h"
+
+VEC_DEFINE(timer_vec, struct timer, 32)
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+/* ------------------------------------------------------------------------- */
+void timer_wheel_init(struct timer_wheel* w, uint32_t now)
+{
+    int level, slot;
+    for (level = 0; level != TIMER_WHEEL_LEVELS; ++level)
+        for (slot = 0; slot != TIMER_WHEEL_SLOTS; ++slot)
+            timer_vec_init(&w->slots[level][slot]);
+    w->now = now;
+}
+
+/* ------------------------------------------------------------------------- */
+void timer_wheel_deinit(struct timer_wheel* w)
+{
+    int level, slot;
+    for (level = 0; level != TIMER_WHEEL_LEVELS; ++level)
+        for (slot = 0; slot != TIMER_WHEEL_SLOTS; ++slot)
+            timer_vec_deinit(w->slots[level][slot]);
+}
+
+/* ------------------------------------------------------------------------- */
+static int add_timer(struct timer_wheel* w, struct timer t)
+{
+    int      level, shift;
+    uint32_t delta = t.expires - w->now;
+
+    /* Timers being redistributed can expire on the current tick, in which
+     * case they end up in the level 0 slot that is processed next */
+    if (delta >= (uint32_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+    {
+        delta = ((uint32_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+        t.expires = w->now + delta;
+    }
+
+    /* Find the lowest level that can hold the deadline. The slot is visited
+     * before the deadline passes, at which point the timer moves down */
+    for (level = 0; level != TIMER_WHEEL_LEVELS - 1; ++level)
+        if (delta < (uint32_t)1 << (TIMER_WHEEL_BITS * (level + 1)))
+            break;
+
+    shift = TIMER_WHEEL_BITS * level;
+    return timer_vec_push(
+        &w->slots[level][(t.expires >> shift) & SLOT_MASK], t);
+}
+
+/* ------------------------------------------------------------------------- */
+int timer_wheel_add(
+    struct timer_wheel*    w,
+    uint32_t               expires,
+    int                    type,
+    const struct net_addr* addr)
+{
+    struct timer t;
+    t.addr = *addr;
+    t.expires = expires;
+    t.type = type;
+
+    /* The slot of the current tick was already processed, so deadlines that
+     * aren't in the future expire on the next tick */
+    if (expires - w->now == 0 || expires - w->now > 0x7FFFFFFF)
+        t.expires = w->now + 1;
+
+    return add_timer(w, t);
+}
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Takes the timers out of a slot, so that timers added while they are
+ * being processed don't end up in the same list.
+ */
+static struct timer_vec* take_slot(struct timer_wheel* w, int level, int slot)
+{
+    struct timer_vec* timers = w->slots[level][slot];
+    timer_vec_init(&w->slots[level][slot]);
+    return timers;
+}
+
+/* Gives the memory of a processed slot back, if nothing was added meanwhile */
+static void return_slot(
+    struct timer_wheel* w, int level, int slot, struct timer_vec* timers)
+{
+    if (w->slots[level][slot] == NULL)
+    {
+        timer_vec_clear(timers);
+        w->slots[level][slot] = timers;
+    }
+    else
+        timer_vec_deinit(timers);
+}
+
+/* ------------------------------------------------------------------------- */
+int timer_wheel_advance(
+    struct timer_wheel* w, timer_func on_expire, void* user)
+{
+    int               level, slot, result = 0;
+    struct timer*     t;
+    struct timer_vec* timers;
+
+    w->now++;
+
+    /* Every time a level completes a rotation, the next slot of the level
+     * above is redistributed into the levels below */
+    for (level = 1; level != TIMER_WHEEL_LEVELS; ++level)
+    {
+        int shift = TIMER_WHEEL_BITS * level;
+        if ((w->now & (((uint32_t)1 << shift) - 1)) != 0)
+            break;
+
+        slot = (w->now >> shift) & SLOT_MASK;
+        timers = take_slot(w, level, slot);
+        vec_for_each (timers, t)
+            if (add_timer(w, *t) != 0)
+            {
+                result = -1;
+                break;
+            }
+        return_slot(w, level, slot, timers);
+        if (result != 0)
+            return -1;
+    }
+
+    slot = w->now & SLOT_MASK;
+    timers = take_slot(w, 0, slot);
+    vec_for_each (timers, t)
+        if (on_expire(t, user) != 0)
+        {
+            result = -1;
+            break;
+        }
+    return_slot(w, 0, slot, timers);
+
+    return result;
+}
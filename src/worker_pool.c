@@ -0,0 +1,193 @@
+#include "clither/log.h"
+#include "clither/mem.h"
+#include "clither/mutex.h"
+#include "clither/thread.h"
+#include "clither/worker_pool.h"
+#include <stddef.h> /* NULL */
+
+/* Each thread gets this many chunks on average, so threads that finish early
+ * can help out the ones that were given more expensive items */
+#define CHUNKS_PER_THREAD 4
+
+/* ------------------------------------------------------------------------- */
+/*!
+ * \brief Claims and runs chunks of the current job until none are left. Must
+ * be called with the lock held, and returns with the lock held.
+ */
+static void run_chunks(struct worker_pool* pool)
+{
+    while (pool->next < pool->count)
+    {
+        int begin = pool->next;
+        int end = begin + pool->chunk_size;
+        if (end > pool->count)
+            end = pool->count;
+        pool->next = end;
+
+        mutex_unlock(pool->lock);
+        pool->func(pool->user, begin, end);
+        mutex_lock(pool->lock);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+static void* worker_main(const void* args)
+{
+    struct worker_pool* pool = (struct worker_pool*)args;
+    unsigned            job_id = 0;
+
+    mem_adopt_threadlocal(pool->mem);
+
+    mutex_lock(pool->lock);
+    while (1)
+    {
+        while (pool->job_id == job_id && !pool->shutdown)
+            cond_wait(pool->work_ready, pool->lock);
+        if (pool->shutdown)
+            break;
+
+        job_id = pool->job_id;
+        run_chunks(pool);
+        if (--pool->busy == 0)
+            cond_signal(pool->work_done);
+    }
+    mutex_unlock(pool->lock);
+
+    mem_adopt_threadlocal(NULL);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+static void stop_workers(struct worker_pool* pool, int started)
+{
+    int i;
+
+    mutex_lock(pool->lock);
+    pool->shutdown = 1;
+    cond_broadcast(pool->work_ready);
+    mutex_unlock(pool->lock);
+
+    for (i = 0; i != started; ++i)
+        thread_join(pool->threads[i]);
+}
+
+/* ------------------------------------------------------------------------- */
+int worker_pool_init(struct worker_pool* pool, int thread_count)
+{
+    int i;
+
+    pool->threads = NULL;
+    pool->mem = NULL;
+    pool->func = NULL;
+    pool->user = NULL;
+    pool->count = 0;
+    pool->chunk_size = 1;
+    pool->next = 0;
+    pool->busy = 0;
+    pool->job_id = 0;
+    pool->shutdown = 0;
+    pool->thread_count = thread_count > 1 ? thread_count - 1 : 0;
+    if (pool->thread_count == 0)
+        return 0;
+
+    pool->mem = mem_share_threadlocal();
+    if (pool->mem == NULL)
+        goto share_mem_failed;
+
+    pool->lock = mutex_create();
+    if (pool->lock == NULL)
+        goto create_lock_failed;
+    pool->work_ready = cond_create();
+    if (pool->work_ready == NULL)
+        goto create_work_ready_failed;
+    pool->work_done = cond_create();
+    if (pool->work_done == NULL)
+        goto create_work_done_failed;
+
+    pool->threads =
+        mem_alloc((int)sizeof(struct thread*) * pool->thread_count);
+    if (pool->threads == NULL)
+    {
+        log_oom(
+            (int)sizeof(struct thread*) * pool->thread_count,
+            "worker_pool_init()");
+        goto alloc_threads_failed;
+    }
+
+    for (i = 0; i != pool->thread_count; ++i)
+    {
+        pool->threads[i] = thread_start(worker_main, pool);
+        if (pool->threads[i] == NULL)
+            goto start_threads_failed;
+    }
+
+    log_dbg("Started %d worker threads\n", pool->thread_count);
+
+    return 0;
+
+start_threads_failed:
+    stop_workers(pool, i);
+    mem_free(pool->threads);
+alloc_threads_failed:
+    cond_destroy(pool->work_done);
+create_work_done_failed:
+    cond_destroy(pool->work_ready);
+create_work_ready_failed:
+    mutex_destroy(pool->lock);
+create_lock_failed:
+share_mem_failed:
+    pool->thread_count = 0;
+    return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+void worker_pool_deinit(struct worker_pool* pool)
+{
+    if (pool->thread_count == 0)
+        return;
+
+    stop_workers(pool, pool->thread_count);
+    mem_free(pool->threads);
+    cond_destroy(pool->work_done);
+    cond_destroy(pool->work_ready);
+    mutex_destroy(pool->lock);
+}
+
+/* ------------------------------------------------------------------------- */
+void worker_pool_run(
+    struct worker_pool* pool,
+    worker_pool_func    func,
+    void*               user,
+    int                 count,
+    int                 min_chunk_size)
+{
+    int chunk_size;
+
+    if (min_chunk_size < 1)
+        min_chunk_size = 1;
+    if (pool->thread_count == 0 || count < min_chunk_size * 2)
+    {
+        if (count > 0)
+            func(user, 0, count);
+        return;
+    }
+
+    chunk_size = count / ((pool->thread_count + 1) * CHUNKS_PER_THREAD);
+    if (chunk_size < min_chunk_size)
+        chunk_size = min_chunk_size;
+
+    mutex_lock(pool->lock);
+    pool->func = func;
+    pool->user = user;
+    pool->count = count;
+    pool->chunk_size = chunk_size;
+    pool->next = 0;
+    pool->busy = pool->thread_count;
+    pool->job_id++;
+    cond_broadcast(pool->work_ready);
+
+    run_chunks(pool);
+    while (pool->busy > 0)
+        cond_wait(pool->work_done, pool->lock);
+    mutex_unlock(pool->lock);
+}
@@ -1,11 +1,19 @@
 #include "clither/log.h"
 #include "clither/q.h"
+#include "clither/quadtree.h"
+#include "clither/quadtree_handle_rb.h"
 #include "clither/snake.h"
 #include "clither/snake_bmap.h"
 #include "clither/str.h"
 #include "clither/world.h"
 #include <stddef.h>
 
+/* The head always lies within the newest segments of its own snake, so these
+ * are never reported as collisions */
+#define SELF_COLLISION_IGNORED_SEGMENTS 3
+
+VEC_DEFINE(world_collision_vec, struct world_collision, 16)
+
 /* ------------------------------------------------------------------------- */
 void world_init(struct world* world)
 {
@@ -14,6 +22,17 @@ void world_init(struct world* world)
     world->inner_radius = make_qw(20);
     world->ring_start = make_qw(40);
     world->ring_end = make_qw(64);
+
+    /* Snakes can leave the ring, but the vast majority of segments will be
+     * inside of it */
+    quadtree_init(
+        &world->quadtree,
+        make_qwaabbqw(
+            -world->ring_end,
+            -world->ring_end,
+            world->ring_end,
+            world->ring_end));
+    world_collision_vec_init(&world->collisions);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -28,6 +47,8 @@ void world_deinit(struct world* world)
         snake_deinit(snake);
     }
     snake_bmap_deinit(world->snakes);
+    world_collision_vec_deinit(world->collisions);
+    quadtree_deinit(&world->quadtree);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -41,6 +62,12 @@ struct snake* world_create_snake(
     if (snake_bmap_emplace_new(&world->snakes, snake_id, &snake) != BMAP_NEW)
         return NULL;
     snake_init(snake, spawn_pos, username);
+    if (snake_attach_quadtree(&snake->data, &world->quadtree, snake_id) != 0)
+    {
+        snake_deinit(snake);
+        snake_bmap_erase(world->snakes, snake_id);
+        return NULL;
+    }
 
     log_info(
         "Creating snake id: %d, pos: [%.2f,%.2f], username: \"%s\"\n",
@@ -87,8 +114,101 @@ void world_remove_snake(struct world* world, uint16_t snake_id)
     snake_bmap_erase(world->snakes, snake_id);
 }
 
+/* ------------------------------------------------------------------------- */
+int world_rebuild_quadtree(struct world* world)
+{
+    int16_t       idx;
+    uint16_t      snake_id;
+    struct snake* snake;
+
+    /* Clearing the tree (rather than only removing the items) compacts the
+     * item storage, so the items of each snake end up next to each other */
+    bmap_for_each (world->snakes, idx, snake_id, snake)
+        snake_detach_quadtree(&snake->data);
+    quadtree_clear(&world->quadtree);
+
+    bmap_for_each (world->snakes, idx, snake_id, snake)
+        if (snake_attach_quadtree(&snake->data, &world->quadtree, snake_id) !=
+            0)
+        {
+            return -1;
+        }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+struct collision_ctx
+{
+    struct world*       world;
+    const struct snake* snake;
+    uint16_t            snake_id;
+    int                 first_collision;
+};
+
+static int on_head_overlaps_segment(int32_t item, uint16_t key, void* user)
+{
+    int                     i;
+    struct world_collision* collision;
+    struct collision_ctx*   ctx = user;
+
+    if (key == ctx->snake_id)
+    {
+        const struct snake_data* data = &ctx->snake->data;
+        for (i = rb_count(data->quadtree_items) - 1;
+             i >= 0 && i >= rb_count(data->quadtree_items) -
+                                SELF_COLLISION_IGNORED_SEGMENTS;
+             --i)
+        {
+            if (*rb_peek(data->quadtree_items, i) == item)
+                return 0;
+        }
+    }
+
+    /* Several segments of the same snake usually overlap the head */
+    for (i = ctx->first_collision; i != vec_count(ctx->world->collisions); ++i)
+        if (vec_get(ctx->world->collisions, i)->other_snake_id == key)
+            return 0;
+
+    collision = world_collision_vec_emplace(&ctx->world->collisions);
+    if (collision == NULL)
+        return -1;
+    collision->snake_id = ctx->snake_id;
+    collision->other_snake_id = key;
+
+    return 0;
+}
+
 /* ------------------------------------------------------------------------- */
 void world_step(
     struct world* world, uint16_t frame_number, uint8_t sim_tick_rate)
 {
+    int16_t              idx;
+    struct snake*        snake;
+    struct collision_ctx ctx;
+    (void)frame_number;
+    (void)sim_tick_rate;
+
+    /* Snakes only record how their segments changed while stepping, so they
+     * can be stepped in parallel. Failed insertions are retried next frame */
+    bmap_for_each (world->snakes, idx, ctx.snake_id, snake)
+        snake_sync_quadtree(&snake->data);
+
+    world_collision_vec_clear(world->collisions);
+
+    ctx.world = world;
+    bmap_for_each (world->snakes, idx, ctx.snake_id, snake)
+    {
+        struct qwpos head = snake->head.pos;
+        ctx.snake = snake;
+        ctx.first_collision = vec_count(world->collisions);
+        if (quadtree_query(
+                &world->quadtree,
+                make_qwaabbqw(head.x, head.y, head.x, head.y),
+                on_head_overlaps_segment,
+                &ctx) != 0)
+        {
+            break;
+        }
+    }
 }
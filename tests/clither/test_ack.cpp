@@ -0,0 +1,239 @@
+#include "gmock/gmock.h"
+
+extern "C" {
+#include "clither/ack.h"
+#include "clither/msg.h"
+#include "clither/msg_vec.h"
+}
+
+#define NAME ack
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        ack_init(&a);
+        ack_init(&b);
+    }
+
+    /* Sends a packet from one side to the other. Returns what the receiving
+     * side thinks of it */
+    static int Send(struct ack_state* from, struct ack_state* to)
+    {
+        uint8_t buf[ACK_HEADER_SIZE];
+        ack_write_header(from, buf);
+        return ack_read_header(to, buf, ACK_HEADER_SIZE);
+    }
+
+    /* Sends a packet that never arrives */
+    static void Lose(struct ack_state* from)
+    {
+        uint8_t buf[ACK_HEADER_SIZE];
+        ack_write_header(from, buf);
+    }
+
+    struct ack_state a;
+    struct ack_state b;
+};
+
+TEST_F(NAME, nothing_is_acked_initially)
+{
+    EXPECT_THAT(ack_status_of(&a, 1), Eq(ACK_IN_FLIGHT));
+    EXPECT_THAT(Send(&b, &a), Eq(1));
+    EXPECT_THAT(ack_status_of(&a, 1), Eq(ACK_IN_FLIGHT));
+}
+
+TEST_F(NAME, packet_is_acked_by_reply)
+{
+    EXPECT_THAT(Send(&a, &b), Eq(1));
+    EXPECT_THAT(b.ack_pending, Eq(1u));
+    EXPECT_THAT(Send(&b, &a), Eq(1));
+    EXPECT_THAT(b.ack_pending, Eq(0u));
+    EXPECT_THAT(ack_status_of(&a, 1), Eq(ACK_RECEIVED));
+    EXPECT_THAT(ack_status_of(&a, 2), Eq(ACK_IN_FLIGHT));
+}
+
+TEST_F(NAME, short_packets_are_rejected)
+{
+    uint8_t buf[ACK_HEADER_SIZE];
+    ack_write_header(&a, buf);
+    EXPECT_THAT(ack_read_header(&b, buf, ACK_HEADER_SIZE - 1), Eq(-1));
+}
+
+TEST_F(NAME, zero_sequence_number_is_rejected_without_acking)
+{
+    uint8_t buf[ACK_HEADER_SIZE];
+    Lose(&a);
+    EXPECT_THAT(Send(&a, &b), Eq(1));
+
+    /* A header that claims to ack packet 2, but has an invalid seq */
+    ack_write_header(&b, buf);
+    buf[0] = 0;
+    buf[1] = 0;
+    EXPECT_THAT(ack_read_header(&a, buf, ACK_HEADER_SIZE), Eq(-1));
+    EXPECT_THAT(ack_status_of(&a, 2), Eq(ACK_IN_FLIGHT));
+}
+
+TEST_F(NAME, duplicate_packets_are_dropped)
+{
+    uint8_t buf[ACK_HEADER_SIZE];
+    ack_write_header(&a, buf);
+    EXPECT_THAT(ack_read_header(&b, buf, ACK_HEADER_SIZE), Eq(1));
+    EXPECT_THAT(ack_read_header(&b, buf, ACK_HEADER_SIZE), Eq(0));
+}
+
+TEST_F(NAME, reordered_packets_are_accepted_once)
+{
+    uint8_t first[ACK_HEADER_SIZE];
+    ack_write_header(&a, first);
+    EXPECT_THAT(Send(&a, &b), Eq(1));
+    EXPECT_THAT(ack_read_header(&b, first, ACK_HEADER_SIZE), Eq(1));
+    EXPECT_THAT(ack_read_header(&b, first, ACK_HEADER_SIZE), Eq(0));
+
+    Send(&b, &a);
+    EXPECT_THAT(ack_status_of(&a, 1), Eq(ACK_RECEIVED));
+    EXPECT_THAT(ack_status_of(&a, 2), Eq(ACK_RECEIVED));
+}
+
+TEST_F(NAME, lost_packet_is_detected)
+{
+    Send(&a, &b); /* 1 */
+    Lose(&a);     /* 2 */
+    Send(&a, &b); /* 3 */
+    Lose(&a);     /* 4 */
+    Send(&a, &b); /* 5 */
+    Send(&b, &a);
+
+    EXPECT_THAT(ack_status_of(&a, 1), Eq(ACK_RECEIVED));
+    EXPECT_THAT(ack_status_of(&a, 2), Eq(ACK_LOST));
+    EXPECT_THAT(ack_status_of(&a, 3), Eq(ACK_RECEIVED));
+    /* Too recent to tell if it was lost or reordered */
+    EXPECT_THAT(ack_status_of(&a, 4), Eq(ACK_IN_FLIGHT));
+    EXPECT_THAT(ack_status_of(&a, 5), Eq(ACK_RECEIVED));
+}
+
+TEST_F(NAME, acks_cover_32_packets)
+{
+    for (int i = 0; i != 33; ++i)
+        Send(&a, &b);
+    Send(&b, &a);
+    for (uint16_t seq = 1; seq != 34; ++seq)
+        EXPECT_THAT(ack_status_of(&a, seq), Eq(ACK_RECEIVED)) << seq;
+
+    /* Older than the window */
+    EXPECT_THAT(ack_status_of(&a, 0xFFFF), Eq(ACK_LOST));
+}
+
+TEST_F(NAME, lost_acks_are_recovered_from_later_packets)
+{
+    Send(&a, &b);
+    Lose(&b);
+    Send(&a, &b);
+    Send(&b, &a);
+    EXPECT_THAT(ack_status_of(&a, 1), Eq(ACK_RECEIVED));
+    EXPECT_THAT(ack_status_of(&a, 2), Eq(ACK_RECEIVED));
+}
+
+TEST_F(NAME, sequence_numbers_skip_zero)
+{
+    uint8_t buf[ACK_HEADER_SIZE];
+    a.next_seq = 0xFFFF;
+    EXPECT_THAT(Send(&a, &b), Eq(1));
+    ack_write_header(&a, buf);
+    EXPECT_THAT((buf[0] << 8) | buf[1], Eq(1));
+    EXPECT_THAT(ack_read_header(&b, buf, ACK_HEADER_SIZE), Eq(1));
+
+    Send(&b, &a);
+    EXPECT_THAT(ack_status_of(&a, 0xFFFF), Eq(ACK_RECEIVED));
+    EXPECT_THAT(ack_status_of(&a, 1), Eq(ACK_RECEIVED));
+}
+
+TEST_F(NAME, reliable_message_is_retired_when_acked)
+{
+    struct msg_vec* msgs;
+    msg_vec_init(&msgs);
+    struct msg* m = msg_snake_destroy(5);
+    ASSERT_THAT(msg_is_reliable(m), IsTrue());
+    msg_vec_push(&msgs, m);
+
+    ack_msg_sent(m, a.next_seq);
+    Send(&a, &b);
+    ASSERT_THAT(ack_update_msgs(&a, msgs), Eq(0));
+    EXPECT_THAT(vec_count(msgs), Eq(1));
+    EXPECT_THAT(m->in_flight, Eq(1u));
+
+    Send(&b, &a);
+    ASSERT_THAT(ack_update_msgs(&a, msgs), Eq(0));
+    EXPECT_THAT(vec_count(msgs), Eq(0));
+
+    msg_vec_deinit(msgs);
+}
+
+TEST_F(NAME, reliable_message_is_resent_when_lost)
+{
+    struct msg_vec* msgs;
+    msg_vec_init(&msgs);
+    struct msg* m = msg_snake_destroy(5);
+    msg_vec_push(&msgs, m);
+
+    ack_msg_sent(m, a.next_seq);
+    Lose(&a);
+    for (int i = 0; i != ACK_LOSS_DISTANCE; ++i)
+        Send(&a, &b);
+    Send(&b, &a);
+    ASSERT_THAT(ack_update_msgs(&a, msgs), Eq(0));
+    EXPECT_THAT(vec_count(msgs), Eq(1));
+    EXPECT_THAT(m->in_flight, Eq(0u));
+
+    msg_free(m);
+    msg_vec_deinit(msgs);
+}
+
+TEST_F(NAME, reliable_message_is_resent_after_timeout)
+{
+    struct msg_vec* msgs;
+    msg_vec_init(&msgs);
+    struct msg* m = msg_snake_destroy(5);
+    msg_vec_push(&msgs, m);
+
+    ack_msg_sent(m, a.next_seq);
+    Lose(&a);
+    for (int i = 1; i != ACK_RESEND_TIMEOUT; ++i)
+    {
+        ASSERT_THAT(ack_update_msgs(&a, msgs), Eq(0));
+        EXPECT_THAT(m->in_flight, Eq(1u));
+    }
+    ASSERT_THAT(ack_update_msgs(&a, msgs), Eq(0));
+    EXPECT_THAT(m->in_flight, Eq(0u));
+
+    msg_free(m);
+    msg_vec_deinit(msgs);
+}
+
+TEST_F(NAME, unacknowledged_message_fails_eventually)
+{
+    struct msg_vec* msgs;
+    msg_vec_init(&msgs);
+    struct msg* m = msg_snake_destroy(5);
+    msg_vec_push(&msgs, m);
+
+    for (int sends = 0; sends != ACK_MAX_SENDS; ++sends)
+    {
+        ack_msg_sent(m, a.next_seq);
+        Lose(&a);
+        for (int i = 1; i != ACK_RESEND_TIMEOUT; ++i)
+        {
+            ASSERT_THAT(ack_update_msgs(&a, msgs), Eq(0));
+        }
+        if (sends + 1 != ACK_MAX_SENDS)
+        {
+            ASSERT_THAT(ack_update_msgs(&a, msgs), Eq(0));
+        }
+    }
+    EXPECT_THAT(ack_update_msgs(&a, msgs), Eq(-1));
+
+    msg_free(m);
+    msg_vec_deinit(msgs);
+}
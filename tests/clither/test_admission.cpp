@@ -0,0 +1,93 @@
+#include "gmock/gmock.h"
+
+extern "C" {
+#include "clither/admission.h"
+#include "clither/net.h"
+}
+
+#define NAME admission
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        ASSERT_THAT(admission_init(&table), Eq(0));
+        MakeAddr(&addr, 1);
+        MakeAddr(&other_addr, 2);
+    }
+
+    void TearDown() override { admission_deinit(table); }
+
+    static void MakeAddr(struct net_addr* a, int id)
+    {
+        memset(a, 0, sizeof(*a));
+        a->len = 16;
+        a->sockaddr_storage[4] = 127;
+        a->sockaddr_storage[6] = (char)(id >> 8);
+        a->sockaddr_storage[7] = (char)id;
+    }
+
+    /* 60 packets per second, bursts of 30, 20 net ticks per second */
+    int Check(const struct net_addr* a, uint32_t now)
+    {
+        return admission_check(table, a, now, 60, 30, 20);
+    }
+
+    struct admission_table* table;
+    struct net_addr         addr;
+    struct net_addr         other_addr;
+};
+
+TEST_F(NAME, burst_is_admitted_then_dropped)
+{
+    for (int i = 0; i != 30; ++i)
+        ASSERT_THAT(Check(&addr, 100), IsTrue()) << i;
+    EXPECT_THAT(Check(&addr, 100), IsFalse());
+}
+
+TEST_F(NAME, bucket_refills_at_rate)
+{
+    for (int i = 0; i != 30; ++i)
+        Check(&addr, 100);
+    ASSERT_THAT(Check(&addr, 100), IsFalse());
+
+    /* 60 packets per second at 20 ticks per second is 3 per tick */
+    for (int i = 0; i != 3; ++i)
+        EXPECT_THAT(Check(&addr, 101), IsTrue()) << i;
+    EXPECT_THAT(Check(&addr, 101), IsFalse());
+}
+
+TEST_F(NAME, bucket_does_not_refill_past_burst)
+{
+    Check(&addr, 100);
+    for (int i = 0; i != 30; ++i)
+        ASSERT_THAT(Check(&addr, 1000), IsTrue()) << i;
+    EXPECT_THAT(Check(&addr, 1000), IsFalse());
+}
+
+TEST_F(NAME, addresses_have_separate_buckets)
+{
+    for (int i = 0; i != 30; ++i)
+        Check(&addr, 100);
+    ASSERT_THAT(Check(&addr, 100), IsFalse());
+    EXPECT_THAT(Check(&other_addr, 100), IsTrue());
+}
+
+TEST_F(NAME, many_addresses_do_not_evict_active_ones)
+{
+    for (int i = 0; i != 30; ++i)
+        Check(&addr, 100);
+
+    /* Fill the table with addresses that were used a while ago */
+    for (int id = 3; id != ADMISSION_SETS; ++id)
+    {
+        struct net_addr a;
+        MakeAddr(&a, id);
+        Check(&a, 50);
+    }
+
+    /* Still rate limited, i.e. the bucket was not replaced by a full one */
+    EXPECT_THAT(Check(&addr, 100), IsFalse());
+}
@@ -299,3 +299,27 @@ TEST(NAME, set_port_short_missing_arg_other_options)
     ASSERT_THAT(args_parse(&a, 2, (char**)argv), Eq(-1));
 }
 #endif
+
+TEST(NAME, set_bots_mode)
+{
+    const char* argv[] = {"./clither", "--bots", "50", "--ip", "10.0.0.1"};
+    struct args a;
+    ASSERT_THAT(args_parse(&a, 5, (char**)argv), Eq(0));
+    EXPECT_THAT(a.mode, Eq(MODE_BOTS));
+    EXPECT_THAT(a.bot_count, Eq(50));
+    EXPECT_THAT(a.ip, StrEq("10.0.0.1"));
+}
+
+TEST(NAME, set_bots_missing_arg)
+{
+    const char* argv[] = {"./clither", "--bots"};
+    struct args a;
+    ASSERT_THAT(args_parse(&a, 2, (char**)argv), Eq(-1));
+}
+
+TEST(NAME, set_bots_zero)
+{
+    const char* argv[] = {"./clither", "--bots", "0"};
+    struct args a;
+    ASSERT_THAT(args_parse(&a, 3, (char**)argv), Eq(-1));
+}
@@ -138,7 +138,8 @@ class NAME : public Test
 public:
     void              SetUp() override { qwpos_vec_init(&points); }
     void              TearDown() override { qwpos_vec_deinit(points); }
-    struct qwpos_vec* points;
+    struct qwpos_vec*      points;
+    struct bezier_fit_sums sums;
 };
 
 TEST_F(NAME, misfit)
@@ -179,11 +180,12 @@ TEST_F(NAME, misfit)
 
     for (int i = 0; i != array_len(points3); ++i)
         qwpos_vec_push(&points, points3[i]);
-    bezier_fit_trail(&head, &tail, points);
+    bezier_fit_sums_init(&sums, points);
+    bezier_fit_trail(&head, &tail, points, &sums);
 
     EXPECT_THAT(head.pos.x, Eq(32605));
     EXPECT_THAT(head.pos.y, Eq(29312));
-    EXPECT_THAT(head.angle, Eq(-1205));
+    EXPECT_THAT(head.angle, Eq(-1153));
     EXPECT_THAT(head.len_backwards, Eq(25));
     EXPECT_THAT(head.len_forwards, Eq(0));
 
@@ -193,3 +195,144 @@ TEST_F(NAME, misfit)
     EXPECT_THAT(tail.len_backwards, Eq(17));
     EXPECT_THAT(tail.len_forwards, Eq(27));
 }
+
+TEST_F(NAME, sums_match_after_push_and_pop)
+{
+    struct bezier_fit_sums expected;
+
+    bezier_fit_sums_init(&sums, points);
+    for (int i = 0; i != array_len(points3); ++i)
+    {
+        qwpos_vec_push(&points, points3[i]);
+        bezier_fit_sums_push(&sums, points);
+    }
+    bezier_fit_sums_init(&expected, points);
+    EXPECT_THAT(sums.x, ElementsAreArray(expected.x));
+    EXPECT_THAT(sums.y, ElementsAreArray(expected.y));
+
+    for (int i = 0; i != 20; ++i)
+    {
+        bezier_fit_sums_pop(&sums, points);
+        qwpos_vec_pop(points);
+    }
+    bezier_fit_sums_init(&expected, points);
+    EXPECT_THAT(sums.x, ElementsAreArray(expected.x));
+    EXPECT_THAT(sums.y, ElementsAreArray(expected.y));
+}
+
+TEST_F(NAME, long_trail_still_fits)
+{
+    /*
+     * A slow snake leaves many points on a short arc. This used to exceed the
+     * precision of the q16.16 T'*T matrix, which forced a new segment
+     * regardless of the fit.
+     */
+    struct bezier_handle head = {{0, 0}, 0, 0, 0};
+    struct bezier_handle tail = {{0, 0}, make_qa(M_PI), 0, 0};
+
+    for (int i = 0; i != 700; ++i)
+    {
+        /* Radius of 4, moving 1/256 units per step */
+        double a = i / 256.0 / 4;
+        qwpos_vec_push(
+            &points, make_qwposf(std::sin(a) * 4, (1 - std::cos(a)) * 4));
+    }
+    bezier_fit_sums_init(&sums, points);
+    bezier_fit_trail(&head, &tail, points, &sums);
+
+    /* Handles that approximate an arc are 4/3*tan(angle/4)*radius long */
+    const double angle = 699 / 256.0 / 4;
+    const double len = 4.0 / 3 * std::tan(angle / 4) * 4;
+    EXPECT_THAT(qa_to_float(head.angle), DoubleNear(angle - M_PI, 0.01));
+    EXPECT_THAT(head.len_backwards / 255.0, DoubleNear(len, 0.01));
+    EXPECT_THAT(tail.len_forwards / 255.0, DoubleNear(len, 0.01));
+}
+
+/* Same threshold snake_update_curve_from_head() uses to start a new segment */
+#define SPLIT_THRESHOLD make_q16_16_2(1, 16)
+
+static double fit_prefixes(
+    struct qwpos_vec**      points,
+    struct bezier_fit_sums* sums,
+    const struct qwpos*     trail,
+    int                     count,
+    qa                      tail_angle)
+{
+    double max_error = 0;
+
+    bezier_fit_sums_init(sums, *points);
+    for (int i = 0; i != count; ++i)
+    {
+        struct bezier_handle head = {{0, 0}, 0, 0, 0};
+        struct bezier_handle tail = {trail[0], tail_angle, 17, 0};
+        double               error;
+
+        qwpos_vec_push(points, trail[i]);
+        bezier_fit_sums_push(sums, *points);
+        error = bezier_fit_trail(&head, &tail, *points, sums);
+        if (error > max_error)
+            max_error = error;
+    }
+
+    return max_error;
+}
+
+/* Tail handle pointing away from the trail, like the previous segment's head */
+static qa tail_angle_of(const struct qwpos* trail)
+{
+    return make_qa(std::atan2(
+        qw_to_float(qw_sub(trail[0].y, trail[1].y)),
+        qw_to_float(qw_sub(trail[0].x, trail[1].x))));
+}
+
+TEST_F(NAME, recorded_trails_do_not_split)
+{
+    /*
+     * None of these trails were split by the exhaustive error estimate, so
+     * the sampled estimate must not split them either.
+     */
+    EXPECT_THAT(
+        fit_prefixes(
+            &points,
+            &sums,
+            points1,
+            array_len(points1),
+            tail_angle_of(points1)),
+        Lt(SPLIT_THRESHOLD));
+    qwpos_vec_clear(points);
+    EXPECT_THAT(
+        fit_prefixes(
+            &points,
+            &sums,
+            points2,
+            array_len(points2),
+            tail_angle_of(points2)),
+        Lt(SPLIT_THRESHOLD));
+    qwpos_vec_clear(points);
+    EXPECT_THAT(
+        fit_prefixes(
+            &points,
+            &sums,
+            points3,
+            array_len(points3),
+            make_qa2(-4676, 1 << 12)),
+        Lt(SPLIT_THRESHOLD));
+}
+
+TEST_F(NAME, corner_splits)
+{
+    /* Straight line followed by a 90 degree turn, moving 1/64 units per step */
+    struct qwpos corner[40];
+    for (int i = 0; i != 20; ++i)
+        corner[i] = make_qwposf(i / 64.0, 0);
+    for (int i = 20; i != 40; ++i)
+        corner[i] = make_qwposf(19 / 64.0, (i - 19) / 64.0);
+
+    EXPECT_THAT(
+        fit_prefixes(&points, &sums, corner, 20, make_qa(M_PI)),
+        Lt(SPLIT_THRESHOLD));
+    qwpos_vec_clear(points);
+    EXPECT_THAT(
+        fit_prefixes(&points, &sums, corner, 40, make_qa(M_PI)),
+        Gt(SPLIT_THRESHOLD));
+}
@@ -35,7 +35,9 @@ TEST_F(NAME, calc_equidistant_points_on_single_curve)
     bezier_calc_equidistant_points(
         &points, handles, make_qw(0.1), make_qw(0.4));
 
-    ASSERT_THAT(vec_count(points), Eq(5));
+    /* 4 * make_qw(0.1) falls one unit short of make_qw(0.4), so it takes a
+     * fifth point after the head to cover the length */
+    ASSERT_THAT(vec_count(points), Eq(6));
     EXPECT_THAT(vec_get(points, 0)->pos.x, Eq(make_qw(2)));
     EXPECT_THAT(vec_get(points, 0)->pos.y, Eq(make_qw(3)));
 
@@ -84,7 +86,7 @@ TEST_F(NAME, calc_equidistant_points_on_two_curves)
     EXPECT_THAT(vec_get(points, 1)->pos.x, Eq(0));
     EXPECT_THAT(vec_get(points, 1)->pos.y, Eq(26215));
     EXPECT_THAT(vec_get(points, 2)->pos.x, Eq(0));
-    EXPECT_THAT(vec_get(points, 2)->pos.y, Eq(19661));
+    EXPECT_THAT(vec_get(points, 2)->pos.y, Eq(26215 - make_qw(0.4)));
 
     bezier_handle_rb_deinit(handles);
 }
@@ -112,4 +114,29 @@ TEST_F(NAME, calc_equidistant_points_on_two_curves_spacing_larger_than_curve)
 
     bezier_handle_rb_deinit(handles);
 }
+
+TEST_F(NAME, calc_arc_length_of_straight_curve)
+{
+    bezier_handle tail, head;
+    bezier_handle_init(&tail, make_qwposf(0, 1), 0);
+    bezier_handle_init(&head, make_qwposf(0, 2.5), 0);
+
+    EXPECT_THAT(
+        qw_to_float(bezier_calc_arc_length(&head, &tail)),
+        DoubleNear(1.5, 0.001));
+}
+
+TEST_F(NAME, calc_arc_length_of_curve)
+{
+    bezier_handle tail, head;
+    bezier_handle_init(&tail, make_qwposi(3, 4), make_qa(M_PI / 7));
+    tail.len_forwards = 255;
+    bezier_handle_init(&head, make_qwposi(2, 3), make_qa(M_PI / 4 * 3));
+    head.len_backwards = 255;
+
+    /* Reference value is from summing up 100000 steps using doubles */
+    EXPECT_THAT(
+        qw_to_float(bezier_calc_arc_length(&head, &tail)),
+        DoubleNear(1.9443, 0.005));
+}
 } // namespace
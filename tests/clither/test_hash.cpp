@@ -0,0 +1,53 @@
+#include "gmock/gmock.h"
+
+extern "C" {
+#include "clither/hash.h"
+}
+
+#define NAME hash
+
+using namespace testing;
+
+/* Test vectors from the SipHash paper use the key 00 01 02 ... 0f and the
+ * messages 00, 00 01, 00 01 02, ... */
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        for (int i = 0; i != 16; ++i)
+            key[i] = (uint8_t)i;
+        for (int i = 0; i != 64; ++i)
+            msg[i] = (uint8_t)i;
+    }
+
+    uint8_t key[16];
+    uint8_t msg[64];
+};
+
+TEST_F(NAME, siphash24_empty_message)
+{
+    EXPECT_THAT(
+        hash64_siphash24(key, msg, 0),
+        Eq(((uint64_t)0x726fdb47 << 32) | 0xdd0e0e31));
+}
+
+TEST_F(NAME, siphash24_partial_block)
+{
+    EXPECT_THAT(
+        hash64_siphash24(key, msg, 1),
+        Eq(((uint64_t)0x74f839c5 << 32) | 0x93dc67fd));
+}
+
+TEST_F(NAME, siphash24_paper_example)
+{
+    EXPECT_THAT(
+        hash64_siphash24(key, msg, 15),
+        Eq(((uint64_t)0xa129ca61 << 32) | 0x49be45e5));
+}
+
+TEST_F(NAME, siphash24_depends_on_key)
+{
+    uint64_t h = hash64_siphash24(key, msg, 8);
+    key[15] ^= 1;
+    EXPECT_THAT(hash64_siphash24(key, msg, 8), Ne(h));
+}
@@ -0,0 +1,75 @@
+#include "gmock/gmock.h"
+
+extern "C" {
+#include "clither/join_cookie.h"
+#include "clither/net.h"
+}
+
+#define NAME join_cookie
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        ASSERT_THAT(join_cookie_init(&secrets), Eq(0));
+        MakeAddr(&addr, 1);
+        MakeAddr(&other_addr, 2);
+    }
+
+    static void MakeAddr(struct net_addr* a, int id)
+    {
+        memset(a, 0, sizeof(*a));
+        a->len = 16;
+        a->sockaddr_storage[4] = 127;
+        a->sockaddr_storage[7] = (char)id;
+    }
+
+    struct join_cookie_secrets secrets;
+    struct net_addr            addr;
+    struct net_addr            other_addr;
+};
+
+TEST_F(NAME, cookie_is_accepted_for_same_address)
+{
+    uint8_t cookie[JOIN_COOKIE_SIZE];
+    join_cookie_make(&secrets, &addr, cookie);
+    EXPECT_THAT(join_cookie_check(&secrets, &addr, cookie), IsTrue());
+}
+
+TEST_F(NAME, cookie_is_rejected_for_other_address)
+{
+    uint8_t cookie[JOIN_COOKIE_SIZE];
+    join_cookie_make(&secrets, &addr, cookie);
+    EXPECT_THAT(join_cookie_check(&secrets, &other_addr, cookie), IsFalse());
+}
+
+TEST_F(NAME, modified_cookie_is_rejected)
+{
+    uint8_t cookie[JOIN_COOKIE_SIZE];
+    join_cookie_make(&secrets, &addr, cookie);
+    cookie[JOIN_COOKIE_SIZE - 1] ^= 1;
+    EXPECT_THAT(join_cookie_check(&secrets, &addr, cookie), IsFalse());
+}
+
+TEST_F(NAME, cookie_survives_one_rotation)
+{
+    uint8_t cookie[JOIN_COOKIE_SIZE];
+    join_cookie_make(&secrets, &addr, cookie);
+
+    ASSERT_THAT(join_cookie_rotate(&secrets), Eq(0));
+    EXPECT_THAT(join_cookie_check(&secrets, &addr, cookie), IsTrue());
+
+    ASSERT_THAT(join_cookie_rotate(&secrets), Eq(0));
+    EXPECT_THAT(join_cookie_check(&secrets, &addr, cookie), IsFalse());
+}
+
+TEST_F(NAME, cookies_differ_between_secrets)
+{
+    uint8_t before[JOIN_COOKIE_SIZE], after[JOIN_COOKIE_SIZE];
+    join_cookie_make(&secrets, &addr, before);
+    ASSERT_THAT(join_cookie_rotate(&secrets), Eq(0));
+    join_cookie_make(&secrets, &addr, after);
+    EXPECT_THAT(memcmp(before, after, JOIN_COOKIE_SIZE), Ne(0));
+}
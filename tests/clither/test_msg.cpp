@@ -1,9 +1,14 @@
 #include "gmock/gmock.h"
+#include <cstring>
+#include <vector>
 
 extern "C" {
+#include "clither/bezier_handle_rb.h"
 #include "clither/cmd.h"
 #include "clither/msg.h"
 #include "clither/msg_vec.h"
+#include "clither/net.h"
+#include "clither/snake.h"
 }
 
 #define NAME msg
@@ -164,7 +169,7 @@ TEST(NAME, parse_join_request)
 TEST(NAME, parse_join_accept_payload_too_small)
 {
     // clang-format off
-    uint8_t payload[14] = {
+    uint8_t payload[22] = {
         0xAA,             // Sim tick rate
         0xBB,             // Net tick rate
         0x12, 0x34,       // Client frame
@@ -172,17 +177,19 @@ TEST(NAME, parse_join_accept_payload_too_small)
         0x90, 0xA0,       // Snake ID
         0xAB, 0xCD, 0xEF, // Spawn X
         0xFE, 0xDC, 0xBA, // Spawn Y
+        0x01, 0x02, 0x03, 0x04, // Connection ID
+        0x05, 0x06, 0x07, 0x08,
     };
     // clang-format on
 
     parsed_payload pp;
-    ASSERT_THAT(msg_parse_payload(&pp, MSG_JOIN_ACCEPT, payload, 13), Eq(-1));
+    ASSERT_THAT(msg_parse_payload(&pp, MSG_JOIN_ACCEPT, payload, 21), Eq(-1));
 }
 
 TEST(NAME, parse_join_accept_qw_sign_extension)
 {
     // clang-format off
-    uint8_t payload[14] = {
+    uint8_t payload[22] = {
         0xAA,             // Sim tick rate
         0xBB,             // Net tick rate
         0x12, 0x34,       // Client frame
@@ -190,12 +197,14 @@ TEST(NAME, parse_join_accept_qw_sign_extension)
         0x90, 0xA0,       // Snake ID
         0xFF, 0xFF, 0xFF, // Spawn X
         0xFF, 0xFF, 0xFF, // Spawn Y
+        0x01, 0x02, 0x03, 0x04, // Connection ID
+        0x05, 0x06, 0x07, 0x08,
     };
     // clang-format on
 
     parsed_payload pp;
     ASSERT_THAT(
-        msg_parse_payload(&pp, MSG_JOIN_ACCEPT, payload, 14),
+        msg_parse_payload(&pp, MSG_JOIN_ACCEPT, payload, 22),
         Eq(MSG_JOIN_ACCEPT));
     EXPECT_THAT(pp.join_accept.spawn.x, Eq(-1));
     EXPECT_THAT(pp.join_accept.spawn.y, Eq(-1));
@@ -204,7 +213,7 @@ TEST(NAME, parse_join_accept_qw_sign_extension)
 TEST(NAME, parse_join_accept)
 {
     // clang-format off
-    uint8_t payload[14] = {
+    uint8_t payload[22] = {
         0xAA,             // Sim tick rate
         0xBB,             // Net tick rate
         0x12, 0x34,       // Client frame
@@ -212,12 +221,14 @@ TEST(NAME, parse_join_accept)
         0x90, 0xA0,       // Snake ID
         0x0B, 0xCD, 0xEF, // Spawn X
         0x0E, 0xDC, 0xBA, // Spawn Y
+        0x01, 0x02, 0x03, 0x04, // Connection ID
+        0x05, 0x06, 0x07, 0x08,
     };
     // clang-format on
 
     parsed_payload pp;
     ASSERT_THAT(
-        msg_parse_payload(&pp, MSG_JOIN_ACCEPT, payload, 14),
+        msg_parse_payload(&pp, MSG_JOIN_ACCEPT, payload, 22),
         Eq(MSG_JOIN_ACCEPT));
     EXPECT_THAT(pp.join_accept.sim_tick_rate, Eq(0xAA));
     EXPECT_THAT(pp.join_accept.net_tick_rate, Eq(0xBB));
@@ -226,6 +237,7 @@ TEST(NAME, parse_join_accept)
     EXPECT_THAT(pp.join_accept.snake_id, Eq(0x90A0));
     EXPECT_THAT(pp.join_accept.spawn.x, Eq(0x0BCDEF));
     EXPECT_THAT(pp.join_accept.spawn.y, Eq(0x0EDCBA));
+    EXPECT_THAT(pp.join_accept.conn_id, Eq(0x0102030405060708u));
 }
 
 TEST(NAME, parse_join_deny_payload_too_small)
@@ -306,6 +318,31 @@ TEST(NAME, parse_join_deny)
     EXPECT_THAT(pp.join_deny.error, StrEq("oops"));
 }
 
+TEST(NAME, parse_join_redirect_payload_too_small)
+{
+    uint8_t        payload[] = {0x15, 0xB4};
+    parsed_payload pp;
+    ASSERT_THAT(msg_parse_payload(&pp, MSG_JOIN_REDIRECT, payload, 1), Eq(-1));
+}
+
+TEST(NAME, parse_join_redirect_invalid_port)
+{
+    uint8_t        payload[] = {0x00, 0x00};
+    parsed_payload pp;
+    ASSERT_THAT(msg_parse_payload(&pp, MSG_JOIN_REDIRECT, payload, 2), Eq(-2));
+}
+
+TEST(NAME, parse_join_redirect)
+{
+    struct msg*    m = msg_join_redirect(5556);
+    parsed_payload pp;
+    ASSERT_THAT(
+        msg_parse_payload(&pp, MSG_JOIN_REDIRECT, m->payload, m->payload_len),
+        Eq(MSG_JOIN_REDIRECT));
+    EXPECT_THAT(pp.join_redirect.port, Eq(5556));
+    msg_free(m);
+}
+
 TEST(NAME, parse_snake_bezier_payload_too_small)
 {
     // clang-format off
@@ -390,3 +427,177 @@ TEST(NAME, parse_snake_bezier_qwpos_sign_extension)
     EXPECT_THAT(pp.snake_bezier.len_backwards, Eq(0x20));
     EXPECT_THAT(pp.snake_bezier.len_forwards, Eq(0x21));
 }
+
+TEST(NAME, small_messages_use_small_pool)
+{
+    struct msg* small = msg_snake_bezier_ack(1);
+    struct msg* large = msg_join_deny_server_full(
+        "A rather long error message that does not fit into the smallest "
+        "size class");
+    EXPECT_THAT(small->pool, Eq(0));
+    EXPECT_THAT(large->pool, Gt(small->pool));
+    msg_free(large);
+    msg_free(small);
+}
+
+TEST(NAME, freed_messages_are_reused)
+{
+    struct msg* m1 = msg_snake_bezier_ack(1);
+    struct msg* m2 = msg_snake_bezier_ack(2);
+    msg_free(m1);
+
+    struct msg* m3 = msg_snake_destroy(3);
+    EXPECT_THAT(m3, Eq(m1));
+    EXPECT_THAT(m3->type, Eq(MSG_SNAKE_DESTROY));
+    msg_free(m3);
+    msg_free(m2);
+}
+
+TEST(NAME, pool_grows_past_one_slab)
+{
+    std::vector<struct msg*> msgs;
+    for (int i = 0; i != 1000; ++i)
+    {
+        msgs.push_back(msg_snake_bezier_ack((uint16_t)i));
+        ASSERT_THAT(msgs.back(), NotNull());
+    }
+    for (int i = 0; i != 1000; ++i)
+    {
+        EXPECT_THAT(msgs[i]->payload_len, Eq(2));
+        msg_free(msgs[i]);
+    }
+}
+
+TEST(NAME, snake_head_write_matches_msg)
+{
+    struct snake_head head;
+    head.pos = make_qwposi(-3, 7);
+    head.angle = make_qa(1.5);
+    head.speed = 42;
+
+    struct net_udp_packet pkt;
+    pkt.len = 5;
+    ASSERT_THAT(msg_snake_head_write(&pkt, &head, 1234), Gt(0));
+
+    struct msg* m = msg_snake_head(&head, 1234);
+    ASSERT_THAT(pkt.len, Eq(5 + 2 + m->payload_len));
+    EXPECT_THAT(pkt.data[5], Eq(MSG_SNAKE_HEAD));
+    EXPECT_THAT(pkt.data[6], Eq(m->payload_len));
+    EXPECT_THAT(memcmp(pkt.data + 7, m->payload, m->payload_len), Eq(0));
+    msg_free(m);
+}
+
+TEST(NAME, snake_head_write_fails_if_packet_is_full)
+{
+    struct snake_head head;
+    head.pos = make_qwposi(0, 0);
+    head.angle = 0;
+    head.speed = 0;
+
+    struct net_udp_packet pkt;
+    pkt.len = NET_MAX_UDP_PACKET_SIZE - 5;
+    EXPECT_THAT(msg_snake_head_write(&pkt, &head, 1), Eq(0));
+    EXPECT_THAT(pkt.len, Eq(NET_MAX_UDP_PACKET_SIZE - 5));
+}
+
+TEST(NAME, snake_bezier_batch_round_trip)
+{
+    struct snake snake;
+    struct cmd   c = cmd_default();
+    snake_init(&snake, make_qwposi(-10, 20), "test");
+    snake_param_update(&snake.param, snake.param.upgrades, 20000);
+    for (int frame = 0; frame != 2000; ++frame)
+    {
+        c.angle = (uint8_t)(c.angle + (frame / 40 % 2 ? 2 : -2));
+        snake_remove_stale_segments(
+            &snake.data,
+            snake_step(&snake.data, &snake.head, &snake.param, c, 60));
+    }
+    const int handle_count = rb_count(snake.data.bezier_handles);
+    ASSERT_THAT(handle_count, Gt(MSG_SNAKE_BEZIER_BATCH_MAX));
+
+    int batched_bytes = 0;
+    int first, count;
+    for (first = 0; first != handle_count; first += count)
+    {
+        count = handle_count - first;
+        struct msg* m = msg_snake_bezier_batch(7, &snake.data, first, &count);
+        ASSERT_THAT(m, NotNull());
+        ASSERT_THAT(count, Gt(0));
+        batched_bytes += m->payload_len + 2;
+
+        parsed_payload pp;
+        ASSERT_THAT(
+            msg_parse_payload(&pp, m->type, m->payload, m->payload_len),
+            Eq(MSG_SNAKE_BEZIER_BATCH));
+        EXPECT_THAT(pp.snake_bezier_batch.snake_id, Eq(7));
+        EXPECT_THAT(
+            pp.snake_bezier_batch.first_handle_id,
+            Eq(snake_bezier_handle_id(&snake.data, first)));
+        ASSERT_THAT(pp.snake_bezier_batch.count, Eq(count));
+        for (int i = 0; i != count; ++i)
+        {
+            const bezier_handle* expected =
+                rb_peek(snake.data.bezier_handles, first + i);
+            const bezier_handle* actual = &pp.snake_bezier_batch.handles[i];
+            EXPECT_THAT(actual->pos.x, Eq(expected->pos.x));
+            EXPECT_THAT(actual->pos.y, Eq(expected->pos.y));
+            EXPECT_THAT(actual->angle, Eq(expected->angle));
+            EXPECT_THAT(actual->len_backwards, Eq(expected->len_backwards));
+            EXPECT_THAT(actual->len_forwards, Eq(expected->len_forwards));
+        }
+        msg_free(m);
+    }
+
+    /* One MSG_SNAKE_BEZIER is 14 bytes of payload and 2 bytes of header */
+    EXPECT_THAT(batched_bytes * 10, Lt(handle_count * 16 * 6));
+
+    snake_deinit(&snake);
+}
+
+TEST(NAME, parse_snake_bezier_batch_invalid_count)
+{
+    // clang-format off
+    uint8_t payload[15] = {
+        0xAA, 0xBB,       // Snake ID
+        0x00, 0x05,       // First handle ID
+        0x00,             // Count
+        0x12, 0x34, 0x56, // X Position
+        0x65, 0x43, 0x21, // Y Position
+        0x00, 0x50,       // Angle
+        0x20, 0x21,       // Length backwards/forwards
+    };
+    // clang-format on
+
+    parsed_payload pp;
+    ASSERT_THAT(
+        msg_parse_payload(&pp, MSG_SNAKE_BEZIER_BATCH, payload, 14), Eq(-1));
+    ASSERT_THAT(
+        msg_parse_payload(&pp, MSG_SNAKE_BEZIER_BATCH, payload, 15), Eq(-2));
+    payload[4] = MSG_SNAKE_BEZIER_BATCH_MAX + 1;
+    ASSERT_THAT(
+        msg_parse_payload(&pp, MSG_SNAKE_BEZIER_BATCH, payload, 15), Eq(-2));
+}
+
+TEST(NAME, parse_snake_bezier_batch_truncated_handle)
+{
+    // clang-format off
+    uint8_t payload[20] = {
+        0xAA, 0xBB,       // Snake ID
+        0x00, 0x05,       // First handle ID
+        0x02,             // Count
+        0x12, 0x34, 0x56, // X Position
+        0x65, 0x43, 0x21, // Y Position
+        0x00, 0x50,       // Angle
+        0x20, 0x21,       // Length backwards/forwards
+        0x81, 0x01,       // X delta (varint)
+        0x03,             // Y delta
+        0x04,             // Angle delta
+        0x20,             // Length backwards, but forwards is missing
+    };
+    // clang-format on
+
+    parsed_payload pp;
+    ASSERT_THAT(
+        msg_parse_payload(&pp, MSG_SNAKE_BEZIER_BATCH, payload, 20), Eq(-3));
+}
@@ -0,0 +1,110 @@
+#include "gmock/gmock.h"
+#include <cstring>
+
+extern "C" {
+#include "clither/net.h"
+}
+
+#define NAME net
+
+using namespace testing;
+
+class NAME : public Test
+{
+public:
+    void SetUp() override
+    {
+        ASSERT_THAT(net_init(), Eq(0));
+        sockfd_vec_init(&client_socks);
+        server_sock = net_bind("127.0.0.1", "5556");
+        ASSERT_THAT(server_sock, Ge(0));
+        ASSERT_THAT(
+            net_connect(&client_socks, "127.0.0.1", "5556"), Eq(0));
+        ASSERT_THAT(vec_count(client_socks), Ge(1));
+        client_sock = *vec_get(client_socks, 0);
+    }
+    void TearDown() override
+    {
+        int* sockfd;
+        vec_for_each (client_socks, sockfd)
+            net_close(*sockfd);
+        sockfd_vec_deinit(client_socks);
+        if (server_sock >= 0)
+            net_close(server_sock);
+        net_deinit();
+    }
+
+protected:
+    struct sockfd_vec* client_socks;
+    int                client_sock;
+    int                server_sock = -1;
+};
+
+TEST_F(NAME, recvfrom_many_returns_zero_if_nothing_is_pending)
+{
+    struct net_udp_packet pkts[4];
+    struct net_addr       addrs[4];
+    EXPECT_THAT(net_recvfrom_many(server_sock, pkts, addrs, 4), Eq(0));
+}
+
+TEST_F(NAME, recvfrom_many_reads_in_batches)
+{
+    struct net_udp_packet pkts[NET_BATCH_SIZE];
+    struct net_addr       addrs[NET_BATCH_SIZE];
+    const int             total = NET_BATCH_SIZE + 5;
+
+    for (int i = 0; i != total; ++i)
+    {
+        uint8_t buf[3] = {(uint8_t)i, 0xAB, 0xCD};
+        ASSERT_THAT(net_send(client_sock, buf, 1 + i % 3), Eq(1 + i % 3));
+    }
+
+    ASSERT_THAT(
+        net_recvfrom_many(server_sock, pkts, addrs, NET_BATCH_SIZE),
+        Eq(NET_BATCH_SIZE));
+    for (int i = 0; i != NET_BATCH_SIZE; ++i)
+    {
+        EXPECT_THAT(pkts[i].len, Eq(1 + i % 3));
+        EXPECT_THAT(pkts[i].data[0], Eq(i));
+        EXPECT_THAT(addrs[i].len, Eq(addrs[0].len));
+    }
+
+    ASSERT_THAT(
+        net_recvfrom_many(server_sock, pkts, addrs, NET_BATCH_SIZE), Eq(5));
+    EXPECT_THAT(pkts[4].data[0], Eq(total - 1));
+    EXPECT_THAT(
+        net_recvfrom_many(server_sock, pkts, addrs, NET_BATCH_SIZE), Eq(0));
+}
+
+TEST_F(NAME, sendto_many_reaches_every_address)
+{
+    struct net_udp_packet        pkts[NET_BATCH_SIZE + 3];
+    const struct net_udp_packet* pkt_ptrs[NET_BATCH_SIZE + 3];
+    const struct net_addr*       addrs[NET_BATCH_SIZE + 3];
+    struct net_addr              client_addr;
+    uint8_t                      buf[NET_MAX_UDP_PACKET_SIZE];
+
+    /* Learn the client's address */
+    buf[0] = 42;
+    ASSERT_THAT(net_send(client_sock, buf, 1), Eq(1));
+    ASSERT_THAT(net_recvfrom_many(server_sock, pkts, &client_addr, 1), Eq(1));
+
+    for (int i = 0; i != NET_BATCH_SIZE + 3; ++i)
+    {
+        pkts[i].len = 2;
+        pkts[i].data[0] = (uint8_t)i;
+        pkts[i].data[1] = 0xEE;
+        pkt_ptrs[i] = &pkts[i];
+        addrs[i] = &client_addr;
+    }
+    EXPECT_THAT(
+        net_sendto_many(server_sock, pkt_ptrs, addrs, NET_BATCH_SIZE + 3),
+        Eq(NET_BATCH_SIZE + 3));
+
+    for (int i = 0; i != NET_BATCH_SIZE + 3; ++i)
+    {
+        ASSERT_THAT(net_recv(client_sock, buf, sizeof(buf)), Eq(2));
+        EXPECT_THAT(buf[0], Eq(i));
+    }
+    EXPECT_THAT(net_recv(client_sock, buf, sizeof(buf)), Eq(0));
+}
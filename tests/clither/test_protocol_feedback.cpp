@@ -5,7 +5,7 @@ extern "C" {
 #include "clither/msg_vec.h"
 #include "clither/net.h"
 #include "clither/server.h"
-#include "clither/server_client_hm.h"
+#include "clither/server_client_vec.h"
 #include "clither/server_settings.h"
 #include "clither/snake_bmap.h"
 #include "clither/world.h"
@@ -102,6 +102,12 @@ TEST_F(NAME, server_holds_snake_until_catching_up_to_client_first_command_frame)
     uint16_t sv_frame = 32;
     ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+
+    // Answer the server's join challenge
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, sv_frame), Eq(0));
+    ASSERT_THAT(client_recv(&cl, &cl_world), Eq(client_recv_ok()));
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+
     ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, sv_frame), Eq(0));
     ASSERT_THAT(server_send_pending_data(&sv, &sv_world), Eq(0));
     cl.frame_number += rtt;
@@ -129,18 +135,14 @@ TEST_F(NAME, server_holds_snake_until_catching_up_to_client_first_command_frame)
         SimServer(sv_frame++);
         SimServer(sv_frame++);
         SimServer(sv_frame);
-        server_queue_snake_data(&sv, &sv_world, sv_frame);
+        server_queue_snake_data(&sv, &sv_settings, &sv_world, sv_frame);
         server_send_pending_data(&sv, &sv_world);
         sv_frame++;
     };
 
-    int16_t                slot;
-    const struct net_addr* addr;
-    struct server_client*  sv_client;
-    server_client_hm_for_each (sv.clients, slot, addr, sv_client)
+    struct server_client* sv_client;
+    server_client_vec_for_each (sv.clients, sv_client)
     {
-        (void)slot;
-        (void)addr;
         struct snake* sv_snake =
             snake_bmap_find(sv_world.snakes, sv_client->snake_id);
         ASSERT_THAT(snake_is_held(sv_snake), IsTrue());
@@ -149,10 +151,8 @@ TEST_F(NAME, server_holds_snake_until_catching_up_to_client_first_command_frame)
     while (sv_frame <= sv_hold_until)
         RunServerClient();
 
-    server_client_hm_for_each (sv.clients, slot, addr, sv_client)
+    server_client_vec_for_each (sv.clients, sv_client)
     {
-        (void)slot;
-        (void)addr;
         struct snake* sv_snake =
             snake_bmap_find(sv_world.snakes, sv_client->snake_id);
         ASSERT_THAT(snake_is_held(sv_snake), IsFalse());
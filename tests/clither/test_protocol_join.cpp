@@ -4,8 +4,9 @@ extern "C" {
 #include "clither/client.h"
 #include "clither/msg_vec.h"
 #include "clither/net.h"
+#include "clither/net_addr_hm.h"
 #include "clither/server.h"
-#include "clither/server_client_hm.h"
+#include "clither/server_client_vec.h"
 #include "clither/server_settings.h"
 #include "clither/snake_bmap.h"
 #include "clither/world.h"
@@ -45,6 +46,46 @@ public:
         net_deinit();
     }
 
+    /* Expects the server to answer the client's join request with a cookie,
+     * and has the client send the request again, this time with the cookie */
+    void AnswerChallenge(struct server* server, struct world* world)
+    {
+        int clients = hm_count(server->clients_by_addr);
+        ASSERT_THAT(server_recv(server, &sv_settings, world, 1), Eq(0));
+        ASSERT_THAT(hm_count(server->clients_by_addr), Eq(clients));
+        ASSERT_THAT(client_recv(&cl, &cl_world), Eq(client_recv_ok()));
+        ASSERT_THAT(cl.state, Eq(CLIENT_JOINING));
+        ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    }
+    void AnswerChallenge() { AnswerChallenge(&sv, &sv_world); }
+
+    /* Joins the server and returns the server's side of the client */
+    struct server_client* Join()
+    {
+        struct server_client* svc;
+        EXPECT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+        EXPECT_THAT(client_send_pending_data(&cl), Eq(0));
+        AnswerChallenge();
+        EXPECT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+        EXPECT_THAT(server_send_pending_data(&sv, &sv_world), Eq(0));
+        EXPECT_THAT(
+            client_recv(&cl, &cl_world), Eq(client_recv_tick_rate_changed()));
+        server_client_vec_for_each (sv.clients, svc)
+            return svc;
+        return nullptr;
+    }
+
+    /* Sends from a new local port, as if a NAT had changed the mapping */
+    void ChangeClientAddress()
+    {
+        int* sockfd;
+        vec_for_each (cl.udp_sockfds, sockfd)
+            net_close(*sockfd);
+        sockfd_vec_clear(cl.udp_sockfds);
+        ASSERT_THAT(
+            net_connect(&cl.udp_sockfds, "127.0.0.1", "5555"), Ge(0));
+    }
+
 protected:
     struct server          sv;
     struct server_settings sv_settings;
@@ -64,19 +105,33 @@ TEST_F(NAME, client_resends_join_request)
     ASSERT_THAT((*vec_get(cl.pending_msgs, 0))->type, Eq(MSG_JOIN_REQUEST));
 }
 
-TEST_F(NAME, server_resends_join_accept)
+TEST_F(NAME, client_resends_join_request_after_timeout)
 {
     ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    ASSERT_THAT((*vec_get(cl.pending_msgs, 0))->send_count, Eq(1));
+
+    /* Nothing was acked, and no loss can be detected */
+    for (int i = 1; i != ACK_RESEND_TIMEOUT; ++i)
+        ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    ASSERT_THAT((*vec_get(cl.pending_msgs, 0))->send_count, Eq(1));
+
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    ASSERT_THAT((*vec_get(cl.pending_msgs, 0))->send_count, Eq(2));
+}
+
+TEST_F(NAME, server_resends_join_accept)
+{
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
+    for (int i = 0; i != ACK_RESEND_TIMEOUT; ++i)
+        ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
 
-    int             slot;
-    const net_addr* addr;
-    server_client*  svc;
+    server_client* svc;
     ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
-    server_client_hm_for_each (sv.clients, slot, addr, svc)
+    server_client_vec_for_each (sv.clients, svc)
     {
-        (void)addr;
         ASSERT_THAT(vec_count(svc->pending_msgs), Eq(2));
         ASSERT_THAT(
             (*vec_get(svc->pending_msgs, 0))->type, Eq(MSG_JOIN_ACCEPT));
@@ -85,10 +140,73 @@ TEST_F(NAME, server_resends_join_accept)
     }
 }
 
+TEST_F(NAME, server_challenges_join_without_cookie)
+{
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+    EXPECT_THAT(hm_count(sv.clients_by_addr), Eq(0));
+    EXPECT_THAT(bmap_count(sv_world.snakes), Eq(0));
+
+    /* The join request is replaced by one carrying the cookie */
+    ASSERT_THAT(client_recv(&cl, &cl_world), Eq(client_recv_ok()));
+    ASSERT_THAT(vec_count(cl.pending_msgs), Eq(1));
+    struct msg* request = *vec_get(cl.pending_msgs, 0);
+    ASSERT_THAT(request->type, Eq(MSG_JOIN_REQUEST));
+    ASSERT_THAT(request->send_count, Eq(0));
+
+    union parsed_payload pp;
+    ASSERT_THAT(
+        msg_parse_payload(
+            &pp, MSG_JOIN_REQUEST, request->payload, request->payload_len),
+        Eq(MSG_JOIN_REQUEST));
+    EXPECT_THAT(pp.join_request.cookie, NotNull());
+}
+
+TEST_F(NAME, server_ignores_forged_cookie)
+{
+    uint8_t cookie[JOIN_COOKIE_SIZE] = {1, 2, 3, 4, 5, 6, 7, 8};
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+    msg_vec_remove_type(cl.pending_msgs, MSG_JOIN_REQUEST);
+    client_queue(&cl, msg_join_request(0x0000, 0, "test", cookie));
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+
+    AnswerChallenge();
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+    EXPECT_THAT(hm_count(sv.clients_by_addr), Eq(1));
+}
+
+TEST_F(NAME, cookie_expires_after_two_rotations)
+{
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
+
+    int rotation = JOIN_COOKIE_ROTATE_INTERVAL * sv_settings.net_tick_rate;
+    for (int i = 0; i != 2 * rotation; ++i)
+        ASSERT_THAT(
+            server_update_timeouts(&sv, &sv_settings, &sv_world), Eq(0));
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+    EXPECT_THAT(hm_count(sv.clients_by_addr), Eq(0));
+}
+
+TEST_F(NAME, server_challenges_before_denying_join)
+{
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+
+    /* An address that didn't prove itself only ever gets a challenge */
+    sv_settings.max_players = 0;
+    sv_settings.max_username_len = 1;
+    sv.redirect_port = 5556;
+    AnswerChallenge();
+}
+
 TEST_F(NAME, server_denies_join_full_server)
 {
     ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
 
     sv_settings.max_players = 0;
     ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
@@ -99,10 +217,85 @@ TEST_F(NAME, server_denies_join_full_server)
     ASSERT_THAT(vec_count(cl.pending_msgs), Eq(0));
 }
 
+TEST_F(NAME, server_redirects_join_when_full)
+{
+    struct server sv2;
+    struct world  sv2_world;
+    ASSERT_THAT(server_init(&sv2, "", "5556"), Eq(0));
+    world_init(&sv2_world);
+
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
+
+    sv_settings.max_players = 0;
+    sv.redirect_port = 5556;
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+    EXPECT_THAT(hm_count(sv.clients_by_addr), Eq(0));
+
+    /* Client reconnects to the other instance */
+    ASSERT_THAT(client_recv(&cl, &cl_world), Eq(client_recv_ok()));
+    ASSERT_THAT(cl.state, Eq(CLIENT_JOINING));
+    ASSERT_THAT(vec_count(cl.pending_msgs), Eq(1));
+    ASSERT_THAT((*vec_get(cl.pending_msgs, 0))->type, Eq(MSG_JOIN_REQUEST));
+    ASSERT_THAT((*vec_get(cl.pending_msgs, 0))->send_count, Eq(0));
+
+    sv_settings.max_players = 10;
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge(&sv2, &sv2_world);
+    ASSERT_THAT(server_recv(&sv2, &sv_settings, &sv2_world, 1), Eq(0));
+    EXPECT_THAT(hm_count(sv2.clients_by_addr), Eq(1));
+    ASSERT_THAT(server_send_pending_data(&sv2, &sv2_world), Eq(0));
+    ASSERT_THAT(
+        client_recv(&cl, &cl_world), Eq(client_recv_tick_rate_changed()));
+    ASSERT_THAT(cl.state, Eq(CLIENT_CONNECTED));
+
+    world_deinit(&sv2_world);
+    server_deinit(&sv2);
+}
+
+TEST_F(NAME, server_redirects_join_when_over_cpu_budget)
+{
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
+
+    sv.redirect_port = 5556;
+    sv.over_cpu_budget = 1;
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+    EXPECT_THAT(hm_count(sv.clients_by_addr), Eq(0));
+    ASSERT_THAT(client_recv(&cl, &cl_world), Eq(client_recv_ok()));
+    EXPECT_THAT(cl.redirects, Eq(1));
+}
+
+TEST_F(NAME, client_stops_following_redirects_eventually)
+{
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+
+    /* The server keeps redirecting to itself */
+    sv_settings.max_players = 0;
+    sv.redirect_port = 5555;
+    for (int i = 0; i != CLIENT_MAX_REDIRECTS; ++i)
+    {
+        ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+        AnswerChallenge();
+        ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+        ASSERT_THAT(client_recv(&cl, &cl_world), Eq(client_recv_ok()));
+        ASSERT_THAT(cl.state, Eq(CLIENT_JOINING));
+    }
+
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+    ASSERT_THAT(client_recv(&cl, &cl_world), Eq(client_recv_disconnected()));
+    ASSERT_THAT(cl.state, Eq(CLIENT_DISCONNECTED));
+}
+
 TEST_F(NAME, server_denies_join_username_too_long)
 {
     ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
 
     sv_settings.max_username_len = 1;
     ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
@@ -117,6 +310,7 @@ TEST_F(NAME, server_accepts_join)
 {
     ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
 
     ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
     ASSERT_THAT(server_send_pending_data(&sv, &sv_world), Eq(0));
@@ -130,6 +324,93 @@ TEST_F(NAME, server_accepts_join)
     ASSERT_THAT(snake_bmap_find(sv_world.snakes, cl.snake_id), NotNull());
 }
 
+TEST_F(NAME, server_assigns_connection_id)
+{
+    struct server_client* svc = Join();
+    ASSERT_THAT(svc, NotNull());
+    EXPECT_THAT(cl.conn_id, Ne(0u));
+    EXPECT_THAT(cl.conn_id, Eq(svc->conn_id));
+}
+
+TEST_F(NAME, client_keeps_connection_when_address_changes)
+{
+    struct server_client* svc = Join();
+    ASSERT_THAT(svc, NotNull());
+    struct net_addr old_addr = svc->addr;
+
+    ChangeClientAddress();
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 2), Eq(0));
+    ASSERT_THAT(hm_count(sv.clients_by_addr), Eq(1));
+    EXPECT_THAT(
+        memcmp(
+            svc->addr.sockaddr_storage,
+            old_addr.sockaddr_storage,
+            old_addr.len),
+        Ne(0));
+
+    /* The server's reply arrives at the new address */
+    uint16_t recv_seq = cl.ack.recv_seq;
+    ASSERT_THAT(server_send_pending_data(&sv, &sv_world), Eq(0));
+    ASSERT_THAT(client_recv(&cl, &cl_world), Eq(client_recv_ok()));
+    EXPECT_THAT(cl.ack.recv_seq, Ne(recv_seq));
+}
+
+TEST_F(NAME, connection_id_from_other_address_is_validated)
+{
+    struct server_client* svc = Join();
+    ASSERT_THAT(svc, NotNull());
+    struct net_addr addr = svc->addr;
+
+    struct sockfd_vec* sockfds;
+    sockfd_vec_init(&sockfds);
+    ASSERT_THAT(net_connect(&sockfds, "127.0.0.1", "5555"), Ge(0));
+
+    /* Guessed id, and a correct id on a packet that isn't newer than what
+     * the client sent */
+    uint64_t ids[2] = {svc->conn_id ^ 0x10000, svc->conn_id};
+    uint16_t seqs[2] = {0x1000, svc->ack.recv_seq};
+    for (int i = 0; i != 2; ++i)
+    {
+        uint8_t buf[MSG_CONN_ID_SIZE + ACK_HEADER_SIZE] = {};
+        for (int b = 0; b != MSG_CONN_ID_SIZE; ++b)
+            buf[b] = (uint8_t)(ids[i] >> (8 * (MSG_CONN_ID_SIZE - 1 - b)));
+        buf[MSG_CONN_ID_SIZE + 0] = (uint8_t)(seqs[i] >> 8);
+        buf[MSG_CONN_ID_SIZE + 1] = (uint8_t)seqs[i];
+        ASSERT_THAT(
+            net_send(*vec_last(sockfds), buf, sizeof(buf)), Eq((int)sizeof(buf)));
+        ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 2), Eq(0));
+        ASSERT_THAT(hm_count(sv.clients_by_addr), Eq(1));
+        EXPECT_THAT(
+            memcmp(svc->addr.sockaddr_storage, addr.sockaddr_storage, addr.len),
+            Eq(0));
+    }
+
+    int* sockfd;
+    vec_for_each (sockfds, sockfd)
+        net_close(*sockfd);
+    sockfd_vec_deinit(sockfds);
+}
+
+TEST_F(NAME, server_times_out_silent_client)
+{
+    ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
+    ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
+    ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 1), Eq(0));
+    ASSERT_THAT(hm_count(sv.clients_by_addr), Eq(1));
+
+    /* server_recv() already advanced by one tick */
+    int timeout = sv_settings.client_timeout * sv_settings.net_tick_rate;
+    for (int i = 0; i != timeout; ++i)
+        ASSERT_THAT(
+            server_update_timeouts(&sv, &sv_settings, &sv_world), Eq(0));
+    EXPECT_THAT(hm_count(sv.clients_by_addr), Eq(1));
+
+    ASSERT_THAT(server_update_timeouts(&sv, &sv_settings, &sv_world), Eq(0));
+    EXPECT_THAT(hm_count(sv.clients_by_addr), Eq(0));
+}
+
 TEST_F(NAME, client_calculates_frame_number_with_buffer)
 {
     uint16_t sv_frame_number = 32;
@@ -138,6 +419,7 @@ TEST_F(NAME, client_calculates_frame_number_with_buffer)
 
     ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
 
     ASSERT_THAT(
         server_recv(&sv, &sv_settings, &sv_world, sv_frame_number), Eq(0));
@@ -161,6 +443,7 @@ TEST_F(NAME, client_updates_tick_rates_from_server)
     sv_settings.net_tick_rate = 80;
     ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
     ASSERT_THAT(server_recv(&sv, &sv_settings, &sv_world, 32), Eq(0));
     ASSERT_THAT(server_send_pending_data(&sv, &sv_world), Eq(0));
     ASSERT_THAT(
@@ -179,6 +462,7 @@ TEST_F(NAME, client_rejects_server_if_given_incorrect_rtt)
 
     ASSERT_THAT(client_connect(&cl, "127.0.0.1", "5555", "test"), Eq(0));
     ASSERT_THAT(client_send_pending_data(&cl), Eq(0));
+    AnswerChallenge();
 
     ASSERT_THAT(
         server_recv(&sv, &sv_settings, &sv_world, sv_frame_number), Eq(0));
@@ -0,0 +1,346 @@
+#include "gmock/gmock.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include "clither/bezier_handle_rb.h"
+#include "clither/cmd.h"
+#include "clither/qwaabb_rb.h"
+#include "clither/quadtree.h"
+#include "clither/quadtree_handle_rb.h"
+#include "clither/snake.h"
+#include "clither/snake_bmap.h"
+#include "clither/world.h"
+}
+
+#define NAME loose_quadtree
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        quadtree_init(&qt, make_qwaabbi(-64, -64, 64, 64));
+    }
+
+    void TearDown() override { quadtree_deinit(&qt); }
+
+    std::vector<int32_t> query(struct qwaabb aabb)
+    {
+        std::vector<int32_t> result;
+        quadtree_query(&qt, aabb, on_item, &result);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    static int on_item(int32_t item, uint16_t key, void* user)
+    {
+        (void)key;
+        static_cast<std::vector<int32_t>*>(user)->push_back(item);
+        return 0;
+    }
+
+    struct quadtree qt;
+};
+
+TEST_F(NAME, empty_tree_finds_nothing)
+{
+    EXPECT_THAT(quadtree_count(&qt), Eq(0));
+    EXPECT_THAT(query(make_qwaabbi(-64, -64, 64, 64)), IsEmpty());
+}
+
+TEST_F(NAME, query_finds_overlapping_items)
+{
+    int32_t a = quadtree_insert(&qt, make_qwaabbi(1, 1, 2, 2), 1);
+    int32_t b = quadtree_insert(&qt, make_qwaabbi(10, 10, 20, 20), 2);
+    int32_t c = quadtree_insert(&qt, make_qwaabbi(-40, 30, -39, 31), 3);
+    ASSERT_THAT(a, Ge(0));
+    ASSERT_THAT(b, Ge(0));
+    ASSERT_THAT(c, Ge(0));
+    EXPECT_THAT(quadtree_count(&qt), Eq(3));
+
+    EXPECT_THAT(query(make_qwaabbi(0, 0, 1, 1)), ElementsAre(a));
+    EXPECT_THAT(query(make_qwaabbi(2, 2, 10, 10)), ElementsAre(a, b));
+    EXPECT_THAT(query(make_qwaabbi(-41, 29, -40, 30)), ElementsAre(c));
+    EXPECT_THAT(query(make_qwaabbi(30, -30, 31, -29)), IsEmpty());
+}
+
+TEST_F(NAME, items_outside_of_bounds_are_found)
+{
+    int32_t a = quadtree_insert(&qt, make_qwaabbi(200, 200, 201, 201), 1);
+    int32_t b = quadtree_insert(&qt, make_qwaabbi(-500, -1, 500, 1), 2);
+
+    EXPECT_THAT(query(make_qwaabbi(200, 200, 200, 200)), ElementsAre(a));
+    EXPECT_THAT(query(make_qwaabbi(0, 0, 0, 0)), ElementsAre(b));
+    EXPECT_THAT(query(make_qwaabbi(-400, 0, -400, 0)), ElementsAre(b));
+}
+
+TEST_F(NAME, remove_and_reuse_item)
+{
+    int32_t a = quadtree_insert(&qt, make_qwaabbi(1, 1, 2, 2), 1);
+    int32_t b = quadtree_insert(&qt, make_qwaabbi(1, 1, 2, 2), 2);
+    quadtree_remove(&qt, a);
+    EXPECT_THAT(quadtree_count(&qt), Eq(1));
+    EXPECT_THAT(query(make_qwaabbi(0, 0, 3, 3)), ElementsAre(b));
+
+    int32_t c = quadtree_insert(&qt, make_qwaabbi(5, 5, 6, 6), 3);
+    EXPECT_THAT(c, Eq(a));
+    EXPECT_THAT(quadtree_get(&qt, c)->key, Eq(3));
+    EXPECT_THAT(
+        query(make_qwaabbi(0, 0, 6, 6)),
+        ElementsAre(std::min(b, c), std::max(b, c)));
+}
+
+TEST_F(NAME, update_moves_item)
+{
+    int32_t a = quadtree_insert(&qt, make_qwaabbi(1, 1, 2, 2), 1);
+    quadtree_update(&qt, a, make_qwaabbi(-30, -30, -29, -29));
+    EXPECT_THAT(query(make_qwaabbi(1, 1, 2, 2)), IsEmpty());
+    EXPECT_THAT(query(make_qwaabbi(-30, -30, -30, -30)), ElementsAre(a));
+
+    /* Growing the item moves it up the tree */
+    quadtree_update(&qt, a, make_qwaabbi(-30, -30, 30, 30));
+    EXPECT_THAT(query(make_qwaabbi(25, 25, 25, 25)), ElementsAre(a));
+    EXPECT_THAT(quadtree_count(&qt), Eq(1));
+}
+
+TEST_F(NAME, clear_removes_everything)
+{
+    quadtree_insert(&qt, make_qwaabbi(1, 1, 2, 2), 1);
+    quadtree_insert(&qt, make_qwaabbi(3, 3, 4, 4), 1);
+    quadtree_clear(&qt);
+    EXPECT_THAT(quadtree_count(&qt), Eq(0));
+    EXPECT_THAT(query(make_qwaabbi(-64, -64, 64, 64)), IsEmpty());
+}
+
+TEST_F(NAME, matches_brute_force)
+{
+    std::vector<struct qwaabb> aabbs;
+    srand(1234);
+    for (int i = 0; i != 500; ++i)
+    {
+        qw x = make_qw2(rand() % 16000 - 8000, 100);
+        qw y = make_qw2(rand() % 16000 - 8000, 100);
+        qw w = make_qw2(rand() % 1000, 100);
+        qw h = make_qw2(rand() % 1000, 100);
+        aabbs.push_back(make_qwaabbqw(x, y, x + w, y + h));
+        ASSERT_THAT(quadtree_insert(&qt, aabbs.back(), 0), Eq(i));
+    }
+
+    for (int i = 0; i != 100; ++i)
+    {
+        qw x = make_qw2(rand() % 16000 - 8000, 100);
+        qw y = make_qw2(rand() % 16000 - 8000, 100);
+        struct qwaabb q = make_qwaabbqw(x, y, x + make_qw(3), y + make_qw(3));
+
+        std::vector<int32_t> expected;
+        for (int j = 0; j != (int)aabbs.size(); ++j)
+            if (aabbs[j].x1 <= q.x2 && aabbs[j].x2 >= q.x1 &&
+                aabbs[j].y1 <= q.y2 && aabbs[j].y2 >= q.y1)
+                expected.push_back(j);
+        EXPECT_THAT(query(q), Eq(expected));
+    }
+}
+
+TEST(quadtree_snake, segments_are_kept_in_sync)
+{
+    struct quadtree qt;
+    struct snake    snake;
+    struct cmd      c;
+    quadtree_init(&qt, make_qwaabbi(-64, -64, 64, 64));
+    snake_init(&snake, make_qwposi(0, 0), "test");
+    ASSERT_THAT(snake_attach_quadtree(&snake.data, &qt, 7), Eq(0));
+    EXPECT_THAT(quadtree_count(&qt), Eq(1));
+
+    c = cmd_default();
+    c.angle = 40;
+    for (int frame = 0; frame != 600; ++frame)
+    {
+        c.angle = (uint8_t)(c.angle + (frame / 30 % 2 ? 3 : -3));
+        snake_remove_stale_segments(
+            &snake.data,
+            snake_step(&snake.data, &snake.head, &snake.param, c, 60));
+        ASSERT_THAT(snake_sync_quadtree(&snake.data), Eq(0));
+
+        ASSERT_THAT(
+            quadtree_count(&qt), Eq(rb_count(snake.data.bezier_aabbs)));
+    }
+    EXPECT_THAT(rb_count(snake.data.bezier_aabbs), Gt(1));
+
+    /* The head segment's bounding box is updated every step */
+    {
+        struct qwpos head = snake.head.pos;
+        int          found = 0;
+        quadtree_query(
+            &qt,
+            make_qwaabbqw(head.x, head.y, head.x, head.y),
+            [](int32_t, uint16_t key, void* user) {
+                *static_cast<int*>(user) += key == 7;
+                return 0;
+            },
+            &found);
+        EXPECT_THAT(found, Ge(1));
+    }
+
+    snake_deinit(&snake);
+    EXPECT_THAT(quadtree_count(&qt), Eq(0));
+    quadtree_deinit(&qt);
+}
+
+TEST(quadtree_snake, stepping_only_records_changes)
+{
+    struct quadtree qt;
+    struct snake    snake;
+    struct cmd      c;
+    quadtree_init(&qt, make_qwaabbi(-64, -64, 64, 64));
+    snake_init(&snake, make_qwposi(0, 0), "test");
+    ASSERT_THAT(snake_attach_quadtree(&snake.data, &qt, 7), Eq(0));
+
+    /* Turning in circles adds segments quickly */
+    c = cmd_default();
+    for (int frame = 0; frame != 120; ++frame)
+    {
+        c.angle = (uint8_t)(c.angle + 4);
+        snake_remove_stale_segments(
+            &snake.data,
+            snake_step(&snake.data, &snake.head, &snake.param, c, 60));
+    }
+    ASSERT_THAT(rb_count(snake.data.bezier_aabbs), Gt(1));
+    EXPECT_THAT(quadtree_count(&qt), Eq(1));
+    EXPECT_THAT(quadtree_get(&qt, 0)->aabb.x2, Eq(0));
+
+    ASSERT_THAT(snake_sync_quadtree(&snake.data), Eq(0));
+    EXPECT_THAT(quadtree_count(&qt), Eq(rb_count(snake.data.bezier_aabbs)));
+    EXPECT_THAT(
+        quadtree_get(&qt, *rb_peek_read(snake.data.quadtree_items))->aabb.x2,
+        Eq(rb_peek_read(snake.data.bezier_aabbs)->x2));
+
+    snake_deinit(&snake);
+    EXPECT_THAT(quadtree_count(&qt), Eq(0));
+    quadtree_deinit(&qt);
+}
+
+static void step_in_world(struct world* world, struct snake* snake, cmd c)
+{
+    snake_remove_stale_segments(
+        &snake->data,
+        snake_step(&snake->data, &snake->head, &snake->param, c, 60));
+    world_step(world, 0, 60);
+}
+
+TEST(quadtree_world, world_step_finds_head_in_other_snake)
+{
+    struct world  world;
+    struct snake* a;
+    struct snake* b;
+    world_init(&world);
+    a = world_create_snake(&world, 1, make_qwposi(0, 0), "a");
+    b = world_create_snake(&world, 2, make_qwposi(30, 30), "b");
+    ASSERT_THAT(a, NotNull());
+    ASSERT_THAT(b, NotNull());
+    EXPECT_THAT(quadtree_count(&world.quadtree), Eq(2));
+
+    /* Both heads only touch their own segment */
+    world_step(&world, 0, 60);
+    EXPECT_THAT(vec_count(world.collisions), Eq(0));
+
+    /* Move b's head into a's body */
+    b->head.pos = make_qwposi(0, 0);
+    world_step(&world, 0, 60);
+    ASSERT_THAT(vec_count(world.collisions), Eq(1));
+    EXPECT_THAT(vec_get(world.collisions, 0)->snake_id, Eq(2));
+    EXPECT_THAT(vec_get(world.collisions, 0)->other_snake_id, Eq(1));
+
+    world_remove_snake(&world, 1);
+    EXPECT_THAT(quadtree_count(&world.quadtree), Eq(1));
+    world_step(&world, 0, 60);
+    EXPECT_THAT(vec_count(world.collisions), Eq(0));
+
+    world_deinit(&world);
+}
+
+TEST(quadtree_world, snake_does_not_collide_with_its_newest_segments)
+{
+    struct world  world;
+    struct snake* snake;
+    struct cmd    c;
+    world_init(&world);
+    snake = world_create_snake(&world, 1, make_qwposi(0, 0), "a");
+    ASSERT_THAT(snake, NotNull());
+    snake_param_update(&snake->param, {}, 1024);
+
+    c = cmd_default();
+    for (int frame = 0; frame != 600; ++frame)
+    {
+        c.angle = (uint8_t)(frame / 30 % 2 ? 8 : -8);
+        step_in_world(&world, snake, c);
+        ASSERT_THAT(vec_count(world.collisions), Eq(0)) << frame;
+    }
+    EXPECT_THAT(rb_count(snake->data.bezier_aabbs), Gt(1));
+    EXPECT_THAT(
+        quadtree_count(&world.quadtree),
+        Eq(rb_count(snake->data.bezier_aabbs)));
+
+    world_deinit(&world);
+}
+
+TEST(quadtree_world, snake_circling_collides_with_its_older_segments)
+{
+    struct world  world;
+    struct snake* snake;
+    struct cmd    c;
+    int           frame;
+    world_init(&world);
+    snake = world_create_snake(&world, 1, make_qwposi(0, 0), "a");
+    ASSERT_THAT(snake, NotNull());
+    snake_param_update(&snake->param, {}, 1024);
+
+    c = cmd_default();
+    for (frame = 0; frame != 600; ++frame)
+    {
+        c.angle = (uint8_t)(c.angle + 4);
+        step_in_world(&world, snake, c);
+        if (vec_count(world.collisions) > 0)
+            break;
+    }
+    ASSERT_THAT(frame, Lt(600));
+    EXPECT_THAT(vec_get(world.collisions, 0)->snake_id, Eq(1));
+    EXPECT_THAT(vec_get(world.collisions, 0)->other_snake_id, Eq(1));
+
+    world_deinit(&world);
+}
+
+TEST(quadtree_world, rebuild_restores_segments)
+{
+    struct world  world;
+    struct snake* a;
+    struct snake* b;
+    world_init(&world);
+    a = world_create_snake(&world, 1, make_qwposi(0, 0), "a");
+    b = world_create_snake(&world, 2, make_qwposi(0, 3), "b");
+    ASSERT_THAT(a, NotNull());
+    ASSERT_THAT(b, NotNull());
+    for (int frame = 0; frame != 300; ++frame)
+    {
+        step_in_world(&world, a, cmd_default());
+        step_in_world(&world, b, cmd_default());
+    }
+
+    world_step(&world, 0, 60);
+    EXPECT_THAT(vec_count(world.collisions), Eq(0));
+
+    /* b's head is placed onto a's tail, away from a's head */
+    b->head.pos = rb_peek_read(a->data.bezier_handles)->pos;
+    ASSERT_THAT(world_rebuild_quadtree(&world), Eq(0));
+    EXPECT_THAT(
+        quadtree_count(&world.quadtree),
+        Eq(rb_count(a->data.bezier_aabbs) + rb_count(b->data.bezier_aabbs)));
+    world_step(&world, 0, 60);
+    ASSERT_THAT(vec_count(world.collisions), Eq(1));
+    EXPECT_THAT(vec_get(world.collisions, 0)->snake_id, Eq(2));
+    EXPECT_THAT(vec_get(world.collisions, 0)->other_snake_id, Eq(1));
+
+    world_deinit(&world);
+}
@@ -0,0 +1,49 @@
+#include "gmock/gmock.h"
+
+extern "C" {
+#include "clither/server_instance.h"
+#include "clither/server_settings.h"
+}
+
+#define NAME server_instance_scaling
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        server_settings_set_defaults(&settings);
+        settings.max_players = 10;
+        settings.instance_cpu_budget = 50;
+
+        instance.settings = &settings;
+        instance.player_count = 0;
+        instance.load = 0;
+    }
+
+    struct server_settings settings;
+    struct server_instance instance;
+};
+
+TEST_F(NAME, empty_instance_is_not_full)
+{
+    EXPECT_THAT(server_instance_is_full(&instance), IsFalse());
+}
+
+TEST_F(NAME, full_when_max_players_is_reached)
+{
+    instance.player_count = 9;
+    EXPECT_THAT(server_instance_is_full(&instance), IsFalse());
+    instance.player_count = 10;
+    EXPECT_THAT(server_instance_is_full(&instance), IsTrue());
+}
+
+TEST_F(NAME, full_when_cpu_budget_is_used_up)
+{
+    instance.player_count = 1;
+    instance.load = 49;
+    EXPECT_THAT(server_instance_is_full(&instance), IsFalse());
+    instance.load = 50;
+    EXPECT_THAT(server_instance_is_full(&instance), IsTrue());
+}
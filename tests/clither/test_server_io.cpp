@@ -0,0 +1,102 @@
+#include "gmock/gmock.h"
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "clither/net.h"
+#include "clither/server_io.h"
+#include "clither/tick.h"
+}
+
+#define NAME server_io_thread
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        ASSERT_THAT(net_init(), Eq(0));
+        server_sock = net_bind("", "5560");
+        ASSERT_THAT(server_sock, Ge(0));
+        sockfd_vec_init(&client_socks);
+        ASSERT_THAT(
+            net_connect(&client_socks, "127.0.0.1", "5560"), Eq(0));
+        ASSERT_THAT(server_io_init(&io, server_sock), Eq(0));
+    }
+
+    void TearDown() override
+    {
+        int* sockfd;
+        server_io_deinit(&io);
+        vec_for_each (client_socks, sockfd)
+            net_close(*sockfd);
+        sockfd_vec_deinit(client_socks);
+        net_close(server_sock);
+        net_deinit();
+    }
+
+    /* Takes packets until "count" have arrived or a second has passed */
+    std::vector<std::string> Receive(int count)
+    {
+        std::vector<std::string> received;
+        uint64_t                 start = tick_now();
+        while (received.size() < (size_t)count &&
+               tick_now() - start < 1000000000)
+        {
+            const struct server_io_packets* pkts = server_io_take(&io);
+            EXPECT_THAT(pkts, NotNull());
+            for (int i = 0; i != pkts->count; ++i)
+                received.push_back(std::string(
+                    (const char*)pkts->pkts[i].data, pkts->pkts[i].len));
+        }
+        return received;
+    }
+
+    void Send(const char* data)
+    {
+        /* The server binds to the wildcard address, so whichever of the
+         * candidate sockets works delivers it */
+        net_send(*vec_get(client_socks, 0), data, (int)strlen(data));
+    }
+
+    int                 server_sock;
+    struct sockfd_vec*  client_socks;
+    struct server_io    io;
+};
+
+TEST_F(NAME, nothing_received_initially)
+{
+    const struct server_io_packets* pkts = server_io_take(&io);
+    ASSERT_THAT(pkts, NotNull());
+    EXPECT_THAT(pkts->count, Eq(0));
+}
+
+TEST_F(NAME, packets_arrive_in_order)
+{
+    Send("one");
+    Send("two");
+    Send("three");
+    EXPECT_THAT(Receive(3), ElementsAre("one", "two", "three"));
+}
+
+TEST_F(NAME, packets_are_taken_once)
+{
+    Send("one");
+    EXPECT_THAT(Receive(1), ElementsAre("one"));
+    EXPECT_THAT(server_io_take(&io)->count, Eq(0));
+}
+
+TEST_F(NAME, excess_packets_are_dropped)
+{
+    /* Nobody takes the packets in the meantime */
+    for (int i = 0; i != SERVER_IO_CAPACITY + 10; ++i)
+        Send("x");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    EXPECT_THAT(server_io_take(&io)->count, Eq(SERVER_IO_CAPACITY));
+    EXPECT_THAT(server_io_take(&io)->count, Eq(0));
+}
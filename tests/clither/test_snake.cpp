@@ -2,11 +2,14 @@
 
 extern "C" {
 #include "clither/bezier_handle_rb.h"
+#include "clither/bezier_point_vec.h"
 #include "clither/log.h"
+#include "clither/qw_rb.h"
 #include "clither/qwaabb_rb.h"
 #include "clither/qwpos_vec.h"
 #include "clither/qwpos_vec_rb.h"
 #include "clither/snake.h"
+#include "clither/snake_segment_points_rb.h"
 #include "clither/vec.h"
 #include "clither/wrap.h"
 }
@@ -336,6 +339,13 @@ TEST(NAME, roll_back_to_first_frame)
         65535 - 10,
         60);
 
+    /* Rolling back removes points from the trails, and simulating forwards
+     * again adds them back. The running sums must still match the trail */
+    struct bezier_fit_sums sums;
+    bezier_fit_sums_init(&sums, *rb_peek_write(client.data.head_trails));
+    EXPECT_THAT(client.data.head_fit_sums.x, ElementsAreArray(sums.x));
+    EXPECT_THAT(client.data.head_fit_sums.y, ElementsAreArray(sums.y));
+
     snake_deinit(&client);
     snake_deinit(&server);
 }
@@ -369,8 +379,8 @@ TEST(NAME, ackd_head_is_never_outside_aabb)
     ASSERT_THAT(rb_count(client.data.bezier_handles), Eq(4u));
     ASSERT_THAT(rb_count(client.data.bezier_aabbs), Eq(3u));
     ASSERT_THAT(vec_count(*rb_peek(client.data.head_trails, 0)), Eq(10u));
-    ASSERT_THAT(vec_count(*rb_peek(client.data.head_trails, 1)), Eq(36u));
-    ASSERT_THAT(vec_count(*rb_peek(client.data.head_trails, 2)), Eq(32u));
+    ASSERT_THAT(vec_count(*rb_peek(client.data.head_trails, 1)), Eq(41u));
+    ASSERT_THAT(vec_count(*rb_peek(client.data.head_trails, 2)), Eq(27u));
 
     // Reset same conditions for stepping server snake
     c = cmd_default();
@@ -440,7 +450,7 @@ TEST(NAME, ackd_head_is_never_outside_aabb)
 
     // ------------------------------------------------------------------------
     // Step ack'd head up until 1 point before the end of the 2nd segment
-    for (int i = 0; i < 34; ++i, ++frame_number)
+    for (int i = 0; i < 39; ++i, ++frame_number)
     {
         c.angle += 2;
         snake_step(&server.data, &server.head, &param, c, 60);
@@ -502,7 +512,7 @@ TEST(NAME, ackd_head_is_never_outside_aabb)
 
     // ------------------------------------------------------------------------
     // Step ack'd head up until 1 point before the end of the 3nd segment
-    for (int i = 0; i < 30; ++i, ++frame_number)
+    for (int i = 0; i < 25; ++i, ++frame_number)
     {
         c.angle += 2;
         snake_step(&server.data, &server.head, &param, c, 60);
@@ -528,3 +538,138 @@ TEST(NAME, ackd_head_is_never_outside_aabb)
     snake_deinit(&server);
     snake_deinit(&client);
 }
+
+TEST(NAME, server_step_removes_stale_segments)
+{
+    struct snake snake;
+    snake_init(&snake, make_qwposi(1, 1), "server");
+
+    struct snake_param param;
+    snake_param_init(&param);
+
+    struct cmd c = cmd_default();
+    int        removed = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        /* Alternate between curving and going straight */
+        if (i % 200 < 100)
+            c.angle += 2;
+
+        int stale = snake_step_server(&snake.data, &snake.head, &param, c, 60);
+        snake_remove_stale_segments(&snake.data, stale);
+        removed += stale;
+        ASSERT_THAT(
+            rb_count(snake.data.bezier_lengths),
+            Eq(rb_count(snake.data.bezier_aabbs)));
+        if (removed == 0)
+            continue;
+
+        /*
+         * The remaining segments are long enough, but without the tail
+         * segment they wouldn't be. The snake's length is rounded up to whole
+         * point spacings, which is less than twice the length here.
+         */
+        qw total = 0;
+        for (int j = 1; j < rb_count(snake.data.bezier_lengths); ++j)
+            total += *rb_peek(snake.data.bezier_lengths, j);
+        ASSERT_THAT(total, Lt(2 * snake_length(&param))) << i;
+        total += *rb_peek(snake.data.bezier_lengths, 0);
+        ASSERT_THAT(total, Ge(snake_length(&param))) << i;
+    }
+
+    /* Make sure the snake actually got long enough to lose segments */
+    EXPECT_THAT(removed, Gt(0));
+
+    snake_deinit(&snake);
+}
+
+TEST(NAME, points_are_evenly_spaced)
+{
+    struct snake snake;
+    snake_init(&snake, make_qwposi(1, 1), "client");
+
+    struct snake_param param;
+    snake_param_init(&param);
+    snake_param_update(&param, param.upgrades, 400);
+    const double spacing =
+        qw_to_float(make_qw2(1, 6)) * qw_to_float(snake_scale(&param));
+
+    struct cmd c = cmd_default();
+    for (int i = 0; i < 1000; ++i)
+    {
+        if (i % 200 < 100)
+            c.angle += 2;
+        snake_remove_stale_segments(
+            &snake.data,
+            snake_step(&snake.data, &snake.head, &param, c, 60));
+
+        /* Only the first point, which is the head, can be closer */
+        const struct bezier_point_vec* points = snake.data.bezier_points;
+        for (int j = 1; j < vec_count(points); ++j)
+        {
+            const struct qwpos a = vec_get(points, j - 1)->pos;
+            const struct qwpos b = vec_get(points, j)->pos;
+            double dist = hypot(
+                qw_to_float(a.x) - qw_to_float(b.x),
+                qw_to_float(a.y) - qw_to_float(b.y));
+            if (j == 1)
+                ASSERT_THAT(dist, Le(spacing * 1.01)) << i;
+            else
+                ASSERT_THAT(dist, DoubleNear(spacing, spacing * 0.01)) << i;
+        }
+    }
+
+    snake_deinit(&snake);
+}
+
+TEST(NAME, segments_behind_head_are_not_sampled_again)
+{
+    struct snake snake;
+    snake_init(&snake, make_qwposi(1, 1), "client");
+
+    struct snake_param param;
+    snake_param_init(&param);
+    snake_param_update(&param, param.upgrades, 400);
+
+    struct cmd c = cmd_default();
+    while (rb_count(snake.data.bezier_handles) < 5)
+    {
+        c.angle += 2;
+        snake_step(&snake.data, &snake.head, &param, c, 60);
+    }
+
+    /*
+     * Segments are sampled once they stop being the head segment. The first
+     * segment was created with no length, so check the second one.
+     */
+    const struct snake_segment_points* sp =
+        rb_peek(snake.data.segment_points, 1);
+    ASSERT_THAT(sp->valid, IsTrue());
+    std::vector<struct qwpos> sampled;
+    for (int j = 0; j < vec_count(sp->points); ++j)
+        sampled.push_back(vec_get(sp->points, j)->pos);
+    ASSERT_THAT(sampled, Not(IsEmpty()));
+
+    /* The snake is too short to lose segments here */
+    for (int i = 0; i < 100; ++i)
+    {
+        c.angle += 2;
+        ASSERT_THAT(
+            snake_step(&snake.data, &snake.head, &param, c, 60), Eq(0));
+    }
+
+    sp = rb_peek(snake.data.segment_points, 1);
+    ASSERT_THAT(vec_count(sp->points), Eq((int)sampled.size()));
+    for (int j = 0; j < vec_count(sp->points); ++j)
+    {
+        EXPECT_THAT(vec_get(sp->points, j)->pos.x, Eq(sampled[j].x));
+        EXPECT_THAT(vec_get(sp->points, j)->pos.y, Eq(sampled[j].y));
+    }
+
+    /* The tail end of the snake is made up of these points */
+    const struct bezier_point* last = vec_last(snake.data.bezier_points);
+    EXPECT_THAT(last->pos.x, Eq(sampled.back().x));
+    EXPECT_THAT(last->pos.y, Eq(sampled.back().y));
+
+    snake_deinit(&snake);
+}
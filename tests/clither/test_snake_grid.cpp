@@ -0,0 +1,117 @@
+#include "gmock/gmock.h"
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include "clither/snake.h"
+#include "clither/snake_bmap.h"
+#include "clither/snake_grid.h"
+}
+
+#define NAME spatial_grid
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        snake_bmap_init(&snakes);
+        snake_grid_init(&grid, make_qw(16));
+    }
+
+    void TearDown() override
+    {
+        for (int16_t idx = 0; idx != bmap_count(snakes); ++idx)
+            snake_deinit(&snakes->values[idx]);
+        snake_bmap_deinit(snakes);
+        snake_grid_deinit(&grid);
+    }
+
+    void add_snake(uint16_t snake_id, struct qwpos pos)
+    {
+        struct snake* snake;
+        ASSERT_THAT(
+            snake_bmap_emplace_new(&snakes, snake_id, &snake), Eq(BMAP_NEW));
+        snake_init(snake, pos, "test");
+    }
+
+    std::vector<uint16_t> query(struct qwpos pos)
+    {
+        std::vector<uint16_t> result;
+        snake_grid_query(&grid, pos, on_snake, &result);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    static int on_snake(uint16_t snake_id, void* user)
+    {
+        static_cast<std::vector<uint16_t>*>(user)->push_back(snake_id);
+        return 0;
+    }
+
+    struct snake_bmap* snakes;
+    struct snake_grid  grid;
+};
+
+TEST_F(NAME, empty_grid_finds_nothing)
+{
+    EXPECT_THAT(query(make_qwposi(0, 0)), IsEmpty());
+    ASSERT_THAT(snake_grid_rebuild(&grid, snakes, make_qw(10)), Eq(0));
+    EXPECT_THAT(query(make_qwposi(0, 0)), IsEmpty());
+}
+
+TEST_F(NAME, finds_snakes_within_margin)
+{
+    add_snake(1, make_qwposi(0, 0));
+    add_snake(2, make_qwposi(5, 5));
+    add_snake(3, make_qwposi(200, 200));
+    ASSERT_THAT(snake_grid_rebuild(&grid, snakes, make_qw(10)), Eq(0));
+
+    EXPECT_THAT(query(make_qwposi(2, 2)), ElementsAre(1, 2));
+    EXPECT_THAT(query(make_qwposi(200, 205)), ElementsAre(3));
+    EXPECT_THAT(query(make_qwposi(-100, 100)), IsEmpty());
+}
+
+TEST_F(NAME, finds_snakes_in_negative_cells)
+{
+    add_snake(1, make_qwposi(-20, -20));
+    ASSERT_THAT(snake_grid_rebuild(&grid, snakes, make_qw(1)), Eq(0));
+
+    EXPECT_THAT(query(make_qwposi(-20, -20)), ElementsAre(1));
+    EXPECT_THAT(query(make_qwposi(20, 20)), IsEmpty());
+}
+
+TEST_F(NAME, each_snake_is_reported_once)
+{
+    for (uint16_t i = 1; i != 200; ++i)
+        add_snake(i, make_qwposi(i % 7, i % 5));
+    ASSERT_THAT(snake_grid_rebuild(&grid, snakes, make_qw(10)), Eq(0));
+
+    std::vector<uint16_t> result = query(make_qwposi(3, 3));
+    EXPECT_THAT(result.size(), Eq(199u));
+    EXPECT_THAT(
+        std::adjacent_find(result.begin(), result.end()), Eq(result.end()));
+}
+
+TEST_F(NAME, rebuild_forgets_removed_snakes)
+{
+    add_snake(1, make_qwposi(0, 0));
+    add_snake(2, make_qwposi(1, 1));
+    ASSERT_THAT(snake_grid_rebuild(&grid, snakes, make_qw(10)), Eq(0));
+    EXPECT_THAT(query(make_qwposi(0, 0)), ElementsAre(1, 2));
+
+    snake_deinit(snake_bmap_find(snakes, 1));
+    snake_bmap_erase(snakes, 1);
+    ASSERT_THAT(snake_grid_rebuild(&grid, snakes, make_qw(10)), Eq(0));
+    EXPECT_THAT(query(make_qwposi(0, 0)), ElementsAre(2));
+}
+
+TEST_F(NAME, huge_margin_is_not_inserted_per_cell)
+{
+    add_snake(1, make_qwposi(0, 0));
+    ASSERT_THAT(snake_grid_rebuild(&grid, snakes, make_qw(400)), Eq(0));
+
+    EXPECT_THAT(vec_count(grid.entries), Eq(0));
+    EXPECT_THAT(query(make_qwposi(300, -300)), ElementsAre(1));
+}
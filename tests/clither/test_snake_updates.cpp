@@ -0,0 +1,323 @@
+#include "gmock/gmock.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "clither/ack.h"
+#include "clither/bezier.h"
+#include "clither/bezier_handle_rb.h"
+#include "clither/bezier_pending_acks_bmap.h"
+#include "clither/msg.h"
+#include "clither/msg_vec.h"
+#include "clither/net.h"
+#include "clither/proximity_state_bmap.h"
+#include "clither/server.h"
+#include "clither/server_client.h"
+#include "clither/server_client_vec.h"
+#include "clither/server_settings.h"
+#include "clither/snake.h"
+#include "clither/snake_bmap.h"
+#include "clither/world.h"
+}
+
+#define NAME snake_updates
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        struct net_addr addr;
+
+        ASSERT_THAT(net_init(), Eq(0));
+        ASSERT_THAT(server_init(&sv, "", "5557"), Eq(0));
+        server_settings_set_defaults(&settings);
+        world_init(&world);
+
+        ASSERT_THAT(
+            world_create_snake(&world, 1, make_qwposi(0, 0), "client"),
+            NotNull());
+        ASSERT_THAT(
+            world_create_snake(&world, 2, make_qwposi(2, 0), "near"),
+            NotNull());
+        ASSERT_THAT(
+            world_create_snake(&world, 3, make_qwposi(0, 9), "far"),
+            NotNull());
+
+        memset(&addr, 0, sizeof(addr));
+        addr.len = 1;
+        client = server_add_client(&sv, &addr);
+        ASSERT_THAT(client, NotNull());
+        msg_vec_init(&client->pending_msgs);
+        proximity_state_bmap_init(&client->snakes_in_proximity);
+        ack_init(&client->ack);
+        ack_init(&peer);
+        client->snake_id = 1;
+    }
+
+    void TearDown() override
+    {
+        world_deinit(&world);
+        server_deinit(&sv);
+        net_deinit();
+    }
+
+    /* Returns the IDs of all snakes sent to the client in this net tick */
+    std::vector<uint16_t> NetTick()
+    {
+        std::vector<uint16_t> ids;
+        int                   i;
+
+        batches.clear();
+        client->pkt.len = 0;
+        EXPECT_THAT(
+            server_update_snakes_in_range(&sv, &world, make_qw(10)), Eq(0));
+        EXPECT_THAT(
+            server_queue_snake_data(&sv, &settings, &world, frame++), Eq(0));
+
+        for (i = 0; i < client->pkt.len; i += client->pkt.data[i + 1] + 2)
+        {
+            union parsed_payload pp;
+            if (msg_parse_payload(
+                    &pp,
+                    (enum msg_type)client->pkt.data[i],
+                    &client->pkt.data[i + 2],
+                    client->pkt.data[i + 1]) == MSG_SNAKE_BEZIER_BATCH)
+            {
+                ids.push_back(pp.snake_bezier_batch.snake_id);
+                batches.push_back(
+                    {pp.snake_bezier_batch.snake_id,
+                     pp.snake_bezier_batch.first_handle_id,
+                     pp.snake_bezier_batch.count});
+            }
+        }
+
+        return ids;
+    }
+
+    /* Sends the packet built by NetTick(). If it arrives, the client replies
+     * with an ack */
+    void SendPacket(bool arrives)
+    {
+        uint8_t buf[ACK_HEADER_SIZE];
+        ack_write_header(&client->ack, buf);
+        if (!arrives)
+            return;
+        ASSERT_THAT(ack_read_header(&peer, buf, ACK_HEADER_SIZE), Eq(1));
+        ack_write_header(&peer, buf);
+        ASSERT_THAT(ack_read_header(&client->ack, buf, ACK_HEADER_SIZE), Eq(1));
+    }
+
+    void GrowSnake(uint16_t snake_id, int handles)
+    {
+        struct snake* snake = snake_bmap_find(world.snakes, snake_id);
+        for (int i = 0; i != handles; ++i)
+        {
+            struct bezier_handle* h =
+                bezier_handle_rb_emplace_realloc(&snake->data.bezier_handles);
+            ASSERT_THAT(h, NotNull());
+            bezier_handle_init(h, make_qwposi(2, 0), make_qa(0));
+        }
+    }
+
+    int PendingAcks(uint16_t snake_id)
+    {
+        struct proximity_state* prox =
+            proximity_state_bmap_find(client->snakes_in_proximity, snake_id);
+        return prox ? bmap_count(prox->bezier_pending_acks) : -1;
+    }
+
+    struct batch
+    {
+        uint16_t snake_id;
+        uint16_t first_handle_id;
+        int      count;
+    };
+
+    /* Size of a batch carrying every handle of the snake */
+    uint16_t BatchSize(uint16_t snake_id)
+    {
+        struct net_udp_packet pkt;
+        const struct snake*   snake = snake_bmap_find(world.snakes, snake_id);
+        int                   count = rb_count(snake->data.bezier_handles);
+        pkt.len = 0;
+        return (uint16_t)msg_snake_bezier_batch_write(
+            &pkt, NET_MAX_UDP_PACKET_SIZE, snake_id, &snake->data, 0, &count);
+    }
+
+    struct server          sv;
+    struct server_settings settings;
+    struct world           world;
+    struct server_client*  client;
+    struct ack_state       peer;
+    std::vector<batch>     batches;
+    uint16_t               frame = 0;
+};
+
+TEST_F(NAME, all_snakes_are_sent_with_enough_budget)
+{
+    EXPECT_THAT(NetTick(), ElementsAre(2, 3));
+}
+
+TEST_F(NAME, nearest_snake_is_sent_first)
+{
+    settings.snake_update_budget = BatchSize(2);
+    EXPECT_THAT(NetTick(), ElementsAre(2));
+}
+
+TEST_F(NAME, far_snakes_are_not_starved)
+{
+    settings.snake_update_budget = BatchSize(2);
+
+    std::vector<int> sent(4, 0);
+    for (int tick = 0; tick != 20; ++tick)
+    {
+        std::vector<uint16_t> ids = NetTick();
+        EXPECT_THAT(ids, SizeIs(1));
+        for (uint16_t id : ids)
+            sent[id]++;
+    }
+
+    /* The near snake never waits longer than the far snake does */
+    EXPECT_THAT(sent[3], Gt(0));
+    EXPECT_THAT(sent[2], Ge(sent[3]));
+}
+
+TEST_F(NAME, sent_handles_are_pending_until_acked)
+{
+    GrowSnake(2, 4);
+    NetTick();
+    EXPECT_THAT(PendingAcks(2), Eq(6));
+    SendPacket(true);
+
+    /* Only the head segment, which is sent every time, is still pending */
+    NetTick();
+    EXPECT_THAT(PendingAcks(2), Eq(2));
+}
+
+TEST_F(NAME, acked_handles_are_not_resent)
+{
+    GrowSnake(2, 4);
+    NetTick();
+    SendPacket(true);
+
+    NetTick();
+    ASSERT_THAT(batches, SizeIs(2));
+    EXPECT_THAT(batches[0].snake_id, Eq(2));
+    EXPECT_THAT(batches[0].first_handle_id, Eq(4));
+    EXPECT_THAT(batches[0].count, Eq(2));
+}
+
+TEST_F(NAME, lost_handles_are_resent)
+{
+    GrowSnake(2, 4);
+    NetTick();
+    SendPacket(false);
+    for (int i = 0; i != ACK_LOSS_DISTANCE; ++i)
+    {
+        NetTick();
+        SendPacket(true);
+    }
+
+    /* The head segment is sent first, followed by the lost handles */
+    NetTick();
+    ASSERT_THAT(batches, SizeIs(3));
+    EXPECT_THAT(batches[0].snake_id, Eq(2));
+    EXPECT_THAT(batches[0].first_handle_id, Eq(4));
+    EXPECT_THAT(batches[1].snake_id, Eq(2));
+    EXPECT_THAT(batches[1].first_handle_id, Eq(0));
+    EXPECT_THAT(batches[1].count, Eq(4));
+    EXPECT_THAT(PendingAcks(2), Eq(6));
+    SendPacket(true);
+
+    NetTick();
+    EXPECT_THAT(PendingAcks(2), Eq(2));
+}
+
+TEST_F(NAME, handles_pending_for_too_long_are_resent)
+{
+    GrowSnake(2, 4);
+    NetTick();
+    SendPacket(false);
+
+    /* Enough packets later that the lost seq looks newer than the acks */
+    client->ack.next_seq += 0x8001;
+    SendPacket(true);
+
+    NetTick();
+    ASSERT_THAT(batches, SizeIs(3));
+    EXPECT_THAT(batches[1].snake_id, Eq(2));
+    EXPECT_THAT(batches[1].first_handle_id, Eq(0));
+    EXPECT_THAT(batches[1].count, Eq(4));
+}
+
+TEST_F(NAME, handles_removed_from_tail_are_forgotten)
+{
+    GrowSnake(2, 4);
+    NetTick();
+    SendPacket(false);
+
+    struct snake* snake = snake_bmap_find(world.snakes, 2);
+    for (int i = 0; i != 4; ++i)
+    {
+        bezier_handle_rb_take(snake->data.bezier_handles);
+        snake->data.bezier_handle_id_base++;
+    }
+
+    NetTick();
+    EXPECT_THAT(PendingAcks(2), Eq(2));
+}
+
+TEST_F(NAME, clients_seeing_a_snake_receive_the_same_batch)
+{
+    struct net_addr addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.len = 2;
+    ASSERT_THAT(server_add_client(&sv, &addr), NotNull());
+
+    /* Adding a client can move the existing ones */
+    client = vec_get(sv.clients, 0);
+    struct server_client* other = vec_get(sv.clients, 1);
+    msg_vec_init(&other->pending_msgs);
+    proximity_state_bmap_init(&other->snakes_in_proximity);
+    ack_init(&other->ack);
+    other->snake_id = 1;
+
+    NetTick();
+    ASSERT_THAT(other->pkt.len, Eq(client->pkt.len));
+    EXPECT_THAT(
+        memcmp(other->pkt.data, client->pkt.data, client->pkt.len), Eq(0));
+
+    /* The snake changing in the next net tick must not reuse the old batch */
+    struct snake* snake = snake_bmap_find(world.snakes, 2);
+    struct bezier_handle* head = rb_peek(
+        snake->data.bezier_handles, rb_count(snake->data.bezier_handles) - 1);
+    head->pos.x += make_qw(1);
+
+    other->pkt.len = 0;
+    NetTick();
+    ASSERT_THAT(batches, Not(IsEmpty()));
+    ASSERT_THAT(batches[0].snake_id, Eq(2));
+    ASSERT_THAT(other->pkt.len, Eq(client->pkt.len));
+    EXPECT_THAT(
+        memcmp(other->pkt.data, client->pkt.data, client->pkt.len), Eq(0));
+
+    struct net_udp_packet expected;
+    int                   count = batches[0].count;
+    expected.len = 0;
+    msg_snake_bezier_batch_write(
+        &expected,
+        NET_MAX_UDP_PACKET_SIZE,
+        2,
+        &snake->data,
+        batches[0].first_handle_id - snake->data.bezier_handle_id_base,
+        &count);
+    std::vector<uint8_t> pkt(
+        client->pkt.data, client->pkt.data + client->pkt.len);
+    EXPECT_THAT(
+        std::search(
+            pkt.begin(), pkt.end(), expected.data, expected.data + expected.len),
+        Ne(pkt.end()));
+}
@@ -0,0 +1,97 @@
+#include "gmock/gmock.h"
+
+extern "C" {
+#include "clither/tick.h"
+#include "clither/tick_profiler.h"
+}
+
+#define NAME tick_profiler
+
+using namespace testing;
+
+static const char* names[] = {"a", "b"};
+
+/* Records a sample of roughly ns nanoseconds by backdating the phase start */
+static void sample(struct tick_profiler* p, int phase, uint64_t ns)
+{
+    p->phase_start = tick_now() - ns;
+    tick_profiler_end(p, phase);
+}
+
+TEST(NAME, collects_min_max_and_count_per_phase)
+{
+    struct tick_profiler p;
+    tick_profiler_init(&p, names, 2, 0);
+
+    sample(&p, 0, 2000000);
+    sample(&p, 0, 1000000);
+    sample(&p, 0, 3000000);
+
+    EXPECT_THAT(p.phases[0].count, Eq(3u));
+    EXPECT_THAT(p.phases[0].min, AllOf(Ge(1000000u), Lt(2000000u)));
+    EXPECT_THAT(p.phases[0].max, Ge(3000000u));
+    EXPECT_THAT(p.phases[1].count, Eq(0u));
+    EXPECT_THAT(tick_profiler_p99(&p, 1), Eq(0u));
+}
+
+TEST(NAME, p99_ignores_outliers)
+{
+    struct tick_profiler p;
+    tick_profiler_init(&p, names, 2, 0);
+
+    for (int i = 0; i != 995; ++i)
+        sample(&p, 0, 100000);
+    for (int i = 0; i != 5; ++i)
+        sample(&p, 0, 50000000);
+
+    /* Buckets are at most 12.5% wide, leave some room for the clock */
+    EXPECT_THAT(tick_profiler_p99(&p, 0), AllOf(Ge(100000u), Lt(150000u)));
+    EXPECT_THAT(p.phases[0].max, Ge(50000000u));
+}
+
+TEST(NAME, p99_is_never_larger_than_max)
+{
+    struct tick_profiler p;
+    tick_profiler_init(&p, names, 2, 0);
+
+    sample(&p, 0, 123456);
+    EXPECT_THAT(tick_profiler_p99(&p, 0), Eq(p.phases[0].max));
+}
+
+TEST(NAME, end_tick_measures_from_begin)
+{
+    struct tick_profiler p;
+    tick_profiler_init(&p, names, 2, 0);
+
+    tick_profiler_begin(&p);
+    p.tick_start -= 5000000;
+    sample(&p, 0, 1000000);
+    tick_profiler_end_tick(&p, 1);
+
+    EXPECT_THAT(p.phases[1].min, Ge(5000000u));
+}
+
+TEST(NAME, report_starts_a_new_window)
+{
+    struct tick_profiler p;
+    tick_profiler_init(&p, names, 2, 1);
+
+    sample(&p, 0, 1000);
+    EXPECT_THAT(tick_profiler_report(&p), Eq(0));
+    EXPECT_THAT(p.phases[0].count, Eq(1u));
+
+    p.window_start -= 2000000000;
+    EXPECT_THAT(tick_profiler_report(&p), Eq(1));
+    EXPECT_THAT(p.phases[0].count, Eq(0u));
+}
+
+TEST(NAME, report_disabled)
+{
+    struct tick_profiler p;
+    tick_profiler_init(&p, names, 2, 0);
+
+    sample(&p, 0, 1000);
+    p.window_start -= 2000000000;
+    EXPECT_THAT(tick_profiler_report(&p), Eq(0));
+    EXPECT_THAT(p.phases[0].count, Eq(1u));
+}
@@ -0,0 +1,116 @@
+#include "gmock/gmock.h"
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "clither/timer_wheel.h"
+}
+
+#define NAME timer_wheel_ticks
+
+using namespace testing;
+
+struct NAME : Test
+{
+    void SetUp() override
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.len = 4;
+    }
+
+    void TearDown() override { timer_wheel_deinit(&w); }
+
+    static int record(const struct timer* t, void* user)
+    {
+        NAME* self = static_cast<NAME*>(user);
+        EXPECT_THAT(t->expires, Eq(self->w.now));
+        self->fired.push_back(t->type);
+        self->fired_at.push_back(self->w.now);
+        return 0;
+    }
+
+    /* Advances the wheel until the specified tick */
+    void AdvanceTo(uint32_t tick)
+    {
+        while (w.now != tick)
+            ASSERT_THAT(timer_wheel_advance(&w, record, this), Eq(0));
+    }
+
+    struct timer_wheel    w;
+    struct net_addr       addr;
+    std::vector<int>      fired;
+    std::vector<uint32_t> fired_at;
+};
+
+TEST_F(NAME, timers_expire_on_their_tick)
+{
+    static const uint32_t deadlines[] = {
+        1, 63, 64, 65, 127, 4095, 4096, 4097, 100000, 262144, 262145};
+    timer_wheel_init(&w, 0);
+    for (uint32_t deadline : deadlines)
+        ASSERT_THAT(timer_wheel_add(&w, deadline, (int)deadline, &addr), Eq(0));
+
+    AdvanceTo(300000);
+    EXPECT_THAT(fired_at, ElementsAreArray(deadlines));
+}
+
+TEST_F(NAME, timers_added_later_expire_on_their_tick)
+{
+    timer_wheel_init(&w, 0);
+    AdvanceTo(4000);
+    ASSERT_THAT(timer_wheel_add(&w, 4100, 1, &addr), Eq(0));
+    ASSERT_THAT(timer_wheel_add(&w, 8191, 2, &addr), Eq(0));
+    ASSERT_THAT(timer_wheel_add(&w, 8192, 3, &addr), Eq(0));
+    AdvanceTo(10000);
+    EXPECT_THAT(fired_at, ElementsAre(4100, 8191, 8192));
+}
+
+TEST_F(NAME, past_deadlines_expire_on_next_tick)
+{
+    timer_wheel_init(&w, 100);
+    ASSERT_THAT(timer_wheel_add(&w, 100, 1, &addr), Eq(0));
+    ASSERT_THAT(timer_wheel_add(&w, 50, 2, &addr), Eq(0));
+    ASSERT_THAT(timer_wheel_advance(&w, record, this), Eq(0));
+    EXPECT_THAT(fired, ElementsAre(1, 2));
+}
+
+TEST_F(NAME, works_across_wrap_around)
+{
+    timer_wheel_init(&w, 0xFFFFFFF0);
+    ASSERT_THAT(timer_wheel_add(&w, 0xFFFFFFFF, 1, &addr), Eq(0));
+    ASSERT_THAT(timer_wheel_add(&w, 0, 2, &addr), Eq(0));
+    ASSERT_THAT(timer_wheel_add(&w, 5000, 3, &addr), Eq(0));
+    AdvanceTo(6000);
+    EXPECT_THAT(fired, ElementsAre(1, 2, 3));
+}
+
+static int reschedule_once(const struct timer* t, void* user)
+{
+    struct timer_wheel* w = static_cast<struct timer_wheel*>(user);
+    if (t->type == 0)
+        return timer_wheel_add(w, t->expires + 10, 1, &t->addr);
+    return 0;
+}
+
+TEST_F(NAME, timers_can_be_added_while_expiring)
+{
+    timer_wheel_init(&w, 0);
+    ASSERT_THAT(timer_wheel_add(&w, 5, 0, &addr), Eq(0));
+    for (int i = 0; i != 5; ++i)
+        ASSERT_THAT(timer_wheel_advance(&w, reschedule_once, &w), Eq(0));
+
+    AdvanceTo(20);
+    EXPECT_THAT(fired_at, ElementsAre(15));
+}
+
+static int fail(const struct timer*, void*)
+{
+    return -1;
+}
+
+TEST_F(NAME, callback_errors_are_propagated)
+{
+    timer_wheel_init(&w, 0);
+    ASSERT_THAT(timer_wheel_add(&w, 1, 0, &addr), Eq(0));
+    EXPECT_THAT(timer_wheel_advance(&w, fail, NULL), Eq(-1));
+}
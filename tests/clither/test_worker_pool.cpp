@@ -0,0 +1,69 @@
+#include "gmock/gmock.h"
+#include <vector>
+
+extern "C" {
+#include "clither/mem.h"
+#include "clither/worker_pool.h"
+}
+
+#define NAME worker_pool
+
+using namespace testing;
+
+static void count_visits(void* user, int begin, int end)
+{
+    std::vector<int>& visits = *static_cast<std::vector<int>*>(user);
+    for (int i = begin; i != end; ++i)
+        visits[i]++;
+}
+
+static void alloc_items(void* user, int begin, int end)
+{
+    void** ptrs = static_cast<void**>(user);
+    for (int i = begin; i != end; ++i)
+        ptrs[i] = mem_alloc(16);
+}
+
+TEST(NAME, every_item_is_visited_once)
+{
+    struct worker_pool pool;
+    ASSERT_THAT(worker_pool_init(&pool, 4), Eq(0));
+
+    for (int count : {0, 1, 7, 100, 1000})
+    {
+        std::vector<int> visits(count, 0);
+        worker_pool_run(&pool, count_visits, &visits, count, 4);
+        EXPECT_THAT(visits, Each(Eq(1))) << "count = " << count;
+    }
+
+    worker_pool_deinit(&pool);
+}
+
+TEST(NAME, single_thread_runs_on_caller)
+{
+    struct worker_pool pool;
+    ASSERT_THAT(worker_pool_init(&pool, 1), Eq(0));
+    EXPECT_THAT(pool.thread_count, Eq(0));
+
+    std::vector<int> visits(100, 0);
+    worker_pool_run(&pool, count_visits, &visits, 100, 1);
+    EXPECT_THAT(visits, Each(Eq(1)));
+
+    worker_pool_deinit(&pool);
+}
+
+TEST(NAME, memory_allocated_by_workers_can_be_freed_by_caller)
+{
+    struct worker_pool pool;
+    void*              ptrs[256];
+    ASSERT_THAT(worker_pool_init(&pool, 4), Eq(0));
+
+    worker_pool_run(&pool, alloc_items, ptrs, 256, 1);
+    for (void* p : ptrs)
+    {
+        ASSERT_THAT(p, NotNull());
+        mem_free(p);
+    }
+
+    worker_pool_deinit(&pool);
+}